@@ -0,0 +1,117 @@
+/**
+ * The U Programming Language
+ *
+ * Copyright 2018 Joseph Benden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * \author Joseph W. Benden
+ * \copyright (C) 2018 Joseph Benden
+ * \license apache2
+ */
+
+#ifndef U_LANG_ASYNCDIAGCONSUMER_HPP
+#define U_LANG_ASYNCDIAGCONSUMER_HPP
+
+#include <u-lang/Basic/Diagnostic.hpp>
+#include <u-lang/u.hpp>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace u
+{
+
+/// \brief A consumer handing diagnostics to another on a thread of its own.
+///
+/// Each diagnostic is captured whole into a StoredDiagnostic, which is
+/// pushed onto a lock-free queue without blocking the reporting thread; any
+/// number of engines may report to the same consumer at once. A background
+/// thread hands each record, in the order it was pushed, to the wrapped
+/// consumer, which formats and writes it there, blocking on I/O freely.
+///
+/// Diagnostics are counted as they are delivered; call \p flush at a phase
+/// boundary before reading the counts, or expecting output to be written.
+class UAPI AsyncDiagConsumer : public DiagnosticConsumer
+{
+  /// \brief A queued record; the most recently taken one stays behind as
+  /// the new tail, with no record.
+  struct Node
+  {
+    std::atomic<Node*> Next;
+    std::unique_ptr<StoredDiagnostic> Record;
+  };
+
+  std::shared_ptr<DiagnosticConsumer> Inner;
+
+  /// \brief The most recently pushed node; producers swap themselves in.
+  std::atomic<Node*> Head;
+
+  /// \brief The node last taken off the queue; touched by the delivery
+  /// thread alone.
+  Node* Tail;
+
+  std::atomic<uint64_t> NumPushed;
+  std::atomic<uint64_t> NumDelivered;
+
+  /// \brief Whether the delivery thread is about to sleep, or asleep.
+  std::atomic<bool> Sleeping;
+
+  /// \brief The number of threads waiting in \p flush.
+  std::atomic<unsigned> NumFlushing;
+
+  bool Stopping;
+
+  std::mutex Mutex;
+  std::condition_variable Wake;
+  std::condition_variable Delivered;
+  std::thread Worker;
+
+public:
+  explicit AsyncDiagConsumer(std::shared_ptr<DiagnosticConsumer> Consumer);
+
+  AsyncDiagConsumer(AsyncDiagConsumer const&) = delete;
+
+  AsyncDiagConsumer& operator=(AsyncDiagConsumer const&) = delete;
+
+  /// \brief Deliver whatever remains queued, then stop the delivery thread.
+  ~AsyncDiagConsumer() override;
+
+  /// \brief Capture \p Info and queue it for delivery.
+  void HandleDiagnostic(diag::Severity DiagLevel, const Diagnostic& Info) override;
+
+  /// \brief Wait until every diagnostic queued so far was delivered.
+  ///
+  /// \note Must not be called by the wrapped consumer, as it would wait on
+  /// itself.
+  void flush();
+
+  std::shared_ptr<DiagnosticConsumer> getConsumer() const { return Inner; }
+
+private:
+  void push(std::unique_ptr<StoredDiagnostic> Record);
+
+  /// \brief Take the oldest record off the queue; null should it be empty,
+  /// or its producer not have finished linking it in.
+  std::unique_ptr<StoredDiagnostic> pop();
+
+  void run();
+};
+
+} /* namespace u */
+
+#endif // U_LANG_ASYNCDIAGCONSUMER_HPP
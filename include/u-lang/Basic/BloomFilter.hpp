@@ -0,0 +1,102 @@
+/**
+ * The U Programming Language
+ *
+ * Copyright 2018 Joseph Benden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * \author Joseph W. Benden
+ * \copyright (C) 2018 Joseph Benden
+ * \license apache2
+ */
+
+#ifndef U_LANG_BLOOMFILTER_HPP
+#define U_LANG_BLOOMFILTER_HPP
+
+#ifdef __clang__
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunused-parameter"
+#pragma clang diagnostic ignored "-Wmacro-redefined"
+#pragma clang diagnostic ignored "-Wshorten-64-to-32"
+#endif
+#undef HAVE_INTTYPES_H
+#undef HAVE_STDINT_H
+#undef HAVE_UINT64_T
+#include <llvm/ADT/Hashing.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/MathExtras.h>
+#ifdef __clang__
+#pragma clang diagnostic pop
+#endif
+
+#include <u-lang/u.hpp>
+
+#include <cstdint>
+#include <vector>
+
+namespace u
+{
+
+/// \brief A set of strings answering membership with no false negatives,
+/// and false positives for about one percent of the strings not inserted.
+///
+/// Ten bits are kept per expected entry, each string setting seven of them.
+class BloomFilter
+{
+  static constexpr unsigned NumProbes = 7;
+
+  std::vector<uint64_t> Words;
+  uint64_t Mask;
+
+public:
+  explicit BloomFilter(size_t ExpectedEntries)
+  {
+    uint64_t Bits = llvm::NextPowerOf2(ExpectedEntries * 10 + 63);
+    Words.assign(Bits / 64, 0);
+    Mask = Bits - 1;
+  }
+
+  void insert(llvm::StringRef Key)
+  {
+    uint64_t Hash = llvm::hash_value(Key);
+    uint64_t Step = ((Hash >> 33) | (Hash << 31)) | 1;
+
+    for (unsigned i = 0; i < NumProbes; ++i, Hash += Step)
+    {
+      Words[(Hash & Mask) / 64] |= uint64_t(1) << (Hash % 64);
+    }
+  }
+
+  bool mayContain(llvm::StringRef Key) const
+  {
+    uint64_t Hash = llvm::hash_value(Key);
+    uint64_t Step = ((Hash >> 33) | (Hash << 31)) | 1;
+
+    for (unsigned i = 0; i < NumProbes; ++i, Hash += Step)
+    {
+      if (!(Words[(Hash & Mask) / 64] & (uint64_t(1) << (Hash % 64))))
+      {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  /// \brief The size of the filter, in bits.
+  size_t getNumBits() const { return Words.size() * 64; }
+};
+
+} /* namespace u */
+
+#endif //U_LANG_BLOOMFILTER_HPP
@@ -0,0 +1,71 @@
+/**
+ * The U Programming Language
+ *
+ * Copyright 2018 Joseph Benden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * \author Joseph W. Benden
+ * \copyright (C) 2018 Joseph Benden
+ * \license apache2
+ */
+
+#ifndef U_LANG_CONTENTHASH_HPP
+#define U_LANG_CONTENTHASH_HPP
+
+#ifdef __clang__
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunused-parameter"
+#pragma clang diagnostic ignored "-Wmacro-redefined"
+#pragma clang diagnostic ignored "-Wshorten-64-to-32"
+#endif
+#undef HAVE_INTTYPES_H
+#undef HAVE_STDINT_H
+#undef HAVE_UINT64_T
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/MD5.h>
+#ifdef __clang__
+#pragma clang diagnostic pop
+#endif
+
+#include <u-lang/u.hpp>
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+
+namespace u
+{
+
+/// \brief The MD5 digest of the contents of a file.
+typedef std::array<uint8_t, 16> ContentHash;
+
+/// \brief Compute the digest of \p Contents.
+inline ContentHash
+getContentHash(llvm::StringRef Contents)
+{
+  llvm::MD5 Hasher;
+  llvm::MD5::MD5Result Result;
+
+  Hasher.update(Contents);
+  Hasher.final(Result);
+
+  ContentHash Hash;
+  std::memcpy(Hash.data(), &Result[0], Hash.size());
+
+  return Hash;
+}
+
+} /* namespace u */
+
+#endif //U_LANG_CONTENTHASH_HPP
@@ -0,0 +1,101 @@
+/**
+ * The U Programming Language
+ *
+ * Copyright 2018 Joseph Benden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * \author Joseph W. Benden
+ * \copyright (C) 2018 Joseph Benden
+ * \license apache2
+ */
+
+#ifndef U_LANG_CONTENTSTORE_HPP
+#define U_LANG_CONTENTSTORE_HPP
+
+#ifdef __clang__
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunused-parameter"
+#pragma clang diagnostic ignored "-Wmacro-redefined"
+#pragma clang diagnostic ignored "-Wshorten-64-to-32"
+#endif
+#undef HAVE_INTTYPES_H
+#undef HAVE_STDINT_H
+#undef HAVE_UINT64_T
+#include <llvm/Support/MemoryBuffer.h>
+#ifdef __clang__
+#pragma clang diagnostic pop
+#endif
+
+#include <u-lang/Basic/ContentHash.hpp>
+#include <u-lang/u.hpp>
+
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+namespace u
+{
+
+/// \brief Shares a single, immutable buffer between every file of identical
+/// contents, wherever each file was read from.
+///
+/// Buffers are keyed by the digest of their contents, and held only for as
+/// long as someone uses them; the store itself keeps none alive. A buffer
+/// keeps the name of the file first read into it, so users should name
+/// files by other means, such as the path they were read from.
+class UAPI ContentStore
+{
+public:
+  ContentStore()
+    : SweepAt{64}
+  {
+  }
+
+  ContentStore(ContentStore const&) = delete;
+
+  ContentStore& operator=(ContentStore const&) = delete;
+
+  /// \brief Return the buffer held with the contents of \p Buffer, should
+  /// there be one; otherwise hold on to, and return, \p Buffer itself.
+  std::shared_ptr<const llvm::MemoryBuffer> intern(std::unique_ptr<llvm::MemoryBuffer> Buffer);
+
+  /// \brief Return the buffer held with the digest \p Hash; null if none.
+  std::shared_ptr<const llvm::MemoryBuffer> lookup(ContentHash const& Hash) const;
+
+  /// \brief The number of distinct buffers in use.
+  size_t getNumBuffers() const;
+
+private:
+  struct HashOfDigest
+  {
+    size_t operator()(ContentHash const& Hash) const
+    {
+      size_t Value;
+      std::memcpy(&Value, Hash.data(), sizeof(Value));
+      return Value;
+    }
+  };
+
+  mutable std::mutex Mutex;
+
+  std::unordered_map<ContentHash, std::weak_ptr<const llvm::MemoryBuffer>, HashOfDigest> Buffers;
+
+  /// \brief The size of Buffers at which released buffers are forgotten.
+  size_t SweepAt;
+};
+
+} /* namespace u */
+
+#endif // U_LANG_CONTENTSTORE_HPP
@@ -33,6 +33,7 @@
 #undef HAVE_STDINT_H
 #undef HAVE_UINT64_T
 #include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/SmallVector.h>
 #include <llvm/ADT/StringRef.h>
 
 #ifdef __clang__
@@ -46,6 +47,7 @@
 #include <u-lang/Basic/SourceManager.hpp>
 #include <u-lang/u.hpp>
 
+#include <atomic>
 #include <cassert>
 
 namespace u
@@ -57,11 +59,55 @@ class DiagnosticBuilder;
 
 class DiagnosticConsumer;
 
+class StoredDiagnostic;
+
+/// \brief The identity and arguments of a diagnostic being reported.
+///
+/// Each diagnostic in flight owns one, held by its DiagnosticBuilder, so that
+/// any number may be in flight at once, on any number of threads.
+struct DiagnosticStorage
+{
+  enum
+  {
+    /// \brief The maximum number of arguments we can hold.
+    ///
+    /// We currently only support up to 10 arguments (%0-%9).  A single
+    /// diagnostic with more than that almost certainly has to be simplified
+    /// anyway.
+    MaxArguments = 10,
+  };
+
+  diag::DiagnosticID ID;
+
+  SourceLocation Loc;
+
+  unsigned char NumArgs = 0;
+
+  /// \brief The ArgumentKind of each argument.
+  unsigned char ArgKinds[MaxArguments];
+
+  /// \brief The values for the various substitution positions.
+  ///
+  /// The specific value is mangled into an intptr_t and the interpretation
+  /// depends on exactly what sort of argument kind it is; that of a
+  /// std::string is its index into \p ArgStrs.
+  intptr_t ArgVals[MaxArguments];
+
+  /// \brief Holds the value of each string argument, in order.
+  llvm::SmallVector<std::string, 2> ArgStrs;
+};
+
 class UAPI DiagnosticEngine
 {
   std::shared_ptr<SourceManager> SM;
   std::shared_ptr<DiagnosticConsumer> DC;
-  std::unique_ptr<diag::DiagnosticMapping> Mappings;
+
+  /// \brief The severity each diagnostic is reported at; that of
+  /// DiagnosticIDs.def, unless overridden.
+  diag::Severity Severities[diag::NUM_DIAGNOSTICS];
+
+  /// \brief Whether diagnostics of \c Ignore severity reach the consumer.
+  bool ReportIgnored;
 
 public:
   enum ArgumentKind
@@ -84,54 +130,38 @@ public:
 
   inline DiagnosticBuilder Report(diag::DiagnosticID DiagID);
 
-  void Reset();
-
-  std::shared_ptr<SourceManager> getSourceManager() { return SM; }
-
-  std::shared_ptr<DiagnosticConsumer> getClient() { return DC; }
-
-private:
-  friend class Diagnostic;
-
-  friend class DiagnosticBuilder;
-
-  SourceLocation CurDiagLoc;
+  /// \brief Report \p DiagID at severity \p S from now on; \c Ignore
+  /// drops it, and \c Error promotes it.
+  ///
+  /// \note Severities are read without synchronization; set them before
+  /// reporting from several threads.
+  void setSeverity(diag::DiagnosticID DiagID, diag::Severity S) { Severities[DiagID] = S; }
 
-  diag::DiagnosticID CurDiagID;
+  /// \brief Return the severity \p DiagID is reported at.
+  diag::Severity getSeverity(diag::DiagnosticID DiagID) const { return Severities[DiagID]; }
 
-  enum
+  /// \brief Whether a report of \p DiagID is dropped. Its builder is then
+  /// inert, and captures no arguments.
+  bool isIgnored(diag::DiagnosticID DiagID) const
   {
-    /// \brief The maximum number of arguments we can hold.
-    ///
-    /// We currently only support up to 10 arguments (%0-%9).  A single
-    /// diagnostic with more than that almost certainly has to be simplified
-    /// anyway.
-      MaxArguments = 10,
-  };
+    return Severities[DiagID] == diag::Severity::Ignore && !ReportIgnored;
+  }
 
-  signed char NumDiagArgs;
+  /// \brief Pass diagnostics of \c Ignore severity on to the consumer, rather
+  /// than dropping them.
+  void setReportIgnored(bool Value) { ReportIgnored = Value; }
 
-  /// \brief Specifies whether an argument is in DiagArgumentsStr or
-  /// in DiagArguments.
-  unsigned char DiagArgumentsKind[MaxArguments];
+  std::shared_ptr<SourceManager> getSourceManager() const { return SM; }
 
-  /// \brief Holds the values of each string argument for the current
-  /// diagnostic.
-  ///
-  /// This is only used when the corresponding ArgumentKind is ak_std_string.
-  std::string DiagArgumentsStr[MaxArguments];
+  std::shared_ptr<DiagnosticConsumer> getClient() const { return DC; }
 
-  /// \brief The values for the various substitution positions.
-  ///
-  /// This is used when the argument is not an std::string. The specific
-  /// value is mangled into an intptr_t and the interpretation depends on
-  /// exactly what sort of argument kind it is.
-  intptr_t DiagArgumentsVal[MaxArguments];
-
-  // bool ProcessDiag();
+private:
+  friend class DiagnosticBuilder;
 
 protected:
-  bool EmitCurrentDiagnostic(bool Force = false);
+  /// \brief Hand the diagnostic \p Storage describes to the consumer; safe to
+  /// call from any number of threads at once.
+  bool EmitDiagnostic(const DiagnosticStorage& Storage, bool Force = false);
 };
 
 //===----------------------------------------------------------------------===//
@@ -142,7 +172,7 @@ protected:
 ///
 /// This is constructed by the DiagnosticEngine::Report method, and
 /// allows insertion of extra information (arguments and source ranges) into
-/// the currently "in flight" diagnostic.  When the temporary for the builder
+/// the "in flight" diagnostic it holds.  When the temporary for the builder
 /// is destroyed, the diagnostic is issued.
 ///
 /// Note that many of these will be created as temporary objects (many call
@@ -153,7 +183,7 @@ protected:
 class DiagnosticBuilder
 {
   mutable DiagnosticEngine* DiagObj = nullptr;
-  mutable signed char NumArgs = 0;
+  mutable DiagnosticStorage Storage;
 
   /// \brief Status variable indicating if this diagnostic is still active.
   ///
@@ -170,15 +200,16 @@ class DiagnosticBuilder
 
   DiagnosticBuilder() = default;
 
-  explicit DiagnosticBuilder(DiagnosticEngine* diagObj)
+  DiagnosticBuilder(DiagnosticEngine* diagObj, SourceLocation Loc, diag::DiagnosticID DiagID)
     : DiagObj(diagObj)
     , IsActive(true)
   {
     assert(diagObj && "DiagnosticBuilder requires a valid DiagnosticEngine!");
+    Storage.ID = DiagID;
+    Storage.Loc = Loc;
   }
 
 protected:
-  void FlushCounts() { DiagObj->NumDiagArgs = NumArgs; }
 
   /// \brief Clear out the current diagnostic.
   void Clear() const
@@ -200,16 +231,13 @@ protected:
   /// diagnostic was suppressed.
   bool Emit()
   {
-    // If this diagnostic is inactive, then its soul was stolen.
+    // If this diagnostic is inactive, then it was dropped or its soul was
+    // stolen.
     if (!isActive())
-      return false; // LCOV_EXCL_LINE
-
-    // When emitting diagnostics, we set the final argument count into
-    // the DiagnosticEngine object.
-    FlushCounts();
+      return false;
 
     // Process the diagnostic.
-    bool Result = DiagObj->EmitCurrentDiagnostic(IsForceEmit);
+    bool Result = DiagObj->EmitDiagnostic(Storage, IsForceEmit);
 
     // This diagnostic is dead.
     Clear();
@@ -224,7 +252,7 @@ public:
     IsActive = D.IsActive;
     IsForceEmit = D.IsForceEmit;
     D.Clear();
-    NumArgs = D.NumArgs;
+    Storage = std::move(D.Storage);
   }
 
   DiagnosticBuilder& operator=(const DiagnosticBuilder&) = delete;
@@ -253,20 +281,26 @@ public:
 
   void AddString(llvm::StringRef S) const
   {
-    assert(isActive() && "Clients must not add to cleared diagnostic!"); // LCOV_EXCL_LINE
-    assert(NumArgs < DiagnosticEngine::MaxArguments &&                   // LCOV_EXCL_LINE
+    // a dropped diagnostic captures nothing.
+    if (!isActive())
+      return;
+
+    assert(Storage.NumArgs < DiagnosticStorage::MaxArguments &&         // LCOV_EXCL_LINE
       "Too many arguments to diagnostic!");                         // LCOV_EXCL_LINE
-    DiagObj->DiagArgumentsKind[NumArgs] = DiagnosticEngine::ak_std_string;
-    DiagObj->DiagArgumentsStr[NumArgs++] = S;
+    Storage.ArgKinds[Storage.NumArgs] = DiagnosticEngine::ak_std_string;
+    Storage.ArgVals[Storage.NumArgs++] = static_cast<intptr_t>(Storage.ArgStrs.size());
+    Storage.ArgStrs.push_back(S);
   }
 
   void AddTaggedVal(intptr_t V, DiagnosticEngine::ArgumentKind Kind) const
   {
-    assert(isActive() && "Clients must not add to cleared diagnostic!"); // LCOV_EXCL_LINE
-    assert(NumArgs < DiagnosticEngine::MaxArguments &&                   // LCOV_EXCL_LINE
+    if (!isActive())
+      return;
+
+    assert(Storage.NumArgs < DiagnosticStorage::MaxArguments &&         // LCOV_EXCL_LINE
       "Too many arguments to diagnostic!");                         // LCOV_EXCL_LINE
-    DiagObj->DiagArgumentsKind[NumArgs] = Kind;
-    DiagObj->DiagArgumentsVal[NumArgs++] = V;
+    Storage.ArgKinds[Storage.NumArgs] = Kind;
+    Storage.ArgVals[Storage.NumArgs++] = V;
   }
 };
 
@@ -318,10 +352,10 @@ operator<<(const DiagnosticBuilder& DB, tok::TokenKind I)
 inline DiagnosticBuilder
 DiagnosticEngine::Report(SourceLocation Loc, diag::DiagnosticID DiagID)
 {
-  assert(CurDiagID == diag::NUM_DIAGNOSTICS && "Multiple diagnostics in flight at once!");
-  CurDiagLoc = Loc; // NOLINT
-  CurDiagID = DiagID;
-  return DiagnosticBuilder(this);
+  if (isIgnored(DiagID))
+    return DiagnosticBuilder::getEmpty();
+
+  return DiagnosticBuilder(this, Loc, DiagID); // NOLINT
 }
 
 inline DiagnosticBuilder
@@ -336,29 +370,37 @@ DiagnosticEngine::Report(diag::DiagnosticID DiagID)
 
 /// A little helper class (which is basically a smart pointer that forwards
 /// info from DiagnosticEngine) that allows clients to enquire about the
-/// currently in-flight diagnostic.
+/// currently in-flight diagnostic, or about a StoredDiagnostic.
 class Diagnostic
 {
   const DiagnosticEngine* DiagObj;
+  const DiagnosticStorage* Storage;
+
+  /// \brief The record this diagnostic was stored in; null while in-flight.
+  const StoredDiagnostic* Stored = nullptr;
 
 public:
-  explicit Diagnostic(const DiagnosticEngine* DO)
+  Diagnostic(const DiagnosticEngine* DO, const DiagnosticStorage& S)
     : DiagObj(DO)
+    , Storage(&S)
   {
   }
 
+  explicit Diagnostic(const StoredDiagnostic& SD);
+
+  /// \brief The engine reporting this diagnostic; null once it was stored,
+  /// as the engine may since be gone.
   const DiagnosticEngine* getDiags() const { return DiagObj; }
 
-  diag::DiagnosticID getID() const { return DiagObj->CurDiagID; }
+  /// \brief The manager able to decode the location; null should there be
+  /// none.
+  std::shared_ptr<SourceManager> getSourceManager() const;
 
-  const SourceLocation& getLocation() const { return DiagObj->CurDiagLoc; }
+  diag::DiagnosticID getID() const { return Storage->ID; }
 
-#if 0
-  bool hasSourceManager() const { return DiagObj->hasSourceManager(); }
-  SourceManager &getSourceManager() const { return DiagObj->getSourceManager();}
-#endif
+  const SourceLocation& getLocation() const { return Storage->Loc; }
 
-  unsigned getNumArgs() const { return static_cast<unsigned>(DiagObj->NumDiagArgs); }
+  unsigned getNumArgs() const { return Storage->NumArgs; }
 
   /// \brief Return the kind of the specified index.
   ///
@@ -369,7 +411,7 @@ public:
   DiagnosticEngine::ArgumentKind getArgKind(unsigned Idx) const
   {
     assert(Idx < getNumArgs() && "Argument index out of range!");
-    return (DiagnosticEngine::ArgumentKind) DiagObj->DiagArgumentsKind[Idx];
+    return (DiagnosticEngine::ArgumentKind) Storage->ArgKinds[Idx];
   }
 
   /// \brief Return the provided argument string specified by \p Idx.
@@ -377,7 +419,7 @@ public:
   const std::string& getArgStdStr(unsigned Idx) const
   {
     assert(getArgKind(Idx) == DiagnosticEngine::ak_std_string && "invalid argument accessor!");
-    return DiagObj->DiagArgumentsStr[Idx];
+    return Storage->ArgStrs[static_cast<size_t>(Storage->ArgVals[Idx])];
   }
 
   /// \brief Return the specified C string argument.
@@ -385,7 +427,7 @@ public:
   const char* getArgCStr(unsigned Idx) const
   {
     assert(getArgKind(Idx) == DiagnosticEngine::ak_c_string && "invalid argument accessor!");
-    return reinterpret_cast<const char*>(DiagObj->DiagArgumentsVal[Idx]);
+    return reinterpret_cast<const char*>(Storage->ArgVals[Idx]);
   }
 
   /// \brief Return the specified signed integer argument.
@@ -393,7 +435,7 @@ public:
   int getArgSInt(unsigned Idx) const
   {
     assert(getArgKind(Idx) == DiagnosticEngine::ak_sint && "invalid argument accessor!");
-    return (int) DiagObj->DiagArgumentsVal[Idx];
+    return (int) Storage->ArgVals[Idx];
   }
 
   /// \brief Return the specified unsigned integer argument.
@@ -401,7 +443,7 @@ public:
   unsigned getArgUInt(unsigned Idx) const
   {
     assert(getArgKind(Idx) == DiagnosticEngine::ak_uint && "invalid argument accessor!");
-    return (unsigned) DiagObj->DiagArgumentsVal[Idx];
+    return (unsigned) Storage->ArgVals[Idx];
   }
 
   /// \brief Return the specified non-string argument in an opaque form.
@@ -409,7 +451,7 @@ public:
   intptr_t getRawArg(unsigned Idx) const
   {
     assert(getArgKind(Idx) != DiagnosticEngine::ak_std_string && "invalid argument accessor!");
-    return DiagObj->DiagArgumentsVal[Idx];
+    return Storage->ArgVals[Idx];
   }
 
   /// \brief Format this diagnostic into a string, substituting the
@@ -423,24 +465,62 @@ public:
   void FormatDiagnostic(const char* DiagStr, const char* DiagEnd, llvm::SmallVectorImpl<char>& OutStr) const;
 };
 
+/// \brief A diagnostic captured whole, so that it may be formatted after the
+/// engine reporting it moved on, or is gone.
+///
+/// Every argument is copied, C strings included, and the file holding the
+/// location is pinned resident for as long as the record lives. Records are
+/// neither copied nor moved, as C string arguments point into themselves.
+class UAPI StoredDiagnostic
+{
+  friend class Diagnostic;
+
+  diag::Severity Level;
+  DiagnosticStorage Storage;
+
+  /// \brief The manager of the pinned file; null should none be.
+  std::shared_ptr<SourceManager> SM;
+  FileID PinnedFile;
+
+public:
+  StoredDiagnostic(diag::Severity Level, const Diagnostic& Info);
+
+  StoredDiagnostic(StoredDiagnostic const&) = delete;
+
+  StoredDiagnostic& operator=(StoredDiagnostic const&) = delete;
+
+  /// \brief Release the pin on the file holding the location.
+  ~StoredDiagnostic();
+
+  diag::Severity getLevel() const { return Level; }
+
+  diag::DiagnosticID getID() const { return Storage.ID; }
+
+  const SourceLocation& getLocation() const { return Storage.Loc; }
+};
+
 /// \brief Abstract interface, implemented by clients of the front-end, which
 /// formats and prints fully processed diagnostics.
 class DiagnosticConsumer
 {
 protected:
-  unsigned NumWarnings = 0; ///< Number of warnings reported
-  unsigned NumErrors = 0;   ///< Number of errors reported
+  std::atomic<unsigned> NumWarnings{0}; ///< Number of warnings reported
+  std::atomic<unsigned> NumErrors{0};   ///< Number of errors reported
 
 public:
   DiagnosticConsumer() = default;
 
   virtual ~DiagnosticConsumer() = default;
 
-  unsigned getNumErrors() const { return NumErrors; }
+  unsigned getNumErrors() const { return NumErrors.load(); }
 
-  unsigned getNumWarnings() const { return NumWarnings; }
+  unsigned getNumWarnings() const { return NumWarnings.load(); }
 
-  virtual void clear() { NumWarnings = NumErrors = 0; }
+  virtual void clear()
+  {
+    NumWarnings = 0;
+    NumErrors = 0;
+  }
 
   /// \brief Indicates whether the diagnostics handled by this
   /// DiagnosticConsumer should be included in the number of diagnostics
@@ -452,8 +532,9 @@ public:
   /// \brief Handle this diagnostic, reporting it to the user or
   /// capturing it to a log as needed.
   ///
-  /// The default implementation just keeps track of the total number of
-  /// warnings and errors.
+  /// Called on whichever thread reported the diagnostic, possibly on several
+  /// at once. The default implementation just keeps track of the total number
+  /// of warnings and errors.
   virtual void HandleDiagnostic(diag::Severity DiagLevel, const Diagnostic& Info);
 };
 
@@ -30,17 +30,16 @@
 #pragma clang diagnostic ignored "-Wshorten-64-to-32"
 #endif
 #include <llvm/ADT/StringRef.h>
-#include <llvm/ADT/Optional.h>
 
 #ifdef __clang__
 #pragma clang diagnostic pop
 #endif
 
-#include <map>
-
 #include <u-lang/Basic/TokenKinds.hpp>
 #include <u-lang/u.hpp>
 
+#include <cassert>
+
 namespace u
 {
 
@@ -66,38 +65,26 @@ enum DiagnosticID : unsigned short
   NUM_DIAGNOSTICS
 };
 
-struct UAPI DiagnosticInfo
+/// \brief The fixed detail of a diagnostic, as given by DiagnosticIDs.def.
+struct DiagnosticInfo
 {
   Severity Level;
-  std::string Component;
-  DiagnosticID ID;
-  std::string Title;
-  std::string Message;
+  const char* Component;
+  const char* Title;
+  const char* Message;
 };
 
-class UAPI DiagnosticMapping
-{
-  typedef std::map<DiagnosticID, DiagnosticInfo> TableT;
-  typedef TableT::iterator iterator;
-  typedef TableT::const_iterator const_iterator;
-  TableT Table;
-
-public:
-  DiagnosticMapping();
-
-  llvm::Optional<DiagnosticInfo> get(DiagnosticID Search);
-
-  iterator begin() { return Table.begin(); }
+/// \brief The detail of every diagnostic, indexed by its identifier; built
+/// at compile time.
+UAPI extern const DiagnosticInfo DiagnosticTable[NUM_DIAGNOSTICS];
 
-  iterator end() { return Table.end(); }
-
-  const_iterator begin() const { return Table.begin(); }
-
-  const_iterator end() const { return Table.end(); }
-
-protected:
-  void AddDiagnostics();
-};
+/// \brief Return the detail of the diagnostic \p ID.
+inline const DiagnosticInfo&
+getDiagnosticInfo(DiagnosticID ID)
+{
+  assert(ID < NUM_DIAGNOSTICS && "no such diagnostic");
+  return DiagnosticTable[ID];
+}
 
 } /* namespace diag */
 
@@ -0,0 +1,115 @@
+/**
+ * The U Programming Language
+ *
+ * Copyright 2018 Joseph Benden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * \author Joseph W. Benden
+ * \copyright (C) 2018 Joseph Benden
+ * \license apache2
+ */
+
+#ifndef U_LANG_DIAGNOSTICMERGER_HPP
+#define U_LANG_DIAGNOSTICMERGER_HPP
+
+#include <u-lang/Basic/Diagnostic.hpp>
+#include <u-lang/Basic/SourceLocation.hpp>
+#include <u-lang/u.hpp>
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace u
+{
+
+class DiagnosticMerger;
+
+/// \brief Buffers the diagnostics of a single worker, until its
+/// DiagnosticMerger passes them on.
+///
+/// Only the worker it was created for may report to it, so reporting never
+/// contends with other workers.
+class UAPI BufferedDiagConsumer : public DiagnosticConsumer
+{
+  friend class DiagnosticMerger;
+
+  struct Entry
+  {
+    FileID File;
+    uint32_t Offset;
+    std::unique_ptr<StoredDiagnostic> Record;
+  };
+
+  /// \brief Every diagnostic since the last merge, in the order reported.
+  std::vector<Entry> Entries;
+
+public:
+  /// \brief Capture \p Info, keyed by the file and offset of its location.
+  void HandleDiagnostic(diag::Severity DiagLevel, const Diagnostic& Info) override;
+
+  /// \brief The number of diagnostics awaiting a merge.
+  size_t size() const { return Entries.size(); }
+};
+
+/// \brief Passes the diagnostics of parallel workers on to a consumer in an
+/// order independent of how the workers were scheduled.
+///
+/// Each worker reports, through an engine of its own, to a buffer from
+/// \p createWorkerConsumer. At a phase barrier, \p merge hands everything
+/// buffered to the consumer ordered by file, then offset within the file,
+/// then by worker and the order each worker reported in; so that the output
+/// is the same from one run to the next, given the same FileIDs.
+///
+/// FileIDs are handed out in the order files are first read; register every
+/// file the phase reports against from a single thread beforehand, such as
+/// through \p SourceManager::getFiles, for them to be the same each run.
+class UAPI DiagnosticMerger
+{
+  std::shared_ptr<DiagnosticConsumer> Consumer;
+
+  /// \brief Guards the list of workers.
+  std::mutex Mutex;
+
+  /// \brief The buffers, in the order created; which breaks ties between
+  /// workers reporting at the same location.
+  std::vector<std::shared_ptr<BufferedDiagConsumer>> Workers;
+
+public:
+  explicit DiagnosticMerger(std::shared_ptr<DiagnosticConsumer> C)
+    : Consumer{std::move(C)}
+  {
+  }
+
+  DiagnosticMerger(DiagnosticMerger const&) = delete;
+
+  DiagnosticMerger& operator=(DiagnosticMerger const&) = delete;
+
+  /// \brief Return a buffer for one more worker; create the buffers in a
+  /// fixed order for ties to be broken the same way each run.
+  std::shared_ptr<BufferedDiagConsumer> createWorkerConsumer();
+
+  /// \brief Hand every buffered diagnostic to the consumer, in order, and
+  /// empty the buffers.
+  ///
+  /// \pre No worker is reporting.
+  void merge();
+
+  std::shared_ptr<DiagnosticConsumer> getConsumer() const { return Consumer; }
+};
+
+} /* namespace u */
+
+#endif // U_LANG_DIAGNOSTICMERGER_HPP
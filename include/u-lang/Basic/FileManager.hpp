@@ -29,6 +29,7 @@
 #pragma clang diagnostic ignored "-Wmacro-redefined"
 #pragma clang diagnostic ignored "-Wshorten-64-to-32"
 #endif
+#include <llvm/ADT/StringExtras.h>
 #include <llvm/Support/FileSystem.h>
 #include <llvm/Support/Path.h>
 
@@ -38,48 +39,205 @@
 
 #include <glog/logging.h>
 
+#include <memory>
+#include <mutex>
 #include <string>
+#include <utility>
 #include <vector>
 
+#include <u-lang/Basic/ContentStore.hpp>
+#include <u-lang/Basic/FileWatcher.hpp>
+#include <u-lang/Basic/ModuleBundle.hpp>
+#include <u-lang/Basic/ModuleIndex.hpp>
 #include <u-lang/Basic/VirtualFileSystem.hpp>
 #include <u-lang/u.hpp>
 
 namespace u
 {
 
+namespace detail
+{
+
+/// \brief The stack of virtual file systems built for one configuration of
+/// module paths, shared by every FileManager so configured.
+///
+/// The layers never change once built; what they cache does, and is only
+/// ever used under Mutex.
+struct FileManagerStack
+{
+  IntrusiveRefCntPtr<vfs::ConcatenatedOverlayFileSystem> VFS;
+
+  /// \brief The stack as a whole, with the outcome of each lookup cached.
+  IntrusiveRefCntPtr<vfs::StatCachingFileSystem> CachedVFS;
+
+  /// \brief Each real file system layer of the stack, with its own cache.
+  std::vector<IntrusiveRefCntPtr<vfs::StatCachingFileSystem>> Layers;
+
+  /// \brief The real file system beneath each of the Layers not served
+  /// from a module bundle, each keeping a filter of the entries beneath its
+  /// root.
+  std::vector<IntrusiveRefCntPtr<vfs::RealFileSystem>> RealLayers;
+
+  /// \brief The root directory, or module bundle, of each of the Layers.
+  std::vector<std::string> LayerRoots;
+
+  /// \brief Where the index of each module root is kept; empty should the
+  /// module roots not be indexed.
+  std::string IndexDirectory;
+
+  /// \brief The index of each of the Layers, once loaded or built; null
+  /// for a layer not indexed.
+  std::vector<std::unique_ptr<ModuleIndex>> Indices;
+
+  /// \brief The layers whose index must be built anew, as anything beneath
+  /// their root may have changed; each is when next used.
+  std::vector<bool> DirtyIndices;
+
+  /// \brief The files changed beneath the root of each of the Layers since
+  /// its index was last brought up to date; only they are read again when
+  /// the index is next used.
+  std::vector<std::vector<std::string>> ChangedEntries;
+
+  /// \brief The contents read through the stack, shared between files of
+  /// identical contents.
+  ContentStore Contents;
+
+  /// \brief Serializes every use of the stack.
+  std::mutex Mutex;
+};
+
+} // namespace detail
+
+/// \brief Resolves files across the module paths, through a stack of virtual
+/// file systems.
+///
+/// The stack is only built once first used, and is shared by every
+/// FileManager configured with the same module paths; it is released with
+/// the last of them. A FileManager changing its working directory is given
+/// a stack of its own. Each FileManager is to be used by one thread at a
+/// time, while those sharing a stack may be used concurrently.
+///
+/// The outcome of every lookup, found or not, is cached both for the stack
+/// as a whole and for each of its layers; call invalidateStatCache once
+/// files may have been added or removed beneath it. A layer is not consulted
+/// for paths a filter of the entries beneath its root rules out; with module
+/// indices enabled, the index of each root serves as that filter.
+///
+/// A module path naming a file, rather than a directory, is mapped as a
+/// module bundle and served from it.
+///
+/// Clients reading many files share a buffer between identical files by
+/// way of internBuffer.
+///
+/// A long-running process may instead have the module roots watched for
+/// changes, with EnableFileWatching; each pollFileChanges then forgets only
+/// what changed, and tells the listeners subscribed with subscribeToChanges.
 class UAPI FileManager
 {
-  std::unique_ptr<vfs::ConcatenatedOverlayFileSystem> VFS;
   std::vector<std::string> SystemModulePaths;
-  std::vector<std::string> UserModulePaths;
+
+  /// \brief Where the index of each module root is kept; empty should the
+  /// module roots not be indexed.
+  std::string IndexDirectory;
+
+  /// \brief The stack for the module paths; null until first used.
+  mutable std::shared_ptr<detail::FileManagerStack> Stack;
+
+  /// \brief Whether the stack is ours alone, rather than shared.
+  mutable bool HasPrivateStack{false};
+
+  /// \brief Watches the module roots; null unless enabled.
+  std::unique_ptr<FileWatcher> Watcher;
+
+  /// \brief Told the path, as seen through the stack, of each change.
+  std::vector<std::pair<unsigned, FileWatcher::Listener>> ChangeListeners;
+
+  unsigned NextChangeHandle{1};
 
 public:
-  FileManager()
+  FileManager();
+
+  FileManager(FileManager const&) = delete;
+
+  FileManager& operator=(FileManager const&) = delete;
+
+  void SetSystemModulePaths(std::vector<std::string> Paths)
   {
-    AddDefaultSystemModulePath();
-    AddDefaultUserModulePath();
-    Initialize();
+    SystemModulePaths = std::move(Paths);
+    Stack.reset();
+    HasPrivateStack = false;
   }
 
-  void SetSystemModulePaths(std::vector<std::string> Paths)
+  /// \brief Index the modules beneath each module root, keeping the indices
+  /// in \p Directory; an index still current is loaded instead of rebuilt.
+  void SetModuleIndexDirectory(std::string Directory)
   {
-    SystemModulePaths.clear();
+    IndexDirectory = std::move(Directory);
+    Stack.reset();
+    HasPrivateStack = false;
+  }
 
-    SystemModulePaths.assign(Paths.begin(), Paths.end());
+  /// \brief Watch every module root, and all beneath it, for changes;
+  /// returns false should changes not be watchable here.
+  bool EnableFileWatching();
 
-    Initialize();
+  /// \brief Forget whatever was cached about each file changed since the
+  /// last poll, and tell the listeners; never blocks. Returns the number of
+  /// changes seen.
+  unsigned pollFileChanges();
+
+  /// \brief Tell \p L the path, as seen through the stack, of each change
+  /// found by pollFileChanges; an empty path means anything may have
+  /// changed. Returns the handle to unsubscribe with.
+  unsigned subscribeToChanges(FileWatcher::Listener L)
+  {
+    ChangeListeners.emplace_back(NextChangeHandle, std::move(L));
+    return NextChangeHandle++;
+  }
+
+  void unsubscribeFromChanges(unsigned Handle)
+  {
+    for (auto I = ChangeListeners.begin(), E = ChangeListeners.end(); I != E; ++I)
+    {
+      if (I->first == Handle)
+      {
+        ChangeListeners.erase(I);
+        return;
+      }
+    }
   }
 
+  /// \brief Return what the module indices know about the file at \p Path,
+  /// as held by the top-most layer holding it. Requires indices to have
+  /// been enabled with SetModuleIndexDirectory.
+  llvm::Optional<ModuleIndex::Entry> lookupModule(const llvm::Twine& Path);
+
   /// \brief Get the status of the entry at \p Path, if one exists.
   llvm::ErrorOr<vfs::Status> status(const llvm::Twine& Path)
   {
-    return VFS->status(Path);
+    auto& S = getStack();
+    std::lock_guard<std::mutex> Lock(S.Mutex);
+
+    return S.CachedVFS->status(Path);
   }
 
   /// \brief Get a \p File object for the file at \p Path, if one exists.
   llvm::ErrorOr<std::unique_ptr<vfs::File>> openFileForRead(const llvm::Twine& Path)
   {
-    return VFS->openFileForRead(Path);
+    auto& S = getStack();
+    std::lock_guard<std::mutex> Lock(S.Mutex);
+
+    return S.CachedVFS->openFileForRead(Path);
+  }
+
+  /// \brief Get a \p File object for each of \p Paths, in order, opening
+  /// them as a batch.
+  vfs::FileBatch openFilesForRead(llvm::ArrayRef<std::string> Paths)
+  {
+    auto& S = getStack();
+    std::lock_guard<std::mutex> Lock(S.Mutex);
+
+    return S.CachedVFS->openFilesForRead(Paths);
   }
 
   /// This is a convenience method that opens a file, gets its content and then
@@ -89,83 +247,81 @@ public:
                                                                       bool RequiresNullTerminator = true,
                                                                       bool IsVolatile = false)
   {
-    return VFS->getBufferForFile(Name, FileSize, RequiresNullTerminator, IsVolatile);
+    auto& S = getStack();
+    std::lock_guard<std::mutex> Lock(S.Mutex);
+
+    return S.CachedVFS->getBufferForFile(Name, FileSize, RequiresNullTerminator, IsVolatile);
+  }
+
+  /// \brief Return the buffer of identical contents read before, should
+  /// there be one still in use, in place of \p Buffer.
+  std::shared_ptr<const llvm::MemoryBuffer> internBuffer(std::unique_ptr<llvm::MemoryBuffer> Buffer)
+  {
+    return getStack().Contents.intern(std::move(Buffer));
   }
 
+  ContentStore& getContentStore() { return getStack().Contents; }
+
   /// \brief Get a directory_iterator for \p Dir.
   /// \note The 'end' iterator is directory_iterator().
   vfs::directory_iterator dir_begin(const llvm::Twine& Dir, std::error_code& EC)
   {
-    return VFS->dir_begin(Dir, EC);
+    auto& S = getStack();
+    std::lock_guard<std::mutex> Lock(S.Mutex);
+
+    return S.VFS->dir_begin(Dir, EC);
   }
 
   /// Set the working directory. This will affect all following operations on
   /// this file system and may propagate down for nested file systems.
-  std::error_code setCurrentWorkingDirectory(const llvm::Twine& Path)
-  {
-    return VFS->setCurrentWorkingDirectory(Path);
-  }
+  std::error_code setCurrentWorkingDirectory(const llvm::Twine& Path);
 
   /// Get the working directory of this file system.
   llvm::ErrorOr<std::string> getCurrentWorkingDirectory() const
   {
-    return VFS->getCurrentWorkingDirectory();
+    auto& S = getStack();
+    std::lock_guard<std::mutex> Lock(S.Mutex);
+
+    return S.VFS->getCurrentWorkingDirectory();
   }
 
   /// Check whether a file exists. Provided for convenience.
   bool exists(const llvm::Twine& Path)
   {
-    return VFS->exists(Path);
-  }
+    auto& S = getStack();
+    std::lock_guard<std::mutex> Lock(S.Mutex);
 
-private:
-  void AddDefaultSystemModulePath()
-  {
-    SystemModulePaths.emplace_back(ULANG_SYS_MODULE_PATH);
+    return S.CachedVFS->exists(Path);
   }
 
-  void AddDefaultUserModulePath()
-  {
-    llvm::SmallString<128> Storage;
-    llvm::sys::path::home_directory(Storage);
+  /// \brief Forget every cached lookup of \p Path, in the stack and each
+  /// layer, and read it from disk again when next opened.
+  void invalidateStatCache(const llvm::Twine& Path);
 
-    UserModulePaths.emplace_back(Storage.str().str() + "/.u-lang/modules");
-  }
+  /// \brief Forget every cached lookup.
+  void invalidateStatCache();
 
-  void Initialize()
-  {
-    IntrusiveRefCntPtr<vfs::InMemoryFileSystem> inMemoryFileSystem = new vfs::InMemoryFileSystem();
+  /// \brief The number of lookups which reached a real file system layer.
+  unsigned getNumStatCacheMisses() const;
 
-    VFS = std::make_unique<vfs::ConcatenatedOverlayFileSystem>(inMemoryFileSystem);
+private:
+  /// \brief Return the stack for the module paths, sharing or building it
+  /// should there not be one yet.
+  detail::FileManagerStack& getStack() const;
 
-    for (auto& Path : SystemModulePaths)
-    {
-      IntrusiveRefCntPtr<vfs::FileSystem> realFileSystem = new vfs::RealFileSystem(Path);
+  /// \brief Replace the stack with one for the module paths; shared unless
+  /// \p Private, and built anew should \p Rebuild.
+  void AcquireStack(bool Private, bool Rebuild) const;
 
-      if (llvm::sys::fs::exists(Path))
-      {
-        VFS->pushOverlay(realFileSystem); // LCOV_EXCL_LINE
-      }
-      else
-      {
-        LOG(WARNING) << "The system module path " << Path << " does not exist."; // LCOV_EXCL_LINE
-      }
-    }
+  void WatchModuleRoot(std::string const& Root) const;
 
-    for (auto& Path : UserModulePaths)
-    {
-      IntrusiveRefCntPtr<vfs::FileSystem> realFileSystem = new vfs::RealFileSystem(Path);
+  /// \brief Forget every cached lookup of \p Path; with \p OutdateIndices,
+  /// have every module index read the file again when next used.
+  void ForgetLookups(const llvm::Twine& Path, bool OutdateIndices);
 
-      if (llvm::sys::fs::exists(Path))
-      {
-        VFS->pushOverlay(realFileSystem); // LCOV_EXCL_LINE
-      }
-      else
-      {
-        LOG(WARNING) << "The user module path " << Path << " does not exist."; // LCOV_EXCL_LINE
-      }
-    }
-  }
+  /// \brief Forget what was cached about the entry at the physical \p Path,
+  /// and tell the listeners.
+  void OnFileChanged(llvm::StringRef Path);
 };
 
 } /* namespace u */
@@ -0,0 +1,120 @@
+/**
+ * The U Programming Language
+ *
+ * Copyright 2018 Joseph Benden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * \author Joseph W. Benden
+ * \copyright (C) 2018 Joseph Benden
+ * \license apache2
+ */
+
+#ifndef U_LANG_FILEWATCHER_HPP
+#define U_LANG_FILEWATCHER_HPP
+
+#ifdef __clang__
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunused-parameter"
+#pragma clang diagnostic ignored "-Wmacro-redefined"
+#pragma clang diagnostic ignored "-Wshorten-64-to-32"
+#endif
+#undef HAVE_INTTYPES_H
+#undef HAVE_STDINT_H
+#undef HAVE_UINT64_T
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/ADT/Twine.h>
+#ifdef __clang__
+#pragma clang diagnostic pop
+#endif
+
+#include <u-lang/u.hpp>
+
+#include <functional>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+namespace u
+{
+
+/// \brief Watches files and directory trees for changes, publishing the
+/// path of each changed entry to its listeners.
+///
+/// Changes are queued by the kernel as they happen, and only published once
+/// poll is called; a long-running process polls before each rebuild, so
+/// that caches re-validate only what changed. Should the kernel drop events,
+/// an empty path is published, meaning anything may have changed.
+///
+/// Only Linux, through inotify, is supported; elsewhere nothing is watched.
+class UAPI FileWatcher
+{
+public:
+  /// \brief Called with the path of each changed entry.
+  typedef std::function<void(llvm::StringRef Path)> Listener;
+
+  FileWatcher();
+
+  FileWatcher(FileWatcher const&) = delete;
+
+  FileWatcher& operator=(FileWatcher const&) = delete;
+
+  ~FileWatcher();
+
+  /// \brief Whether changes can be watched for at all.
+  bool isWatching() const { return FD >= 0; }
+
+  /// \brief The descriptor which becomes readable once changes are queued,
+  /// for use with an event loop; -1 if not watching.
+  int getDescriptor() const { return FD; }
+
+  /// \brief Watch the directory \p Root, and every directory beneath it,
+  /// including those created later.
+  std::error_code watchTree(const llvm::Twine& Root);
+
+  /// \brief Watch the single file at \p Path.
+  std::error_code watchFile(const llvm::Twine& Path);
+
+  /// \brief Publish changes to \p L until unsubscribed; returns the handle
+  /// to unsubscribe with.
+  unsigned subscribe(Listener L);
+
+  void unsubscribe(unsigned Handle);
+
+  /// \brief Publish every change queued since the last poll, each changed
+  /// path once; never blocks. Returns the number of paths published.
+  unsigned poll();
+
+  /// \brief The number of files and directories watched.
+  unsigned getNumWatches() const { return static_cast<unsigned>(Watches.size()); }
+
+private:
+  /// \brief Add a watch on \p Path, recording whether it is of a tree.
+  std::error_code addWatch(std::string const& Path, bool Tree);
+
+  /// \brief The inotify instance; -1 if unavailable.
+  int FD;
+
+  /// \brief The watched path, and whether it is of a tree, by descriptor.
+  llvm::DenseMap<int, std::pair<std::string, bool>> Watches;
+
+  std::vector<std::pair<unsigned, Listener>> Listeners;
+
+  unsigned NextHandle;
+};
+
+} /* namespace u */
+
+#endif // U_LANG_FILEWATCHER_HPP
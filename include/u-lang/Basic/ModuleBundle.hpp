@@ -0,0 +1,145 @@
+/**
+ * The U Programming Language
+ *
+ * Copyright 2018 Joseph Benden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * \author Joseph W. Benden
+ * \copyright (C) 2018 Joseph Benden
+ * \license apache2
+ */
+
+#ifndef U_LANG_MODULEBUNDLE_HPP
+#define U_LANG_MODULEBUNDLE_HPP
+
+#ifdef __clang__
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunused-parameter"
+#pragma clang diagnostic ignored "-Wmacro-redefined"
+#pragma clang diagnostic ignored "-Wshorten-64-to-32"
+#endif
+#undef HAVE_INTTYPES_H
+#undef HAVE_STDINT_H
+#undef HAVE_UINT64_T
+#include <llvm/ADT/IntrusiveRefCntPtr.h>
+#include <llvm/ADT/Optional.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/ADT/Twine.h>
+#include <llvm/Support/ErrorOr.h>
+#include <llvm/Support/MemoryBuffer.h>
+#ifdef __clang__
+#pragma clang diagnostic pop
+#endif
+
+#include <u-lang/Basic/VirtualFileSystem.hpp>
+#include <u-lang/u.hpp>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <vector>
+
+namespace u
+{
+
+/// \brief Packs many files into a single module bundle.
+///
+/// A bundle is a header, followed by a record per file and directory, the
+/// paths of those, and the contents of every file; each of those begins on
+/// a page boundary and is followed by a NUL, so that a mapping of the bundle
+/// hands out the contents in place. The records are ordered by the path of
+/// their parent directory, then by name, so the children of a directory are
+/// consecutive and any path is found by binary search.
+class UAPI ModuleBundleWriter
+{
+  struct PendingFile
+  {
+    std::string Path;
+    std::unique_ptr<llvm::MemoryBuffer> Contents;
+    int64_t MTime;
+  };
+
+  std::vector<PendingFile> Files;
+
+public:
+  /// \brief Add \p Contents as the file at \p Path, a normalized path such
+  /// as "/std/io.u", last modified \p MTime nanoseconds after the epoch. The
+  /// directories holding it are implied.
+  void addFile(llvm::StringRef Path, std::unique_ptr<llvm::MemoryBuffer> Contents, int64_t MTime);
+
+  /// \brief Add every file beneath \p Root, at its path relative to it.
+  std::error_code addDirectory(llvm::StringRef Root);
+
+  /// \brief Store the bundle at \p BundlePath, replacing any bundle there.
+  std::error_code writeToFile(llvm::StringRef BundlePath) const;
+
+  unsigned getNumFiles() const { return static_cast<unsigned>(Files.size()); }
+};
+
+namespace vfs
+{
+
+/// \brief A read-only file system serving the files of a module bundle.
+///
+/// The bundle is mapped once; \p status and \p dir_begin read its records
+/// in place, and every file opened hands out its contents straight from the
+/// mapping, which lives for as long as any buffer over it.
+class BundleFileSystem : public FileSystem
+{
+  std::shared_ptr<llvm::MemoryBuffer> Bundle;
+  std::string WorkingDirectory;
+
+  /// \brief Distinguishes the unique IDs of this bundle from those of any
+  /// other.
+  uint64_t Serial;
+
+public:
+  /// \brief Map the bundle stored at \p BundlePath.
+  static llvm::ErrorOr<IntrusiveRefCntPtr<BundleFileSystem>> open(const Twine& BundlePath);
+
+  llvm::ErrorOr<Status> status(const Twine& Path) override;
+
+  llvm::ErrorOr<std::unique_ptr<File>> openFileForRead(const Twine& Path) override;
+
+  directory_iterator dir_begin(const Twine& Dir, std::error_code& EC) override;
+
+  llvm::ErrorOr<std::string> getCurrentWorkingDirectory() const override { return WorkingDirectory; }
+
+  std::error_code setCurrentWorkingDirectory(const Twine& Path) override;
+
+  /// \brief Answered exactly, from the records of the bundle.
+  bool mayContain(const Twine& Path) override { return lookup(Path).hasValue(); }
+
+  /// \brief The number of files and directories in the bundle.
+  unsigned getNumEntries() const;
+
+  /// \brief The status of the \p Index'th record of the bundle.
+  Status getStatus(unsigned Index) const;
+
+private:
+  explicit BundleFileSystem(std::shared_ptr<llvm::MemoryBuffer> B);
+
+  /// \brief Whether the bundle is well formed.
+  bool isValid() const;
+
+  /// \brief The index of the record for \p Path; the root is the first.
+  llvm::Optional<unsigned> lookup(const Twine& Path) const;
+};
+
+} /* namespace vfs */
+
+} /* namespace u */
+
+#endif //U_LANG_MODULEBUNDLE_HPP
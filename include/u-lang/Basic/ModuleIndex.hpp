@@ -0,0 +1,163 @@
+/**
+ * The U Programming Language
+ *
+ * Copyright 2018 Joseph Benden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * \author Joseph W. Benden
+ * \copyright (C) 2018 Joseph Benden
+ * \license apache2
+ */
+
+#ifndef U_LANG_MODULEINDEX_HPP
+#define U_LANG_MODULEINDEX_HPP
+
+#ifdef __clang__
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunused-parameter"
+#pragma clang diagnostic ignored "-Wmacro-redefined"
+#pragma clang diagnostic ignored "-Wshorten-64-to-32"
+#endif
+#undef HAVE_INTTYPES_H
+#undef HAVE_STDINT_H
+#undef HAVE_UINT64_T
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/Optional.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/MemoryBuffer.h>
+#ifdef __clang__
+#pragma clang diagnostic pop
+#endif
+
+#include <u-lang/Basic/ContentHash.hpp>
+#include <u-lang/u.hpp>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <system_error>
+
+namespace u
+{
+
+/// \brief A persistent index of the files beneath a module root.
+///
+/// Maps the path of each file, as seen through the virtual file system, to
+/// the layer holding it, its size, modification time and content digest.
+/// The index is kept as an open-addressed hash table, serialized such that
+/// it is probed in place once mapped from disk; nothing is parsed on load.
+///
+/// Every directory beneath the root is recorded too, with its modification
+/// time. Adding, removing or renaming a file changes the time of its
+/// directory; comparing those tells whether the index is still current,
+/// without reading any directory or file. Rewriting a file changes only its
+/// own time, so is told apart by checking the single file looked up. An
+/// index rebuilt from an outdated one reads only the files which changed
+/// since.
+class UAPI ModuleIndex
+{
+public:
+  /// \brief What is known about a single file.
+  struct Entry
+  {
+    /// \brief The layer of the virtual file system holding the file.
+    unsigned Layer;
+
+    uint64_t Size;
+
+    /// \brief The modification time, in nanoseconds since the epoch.
+    int64_t MTime;
+
+    ContentHash Hash;
+  };
+
+  ModuleIndex(ModuleIndex const&) = delete;
+
+  ModuleIndex& operator=(ModuleIndex const&) = delete;
+
+  /// \brief Index every file beneath \p Root, as held by \p Layer; the
+  /// digest of a file unchanged since indexed by \p Previous is reused.
+  static std::unique_ptr<ModuleIndex> build(llvm::StringRef Root,
+                                            unsigned Layer,
+                                            ModuleIndex const* Previous = nullptr);
+
+  /// \brief Map the index stored at \p IndexPath; null should it be missing
+  /// or malformed.
+  static std::unique_ptr<ModuleIndex> load(llvm::StringRef IndexPath);
+
+  /// \brief Map the index stored at \p IndexPath, should it be current for
+  /// \p Root and \p Layer; otherwise build it anew and store it there.
+  static std::unique_ptr<ModuleIndex> loadOrBuild(llvm::StringRef Root, unsigned Layer, llvm::StringRef IndexPath);
+
+  /// \brief Index the root anew, reading only the files changed since this
+  /// index was built, and store it at \p IndexPath.
+  std::unique_ptr<ModuleIndex> rebuild(llvm::StringRef IndexPath) const;
+
+  /// \brief Index anew only the files at \p Paths, normalized paths relative
+  /// to the root, and store the index at \p IndexPath; nothing else is read.
+  /// Null should any of them be, or have been, a directory, as the root must
+  /// then be indexed anew.
+  std::unique_ptr<ModuleIndex> update(llvm::ArrayRef<std::string> Paths, llvm::StringRef IndexPath) const;
+
+  /// \brief Store the index at \p IndexPath, replacing any index there.
+  std::error_code writeToFile(llvm::StringRef IndexPath) const;
+
+  /// \brief Whether no file was added, removed or renamed beneath the root
+  /// since indexing, by the times of its directories alone.
+  bool isUpToDate() const;
+
+  /// \brief Whether the file at \p Path, a normalized path relative to the
+  /// root, is still as \p Known; only that file is looked at.
+  bool isCurrent(llvm::StringRef Path, Entry const& Known) const;
+
+  /// \brief Return what is known about the file at \p Path, a normalized
+  /// path relative to the root, such as "/std/io.u".
+  llvm::Optional<Entry> lookup(llvm::StringRef Path) const;
+
+  /// \brief Whether a file or directory is at \p Path, a normalized path
+  /// relative to the root.
+  bool contains(llvm::StringRef Path) const;
+
+  /// \brief The directory the index covers.
+  llvm::StringRef getRoot() const;
+
+  /// \brief The layer the indexed files are held by.
+  unsigned getLayer() const;
+
+  unsigned getNumEntries() const;
+
+private:
+  explicit ModuleIndex(std::unique_ptr<llvm::MemoryBuffer> Data);
+
+  /// \brief Build the index of \p Root, reusing what \p Previous knows of
+  /// unchanged files, and store it at \p IndexPath.
+  static std::unique_ptr<ModuleIndex> buildAndStore(llvm::StringRef Root,
+                                                    unsigned Layer,
+                                                    llvm::StringRef IndexPath,
+                                                    ModuleIndex const* Previous);
+
+  /// \brief Whether the serialized index is well formed.
+  bool isValid() const;
+
+  /// \brief Return the slot of the table holding \p Path; zero should
+  /// there be none.
+  uint32_t find(llvm::StringRef Path) const;
+
+  /// \brief The serialized index, probed in place.
+  std::unique_ptr<llvm::MemoryBuffer> Data;
+};
+
+} /* namespace u */
+
+#endif //U_LANG_MODULEINDEX_HPP
@@ -38,8 +38,7 @@
 #pragma clang diagnostic pop
 #endif
 
-#include <fstream>
-#include <sstream>
+#include <memory>
 #include <string>
 
 #include <u-lang/Basic/SourceLocation.hpp>
@@ -56,10 +55,89 @@ enum class eol
   MacLineEndings = 4,
 };
 
+/// \brief The code point substituted for malformed UTF-8 input.
+static constexpr uint32_t ReplacementCharacter = 0xFFFD;
+
+/// \brief Decode the next UTF-8 encoded code point, without throwing.
+///
+/// Truncated, overlong, surrogate and out-of-range sequences consume the
+/// offending octets and yield \c ReplacementCharacter, setting \p Invalid
+/// so the caller may report the problem. Only single-pass input iterators
+/// are required; continuation octets are examined before being consumed.
+///
+/// \pre \p it must not equal \p end.
+template<typename octet_iterator>
+inline uint32_t
+DecodeUTF8(octet_iterator& it, octet_iterator end, bool& Invalid)
+{
+  auto Lead = static_cast<uint8_t>(*it);
+  ++it;
+
+  Invalid = false;
+  if (U_LIKELY(Lead < 0x80))
+  {
+    return Lead;
+  }
+
+  unsigned Length;
+  uint32_t CodePoint;
+  uint32_t Minimum;
+  if ((Lead & 0xE0u) == 0xC0u)
+  {
+    Length = 2;
+    CodePoint = Lead & 0x1Fu;
+    Minimum = 0x80;
+  }
+  else if ((Lead & 0xF0u) == 0xE0u)
+  {
+    Length = 3;
+    CodePoint = Lead & 0x0Fu;
+    Minimum = 0x800;
+  }
+  else if ((Lead & 0xF8u) == 0xF0u)
+  {
+    Length = 4;
+    CodePoint = Lead & 0x07u;
+    Minimum = 0x10000;
+  }
+  else
+  {
+    // a stray continuation octet, or an invalid lead octet.
+    Invalid = true;
+    return ReplacementCharacter;
+  }
+
+  for (unsigned i = 1; i < Length; ++i)
+  {
+    if (it == end || (static_cast<uint8_t>(*it) & 0xC0u) != 0x80u)
+    {
+      // truncated; leave the offending octet for the next call.
+      Invalid = true;
+      return ReplacementCharacter;
+    }
+
+    CodePoint = (CodePoint << 6u) | (static_cast<uint8_t>(*it) & 0x3Fu);
+    ++it;
+  }
+
+  if (CodePoint < Minimum || CodePoint > 0x10FFFF || (CodePoint >= 0xD800 && CodePoint <= 0xDFFF))
+  {
+    Invalid = true;
+    return ReplacementCharacter;
+  }
+
+  return CodePoint;
+}
+
+/// \brief A stream of code points decoded from an in-memory buffer.
+///
+/// The buffer is shared, so that a SourceManager may retain the contents of a
+/// file for as long as locations within it need decoding. Only byte offsets
+/// are tracked while reading; lines and columns are recovered on demand.
 class UAPI Source
 {
 public:
-  Source() = default;
+  Source();
 
   Source(Source const&) = delete;
 
@@ -69,38 +147,39 @@ public:
 
   Source& operator=(Source&&) = delete;
 
-  virtual explicit operator bool() const = 0;
+  virtual ~Source() = default;
 
-  virtual uint32_t Get() = 0;
+  explicit operator bool() const { return cur_ != end_; }
 
-  virtual SourceLocation getLocation() const = 0;
+  uint32_t Get();
 
-  virtual bool hasBOM() const = 0;
+  /// \brief The unique identifier of the underlying file, if any.
+  virtual llvm::sys::fs::UniqueID getUniqueID() const = 0;
 
-  virtual eol detectedLineEndings() const = 0;
-};
-
-class UAPI FileSource : public Source
-{
-public:
-  FileSource() = delete;
+  virtual std::string const& getFileName() const = 0;
 
-  explicit FileSource(std::string const& fileName);
+  virtual std::string const& getFilePath() const = 0;
 
-  FileSource(FileSource const&) = delete;
+  /// \brief The path by which the contents may be read again through the
+  /// virtual file system; empty should they not be.
+  virtual std::string const& getVirtualPath() const;
 
-  FileSource(FileSource&&) = delete;
+  /// \brief The byte offset of the last character returned by Get().
+  uint32_t getOffset() const { return offset_; }
 
-  FileSource& operator=(FileSource const&) = delete;
+  /// \brief The number of bytes consumed from the underlying buffer so far.
+  uint32_t getReadOffset() const { return static_cast<uint32_t>(cur_ - start_); }
 
-  FileSource& operator=(FileSource&&) = delete;
+  /// \brief The size, in bytes, of the underlying buffer.
+  uint32_t getSize() const { return static_cast<uint32_t>(end_ - start_); }
 
-  explicit operator bool() const override { return it_ != end_; }
+  /// \brief The underlying buffer; empty should the source not be readable.
+  std::shared_ptr<const llvm::MemoryBuffer> getBuffer() const { return buffer_; }
 
-  bool hasBOM() const override { return hasBOM_; }
+  bool hasBOM() const { return hasBOM_; }
 
   // LCOV_EXCL_START
-  eol detectedLineEndings() const override
+  eol detectedLineEndings() const
   {
     if (foundFF_ && foundNL_)
     {
@@ -119,25 +198,50 @@ public:
   }
   // LCOV_EXCL_STOP
 
-  uint32_t Get() override;
-
-  SourceLocation getLocation() const override
-  {
-    return SourceLocation(fileName_, filePath_, SourceRange(position_, position_));
-  }
+  /// \brief Whether the last character returned by Get() was substituted
+  /// for a malformed UTF-8 sequence.
+  bool lastCharWasInvalid() const { return invalid_; }
 
 protected:
-  std::string fileName_;
-  std::string filePath_;
-  bool first_;
+  /// \brief Begin reading from \p Buffer, skipping any byte order mark.
+  void setBuffer(std::shared_ptr<const llvm::MemoryBuffer> Buffer);
+
+private:
+  std::shared_ptr<const llvm::MemoryBuffer> buffer_;
+  const char* start_;
+  const char* cur_;
+  const char* end_;
+  uint32_t offset_;
   bool hasBOM_;
-  std::fstream stream_;
-  std::istreambuf_iterator<char> it_;
-  std::istreambuf_iterator<char> end_;
-  SourcePosition position_;
-  bool gotNewLine_;
   bool foundFF_;
   bool foundNL_;
+  bool invalid_;
+};
+
+class UAPI FileSource : public Source
+{
+public:
+  FileSource() = delete;
+
+  explicit FileSource(std::string const& fileName);
+
+  FileSource(FileSource const&) = delete;
+
+  FileSource(FileSource&&) = delete;
+
+  FileSource& operator=(FileSource const&) = delete;
+
+  FileSource& operator=(FileSource&&) = delete;
+
+  llvm::sys::fs::UniqueID getUniqueID() const override { return llvm::sys::fs::UniqueID{}; }
+
+  std::string const& getFileName() const override { return fileName_; }
+
+  std::string const& getFilePath() const override { return filePath_; }
+
+protected:
+  std::string fileName_;
+  std::string filePath_;
 };
 
 class UAPI StringSource : public Source
@@ -147,16 +251,10 @@ public:
 
   explicit StringSource(std::string const& source)
     : Source()
-    , source_{source}
-    , hasBOM_{false}
-    , stream_{source}
-    , it_{stream_.rdbuf()}
-    , first_{true}
-    , position_{1, 0}
-    , gotNewLine_{false}
-    , foundFF_{false}
-    , foundNL_{false}
+    , fileName_{"top-level.u"}
+    , filePath_{"."}
   {
+    setBuffer(llvm::MemoryBuffer::getMemBufferCopy(source, fileName_));
   }
 
   StringSource(StringSource const&) = delete;
@@ -167,73 +265,15 @@ public:
 
   StringSource& operator=(StringSource&&) = delete;
 
-  explicit operator bool() const override { return it_ != end_; }
-
-  bool hasBOM() const override { return hasBOM_; }
-
-  // LCOV_EXCL_START
-  eol detectedLineEndings() const override
-  {
-    if (foundFF_ && foundNL_)
-    {
-      return eol::WindowsLineEndings;
-    }
-    else if (foundFF_)
-    {
-      return eol::MacLineEndings;
-    }
-    else if (foundNL_)
-    {
-      return eol::UnixLineEndings;
-    }
-
-    return eol::Unknown;
-  }
-  // LCOV_EXCL_STOP
+  llvm::sys::fs::UniqueID getUniqueID() const override { return llvm::sys::fs::UniqueID{}; }
 
-  uint32_t Get() override;
+  std::string const& getFileName() const override { return fileName_; }
 
-  SourceLocation getLocation() const override
-  {
-    return SourceLocation("top-level.u", ".", SourceRange(position_, position_));
-  }
+  std::string const& getFilePath() const override { return filePath_; }
 
 protected:
-  std::string source_;
-  bool hasBOM_;
-  std::stringstream stream_;
-  std::istreambuf_iterator<char> it_;
-  std::istreambuf_iterator<char> end_;
-  bool first_;
-  SourcePosition position_;
-  bool gotNewLine_;
-  bool foundFF_;
-  bool foundNL_;
-};
-
-class UAPI MemoryBufferInputStream : public std::istream
-{
-public:
-  MemoryBufferInputStream(const uint8_t* Data, size_t Length)
-    : std::istream(&buffer_)
-    , buffer_{Data, Length}
-  {
-    rdbuf(&buffer_);
-  }
-
-private:
-  class MemoryBuffer : public std::basic_streambuf<char>
-  {
-  public:
-    MemoryBuffer(const uint8_t* Data, size_t Length)
-    {
-      setg(reinterpret_cast<char*>(const_cast<uint8_t*>(Data)),
-           reinterpret_cast<char*>(const_cast<uint8_t*>(Data)),
-           reinterpret_cast<char*>(const_cast<uint8_t*>(Data)) + Length);
-    }
-  };
-
-  MemoryBuffer buffer_;
+  std::string fileName_;
+  std::string filePath_;
 };
 
 class UAPI MemoryBufferSource : public Source
@@ -243,7 +283,8 @@ public:
 
   explicit MemoryBufferSource(llvm::sys::fs::UniqueID ID,
                               llvm::StringRef Path,
-                              std::unique_ptr<llvm::MemoryBuffer> Buf);
+                              std::shared_ptr<const llvm::MemoryBuffer> Buf,
+                              llvm::StringRef VirtualPath = llvm::StringRef());
 
   MemoryBufferSource(MemoryBufferSource const&) = delete;
 
@@ -253,51 +294,19 @@ public:
 
   MemoryBufferSource& operator=(MemoryBufferSource&&) = delete;
 
-  explicit operator bool() const override { return it_ != end_; }
-
-  bool hasBOM() const override { return hasBOM_; }
-
-  // LCOV_EXCL_START
-  eol detectedLineEndings() const override
-  {
-    if (foundFF_ && foundNL_)
-    {
-      return eol::WindowsLineEndings;
-    }
-    else if (foundFF_)
-    {
-      return eol::MacLineEndings;
-    }
-    else if (foundNL_)
-    {
-      return eol::UnixLineEndings;
-    }
+  llvm::sys::fs::UniqueID getUniqueID() const override { return id_; }
 
-    return eol::Unknown;
-  }
-  // LCOV_EXCL_STOP
+  std::string const& getFileName() const override { return fileName_; }
 
-  uint32_t Get() override;
+  std::string const& getFilePath() const override { return filePath_; }
 
-  SourceLocation getLocation() const override
-  {
-    return SourceLocation(id_, fileName_, filePath_, SourceRange(position_, position_));
-  }
+  std::string const& getVirtualPath() const override { return virtualPath_; }
 
 protected:
   llvm::sys::fs::UniqueID id_;
   std::string fileName_;
   std::string filePath_;
-  std::unique_ptr<llvm::MemoryBuffer> source_;
-  bool hasBOM_;
-  MemoryBufferInputStream stream_;
-  std::istreambuf_iterator<char> it_;
-  std::istreambuf_iterator<char> end_;
-  bool first_;
-  SourcePosition position_;
-  bool gotNewLine_;
-  bool foundFF_;
-  bool foundNL_;
+  std::string virtualPath_;
 };
 
 } /* namespace u */
@@ -42,107 +42,185 @@
 namespace u
 {
 
-class UAPI SourcePosition
+/// \brief An opaque identifier for a file registered with a SourceManager.
+///
+/// The value zero is reserved as the invalid FileID.
+class UAPI FileID
 {
+  unsigned ID;
+
 public:
-  SourcePosition(uint64_t line, uint64_t column)
-    : line_{line}
-    , column_{column} {}
+  FileID()
+    : ID{0} {}
+
+  bool isValid() const { return ID != 0; }
+
+  bool isInvalid() const { return ID == 0; }
+
+  bool operator==(const FileID& RHS) const { return ID == RHS.ID; }
+
+  bool operator<(const FileID& RHS) const { return ID < RHS.ID; }
+
+  bool operator<=(const FileID& RHS) const { return ID <= RHS.ID; }
+
+  bool operator!=(const FileID& RHS) const { return !(*this == RHS); }
+
+  bool operator>(const FileID& RHS) const { return RHS < *this; }
+
+  bool operator>=(const FileID& RHS) const { return RHS <= *this; }
+
+  unsigned getHashValue() const { return ID; }
 
-  uint64_t getLineNumber() const { return line_; }
+private:
+  friend class SourceManager;
 
-  SourcePosition& setLineNumber(uint64_t line)
+  static FileID get(unsigned V)
   {
-    line_ = line;
-    return *this;
+    FileID F;
+    F.ID = V;
+    return F;
   }
+};
 
-  uint64_t getColumn() const { return column_; }
+/// \brief Encodes a location in the source code.
+///
+/// A SourceLocation is an offset into the single address space formed by
+/// placing every file registered with a SourceManager into its own slab, one
+/// after another. It is only four bytes wide; the file, line and column it
+/// refers to are decoded on demand by the SourceManager that created it.
+///
+/// The value zero is reserved as the invalid location.
+class UAPI SourceLocation
+{
+  uint32_t ID;
 
-  SourcePosition& setColumn(uint64_t column)
+public:
+  SourceLocation()
+    : ID{0} {}
+
+  bool isValid() const { return ID != 0; }
+
+  bool isInvalid() const { return ID == 0; }
+
+  /// \brief Return a source location with the specified offset from this
+  /// SourceLocation.
+  SourceLocation getLocWithOffset(int32_t Offset) const
   {
-    column_ = column;
-    return *this;
+    SourceLocation L;
+    L.ID = ID + Offset;
+    return L;
   }
 
-  SourcePosition& incrementColumn()
+  /// \brief When a SourceLocation itself cannot be used, this returns
+  /// an (opaque) 32-bit integer encoding for it.
+  ///
+  /// This should only be passed to SourceLocation::getFromRawEncoding, it
+  /// should not be inspected directly.
+  uint32_t getRawEncoding() const { return ID; }
+
+  /// \brief Turn a raw encoding of a SourceLocation object into
+  /// a real SourceLocation.
+  ///
+  /// \see getRawEncoding.
+  static SourceLocation getFromRawEncoding(uint32_t Encoding)
   {
-    ++column_;
-    return *this;
+    SourceLocation X;
+    X.ID = Encoding;
+    return X;
   }
 
-  SourcePosition& incrementLineNumber()
+  bool operator==(const SourceLocation& RHS) const { return ID == RHS.ID; }
+
+  bool operator!=(const SourceLocation& RHS) const { return ID != RHS.ID; }
+
+  bool operator<(const SourceLocation& RHS) const { return ID < RHS.ID; }
+
+private:
+  friend class SourceManager;
+
+  uint32_t getOffset() const { return ID; }
+
+  static SourceLocation getFileLoc(uint32_t Offset)
   {
-    ++line_;
-    return *this;
+    SourceLocation L;
+    L.ID = Offset;
+    return L;
   }
-
-protected:
-  uint64_t line_;
-  uint64_t column_;
 };
 
+/// \brief A trivial tuple used to represent a source range; both ends are
+/// inclusive.
 class UAPI SourceRange
 {
+  SourceLocation B;
+  SourceLocation E;
+
 public:
-  SourceRange(SourcePosition const& begin, SourcePosition const& end)
-    : begin_{begin}
-    , end_{end} {}
+  SourceRange() = default;
+
+  SourceRange(SourceLocation loc) // NOLINT
+    : B{loc}
+    , E{loc} {}
+
+  SourceRange(SourceLocation begin, SourceLocation end)
+    : B{begin}
+    , E{end} {}
+
+  SourceLocation getBegin() const { return B; }
 
-  SourcePosition const& getBegin() const { return begin_; }
+  SourceLocation getEnd() const { return E; }
 
-  SourcePosition const& getEnd() const { return end_; }
+  void setBegin(SourceLocation b) { B = b; }
 
-  SourcePosition& getBegin() { return begin_; }
+  void setEnd(SourceLocation e) { E = e; }
 
-  SourcePosition& getEnd() { return end_; }
+  bool isValid() const { return B.isValid() && E.isValid(); }
 
-protected:
-  SourcePosition begin_;
-  SourcePosition end_;
+  bool isInvalid() const { return !isValid(); }
+
+  bool operator==(const SourceRange& X) const { return B == X.B && E == X.E; }
+
+  bool operator!=(const SourceRange& X) const { return B != X.B || E != X.E; }
 };
 
-class UAPI SourceLocation
+/// \brief The decoded form of a SourceLocation, as produced by
+/// SourceManager::getPresumedLoc.
+class UAPI PresumedLoc
 {
+  llvm::sys::fs::UniqueID ID;
+  std::string FileName;
+  std::string FilePath;
+  unsigned Line;
+  unsigned Column;
+
 public:
-  SourceLocation()
-    : id_{}
-    , fileName_{""}
-    , filePath_{""}
-    , range_(SourceRange(SourcePosition(0, 0), SourcePosition(0, 0))) {}
-
-  SourceLocation(std::string const& fileName, std::string const& filePath, SourceRange const& range) // NOLINT
-    : id_{}
-    , fileName_{fileName}
-    , filePath_{filePath}
-    , range_{range} {}
-
-  SourceLocation(llvm::sys::fs::UniqueID id,
-                 std::string const& fileName, // NOLINT
-                 std::string const& filePath, // NOLINT
-                 SourceRange const& range)
-    : id_{id}
-    , fileName_{fileName}
-    , filePath_{filePath}
-    , range_{range}
-  {
-  }
+  PresumedLoc()
+    : ID{}
+    , Line{0}
+    , Column{0} {}
+
+  PresumedLoc(llvm::sys::fs::UniqueID id, std::string fn, std::string fp, unsigned ln, unsigned co) // NOLINT
+    : ID{id}
+    , FileName{std::move(fn)}
+    , FilePath{std::move(fp)}
+    , Line{ln}
+    , Column{co} {}
+
+  bool isValid() const { return Line != 0; }
 
-  llvm::sys::fs::UniqueID getFileID() const { return id_; }
+  bool isInvalid() const { return Line == 0; }
 
-  std::string const& getFileName() const { return fileName_; }
+  llvm::sys::fs::UniqueID getUniqueID() const { return ID; }
 
-  std::string const& getFilePath() const { return filePath_; }
+  std::string const& getFileName() const { return FileName; }
 
-  SourceRange const& getRange() const { return range_; }
+  std::string const& getFilePath() const { return FilePath; }
 
-  SourceRange& getRange() { return range_; }
+  /// \brief Return the presumed line number of this location; one-based.
+  unsigned getLine() const { return Line; }
 
-protected:
-  llvm::sys::fs::UniqueID id_;
-  std::string fileName_;
-  std::string filePath_;
-  SourceRange range_;
+  /// \brief Return the presumed column number of this location; one-based.
+  unsigned getColumn() const { return Column; }
 };
 
 }; /* namespace u */
@@ -23,87 +23,398 @@
 #ifndef U_LANG_SOURCEMANAGER_HPP
 #define U_LANG_SOURCEMANAGER_HPP
 
-#include <map>
+#ifdef __clang__
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunused-parameter"
+#pragma clang diagnostic ignored "-Wmacro-redefined"
+#pragma clang diagnostic ignored "-Wshorten-64-to-32"
+#endif
+#undef HAVE_INTTYPES_H
+#undef HAVE_STDINT_H
+#undef HAVE_UINT64_T
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/StringMap.h>
+#ifdef __clang__
+#pragma clang diagnostic pop
+#endif
+
+#include <atomic>
+#include <iterator>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
+#include <u-lang/Basic/ContentHash.hpp>
 #include <u-lang/Basic/FileManager.hpp>
 #include <u-lang/Basic/Source.hpp>
 #include <u-lang/u.hpp>
 
-#include <utf8.h>
-
 namespace u
 {
 
+class SourceManager;
+
+/// \brief A file registered with a SourceManager.
+///
+/// Everything but the contents is fixed at registration. The contents, and
+/// the line table built from them, form an immutable snapshot which is only
+/// ever replaced as a whole; so a FileInfo may be queried from any thread.
 class UAPI FileInfo
 {
-  typedef std::vector<uint32_t> LineT;
-  typedef std::vector<LineT> LinesT;
-
   llvm::sys::fs::UniqueID ID;
   std::string FileName;
   std::string FilePath;
-  LinesT Lines;
+
+  /// \brief The path the contents were read from, through the virtual file
+  /// system of the owning SourceManager; empty if they cannot be read again.
+  std::string VirtualPath;
+
+  /// \brief The first SourceLocation offset of the slab assigned to this file.
+  uint32_t StartOffset;
+
+  /// \brief The size of the contents, kept while they are evicted.
+  uint32_t Size;
+
+  /// \brief The digest of the contents, verified when they are read again.
+  ContentHash Hash;
+
+  /// \brief The owning SourceManager, which re-reads evicted contents.
+  SourceManager* Owner;
+
+  /// \brief The contents of a file, with its line table once built.
+  struct Contents
+  {
+    std::shared_ptr<const llvm::MemoryBuffer> Buffer;
+
+    /// \brief The byte offset at which each line begins; empty until built.
+    std::vector<uint32_t> LineOffsets;
+
+    llvm::StringRef getText() const { return Buffer ? Buffer->getBuffer() : llvm::StringRef(); }
+
+    size_t getResidentBytes() const { return getText().size() + LineOffsets.capacity() * sizeof(uint32_t); }
+  };
+
+  typedef std::shared_ptr<const Contents> ContentsRef;
+
+  /// \brief The resident contents; null while evicted. Only ever accessed
+  /// through the atomic shared_ptr operations.
+  mutable ContentsRef Data;
+
+  /// \brief The number of clients needing the contents to stay resident.
+  mutable std::atomic<unsigned> PinCount;
+
+  /// \brief Set once the contents could not be read back unchanged.
+  mutable std::atomic<bool> Stale;
+
+  /// \brief When the contents were last used, by the clock of the owner.
+  mutable std::atomic<uint64_t> LastUse;
 
 public:
-  FileInfo(llvm::sys::fs::UniqueID ID, std::string const& FN, std::string const& FP) // NOLINT
-    : ID{ID}
-    , FileName{FN}
-    , FilePath{FP} {}
+  FileInfo(llvm::sys::fs::UniqueID ID, // NOLINT
+           std::string const& FN,
+           std::string const& FP,
+           std::shared_ptr<const llvm::MemoryBuffer> Buf,
+           uint32_t Start,
+           std::string const& VP = std::string(),
+           SourceManager* Owner = nullptr);
+
+  FileInfo(FileInfo const&) = delete;
+
+  FileInfo& operator=(FileInfo const&) = delete;
 
-  llvm::sys::fs::UniqueID getFileID() const { return ID; }
+  llvm::sys::fs::UniqueID getUniqueID() const { return ID; }
+
+  /// \brief The size, in bytes, of the contents of this file.
+  uint32_t getSize() const { return Size; }
 
   std::string getFileName() const { return FileName; }
 
   std::string getFilePath() const { return FilePath; }
 
-  std::string getLine(unsigned Num);
+  /// \brief Whether the contents of this file are currently held in memory.
+  bool isResident() const { return !!std::atomic_load(&Data); }
+
+  /// \brief Whether the contents may be evicted and later read again.
+  bool isEvictable() const { return !VirtualPath.empty() && PinCount.load() == 0; }
+
+  /// \brief Return the number of lines in this file.
+  unsigned getNumLines() const { return static_cast<unsigned>(getContents()->LineOffsets.size()); }
+
+  /// \brief Return the text of the one-based line \p Num, without its line
+  /// terminator. The text refers directly into the buffer of this file, and
+  /// so remains valid only while this file is resident; pin the file with
+  /// SourceManager::pinFile to hold on to it under a memory budget.
+  llvm::StringRef getLine(unsigned Num) const;
+
+  /// \brief Return the one-based line number containing the byte \p Offset.
+  unsigned getLineNumber(uint32_t Offset) const;
+
+  /// \brief Return the one-based byte column of \p Offset within its line.
+  unsigned getColumnNumber(uint32_t Offset) const;
+
+  /// \brief Return the one-based column of \p Offset, counted in code points.
+  unsigned getCharacterColumn(uint32_t Offset) const;
+
+  /// \brief Return the one-based column of \p Offset, as displayed on a
+  /// terminal; wide characters occupy two columns.
+  unsigned getDisplayColumn(uint32_t Offset) const;
 
 private:
-  friend class Lexer;
+  friend class SourceManager;
+
+  /// \brief Return the contents and their line table, reading the contents
+  /// again should they have been evicted, and scanning them for lines
+  /// should that not yet have been done. Never null.
+  ContentsRef getContents() const;
 
-  void AddCharacter(uint64_t LineNum, uint32_t Char);
+  /// \brief Return the bytes of the line holding \p Offset, up to \p Offset.
+  static llvm::StringRef getLinePrefix(Contents const& C, uint32_t Offset);
 };
 
 class UAPI SourceManager
 {
-  typedef std::tuple<llvm::sys::fs::UniqueID, std::string, std::string> FilePathT;
-  typedef std::map<FilePathT, FileInfo> FilePathTableT;
+  /// \brief Every registered file, indexed by FileID - 1. The files occupy
+  /// ascending slabs of the SourceLocation address space, in this order.
+  ///
+  /// Files are appended under RegistrationMutex, then published by storing
+  /// NumFiles; the table is never reallocated, so readers need no lock.
+  static constexpr unsigned ChunkBits = 10;
+  static constexpr unsigned ChunkSize = 1u << ChunkBits;
+  static constexpr unsigned MaxChunks = 4096;
+
+  struct FileChunk
+  {
+    std::unique_ptr<FileInfo> Entries[ChunkSize];
+  };
+
+  std::unique_ptr<FileChunk> FileTable[MaxChunks];
+
+  /// \brief The number of files published in FileTable.
+  std::atomic<unsigned> NumFiles;
+
+  /// \brief Serializes the reservation of slabs and FileTable entries.
+  std::mutex RegistrationMutex;
+
+  /// \brief The first offset available for the next registered file; zero
+  /// is reserved for the invalid SourceLocation.
+  uint32_t NextLocalOffset;
+
+  /// \brief A one-entry hint for getFileID; lookups tend to cluster.
+  mutable std::atomic<unsigned> LastFileIDLookup;
+
+  /// \brief The bytes held by resident contents and line tables.
+  std::atomic<size_t> ResidentBytes;
+
+  /// \brief The bytes resident files may hold before the least recently used
+  /// are evicted; zero for no limit.
+  std::atomic<size_t> MemoryBudget;
+
+  /// \brief Ticks on every use of file contents; orders files for eviction.
+  std::atomic<uint64_t> UseClock;
+
+  /// \brief Serializes eviction passes.
+  std::mutex EvictionMutex;
+
+  /// \brief Serializes use of the FileManager, which is not thread-safe; held
+  /// while reading files, whether first read or again after eviction.
+  std::mutex FileManagerMutex;
 
-  typedef FilePathTableT::iterator iterator;
-  typedef FilePathTableT::const_iterator const_iterator;
+  /// \brief The contents in use by a file, by their buffer; files read with
+  /// identical contents share a buffer, and so share contents and line table.
+  llvm::DenseMap<const llvm::MemoryBuffer*, std::weak_ptr<const FileInfo::Contents>> SharedContents;
 
-  /// \brief Dictionary containing a mapping between a pair of file and path to all source code lines for
-  /// the specified pair.
-  FilePathTableT FileTable;
+  /// \brief Serializes use of SharedContents.
+  std::mutex SharedContentsMutex;
+
+  /// \brief The files reported changed since the last takeChangedFiles.
+  std::vector<FileID> ChangedFiles;
+
+  /// \brief The files read by some spelling of each virtual path, by that
+  /// path normalized; a change reported for a path is found here.
+  llvm::StringMap<std::vector<FileID>> FilesByPath;
+
+  /// \brief Serializes use of ChangedFiles and FilesByPath.
+  std::mutex ChangedFilesMutex;
 
   std::unique_ptr<FileManager> FM;
 
 public:
+  /// \brief An iterator over the registered files, in FileID order.
+  class const_iterator
+  {
+    SourceManager const* SM;
+    unsigned Index;
+
+  public:
+    typedef std::forward_iterator_tag iterator_category;
+    typedef FileInfo const value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef FileInfo const* pointer;
+    typedef FileInfo const& reference;
+
+    const_iterator(SourceManager const* SM, unsigned Index)
+      : SM{SM}
+      , Index{Index}
+    {
+    }
+
+    reference operator*() const { return SM->getEntry(Index); }
+
+    pointer operator->() const { return &SM->getEntry(Index); }
+
+    const_iterator& operator++()
+    {
+      ++Index;
+      return *this;
+    }
+
+    bool operator==(const_iterator const& RHS) const { return Index == RHS.Index; }
+
+    bool operator!=(const_iterator const& RHS) const { return Index != RHS.Index; }
+  };
+
+  typedef const_iterator iterator;
+
   SourceManager()
+    : NumFiles{0}
+    , NextLocalOffset{1}
+    , LastFileIDLookup{0}
+    , ResidentBytes{0}
+    , MemoryBudget{0}
+    , UseClock{0}
   {
     FM = std::make_unique<FileManager>();
+    FM->subscribeToChanges([this](llvm::StringRef Path) { noteFileChanged(Path); });
   }
 
+  SourceManager(SourceManager const&) = delete;
+
+  SourceManager& operator=(SourceManager const&) = delete;
+
+  /// \brief Return the FileManager; it must not be used concurrently with
+  /// this SourceManager reading files through it.
   FileManager& getFileManager() { return *FM; }
 
   std::shared_ptr<Source> getFile(std::string path);
 
-  /// \brief Retrieve or create the FileInfo for the specified filename and path.
-  FileInfo& getOrInsertFileInfo(llvm::sys::fs::UniqueID id, std::string file, std::string path);
+  /// \brief Read each of \p Paths, in order, as a single batch; such as the
+  /// files of a module and its imports. A file which could not be read is
+  /// null.
+  std::vector<std::shared_ptr<Source>> getFiles(std::vector<std::string> const& Paths);
+
+  /// \brief Register a slab for the contents of the specified file, returning
+  /// its FileID; or an invalid FileID should the address space be exhausted.
+  ///
+  /// Contents given a \p VirtualPath may be evicted under a memory budget,
+  /// and are read again through the FileManager when next needed.
+  FileID createFileID(llvm::sys::fs::UniqueID id,
+                      std::string const& file,
+                      std::string const& path,
+                      std::shared_ptr<const llvm::MemoryBuffer> Buffer,
+                      std::string const& VirtualPath = std::string());
+
+  /// \brief Register a slab for the contents of \p S.
+  FileID createFileID(Source const& S);
+
+  /// \brief Return the SourceLocation of the first byte of \p FID.
+  SourceLocation getLocForStartOfFile(FileID FID) const;
+
+  /// \brief Return the FileID whose slab contains \p Loc.
+  ///
+  /// This is wait-free, as are getFileOffset and getLocForStartOfFile.
+  FileID getFileID(SourceLocation Loc) const;
+
+  /// \brief Return the FileInfo registered for \p FID.
+  FileInfo& getFileInfo(FileID FID);
+
+  /// \brief Return the FileInfo registered for \p FID.
+  FileInfo const& getFileInfo(FileID FID) const;
+
+  /// \brief Return the byte offset of \p Loc within its file.
+  uint32_t getFileOffset(SourceLocation Loc) const;
+
+  /// \brief Return the one-based line number of \p Loc; zero if invalid.
+  unsigned getLineNumber(SourceLocation Loc) const;
+
+  /// \brief Return the one-based byte column of \p Loc; zero if invalid.
+  unsigned getColumnNumber(SourceLocation Loc) const;
+
+  /// \brief Return the one-based code point column of \p Loc; zero if invalid.
+  ///
+  /// Unlike getColumnNumber, this walks the line; it is intended for
+  /// rendering diagnostics rather than for use while lexing.
+  unsigned getCharacterColumn(SourceLocation Loc) const;
+
+  /// \brief Return the one-based display column of \p Loc; zero if invalid.
+  ///
+  /// Unlike getColumnNumber, this walks the line; it is intended for
+  /// rendering diagnostics rather than for use while lexing.
+  unsigned getDisplayColumn(SourceLocation Loc) const;
+
+  /// \brief Decode \p Loc into its file, line and column.
+  PresumedLoc getPresumedLoc(SourceLocation Loc) const;
+
+  /// \brief Limit the bytes held by file contents and line tables to
+  /// \p Bytes, evicting the least recently used files; zero for no limit.
+  void setMemoryBudget(size_t Bytes);
+
+  size_t getMemoryBudget() const { return MemoryBudget.load(); }
+
+  /// \brief The bytes currently held by file contents and line tables.
+  size_t getResidentBytes() const { return ResidentBytes.load(); }
+
+  /// \brief Keep the contents of \p FID resident until a matching unpinFile;
+  /// used by clients holding on to those contents, such as a Lexer.
+  void pinFile(FileID FID);
+
+  /// \brief Release a pin taken by pinFile.
+  void unpinFile(FileID FID);
+
+  /// \brief Return, and forget, every file read through the FileManager
+  /// which it has reported changed since last asked; so that caches built
+  /// from those files need re-validate only them. Requires the FileManager
+  /// to watch for changes, with FileManager::EnableFileWatching.
+  std::vector<FileID> takeChangedFiles();
+
+  /// \brief Returns an iterator pointing at the first registered file.
+  const_iterator begin() const { return const_iterator(this, 0); }
+
+  /// \brief Returns an iterator pointing past the last registered file.
+  const_iterator end() const { return const_iterator(this, NumFiles.load(std::memory_order_acquire)); }
+
+private:
+  friend class FileInfo;
+
+  /// \brief Return the published file at \p Index, i.e. FileID - 1.
+  FileInfo& getEntry(unsigned Index) const
+  {
+    return *FileTable[Index >> ChunkBits]->Entries[Index & (ChunkSize - 1)];
+  }
+
+  /// \brief Return \p VirtualPath made absolute against the working directory
+  /// of the FileManager, which is read under FileManagerMutex, and normalized.
+  std::string normalizeVirtualPath(llvm::StringRef VirtualPath);
+
+  /// \brief Note that the file at \p VirtualPath changed; an empty path
+  /// means any might have.
+  void noteFileChanged(llvm::StringRef VirtualPath);
 
-  /// \brief Returns an iterator pointing at the beginning of the FileTable data.
-  iterator begin() { return FileTable.begin(); }
+  /// \brief Return the contents already in use with the buffer of \p C,
+  /// should they have a line table whenever \p C does; otherwise make \p C
+  /// the contents shared by that buffer, and return it.
+  FileInfo::ContentsRef shareContents(FileInfo::ContentsRef C);
 
-  /// \brief Returns an iterator pointing past the end of the FileTable data.
-  iterator end() { return FileTable.end(); }
+  /// \brief Mark \p FI as the most recently used file.
+  void touch(FileInfo const& FI);
 
-  /// \brief Returns a constant iterator pointing at the beginning of the FileTable data.
-  const_iterator begin() const { return FileTable.cbegin(); }
+  /// \brief Read the evicted contents of \p FI again, verifying their digest;
+  /// returns null should they have changed or be unreadable.
+  FileInfo::ContentsRef materialize(FileInfo const& FI);
 
-  /// \brief Returns a constant iterator pointing past the end of the FileTable data.
-  const_iterator end() const { return FileTable.cend(); }
+  /// \brief Evict the least recently used files until within budget, sparing
+  /// \p Keep, which a caller is about to use.
+  void enforceMemoryBudget(FileInfo const* Keep = nullptr);
 };
 
 } /* namespace u */
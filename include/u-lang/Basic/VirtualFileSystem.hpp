@@ -34,10 +34,14 @@
 #undef HAVE_INTTYPES_H
 #undef HAVE_STDINT_H
 #undef HAVE_UINT64_T
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/STLExtras.h"
 #include "llvm/ADT/IntrusiveRefCntPtr.h"
 #include "llvm/ADT/Optional.h"
 #include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
 #include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/StringSet.h"
 #include "llvm/ADT/Twine.h"
 #include "llvm/Support/ErrorOr.h"
 #include "llvm/Support/FileSystem.h"
@@ -49,6 +53,7 @@
 
 #include <glog/logging.h>
 
+#include <u-lang/Basic/BloomFilter.hpp>
 #include <u-lang/Basic/DiagnosticIDs.hpp>
 #include <u-lang/Basic/SourceLocation.hpp>
 #include <u-lang/u.hpp>
@@ -57,6 +62,7 @@
 #include <cassert>
 #include <cstdint>
 #include <ctime>
+#include <functional>
 #include <memory>
 #include <stack>
 #include <string>
@@ -138,7 +144,18 @@ namespace u
 namespace vfs
 {
 
+namespace detail
+{
+struct StatusResolver;
+struct PendingStatus;
+} // end namespace detail
+
 /// \brief The result of a \p status operation.
+///
+/// A status read from a directory may know only the name and type of its
+/// entry; the remaining fields are then looked up when first asked for.
+/// The lookup happens once, shared by every copy of the status, and may be
+/// raced for by any number of threads.
 class Status
 {
   std::string Name;
@@ -152,6 +169,15 @@ class Status
   std::string MountPoint;
   std::string VirtualName;
 
+  /// \brief The fields looked up when first asked for; null should they
+  /// have been known from the start.
+  std::shared_ptr<detail::PendingStatus> Pending;
+
+  /// \brief The status holding every field.
+  Status const& resolve() const { return U_UNLIKELY(!!Pending) ? resolveFields() : *this; }
+
+  Status const& resolveFields() const;
+
 public:
   Status() // NOLINT
     : Type(llvm::sys::fs::file_type::status_error)
@@ -170,6 +196,16 @@ public:
 
   static Status copyWithNewName(const llvm::sys::fs::file_status& In, StringRef NewName, StringRef NewMountPoint = "");
 
+  /// \brief Return the status of a directory entry known only by \p Name and
+  /// \p Type, whose other fields \p Resolver looks up when first needed.
+  static Status fromDirectoryEntry(StringRef Name,
+                                   llvm::sys::fs::file_type Type,
+                                   std::shared_ptr<const detail::StatusResolver> Resolver,
+                                   StringRef MountPoint = "");
+
+  /// \brief Whether every field is known without further lookup.
+  bool isResolved() const;
+
   /// \brief Returns the name that should be used for this file or directory.
   StringRef getName() const { return VirtualName; }
 
@@ -180,17 +216,17 @@ public:
   /// @{
   llvm::sys::fs::file_type getType() const { return Type; }
 
-  llvm::sys::fs::perms getPermissions() const { return Perms; }
+  llvm::sys::fs::perms getPermissions() const { return resolve().Perms; }
 
-  llvm::sys::TimePoint<> getLastModificationTime() const { return MTime; }
+  llvm::sys::TimePoint<> getLastModificationTime() const { return resolve().MTime; }
 
-  llvm::sys::fs::UniqueID getUniqueID() const { return UID; }
+  llvm::sys::fs::UniqueID getUniqueID() const { return resolve().UID; }
 
-  uint32_t getUser() const { return User; }
+  uint32_t getUser() const { return resolve().User; }
 
-  uint32_t getGroup() const { return Group; }
+  uint32_t getGroup() const { return resolve().Group; }
 
-  uint64_t getSize() const { return Size; }
+  uint64_t getSize() const { return resolve().Size; }
 
   /// @}
   /// @name Status queries
@@ -243,9 +279,21 @@ public:
   virtual std::error_code close() = 0;
 };
 
+/// \brief The outcome of opening each of a batch of files, in order.
+typedef SmallVector<llvm::ErrorOr<std::unique_ptr<File>>, 4> FileBatch;
+
 namespace detail
 {
 
+/// \brief Looks up the status of a directory entry by the name it was
+/// reported under.
+struct StatusResolver
+{
+  virtual ~StatusResolver();
+
+  virtual llvm::ErrorOr<Status> resolve(StringRef Name) const = 0;
+};
+
 /// \brief An interface for virtual file systems to provide an iterator over the
 /// (non-recursive) contents of a directory.
 struct DirIterImpl
@@ -354,6 +402,10 @@ public:
   /// \brief Get a \p File object for the file at \p Path, if one exists.
   virtual llvm::ErrorOr<std::unique_ptr<File>> openFileForRead(const Twine& Path) = 0;
 
+  /// \brief Get a \p File object for each of \p Paths, in order; by default,
+  /// each is opened in turn.
+  virtual FileBatch openFilesForRead(llvm::ArrayRef<std::string> Paths);
+
   /// This is a convenience method that opens a file, gets its content and then
   /// closes the file.
   llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> getBufferForFile(const Twine& Name,
@@ -375,6 +427,11 @@ public:
   /// Check whether a file exists. Provided for convenience.
   bool exists(const Twine& Path);
 
+  /// \brief Whether an entry might exist at \p Path; false only should it
+  /// certainly not, letting an overlay skip this file system without a
+  /// lookup.
+  virtual bool mayContain(const Twine& Path) { return true; }
+
   /// Make \a Path an absolute path.
   ///
   /// Makes \a Path absolute using the current directory if it is not already.
@@ -389,25 +446,200 @@ public:
   std::error_code makeAbsolute(SmallVectorImpl<char>& Path) const;
 };
 
+/// \brief A file system serving the directory tree beneath \p MountPoint.
+///
+/// Where supported, the mount point is opened once and every entry beneath
+/// it is looked up relative to that descriptor, with the *at() family of
+/// calls; the kernel then walks only the part of a path beneath the mount
+/// point. The working directory is kept by the file system itself, as a
+/// path beneath the mount point, rather than by the process.
+///
+/// Files opened as a batch are handed out with their contents already in
+/// memory. On Linux they are opened, examined and read through an io_uring
+/// of the calling thread, a few system calls for the whole batch; elsewhere,
+/// or should the kernel offer no such ring, by the calling thread and a pool
+/// of threads shared by every batch.
 class RealFileSystem : public FileSystem
 {
+public:
+  /// \brief Decides whether an entry may exist, by its path relative to the
+  /// mount point, such as "/std/io.u".
+  typedef std::function<bool(StringRef)> MembershipOracle;
+
+private:
   std::string MountPoint;
 
+  /// \brief The open mount point; -1 should it not be.
+  int MountFD;
+
+  /// \brief The working directory, relative to the mount point.
+  std::string WorkingDirectory;
+
+  /// \brief Completes the status of entries read from directories beneath
+  /// the mount point; null should they be looked up as they are read.
+  std::shared_ptr<const detail::StatusResolver> EntryResolver;
+
+  /// \brief Whether \p mayContain consults a membership filter.
+  bool UseMembershipFilter;
+
+  /// \brief The path, relative to the mount point, of every entry beneath
+  /// it; built when next needed should it be null.
+  std::unique_ptr<BloomFilter> Members;
+
+  /// \brief Answers \p mayContain in place of Members; null unless set.
+  MembershipOracle Oracle;
+
 public:
-  explicit RealFileSystem(Twine const& RootedAt)
-    : MountPoint{RootedAt.str()}
-  {
-  } // NOLINT
+  explicit RealFileSystem(Twine const& RootedAt);
+
+  ~RealFileSystem() override;
 
   llvm::ErrorOr<Status> status(const Twine& Path) override;
 
   llvm::ErrorOr<std::unique_ptr<File>> openFileForRead(const Twine& Path) override;
 
+  FileBatch openFilesForRead(llvm::ArrayRef<std::string> Paths) override;
+
   directory_iterator dir_begin(const Twine& Dir, std::error_code& EC) override;
 
   llvm::ErrorOr<std::string> getCurrentWorkingDirectory() const override;
 
   std::error_code setCurrentWorkingDirectory(const Twine& Path) override;
+
+  /// \brief Answer \p mayContain from a filter over the entries beneath the
+  /// mount point, walked when next needed.
+  void enableMembershipFilter() { UseMembershipFilter = true; }
+
+  /// \brief Walk the mount point again when next asked whether it may
+  /// contain an entry; call once entries were added beneath it.
+  void invalidateMembershipFilter() { Members.reset(); }
+
+  /// \brief Have the filter admit the entry at \p Path, should one have been
+  /// added there; a directory has the mount point walked again, as what lies
+  /// beneath it is unknown. An entry removed is left a false positive.
+  void noteEntryChanged(const Twine& Path);
+
+  /// \brief Answer \p mayContain from \p O, such as an index of the entries
+  /// beneath the mount point, rather than by walking it.
+  void setMembershipOracle(MembershipOracle O)
+  {
+    Oracle = std::move(O);
+    UseMembershipFilter = true;
+  }
+
+  bool mayContain(const Twine& Path) override;
+
+private:
+  /// \brief Resolve \p Path to a NUL terminated path relative to the mount
+  /// point; "." for the mount point itself. Any copy needed is made into
+  /// \p Storage.
+  StringRef getRelativePath(const Twine& Path, SmallVectorImpl<char>& Storage) const;
+
+  /// \brief The key of \p Path in the membership filter; false should the
+  /// path not lie strictly beneath the mount point.
+  bool getMemberKey(const Twine& Path, std::string& Key) const;
+};
+
+/// \brief Return a buffer over \p Data, which \p Owner keeps alive for as
+/// long as the buffer is.
+std::unique_ptr<llvm::MemoryBuffer>
+getSharedMemBuffer(std::shared_ptr<const void> Owner, StringRef Data, bool RequiresNullTerminator);
+
+/// \brief Visit every entry beneath \p Dir, as \p recursive_directory_iterator
+/// would, reading distinct subdirectories on up to \p NumThreads threads; as
+/// many as there are cores should it be zero. The calling thread takes part,
+/// helped by those of a pool shared by the process.
+///
+/// \p Visit is called concurrently and in no particular order, save that a
+/// directory is visited before anything beneath it. The walk stops at the
+/// first error, which is returned.
+std::error_code
+walkInParallel(FileSystem& FS,
+               const Twine& Dir,
+               llvm::function_ref<void(const Status&)> Visit,
+               unsigned NumThreads = 0);
+
+/// \brief Return \p Path made absolute against the working directory of \p FS,
+/// with any "." and ".." components removed.
+std::string
+getNormalizedPath(FileSystem const& FS, const Twine& Path);
+
+/// \brief A file system memoizing the \p status of another.
+///
+/// Both found and missing entries are remembered, keyed by normalized path,
+/// so an entry is looked up in the underlying file system at most once
+/// until it is invalidated. Opening an entry known to be missing fails
+/// without consulting the underlying file system, and an entry found missing
+/// when opened is remembered as such. A cached \p Status keeps the spelling
+/// of the path it was first looked up by.
+class StatCachingFileSystem : public FileSystem
+{
+  IntrusiveRefCntPtr<FileSystem> Underlying;
+
+  /// \brief The outcome of every lookup, by normalized path.
+  llvm::StringMap<llvm::ErrorOr<Status>> Cache;
+
+  unsigned NumHits;
+  unsigned NumMisses;
+
+  /// \brief Whether \p EC will not change on its own accord, and so may be
+  /// remembered.
+  static bool isLastingError(std::error_code EC);
+
+  /// \brief Remember that opening the entry at \p Key failed with \p EC.
+  void rememberFailedOpen(std::string const& Key, std::error_code EC);
+
+public:
+  explicit StatCachingFileSystem(IntrusiveRefCntPtr<FileSystem> FS)
+    : Underlying{std::move(FS)}
+    , NumHits{0}
+    , NumMisses{0}
+  {
+  }
+
+  llvm::ErrorOr<Status> status(const Twine& Path) override;
+
+  llvm::ErrorOr<std::unique_ptr<File>> openFileForRead(const Twine& Path) override;
+
+  /// \brief Open every path not known to be missing as a single batch.
+  FileBatch openFilesForRead(llvm::ArrayRef<std::string> Paths) override;
+
+  directory_iterator dir_begin(const Twine& Dir, std::error_code& EC) override
+  {
+    return Underlying->dir_begin(Dir, EC);
+  }
+
+  llvm::ErrorOr<std::string> getCurrentWorkingDirectory() const override
+  {
+    return Underlying->getCurrentWorkingDirectory();
+  }
+
+  std::error_code setCurrentWorkingDirectory(const Twine& Path) override
+  {
+    return Underlying->setCurrentWorkingDirectory(Path);
+  }
+
+  bool mayContain(const Twine& Path) override { return Underlying->mayContain(Path); }
+
+  /// \brief Forget the outcome of looking up \p Path.
+  void invalidate(const Twine& Path) { Cache.erase(getNormalizedPath(*this, Path)); }
+
+  /// \brief Forget the outcome of every lookup.
+  void invalidateAll() { Cache.clear(); }
+
+  /// \brief Whether \p Path was a directory when last looked up, as far as
+  /// the cache knows.
+  bool isCachedDirectory(const Twine& Path) const
+  {
+    auto Cached = Cache.find(getNormalizedPath(*this, Path));
+    return Cached != Cache.end() && Cached->second && Cached->second->isDirectory();
+  }
+
+  /// \brief The number of lookups answered from the cache.
+  unsigned getNumHits() const { return NumHits; }
+
+  /// \brief The number of lookups passed to the underlying file system.
+  unsigned getNumMisses() const { return NumMisses; }
 };
 
 /// \brief A file system that allows overlaying one \p AbstractFileSystem on top
@@ -443,6 +675,8 @@ public:
 
   std::error_code setCurrentWorkingDirectory(const Twine& Path) override;
 
+  bool mayContain(const Twine& Path) override;
+
   typedef FileSystemList::reverse_iterator iterator;
 
   /// \brief Get an iterator pointing to the most recently added file system.
@@ -453,6 +687,56 @@ public:
   iterator overlays_end() { return FSList.rend(); }
 };
 
+namespace detail
+{
+
+struct ConcatenatedContents;
+
+} // end namespace detail
+
+/// \brief A file opened through a ConcatenatedOverlayFileSystem.
+///
+/// The contents are a list of segments, one per layer holding the file,
+/// each referring to the buffer read from its layer. They are only joined
+/// into a single buffer, once, should more than one layer hold the file.
+class ConcatenatedFile : public File
+{
+  std::shared_ptr<detail::ConcatenatedContents> Contents;
+
+  friend class ConcatenatedOverlayFileSystem;
+
+public:
+  /// \brief A run of the contents, read from a single layer.
+  struct Segment
+  {
+    /// \brief The offset of the segment within the contents.
+    uint64_t Offset;
+
+    /// \brief The size of the segment, excluding any appended newline.
+    uint64_t Size;
+
+    /// \brief The layer the segment was read from; zero for the base.
+    unsigned Layer;
+  };
+
+  explicit ConcatenatedFile(std::shared_ptr<detail::ConcatenatedContents> C);
+
+  llvm::ErrorOr<Status> status() override;
+
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> getBuffer(const Twine& Name,
+                                                               uint64_t FileSize,
+                                                               bool RequiresNullTerminator,
+                                                               bool IsVolatile) override;
+
+  std::error_code close() override { return std::error_code{}; } // LCOV_EXCL_LINE
+
+  /// \brief The segments of the contents, from the bottom-most layer up.
+  llvm::ArrayRef<Segment> getSegments() const;
+
+  /// \brief The layer holding the byte at \p Offset of the contents.
+  unsigned getLayerForOffset(uint64_t Offset) const;
+};
+
 /// \brief A file system that allows overlaying one \p AbstractFileSystem on top
 /// of another.
 ///
@@ -463,7 +747,11 @@ public:
 /// top-most (most recently added) directory are used.  When there is a file
 /// that exists in more than one file system, the content is a concatenation
 /// of all files, from the bottom-to-top-most file; but with each
-/// file having a newline appended to prevent parsing problems.
+/// file not ending in one having a newline appended to prevent parsing
+/// problems.
+///
+/// Opening a file reads it from each layer once. The contents are shared by
+/// every open of the same path for as long as any of them is alive.
 class ConcatenatedOverlayFileSystem : public FileSystem
 {
   typedef SmallVector<IntrusiveRefCntPtr<FileSystem>, 1> FileSystemList;
@@ -471,26 +759,46 @@ class ConcatenatedOverlayFileSystem : public FileSystem
   /// their addition.
   FileSystemList FSList;
 
-  std::vector<void*> Cleanup;
+  /// \brief The contents of the files opened, by normalized path; they are
+  /// owned by the files handed out.
+  llvm::StringMap<std::weak_ptr<detail::ConcatenatedContents>> OpenFiles;
+
+  /// \brief The size OpenFiles may reach before its released contents are
+  /// forgotten.
+  size_t NextSweep;
 
 public:
   explicit ConcatenatedOverlayFileSystem(IntrusiveRefCntPtr<FileSystem> Base);
 
-  ~ConcatenatedOverlayFileSystem();
-
   /// \brief Pushes a file system on top of the stack.
   void pushOverlay(IntrusiveRefCntPtr<FileSystem> FS);
 
+  /// \brief Read \p Path from the layers again when next opened.
+  void invalidate(const Twine& Path) { OpenFiles.erase(getNormalizedPath(*this, Path)); }
+
+  /// \brief Read every file from the layers again when next opened.
+  void invalidateAll() { OpenFiles.clear(); }
+
+  /// \brief The number of paths whose contents are remembered, whether or
+  /// not they have since been released.
+  size_t getNumRememberedFiles() const { return OpenFiles.size(); }
+
   llvm::ErrorOr<Status> status(const Twine& Path) override;
 
   llvm::ErrorOr<std::unique_ptr<File>> openFileForRead(const Twine& Path) override;
 
+  /// \brief Open each path as openFileForRead does, opening those held by a
+  /// layer as a single batch of that layer.
+  FileBatch openFilesForRead(llvm::ArrayRef<std::string> Paths) override;
+
   directory_iterator dir_begin(const Twine& Dir, std::error_code& EC) override;
 
   llvm::ErrorOr<std::string> getCurrentWorkingDirectory() const override;
 
   std::error_code setCurrentWorkingDirectory(const Twine& Path) override;
 
+  bool mayContain(const Twine& Path) override;
+
   typedef FileSystemList::reverse_iterator iterator;
 
   /// \brief Get an iterator pointing to the most recently added file system.
@@ -508,6 +816,20 @@ public:
   /// \brief Get a reverse iterator pointing one-past the least recently added file
   /// system.
   reverse_iterator overlays_rend() { return FSList.end(); }
+
+private:
+  /// \brief Return the contents still shared by the open files of \p Key,
+  /// forgetting them should every such file have been released.
+  std::shared_ptr<detail::ConcatenatedContents> findOpenFile(llvm::StringRef Key);
+
+  /// \brief Share the contents of \p F with later opens of \p Key.
+  void rememberOpenFile(llvm::StringRef Key, File& F);
+
+  /// \brief Join the contents of \p Path across the layers, from the
+  /// bottom-most up, opening it in the layer at index \p i of FSList with
+  /// \p OpenLayer(i).
+  llvm::ErrorOr<std::unique_ptr<File>>
+  concatenate(const Twine& Path, llvm::function_ref<llvm::ErrorOr<std::unique_ptr<File>>(size_t)> OpenLayer);
 };
 
 namespace detail
@@ -517,13 +839,37 @@ class InMemoryDirectory;
 
 } // end namespace detail
 
-/// An in-memory file system.
+/// \brief A file system holding its files in memory.
+///
+/// Each directory keeps its children in a hash table, keyed by the interned
+/// name of each; a path component never added is rejected without visiting
+/// a directory. Absolute paths already free of "." and ".." components are
+/// looked up as given.
 class InMemoryFileSystem : public FileSystem
 {
   std::unique_ptr<detail::InMemoryDirectory> Root;
   std::string WorkingDirectory;
   bool UseNormalizedPaths = true;
 
+  /// \brief The name of every file and directory added, stored once.
+  llvm::StringSet<> Names;
+
+  /// \brief Split \p P into the components of its absolute, normalized
+  /// form; any copy needed is made into \p Storage.
+  /// \return the path the \p Components refer into.
+  StringRef splitPath(const Twine& P, SmallVectorImpl<char>& Storage, SmallVectorImpl<StringRef>& Components) const;
+
+  /// \brief Add \p Buffer at the end of \p Components, as \p Name.
+  ///
+  /// \p Chain holds the directories already walked, beginning with the
+  /// root; the directory holding the i'th component is the i'th of them.
+  /// It is extended with every directory walked or created.
+  bool addFileAt(SmallVectorImpl<detail::InMemoryDirectory*>& Chain,
+                 llvm::ArrayRef<StringRef> Components,
+                 const Twine& Name,
+                 time_t ModificationTime,
+                 std::unique_ptr<llvm::MemoryBuffer> Buffer);
+
 public:
   explicit InMemoryFileSystem(bool UseNormalizedPaths = true);
 
@@ -539,6 +885,14 @@ public:
   /// exists in the file system with different contents.
   bool addFileNoOwn(const Twine& Path, time_t ModificationTime, llvm::MemoryBuffer* Buffer);
 
+  /// Add many buffers to the VFS at once, each with its path; the VFS owns
+  /// the buffers. The paths are sorted first, so that each directory is
+  /// looked up once for all of the files beneath it.
+  /// \return true if every file was successfully added, false if any of
+  /// them already exists in the file system with different contents.
+  bool addFiles(time_t ModificationTime,
+                std::vector<std::pair<std::string, std::unique_ptr<llvm::MemoryBuffer>>> Files);
+
   /// Return true if this file system normalizes . and .. in paths.
   bool useNormalizedPaths() const { return UseNormalizedPaths; }
 
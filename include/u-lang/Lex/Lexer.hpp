@@ -70,10 +70,11 @@ class UAPI Lexer
   std::shared_ptr<SourceManager> SM;
   std::shared_ptr<DiagnosticEngine> Diags;
   Source& source_;
-  llvm::sys::fs::UniqueID id_;
-  std::string fileName_;
-  std::string filePath_;
-  SourceRange sourceRange_;
+  FileID FID_;
+  SourceLocation fileStart_;
+  uint32_t prevOffset_;
+  uint32_t curOffset_;
+  uint32_t nextOffset_;
   uint32_t curChar_;
   uint32_t nextChar_;
   uint32_t curValid_;
@@ -95,20 +96,33 @@ public:
 
   Lexer& operator=(Lexer&&) = delete;
 
+  /// \brief Release the pin holding the contents of our file resident.
+  ~Lexer();
+
   std::shared_ptr<SourceManager> getSourceManager() { return SM; }
 
   std::shared_ptr<DiagnosticEngine> getDiags() { return Diags; }
 
   Token Lex();
 
-  SourceLocation getLocation() const { return SourceLocation(id_, fileName_, filePath_, sourceRange_); }
+  /// \brief Return the FileID this lexer registered its source as.
+  FileID getFileID() const { return FID_; }
+
+  /// \brief Return the location of the current character.
+  SourceLocation getLocation() const { return fileStart_.getLocWithOffset(curOffset_); }
 
 protected:
   Token NumberToken();
 
   Token StringToken(uint32_t quote, bool longString);
 
-  Token ConvertFloat(std::string& num, const SourceLocation& w);
+  Token ConvertFloat(std::string& num, const SourceRange& w);
+
+  /// \brief Return the range from \p Begin through the last character consumed.
+  SourceRange getTokenRange(SourceLocation Begin) const
+  {
+    return SourceRange(Begin, fileStart_.getLocWithOffset(prevOffset_));
+  }
 
   DiagnosticBuilder Diag(SourceLocation Loc, diag::DiagnosticID DiagID)
   {
@@ -122,7 +136,7 @@ private:
 
   uint32_t PeekChar();
 
-  uint32_t GetChar();
+  uint32_t GetChar(uint32_t& Offset);
 };
 
 } /* namespace u */
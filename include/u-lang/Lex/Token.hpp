@@ -55,32 +55,34 @@ class UAPI Token
 {
   /// Kind - The actual flavor of token this is.
   tok::TokenKind Kind;
-  SourceLocation Loc;
+
+  /// The first and last characters spelling this token.
+  SourceRange Range;
 
   llvm::APFloat apFloat_;
   llvm::APInt apInt_;
   std::string apIdentifier_;
 
 public:
-  Token(tok::TokenKind K, SourceLocation L)
+  Token(tok::TokenKind K, SourceRange R)
     : Kind{K}
-    , Loc{std::move(L)}
+    , Range{R}
     , apFloat_{0.0} {}
 
-  Token(tok::TokenKind K, SourceLocation L, llvm::APFloat Float)
+  Token(tok::TokenKind K, SourceRange R, llvm::APFloat Float)
     : Kind{K}
-    , Loc{std::move(L)}
+    , Range{R}
     , apFloat_{std::move(Float)} {}
 
-  Token(tok::TokenKind K, SourceLocation L, llvm::APInt Int)
+  Token(tok::TokenKind K, SourceRange R, llvm::APInt Int)
     : Kind{K}
-    , Loc{std::move(L)}
+    , Range{R}
     , apFloat_{0.0}
     , apInt_{std::move(Int)} {}
 
-  Token(tok::TokenKind K, SourceLocation L, std::string Str)
+  Token(tok::TokenKind K, SourceRange R, std::string Str)
     : Kind{K}
-    , Loc{std::move(L)}
+    , Range{R}
     , apFloat_{0.0}
     , apIdentifier_{std::move(Str)} {}
 
@@ -118,12 +120,17 @@ public:
     return isOneOf(tok::integer_constant, tok::real_constant);
   }
 
-  SourceLocation getLocation() const
-  {
-    return Loc;
-  }
+  /// \brief Return the location of the first character of this token.
+  SourceLocation getLocation() const { return Range.getBegin(); }
+
+  /// \brief Return the location of the last character of this token.
+  SourceLocation getEndLoc() const { return Range.getEnd(); }
+
+  SourceRange getSourceRange() const { return Range; }
+
+  void setLocation(SourceLocation L) { Range = SourceRange(L); }
 
-  void setLocation(SourceLocation L) { Loc = std::move(L); }
+  void setSourceRange(SourceRange R) { Range = R; }
 
   const char* getName() const { return tok::getTokenName(Kind); }
 };
@@ -0,0 +1,142 @@
+/**
+ * The U Programming Language
+ *
+ * Copyright 2018 Joseph Benden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * \author Joseph W. Benden
+ * \copyright (C) 2018 Joseph Benden
+ * \license apache2
+ */
+
+#include <glog/logging.h>
+
+#include <u-lang/Basic/AsyncDiagConsumer.hpp>
+#include <u-lang/u.hpp>
+
+using namespace u;
+
+AsyncDiagConsumer::AsyncDiagConsumer(std::shared_ptr<DiagnosticConsumer> Consumer)
+  : Inner{std::move(Consumer)}
+  , Head{new Node{{nullptr}, nullptr}}
+  , Tail{Head.load()}
+  , NumPushed{0}
+  , NumDelivered{0}
+  , Sleeping{false}
+  , NumFlushing{0}
+  , Stopping{false}
+{
+  Worker = std::thread([this]() { run(); });
+}
+
+AsyncDiagConsumer::~AsyncDiagConsumer()
+{
+  {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    Stopping = true;
+  }
+  Wake.notify_one();
+  Worker.join();
+
+  delete Tail;
+}
+
+void
+AsyncDiagConsumer::HandleDiagnostic(diag::Severity DiagLevel, const Diagnostic& Info)
+{
+  push(std::unique_ptr<StoredDiagnostic>(new StoredDiagnostic(DiagLevel, Info)));
+}
+
+void
+AsyncDiagConsumer::flush()
+{
+  uint64_t Target = NumPushed.load();
+
+  ++NumFlushing;
+  {
+    std::unique_lock<std::mutex> Lock(Mutex);
+    Delivered.wait(Lock, [&]() { return NumDelivered.load() >= Target; });
+  }
+  --NumFlushing;
+}
+
+void
+AsyncDiagConsumer::push(std::unique_ptr<StoredDiagnostic> Record)
+{
+  ++NumPushed;
+
+  auto N = new Node{{nullptr}, std::move(Record)};
+  Node* Prev = Head.exchange(N);
+  Prev->Next.store(N);
+
+  // only a delivery thread about to sleep need be woken.
+  if (Sleeping.load())
+  {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    Wake.notify_one();
+  }
+}
+
+std::unique_ptr<StoredDiagnostic>
+AsyncDiagConsumer::pop()
+{
+  Node* Next = Tail->Next.load();
+  if (!Next)
+  {
+    return nullptr;
+  }
+
+  std::unique_ptr<StoredDiagnostic> Record = std::move(Next->Record);
+  delete Tail;
+  Tail = Next;
+  return Record;
+}
+
+void
+AsyncDiagConsumer::run()
+{
+  while (true)
+  {
+    while (auto Record = pop())
+    {
+      if (Inner)
+      {
+        Inner->HandleDiagnostic(Record->getLevel(), Diagnostic(*Record));
+      }
+      DiagnosticConsumer::HandleDiagnostic(Record->getLevel(), Diagnostic(*Record));
+
+      // release the record, and its pin, before it is seen as delivered.
+      Record.reset();
+      ++NumDelivered;
+
+      if (NumFlushing.load())
+      {
+        std::lock_guard<std::mutex> Lock(Mutex);
+        Delivered.notify_all();
+      }
+    }
+
+    // a producer pushing once Sleeping is set will wake us; one having
+    // pushed before is seen by the check below.
+    std::unique_lock<std::mutex> Lock(Mutex);
+    Sleeping.store(true);
+    Wake.wait(Lock, [&]() { return Stopping || Tail->Next.load() != nullptr; });
+    Sleeping.store(false);
+
+    if (Stopping && !Tail->Next.load())
+    {
+      return;
+    }
+  }
+}
@@ -0,0 +1,94 @@
+/**
+ * The U Programming Language
+ *
+ * Copyright 2018 Joseph Benden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * \author Joseph W. Benden
+ * \copyright (C) 2018 Joseph Benden
+ * \license apache2
+ */
+
+#include <glog/logging.h>
+
+#include <u-lang/Basic/ContentStore.hpp>
+#include <u-lang/u.hpp>
+
+#include <algorithm>
+#include <iterator>
+#include <utility>
+
+using namespace u;
+
+std::shared_ptr<const llvm::MemoryBuffer>
+ContentStore::intern(std::unique_ptr<llvm::MemoryBuffer> Buffer)
+{
+  if (!Buffer)
+  {
+    return nullptr; // LCOV_EXCL_LINE
+  }
+
+  auto Hash = getContentHash(Buffer->getBuffer());
+
+  std::lock_guard<std::mutex> Lock(Mutex);
+
+  auto& Slot = Buffers[Hash];
+  if (auto Existing = Slot.lock())
+  {
+    // the digest only tells the contents apart; equal bytes make them one.
+    if (Existing->getBuffer() == Buffer->getBuffer())
+    {
+      VLOG(2) << "Sharing the contents of " << Existing->getBufferIdentifier().str() << " with "
+              << Buffer->getBufferIdentifier().str();
+      return Existing;
+    }
+
+    return std::move(Buffer); // LCOV_EXCL_LINE
+  }
+
+  std::shared_ptr<const llvm::MemoryBuffer> Result = std::move(Buffer);
+  Slot = Result;
+
+  // forget released buffers once they could make up half of the table.
+  if (Buffers.size() >= SweepAt)
+  {
+    for (auto I = Buffers.begin(); I != Buffers.end();)
+    {
+      I = I->second.expired() ? Buffers.erase(I) : std::next(I);
+    }
+
+    SweepAt = std::max<size_t>(64, Buffers.size() * 2);
+  }
+
+  return Result;
+}
+
+std::shared_ptr<const llvm::MemoryBuffer>
+ContentStore::lookup(ContentHash const& Hash) const
+{
+  std::lock_guard<std::mutex> Lock(Mutex);
+
+  auto I = Buffers.find(Hash);
+  return I == Buffers.end() ? nullptr : I->second.lock();
+}
+
+size_t
+ContentStore::getNumBuffers() const
+{
+  std::lock_guard<std::mutex> Lock(Mutex);
+
+  return static_cast<size_t>(std::count_if(Buffers.begin(), Buffers.end(), [](decltype(*Buffers.begin()) Entry) {
+    return !Entry.second.expired();
+  }));
+}
@@ -49,6 +49,10 @@
 #include <u-lang/Basic/DiagnosticIDs.hpp>
 #include <u-lang/u.hpp>
 
+#include <cstring>
+#include <utility>
+#include <vector>
+
 #include <utf8.h>
 
 using namespace u;
@@ -57,38 +61,107 @@ DiagnosticEngine::DiagnosticEngine(std::shared_ptr<SourceManager> M,
                                    std::shared_ptr<u::DiagnosticConsumer> consumer) // NOLINT
   : SM{M}
   , DC{consumer}                                                                    // NOLINT
-  , Mappings{std::make_unique<diag::DiagnosticMapping>()}
-{
-  Reset();
-}
-
-void
-DiagnosticEngine::Reset()
+  , ReportIgnored{false}
 {
-  CurDiagID = diag::NUM_DIAGNOSTICS;
+  for (unsigned ID = 0; ID < diag::NUM_DIAGNOSTICS; ++ID)
+  {
+    Severities[ID] = diag::DiagnosticTable[ID].Level;
+  }
 }
 
 bool
-DiagnosticEngine::EmitCurrentDiagnostic(bool Force)
+DiagnosticEngine::EmitDiagnostic(const DiagnosticStorage& Storage, bool Force)
 {
   (void) Force;
 
-  Diagnostic Info(this);
+  Diagnostic Info(this, Storage);
 
   // Lookup the severity and other detail.
-  diag::Severity Severity = Mappings->get(Info.getID())->Level;
+  diag::Severity Severity = getSeverity(Info.getID());
 
   if (DC)
   {
     DC->HandleDiagnostic(Severity, Info);
   }
 
-  CurDiagID = diag::NUM_DIAGNOSTICS;
+  return true;
+}
 
-  // Clear out the current diagnostic object.
-  // Clear();
+Diagnostic::Diagnostic(const StoredDiagnostic& SD)
+  : DiagObj(nullptr)
+  , Storage(&SD.Storage)
+  , Stored(&SD)
+{
+}
 
-  return true;
+std::shared_ptr<SourceManager>
+Diagnostic::getSourceManager() const
+{
+  if (Stored)
+    return Stored->SM;
+
+  return DiagObj ? DiagObj->getSourceManager() : nullptr;
+}
+
+StoredDiagnostic::StoredDiagnostic(diag::Severity L, const Diagnostic& Info)
+  : Level(L)
+{
+  Storage.ID = Info.getID();
+  Storage.Loc = Info.getLocation();
+  Storage.NumArgs = static_cast<unsigned char>(Info.getNumArgs());
+
+  // C string arguments point into their copies, which must not move.
+  Storage.ArgStrs.reserve(Storage.NumArgs);
+  for (unsigned i = 0; i < Storage.NumArgs; ++i)
+  {
+    Storage.ArgKinds[i] = static_cast<unsigned char>(Info.getArgKind(i));
+    switch (Info.getArgKind(i))
+    {
+    case DiagnosticEngine::ak_std_string:
+      Storage.ArgVals[i] = static_cast<intptr_t>(Storage.ArgStrs.size());
+      Storage.ArgStrs.push_back(Info.getArgStdStr(i));
+      break;
+
+    case DiagnosticEngine::ak_c_string:
+      // the string need not outlive the report; keep a copy to point at.
+      if (const char* S = Info.getArgCStr(i))
+      {
+        Storage.ArgStrs.push_back(S);
+        Storage.ArgVals[i] = reinterpret_cast<intptr_t>(Storage.ArgStrs.back().c_str());
+      }
+      else
+      {
+        Storage.ArgVals[i] = 0;
+      }
+      break;
+
+    default:
+      Storage.ArgVals[i] = Info.getRawArg(i);
+      break;
+    }
+  }
+
+  // the location must remain decodable once the record is formatted.
+  if (Storage.Loc.isValid())
+  {
+    SM = Info.getSourceManager();
+    if (SM)
+    {
+      PinnedFile = SM->getFileID(Storage.Loc);
+      if (PinnedFile.isValid())
+        SM->pinFile(PinnedFile);
+      else
+        SM.reset(); // LCOV_EXCL_LINE
+    }
+  }
+}
+
+StoredDiagnostic::~StoredDiagnostic()
+{
+  if (SM)
+  {
+    SM->unpinFile(PinnedFile);
+  }
 }
 
 void
@@ -103,14 +176,6 @@ DiagnosticConsumer::HandleDiagnostic(u::diag::Severity DiagLevel, u::Diagnostic
     ++NumErrors;
 }
 
-/// ModifierIs - Return true if the specified modifier matches specified string.
-template<std::size_t StrLen>
-static bool
-ModifierIs(const char* Modifier, unsigned long ModifierLen, const char (& Str)[StrLen])
-{
-  return StrLen - 1 == ModifierLen && !memcmp(Modifier, Str, StrLen - 1);
-}
-
 /// ScanForward - Scans forward, looking for the given character, skipping
 /// nested clauses and escaped characters.
 static const char*
@@ -148,267 +213,336 @@ ScanFormat(const char* I, const char* E, char Target)
   return E; // LCOV_EXCL_LINE
 }
 
-/// HandleSelectModifier - Handle the integer 'select' modifier.  This is used
-/// like this:  %select{foo|bar|baz}2.  This means that the integer argument
-/// "%2" has a value from 0-2.  If the value is 0, the diagnostic prints 'foo'.
-/// If the value is 1, it prints 'bar'.  If it has the value 2, it prints 'baz'.
-/// This is very useful for certain classes of variant diagnostics.
-static void
-HandleSelectModifier(const Diagnostic& DInfo,
-                     unsigned ValNo,
-                     const char* Argument,
-                     unsigned long ArgumentLen,
-                     llvm::SmallVectorImpl<char>& OutStr)
+namespace
 {
-  const char* ArgumentEnd = Argument + ArgumentLen;
-
-  // Skip over 'ValNo' |'s.
-  while (ValNo)
-  {
-    const char* NextVal = ScanFormat(Argument, ArgumentEnd, '|');
-    assert(NextVal != ArgumentEnd && "Value for integer select modifier was" // LCOV_EXCL_LINE
-                                     " larger than the number of options in the diagnostic string!");
-    Argument = NextVal + 1; // Skip this string.
-    --ValNo;
-  }
-
-  // Get the end of the value.  This is either the } or the |.
-  const char* EndPtr = ScanFormat(Argument, ArgumentEnd, '|');
-
-  // Recursively format the result of the select clause into the output string.
-  DInfo.FormatDiagnostic(Argument, EndPtr, OutStr);
-}
-
-/// HandleIntegerSModifier - Handle the integer 's' modifier.  This adds the
-/// letter 's' to the string if the value is not 1.  This is used in cases like
-/// this:  "you idiot, you have %4 parameter%s4!".
-static void
-HandleIntegerSModifier(unsigned ValNo, llvm::SmallVectorImpl<char>& OutStr)
+/// FormatStep - One step of a compiled diagnostic message.
+struct FormatStep
 {
-  if (ValNo != 1)
-    OutStr.push_back('s');
-}
-
-/// HandleOrdinalModifier - Handle the integer 'ord' modifier.  This
-/// prints the ordinal form of the given integer, with 1 corresponding
-/// to the first ordinal.  Currently this is hard-coded to use the
-/// English form.
-static void
-HandleOrdinalModifier(unsigned ValNo, llvm::SmallVectorImpl<char>& OutStr)
+  enum OpKind : unsigned char
+  {
+    Text,     ///< Append the Length characters at Chars.
+    Argument, ///< Append argument ArgNo, as its kind prints.
+    Verbatim, ///< Append argument ArgNo, dropping unprintable characters of a string.
+    Select,   ///< Run the alternative argument ArgNo picks from Count, at First.
+    Plural,   ///< Append 's' unless argument ArgNo is one.
+    Ordinal,  ///< Append argument ArgNo as an English ordinal.
+  };
+
+  OpKind Op;
+  unsigned char ArgNo;
+  const char* Chars;
+  unsigned Length;
+  unsigned First;
+  unsigned Count;
+};
+
+/// FormatProgram - A diagnostic message compiled into the steps formatting
+/// it, so that formatting costs only as much as the output it produces.
+struct FormatProgram
 {
-  assert(ValNo != 0 && "ValNo must be strictly positive!");
+  std::vector<FormatStep> Steps;
 
-  llvm::raw_svector_ostream Out(OutStr);
+  /// The [first, last) steps of every alternative of every select.
+  std::vector<std::pair<unsigned, unsigned>> Alternatives;
 
-  // We could use text forms for the first N ordinals, but the numeric
-  // forms are actually nicer in diagnostics because they stand out.
-  Out << ValNo << llvm::getOrdinalSuffix(ValNo);
-}
+  /// The [first, last) steps of the message itself.
+  std::pair<unsigned, unsigned> Message;
+};
 
-/// FormatDiagnostic - Format this diagnostic into a string, substituting the
-/// formal arguments into the %0 slots.  The result is appended onto the Str
-/// array.
-void
-Diagnostic::FormatDiagnostic(llvm::SmallVectorImpl<char>& OutStr) const
-{
-  std::string Diag = getDiags()->Mappings->get(getID())->Message;
-
-  FormatDiagnostic(Diag.c_str(), Diag.c_str() + Diag.size(), OutStr);
-}
-
-void
-Diagnostic::FormatDiagnostic(const char* DiagStr, const char* DiagEnd, llvm::SmallVectorImpl<char>& OutStr) const
+/// CompileFormat - Compile the message [I, E) into \p P, returning the range
+/// of its steps. The steps of any select alternative are laid out ahead of
+/// those of the message selecting it.
+std::pair<unsigned, unsigned>
+CompileFormat(const char* I, const char* E, FormatProgram& P)
 {
+  llvm::SmallVector<FormatStep, 8> Steps;
 
   // When the diagnostic string is only "%0", the entire string is being given
-  // by an outside source.  Remove unprintable characters from this string
-  // and skip all the other string processing.
-  if (DiagEnd - DiagStr == 2 && llvm::StringRef(DiagStr, DiagEnd - DiagStr).equals("%0") &&
-    getArgKind(0) == DiagnosticEngine::ak_std_string)
+  // by an outside source.
+  if (E - I == 2 && I[0] == '%' && I[1] == '0')
   {
-    const std::string& S = getArgStdStr(0);
-    for (char c : S)
-    {
-      if (isprint(c) || c == '\t')
-      {
-        OutStr.push_back(c);
-      }
-    }
-    return;
+    Steps.push_back(FormatStep{FormatStep::Verbatim, 0, nullptr, 0, 0, 0});
+    I = E;
   }
-  /// FormattedArgs - Keep track of all of the arguments formatted by
-  /// ConvertArgToString and pass them into subsequent calls to
-  /// ConvertArgToString, allowing the implementation to avoid redundancies in
-  /// obvious cases.
-  llvm::SmallVector<DiagnosticEngine::ArgumentValue, 8> FormattedArgs;
-
-  /// QualTypeVals - Pass a vector of arrays so that QualType names can be
-  /// compared to see if more information is needed to be printed.
-  llvm::SmallVector<intptr_t, 2> QualTypeVals;
-  llvm::SmallVector<char, 64> Tree;
-
-  while (DiagStr != DiagEnd)
+
+  while (I != E)
   {
-    if (DiagStr[0] != '%')
+    if (I[0] != '%')
     {
-      // Append non-%0 substrings to Str if we have one.
-      const char* StrEnd = std::find(DiagStr, DiagEnd, '%');
-      OutStr.append(DiagStr, StrEnd);
-      DiagStr = StrEnd;
+      const char* StrEnd = std::find(I, E, '%');
+      Steps.push_back(FormatStep{FormatStep::Text, 0, I, static_cast<unsigned>(StrEnd - I), 0, 0});
+      I = StrEnd;
       continue;
     }
-    else if (ispunct(DiagStr[1]))
+    else if (ispunct(I[1]))
     {
-      OutStr.push_back(DiagStr[1]); // %% -> %.
-      DiagStr += 2;
+      Steps.push_back(FormatStep{FormatStep::Text, 0, I + 1, 1, 0, 0}); // %% -> %.
+      I += 2;
       continue;
     }
 
     // Skip the %.
-    ++DiagStr;
+    ++I;
 
     // This must be a placeholder for a diagnostic argument.  The format for a
     // placeholder is one of "%0", "%modifier0", or "%modifier{arguments}0".
     // The digit is a number from 0-9 indicating which argument this comes from.
     // The modifier is a string of digits from the set [-a-z]+, arguments is a
     // brace enclosed string.
-    const char* Modifier = nullptr, * Argument = nullptr;
-    unsigned long ModifierLen = 0, ArgumentLen = 0;
-    (void) ArgumentLen;
-
-    // Check to see if we have a modifier.  If so eat it.
-    if (!isdigit(DiagStr[0]))
+    const char* Modifier = I;
+    while (I[0] == '-' || (I[0] >= 'a' && I[0] <= 'z'))
+      ++I;
+    llvm::StringRef ModifierStr(Modifier, static_cast<size_t>(I - Modifier));
+
+    // If we have an argument, get it next.
+    const char* Argument = I;
+    const char* ArgumentEnd = I;
+    if (!ModifierStr.empty() && I[0] == '{')
     {
-      Modifier = DiagStr;
-      while (DiagStr[0] == '-' || (DiagStr[0] >= 'a' && DiagStr[0] <= 'z'))
-        ++DiagStr;
-      ModifierLen = DiagStr - Modifier;
+      Argument = ++I; // Skip {.
+      I = ScanFormat(I, E, '}');
+      assert(I != E && "Mismatched {}'s in diagnostic string!");
+      ArgumentEnd = I++; // Skip }.
+    }
 
-      // If we have an argument, get it next.
-      if (DiagStr[0] == '{')
-      {
-        ++DiagStr; // Skip {.
-        Argument = DiagStr;
+    assert(isdigit(*I) && "Invalid format for argument in diagnostic");
+    FormatStep Step{FormatStep::Argument, static_cast<unsigned char>(*I++ - '0'), nullptr, 0, 0, 0};
 
-        DiagStr = ScanFormat(DiagStr, DiagEnd, '}');
-        assert(DiagStr != DiagEnd && "Mismatched {}'s in diagnostic string!");
-        ArgumentLen = DiagStr - Argument;
-        ++DiagStr; // Skip }.
+    if (ModifierStr == "select")
+    {
+      // %select{foo|bar|baz}2 prints 'foo' when argument 2 is 0, 'bar' when
+      // it is 1, and so on; each alternative is compiled on its own.
+      llvm::SmallVector<std::pair<unsigned, unsigned>, 4> Alternatives;
+      while (true)
+      {
+        const char* NextVal = ScanFormat(Argument, ArgumentEnd, '|');
+        Alternatives.push_back(CompileFormat(Argument, NextVal, P));
+        if (NextVal == ArgumentEnd)
+          break;
+        Argument = NextVal + 1;
       }
+
+      Step.Op = FormatStep::Select;
+      Step.First = static_cast<unsigned>(P.Alternatives.size());
+      Step.Count = static_cast<unsigned>(Alternatives.size());
+      P.Alternatives.insert(P.Alternatives.end(), Alternatives.begin(), Alternatives.end());
+    }
+    else if (ModifierStr == "s")
+    {
+      Step.Op = FormatStep::Plural;
+    }
+    else if (ModifierStr == "ordinal")
+    {
+      Step.Op = FormatStep::Ordinal;
+    }
+    else
+    {
+      assert(ModifierStr.empty() && "Unknown modifier");
     }
 
-    assert(isdigit(*DiagStr) && "Invalid format for argument in diagnostic");
-    unsigned ArgNo = *DiagStr++ - '0';
+    Steps.push_back(Step);
+  }
 
-    DiagnosticEngine::ArgumentKind Kind = getArgKind(ArgNo);
-    int SVal;
-    unsigned UVal;
+  auto First = static_cast<unsigned>(P.Steps.size());
+  P.Steps.insert(P.Steps.end(), Steps.begin(), Steps.end());
+  return std::make_pair(First, static_cast<unsigned>(P.Steps.size()));
+}
 
-    switch (Kind)
-    {
-      // ---- STRINGS ----
-    case DiagnosticEngine::ak_std_string:
+/// CompileFormat - Compile the message [I, E) into a program of its own.
+FormatProgram
+CompileFormat(const char* I, const char* E)
+{
+  FormatProgram P;
+  P.Message = CompileFormat(I, E, P);
+  return P;
+}
+
+/// getFormatProgram - Return the compiled message of diagnostic \p ID; every
+/// message is compiled once, when a diagnostic is first formatted.
+FormatProgram const&
+getFormatProgram(diag::DiagnosticID ID)
+{
+  static const std::vector<FormatProgram> Programs = [] {
+    std::vector<FormatProgram> Result;
+    Result.reserve(diag::NUM_DIAGNOSTICS);
+    for (auto const& Info : diag::DiagnosticTable)
     {
-      const std::string& S = getArgStdStr(ArgNo);
-      assert(ModifierLen == 0 && "No modifiers for strings yet");
-      OutStr.append(S.begin(), S.end());
-      break;
+      Result.push_back(CompileFormat(Info.Message, Info.Message + std::strlen(Info.Message)));
     }
+    return Result;
+  }();
 
-    case DiagnosticEngine::ak_c_string:
-    {
-      const char* S = getArgCStr(ArgNo);
-      assert(ModifierLen == 0 && "No modifiers for strings yet");
+  return Programs[ID];
+}
 
-      // Don't crash if get passed a null pointer by accident.
-      if (!S)
-        S = "(null)";
-      OutStr.append(S, S + strlen(S));
-      break;
-    }
+/// IntegerArgument - Return integer argument \p ArgNo, as a modifier reads it.
+unsigned
+IntegerArgument(const Diagnostic& DInfo, unsigned ArgNo)
+{
+  if (DInfo.getArgKind(ArgNo) == DiagnosticEngine::ak_sint)
+    return static_cast<unsigned>(DInfo.getArgSInt(ArgNo));
+
+  assert(DInfo.getArgKind(ArgNo) == DiagnosticEngine::ak_uint && "Modifiers apply to integers only");
+  return DInfo.getArgUInt(ArgNo);
+}
+
+/// AppendArgument - Append argument \p ArgNo, as its kind prints.
+void
+AppendArgument(const Diagnostic& DInfo, unsigned ArgNo, llvm::SmallVectorImpl<char>& OutStr)
+{
+  switch (DInfo.getArgKind(ArgNo))
+  {
+    // ---- STRINGS ----
+  case DiagnosticEngine::ak_std_string:
+  {
+    const std::string& S = DInfo.getArgStdStr(ArgNo);
+    OutStr.append(S.begin(), S.end());
+    break;
+  }
+
+  case DiagnosticEngine::ak_c_string:
+  {
+    const char* S = DInfo.getArgCStr(ArgNo);
+
+    // Don't crash if get passed a null pointer by accident.
+    if (!S)
+      S = "(null)";
+    OutStr.append(S, S + strlen(S));
+    break;
+  }
+
+    // ---- INTEGERS ----
+  case DiagnosticEngine::ak_sint:
+    llvm::raw_svector_ostream(OutStr) << DInfo.getArgSInt(ArgNo);
+    break;
+
+  case DiagnosticEngine::ak_uint:
+    llvm::raw_svector_ostream(OutStr) << DInfo.getArgUInt(ArgNo);
+    break;
+
+    // ---- TOKEN SPELLINGS ----
+  case DiagnosticEngine::ak_tokenkind:
+  {
+    tok::TokenKind Kind = static_cast<tok::TokenKind>(DInfo.getRawArg(ArgNo));
+
+    llvm::raw_svector_ostream Out(OutStr);
+    if (const char* S = tok::getPunctuatorSpelling(Kind))
+      // Quoted token spelling for punctuators.
+      Out << '\'' << S << '\'';
+    else if (const char* S = tok::getKeywordSpelling(Kind))
+      // Unquoted token spelling for keywords.
+      Out << S;
+    else if (const char* S = tok::getTokenName(Kind))
+      // Debug name, shouldn't appear in user-facing diagnostics.
+      Out << '<' << S << '>';
+    else
+      Out << "(null)"; // LCOV_EXCL_LINE
+    break;
+  }
+  }
+}
+
+/// HandleOrdinalModifier - Handle the integer 'ord' modifier.  This
+/// prints the ordinal form of the given integer, with 1 corresponding
+/// to the first ordinal.  Currently this is hard-coded to use the
+/// English form.
+void
+HandleOrdinalModifier(unsigned ValNo, llvm::SmallVectorImpl<char>& OutStr)
+{
+  assert(ValNo != 0 && "ValNo must be strictly positive!");
 
-      // ---- INTEGERS ----
-    case DiagnosticEngine::ak_sint:
+  llvm::raw_svector_ostream Out(OutStr);
+
+  // We could use text forms for the first N ordinals, but the numeric
+  // forms are actually nicer in diagnostics because they stand out.
+  Out << ValNo << llvm::getOrdinalSuffix(ValNo);
+}
+
+/// RunFormat - Run the steps [First, Last) of \p P against the arguments of
+/// \p DInfo, appending the result onto \p OutStr.
+void
+RunFormat(const FormatProgram& P,
+          unsigned First,
+          unsigned Last,
+          const Diagnostic& DInfo,
+          llvm::SmallVectorImpl<char>& OutStr)
+{
+  for (unsigned i = First; i != Last; ++i)
+  {
+    const FormatStep& Step = P.Steps[i];
+    switch (Step.Op)
     {
-      SVal = getArgSInt(ArgNo);
+    case FormatStep::Text:
+      OutStr.append(Step.Chars, Step.Chars + Step.Length);
+      break;
 
-      if (ModifierIs(Modifier, ModifierLen, "select"))
-      {
-        HandleSelectModifier(*this, (unsigned) SVal, Argument, ArgumentLen, OutStr);
-      }
-      else if (ModifierIs(Modifier, ModifierLen, "s"))
-      {
-        HandleIntegerSModifier(SVal, OutStr);
-      }
-      else if (ModifierIs(Modifier, ModifierLen, "ordinal"))
+    case FormatStep::Verbatim:
+      if (DInfo.getArgKind(Step.ArgNo) == DiagnosticEngine::ak_std_string)
       {
-        HandleOrdinalModifier((unsigned) SVal, OutStr);
+        // Remove unprintable characters from an outside string.
+        for (char c : DInfo.getArgStdStr(Step.ArgNo))
+        {
+          if (isprint(c) || c == '\t')
+          {
+            OutStr.push_back(c);
+          }
+        }
       }
       else
       {
-        assert(ModifierLen == 0 && "Unknown integer modifier");
-        llvm::raw_svector_ostream(OutStr) << SVal;
+        AppendArgument(DInfo, Step.ArgNo, OutStr);
       }
-    }
       break;
 
-    case DiagnosticEngine::ak_uint:
-    {
-      UVal = getArgUInt(ArgNo);
+    case FormatStep::Argument:
+      AppendArgument(DInfo, Step.ArgNo, OutStr);
+      break;
 
-      if (ModifierIs(Modifier, ModifierLen, "select"))
-      {
-        HandleSelectModifier(*this, UVal, Argument, ArgumentLen, OutStr);
-      }
-      else if (ModifierIs(Modifier, ModifierLen, "s"))
-      {
-        HandleIntegerSModifier(UVal, OutStr);
-      }
-      else if (ModifierIs(Modifier, ModifierLen, "ordinal"))
-      {
-        HandleOrdinalModifier(UVal, OutStr);
-      }
-      else
+    case FormatStep::Select:
+    {
+      unsigned ValNo = IntegerArgument(DInfo, Step.ArgNo);
+      assert(ValNo < Step.Count && "Value for integer select modifier was" // LCOV_EXCL_LINE
+                                   " larger than the number of options in the diagnostic string!");
+      if (ValNo < Step.Count)
       {
-        assert(ModifierLen == 0 && "Unknown integer modifier");
-        llvm::raw_svector_ostream(OutStr) << UVal;
+        auto const& Alternative = P.Alternatives[Step.First + ValNo];
+        RunFormat(P, Alternative.first, Alternative.second, DInfo, OutStr);
       }
+      break;
     }
+
+    case FormatStep::Plural:
+      // "you idiot, you have %4 parameter%s4!"
+      if (IntegerArgument(DInfo, Step.ArgNo) != 1)
+        OutStr.push_back('s');
       break;
 
-      // ---- TOKEN SPELLINGS ----
-    case DiagnosticEngine::ak_tokenkind:
-    {
-      tok::TokenKind Kind = static_cast<tok::TokenKind>(getRawArg(ArgNo));
-      assert(ModifierLen == 0 && "No modifiers for token kinds yet");
-
-      llvm::raw_svector_ostream Out(OutStr);
-      if (const char* S = tok::getPunctuatorSpelling(Kind))
-        // Quoted token spelling for punctuators.
-        Out << '\'' << S << '\'';
-      else if (const char* S = tok::getKeywordSpelling(Kind))
-        // Unquoted token spelling for keywords.
-        Out << S;
-      else if (const char* S = tok::getTokenName(Kind))
-        // Debug name, shouldn't appear in user-facing diagnostics.
-        Out << '<' << S << '>';
-      else
-        Out << "(null)"; // LCOV_EXCL_LINE
-    }
+    case FormatStep::Ordinal:
+      HandleOrdinalModifier(IntegerArgument(DInfo, Step.ArgNo), OutStr);
       break;
     }
-
-    // Remember this argument info for subsequent formatting operations.  Turn
-    // std::strings into a null terminated string to make it be the same case as
-    // all the other ones.
-    if (Kind != DiagnosticEngine::ak_std_string)
-      FormattedArgs.push_back(std::make_pair(Kind, getRawArg(ArgNo)));
-    else
-      FormattedArgs.push_back(std::make_pair(DiagnosticEngine::ak_c_string, (intptr_t) getArgStdStr(ArgNo).c_str()));
   }
+}
+} // end anonymous namespace
+
+/// FormatDiagnostic - Format this diagnostic into a string, substituting the
+/// formal arguments into the %0 slots.  The result is appended onto the Str
+/// array.
+void
+Diagnostic::FormatDiagnostic(llvm::SmallVectorImpl<char>& OutStr) const
+{
+  const FormatProgram& P = getFormatProgram(getID());
+
+  RunFormat(P, P.Message.first, P.Message.second, *this, OutStr);
+}
+
+void
+Diagnostic::FormatDiagnostic(const char* DiagStr, const char* DiagEnd, llvm::SmallVectorImpl<char>& OutStr) const
+{
+  // a message not of the table is compiled for this use alone.
+  FormatProgram P = CompileFormat(DiagStr, DiagEnd);
 
-  // Append the type tree to the end of the diagnostics.
-  OutStr.append(Tree.begin(), Tree.end());
+  RunFormat(P, P.Message.first, P.Message.second, *this, OutStr);
 }
 
 /// IncludeInDiagnosticCounts - This method (whose default implementation
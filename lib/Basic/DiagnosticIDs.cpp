@@ -27,7 +27,6 @@
 #pragma clang diagnostic ignored "-Wshorten-64-to-32"
 #endif
 #include <llvm/ADT/StringRef.h>
-#include <llvm/ADT/Optional.h>
 
 #ifdef __clang__
 #pragma clang diagnostic pop
@@ -39,31 +38,7 @@
 using namespace u;
 using namespace u::diag;
 
-typedef std::map<diag::DiagnosticID, DiagnosticInfo> TableT;
-
-static TableT Table;
-
-DiagnosticMapping::DiagnosticMapping()
-{
-  AddDiagnostics();
-}
-
-llvm::Optional<DiagnosticInfo>
-DiagnosticMapping::get(DiagnosticID Search)
-{
-  auto Result = Table.find(Search);
-  if (Result != end())
-  {
-    return Result->second;
-  }
-
-  return llvm::None; // LCOV_EXCL_LINE
-}
-
-void DiagnosticMapping::AddDiagnostics()
-{
-#define DIAGNOSTIC(A, B, C, D, E)                                                                                          \
-  Table.insert(std::make_pair(diag::C, DiagnosticInfo{diag::Severity::A, #B, C, D, E}));
-
+constexpr DiagnosticInfo diag::DiagnosticTable[NUM_DIAGNOSTICS] = {
+#define DIAGNOSTIC(A, B, C, D, E) {diag::Severity::A, #B, D, E},
 #include <u-lang/Basic/DiagnosticIDs.def>
-}
\ No newline at end of file
+};
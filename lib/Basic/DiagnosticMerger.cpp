@@ -0,0 +1,121 @@
+/**
+ * The U Programming Language
+ *
+ * Copyright 2018 Joseph Benden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * \author Joseph W. Benden
+ * \copyright (C) 2018 Joseph Benden
+ * \license apache2
+ */
+
+#include <glog/logging.h>
+
+#include <u-lang/Basic/DiagnosticMerger.hpp>
+#include <u-lang/u.hpp>
+
+#include <algorithm>
+#include <queue>
+#include <tuple>
+
+using namespace u;
+
+void
+BufferedDiagConsumer::HandleDiagnostic(diag::Severity DiagLevel, const Diagnostic& Info)
+{
+  DiagnosticConsumer::HandleDiagnostic(DiagLevel, Info);
+
+  // decompose the location now; a diagnostic without one sorts first.
+  FileID File;
+  uint32_t Offset = 0;
+  auto SM = Info.getSourceManager();
+  if (SM && Info.getLocation().isValid())
+  {
+    File = SM->getFileID(Info.getLocation());
+    Offset = SM->getFileOffset(Info.getLocation());
+  }
+
+  Entries.push_back(Entry{File, Offset, std::unique_ptr<StoredDiagnostic>(new StoredDiagnostic(DiagLevel, Info))});
+}
+
+std::shared_ptr<BufferedDiagConsumer>
+DiagnosticMerger::createWorkerConsumer()
+{
+  std::lock_guard<std::mutex> Lock(Mutex);
+
+  Workers.push_back(std::make_shared<BufferedDiagConsumer>());
+  return Workers.back();
+}
+
+void
+DiagnosticMerger::merge()
+{
+  std::lock_guard<std::mutex> Lock(Mutex);
+
+  typedef BufferedDiagConsumer::Entry Entry;
+  auto Less = [](Entry const& A, Entry const& B) {
+    return std::tie(A.File, A.Offset) < std::tie(B.File, B.Offset);
+  };
+
+  // order each buffer on its own; a stable sort keeps the order reported.
+  for (auto& Worker : Workers)
+  {
+    std::stable_sort(Worker->Entries.begin(), Worker->Entries.end(), Less);
+  }
+
+  // then repeatedly take the least head among the buffers.
+  typedef std::pair<unsigned, size_t> Cursor;
+  auto Greater = [&](Cursor const& A, Cursor const& B) {
+    Entry const& EA = Workers[A.first]->Entries[A.second];
+    Entry const& EB = Workers[B.first]->Entries[B.second];
+    if (Less(EA, EB))
+      return false;
+    if (Less(EB, EA))
+      return true;
+    return A.first > B.first;
+  };
+
+  std::priority_queue<Cursor, std::vector<Cursor>, decltype(Greater)> Heads(Greater);
+  for (unsigned i = 0; i < Workers.size(); ++i)
+  {
+    if (!Workers[i]->Entries.empty())
+    {
+      Heads.push(Cursor(i, 0));
+    }
+  }
+
+  while (!Heads.empty())
+  {
+    Cursor Head = Heads.top();
+    Heads.pop();
+
+    auto& Entries = Workers[Head.first]->Entries;
+    auto& Record = *Entries[Head.second].Record;
+    if (Consumer)
+    {
+      Consumer->HandleDiagnostic(Record.getLevel(), Diagnostic(Record));
+    }
+
+    if (Head.second + 1 < Entries.size())
+    {
+      Heads.push(Cursor(Head.first, Head.second + 1));
+    }
+  }
+
+  // release the records, and their pins on files.
+  for (auto& Worker : Workers)
+  {
+    Worker->Entries.clear();
+  }
+}
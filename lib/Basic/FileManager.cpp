@@ -0,0 +1,561 @@
+/**
+ * The U Programming Language
+ *
+ * Copyright 2018 Joseph Benden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * \author Joseph W. Benden
+ * \copyright (C) 2018 Joseph Benden
+ * \license apache2
+ */
+
+#ifdef __clang__
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunused-parameter"
+#pragma clang diagnostic ignored "-Wmacro-redefined"
+#pragma clang diagnostic ignored "-Wshorten-64-to-32"
+#endif
+#undef HAVE_INTTYPES_H
+#undef HAVE_STDINT_H
+#undef HAVE_UINT64_T
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Path.h>
+#ifdef __clang__
+#pragma clang diagnostic pop
+#endif
+
+#include <glog/logging.h>
+
+#include <u-lang/Basic/FileManager.hpp>
+#include <u-lang/u.hpp>
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+using namespace u;
+
+namespace
+{
+
+/// The user module path, unless otherwise configured; found once per process.
+std::string const&
+getDefaultUserModulePath()
+{
+  static std::string const Path = [] {
+    llvm::SmallString<128> Storage;
+    llvm::sys::path::home_directory(Storage);
+
+    return Storage.str().str() + "/.u-lang/modules";
+  }();
+
+  return Path;
+}
+
+/// Where the index of the module root \p Root is kept, within \p Directory.
+std::string
+getIndexPath(llvm::StringRef Directory, llvm::StringRef Root)
+{
+  // name each index after its root, stably across runs.
+  auto Digest = getContentHash(Root);
+  auto Name = llvm::toHex(llvm::StringRef(reinterpret_cast<const char*>(Digest.data()), 8)) + ".uidx";
+  llvm::SmallString<256> IndexPath{Directory};
+  llvm::sys::path::append(IndexPath, Name);
+
+  return IndexPath.str().str();
+}
+
+/// Bring the index of \p Layer up to date, should anything beneath its root
+/// have changed; only the files named by a change are read again, unless
+/// the root must be walked anew.
+void
+RefreshIndex(detail::FileManagerStack& S, size_t Layer)
+{
+  auto& Changed = S.ChangedEntries[Layer];
+  if (!S.DirtyIndices[Layer] && Changed.empty())
+  {
+    return;
+  }
+
+  auto& Index = S.Indices[Layer];
+  if (Index)
+  {
+    auto IndexPath = getIndexPath(S.IndexDirectory, S.LayerRoots[Layer]);
+
+    std::unique_ptr<ModuleIndex> Updated;
+    if (!S.DirtyIndices[Layer])
+    {
+      Updated = Index->update(Changed, IndexPath);
+    }
+
+    Index = Updated ? std::move(Updated) : Index->rebuild(IndexPath);
+  }
+
+  S.DirtyIndices[Layer] = false;
+  Changed.clear();
+}
+
+/// Whether an entry may be at \p Path, relative to the root of \p Layer,
+/// as far as its index knows.
+bool
+IndexMayContain(detail::FileManagerStack& S, size_t Layer, llvm::StringRef Path)
+{
+  RefreshIndex(S, Layer);
+
+  return !S.Indices[Layer] || S.Indices[Layer]->contains(Path);
+}
+
+/// Push the module root at \p Path, a directory or a module bundle, onto \p S;
+/// a directory is indexed, should S have an index directory.
+void
+AddModuleRoot(detail::FileManagerStack& S, std::string const& Path, const char* Kind)
+{
+  IntrusiveRefCntPtr<vfs::FileSystem> layerFileSystem;
+  std::unique_ptr<ModuleIndex> Index;
+
+  // the layer of the first module root is one; the in-memory base is zero.
+  auto Layer = S.LayerRoots.size();
+
+  if (llvm::sys::fs::is_regular_file(Path))
+  {
+    auto bundleFileSystem = vfs::BundleFileSystem::open(Path);
+    if (!bundleFileSystem)
+    {
+      LOG(WARNING) << "The " << Kind << " module bundle " << Path << " is unreadable: " // LCOV_EXCL_LINE
+                   << bundleFileSystem.getError().message();                           // LCOV_EXCL_LINE
+      return;                                                                          // LCOV_EXCL_LINE
+    }
+
+    layerFileSystem = *bundleFileSystem;
+  }
+  else if (llvm::sys::fs::exists(Path))
+  {
+    IntrusiveRefCntPtr<vfs::RealFileSystem> realFileSystem = new vfs::RealFileSystem(Path);
+    S.RealLayers.push_back(realFileSystem);
+
+    if (!S.IndexDirectory.empty())
+    {
+      Index = ModuleIndex::loadOrBuild(Path, static_cast<unsigned>(Layer + 1), getIndexPath(S.IndexDirectory, Path));
+    }
+
+    // the index, being exact, rules out entries in place of walking the root.
+    if (Index)
+    {
+      realFileSystem->setMembershipOracle(
+        [&S, Layer](llvm::StringRef Entry) { return IndexMayContain(S, Layer, Entry); });
+    }
+    else
+    {
+      realFileSystem->enableMembershipFilter();
+    }
+
+    layerFileSystem = realFileSystem;
+  }
+  else
+  {
+    LOG(WARNING) << "The " << Kind << " module path " << Path << " does not exist."; // LCOV_EXCL_LINE
+    return;                                                                        // LCOV_EXCL_LINE
+  }
+
+  IntrusiveRefCntPtr<vfs::StatCachingFileSystem> cachedFileSystem = new vfs::StatCachingFileSystem(layerFileSystem);
+  S.VFS->pushOverlay(cachedFileSystem);
+  S.Layers.push_back(cachedFileSystem);
+  S.LayerRoots.push_back(Path);
+  S.Indices.push_back(std::move(Index));
+  S.DirtyIndices.push_back(false);
+  S.ChangedEntries.emplace_back();
+}
+
+/// Build the stack for the given module paths, indexing each module root
+/// into \p IndexDirectory unless empty.
+std::shared_ptr<detail::FileManagerStack>
+BuildStack(std::vector<std::string> const& SystemModulePaths,
+           std::vector<std::string> const& UserModulePaths,
+           std::string const& IndexDirectory)
+{
+  auto S = std::make_shared<detail::FileManagerStack>();
+
+  IntrusiveRefCntPtr<vfs::InMemoryFileSystem> inMemoryFileSystem = new vfs::InMemoryFileSystem();
+  S->VFS = new vfs::ConcatenatedOverlayFileSystem(inMemoryFileSystem);
+  S->CachedVFS = new vfs::StatCachingFileSystem(S->VFS);
+  S->IndexDirectory = IndexDirectory;
+
+  if (!IndexDirectory.empty())
+  {
+    llvm::sys::fs::create_directories(IndexDirectory);
+  }
+
+  for (auto& Path : SystemModulePaths)
+  {
+    AddModuleRoot(*S, Path, "system");
+  }
+
+  for (auto& Path : UserModulePaths)
+  {
+    AddModuleRoot(*S, Path, "user");
+  }
+
+  return S;
+}
+
+/// The stacks in use, by the configuration they were built for.
+struct StackRegistry
+{
+  std::mutex Mutex;
+  std::map<std::string, std::weak_ptr<detail::FileManagerStack>> Stacks;
+
+  static StackRegistry& get()
+  {
+    static StackRegistry Registry;
+    return Registry;
+  }
+
+  /// Return the stack in use for the given configuration, or build it;
+  /// with \p Rebuild, build it anew for whoever next asks.
+  std::shared_ptr<detail::FileManagerStack> acquire(std::vector<std::string> const& SystemModulePaths,
+                                                    std::vector<std::string> const& UserModulePaths,
+                                                    std::string const& IndexDirectory,
+                                                    bool Rebuild = false)
+  {
+    // NUL never occurs within a path, so it separates them unambiguously.
+    std::string Key;
+    for (auto& Path : SystemModulePaths)
+    {
+      Key += Path;
+      Key += '\0';
+    }
+    Key += '\0';
+    for (auto& Path : UserModulePaths)
+    {
+      Key += Path;
+      Key += '\0';
+    }
+    Key += '\0';
+    Key += IndexDirectory;
+
+    std::lock_guard<std::mutex> Lock(Mutex);
+
+    auto& Slot = Stacks[Key];
+    auto S = Slot.lock();
+    if (!S || Rebuild)
+    {
+      S = BuildStack(SystemModulePaths, UserModulePaths, IndexDirectory);
+      Slot = S;
+    }
+
+    // forget the stacks no longer in use.
+    for (auto I = Stacks.begin(); I != Stacks.end();)
+    {
+      I = I->second.expired() ? Stacks.erase(I) : std::next(I);
+    }
+
+    return S;
+  }
+};
+
+} // namespace
+
+FileManager::FileManager()
+  : SystemModulePaths{ULANG_SYS_MODULE_PATH}
+{
+}
+
+detail::FileManagerStack&
+FileManager::getStack() const
+{
+  if (!Stack)
+  {
+    AcquireStack(/*Private=*/false, /*Rebuild=*/false);
+  }
+
+  return *Stack;
+}
+
+void
+FileManager::AcquireStack(bool Private, bool Rebuild) const
+{
+  std::vector<std::string> UserModulePaths{getDefaultUserModulePath()};
+
+  if (Private)
+  {
+    Stack = BuildStack(SystemModulePaths, UserModulePaths, IndexDirectory);
+  }
+  else
+  {
+    Stack = StackRegistry::get().acquire(SystemModulePaths, UserModulePaths, IndexDirectory, Rebuild);
+  }
+  HasPrivateStack = Private;
+
+  if (Watcher)
+  {
+    for (auto& Root : Stack->LayerRoots)
+    {
+      WatchModuleRoot(Root);
+    }
+  }
+}
+
+bool
+FileManager::EnableFileWatching()
+{
+  if (Watcher)
+  {
+    return Watcher->isWatching();
+  }
+
+  Watcher = std::make_unique<FileWatcher>();
+  if (!Watcher->isWatching())
+  {
+    return false; // LCOV_EXCL_LINE
+  }
+
+  Watcher->subscribe([this](llvm::StringRef Path) { OnFileChanged(Path); });
+  for (auto& Root : getStack().LayerRoots)
+  {
+    WatchModuleRoot(Root);
+  }
+
+  return true;
+}
+
+unsigned
+FileManager::pollFileChanges()
+{
+  if (!Watcher)
+  {
+    return 0;
+  }
+
+  auto Changes = Watcher->poll();
+
+  auto& S = getStack();
+  std::lock_guard<std::mutex> Lock(S.Mutex);
+
+  // an index is brought up to date once per poll, however much changed.
+  for (size_t i = 0; i < S.Indices.size(); ++i)
+  {
+    RefreshIndex(S, i);
+  }
+
+  return Changes;
+}
+
+llvm::Optional<ModuleIndex::Entry>
+FileManager::lookupModule(const llvm::Twine& Path)
+{
+  auto& S = getStack();
+  std::lock_guard<std::mutex> Lock(S.Mutex);
+
+  auto Normalized = vfs::getNormalizedPath(*S.VFS, Path);
+
+  for (size_t Layer = S.Indices.size(); Layer-- > 0;)
+  {
+    RefreshIndex(S, Layer);
+
+    if (!S.Indices[Layer])
+    {
+      continue; // LCOV_EXCL_LINE
+    }
+
+    auto Entry = S.Indices[Layer]->lookup(Normalized);
+
+    // a file rewritten in place changes the time of no directory; so the
+    // file looked up is checked on its own, and read again should it differ.
+    if (Entry && !S.Indices[Layer]->isCurrent(Normalized, *Entry))
+    {
+      S.ChangedEntries[Layer].push_back(Normalized);
+      RefreshIndex(S, Layer);
+      Entry = S.Indices[Layer] ? S.Indices[Layer]->lookup(Normalized) : llvm::None;
+    }
+
+    if (Entry)
+    {
+      return Entry;
+    }
+  }
+
+  return llvm::None;
+}
+
+std::error_code
+FileManager::setCurrentWorkingDirectory(const llvm::Twine& Path)
+{
+  // the working directory is not to be shared; so neither is the stack.
+  if (!HasPrivateStack)
+  {
+    AcquireStack(/*Private=*/true, /*Rebuild=*/false);
+  }
+
+  std::lock_guard<std::mutex> Lock(Stack->Mutex);
+  return Stack->VFS->setCurrentWorkingDirectory(Path);
+}
+
+void
+FileManager::invalidateStatCache(const llvm::Twine& Path)
+{
+  ForgetLookups(Path, /*OutdateIndices=*/true);
+}
+
+void
+FileManager::ForgetLookups(const llvm::Twine& Path, bool OutdateIndices)
+{
+  auto& S = getStack();
+  std::lock_guard<std::mutex> Lock(S.Mutex);
+
+  S.CachedVFS->invalidate(Path);
+  S.VFS->invalidate(Path);
+
+  for (auto& Layer : S.Layers)
+  {
+    Layer->invalidate(Path);
+  }
+
+  // the file may have been added beneath a layer that lacked it.
+  for (auto& Layer : S.RealLayers)
+  {
+    Layer->noteEntryChanged(Path);
+  }
+
+  // not knowing which layer holds the file, each index must read it again.
+  if (OutdateIndices)
+  {
+    auto Normalized = vfs::getNormalizedPath(*S.VFS, Path);
+    for (size_t Layer = 0; Layer < S.Indices.size(); ++Layer)
+    {
+      if (S.Indices[Layer])
+      {
+        S.ChangedEntries[Layer].push_back(Normalized);
+      }
+    }
+  }
+}
+
+void
+FileManager::invalidateStatCache()
+{
+  auto& S = getStack();
+  std::lock_guard<std::mutex> Lock(S.Mutex);
+
+  S.CachedVFS->invalidateAll();
+  S.VFS->invalidateAll();
+
+  for (auto& Layer : S.Layers)
+  {
+    Layer->invalidateAll();
+  }
+
+  for (auto& Layer : S.RealLayers)
+  {
+    Layer->invalidateMembershipFilter();
+  }
+  S.DirtyIndices.assign(S.LayerRoots.size(), true);
+}
+
+unsigned
+FileManager::getNumStatCacheMisses() const
+{
+  auto& S = getStack();
+  std::lock_guard<std::mutex> Lock(S.Mutex);
+
+  unsigned Misses{0};
+  for (auto& Layer : S.Layers)
+  {
+    Misses += Layer->getNumMisses();
+  }
+
+  return Misses;
+}
+
+void
+FileManager::WatchModuleRoot(std::string const& Root) const
+{
+  auto EC = llvm::sys::fs::is_directory(Root) ? Watcher->watchTree(Root) : Watcher->watchFile(Root);
+  if (EC)
+  {
+    LOG(WARNING) << "Unable to watch the module path " << Root << ": " << EC.message(); // LCOV_EXCL_LINE
+  }
+}
+
+void
+FileManager::OnFileChanged(llvm::StringRef Path)
+{
+  std::string Changed;
+  bool Remap{false};
+
+  {
+    auto& S = getStack();
+    std::lock_guard<std::mutex> Lock(S.Mutex);
+
+    // the top-most layer beneath whose root the entry lies.
+    size_t Layer = S.LayerRoots.size();
+    while (!Path.empty() && Layer-- > 0)
+    {
+      llvm::StringRef Root = S.LayerRoots[Layer];
+      if (Path == Root && llvm::sys::fs::is_regular_file(Root))
+      {
+        // a rewritten module bundle must be mapped anew.
+        Remap = true;
+        break;
+      }
+
+      if (Path.startswith(Root) && Path.size() > Root.size() && Path[Root.size()] == '/')
+      {
+        Changed = Path.substr(Root.size()).str();
+
+        // a directory created, moved or removed brings or takes entries no
+        // event names; so everything is looked up anew, as after lost events.
+        if (llvm::sys::fs::is_directory(Path) || S.CachedVFS->isCachedDirectory(Changed))
+        {
+          Changed.clear();
+        }
+        else if (S.Indices[Layer])
+        {
+          S.ChangedEntries[Layer].push_back(Changed);
+        }
+        break;
+      }
+    }
+  }
+
+  if (Remap)
+  {
+    // a stack of our own is built anew in the working directory it had.
+    auto WorkingDirectory = getCurrentWorkingDirectory();
+    AcquireStack(HasPrivateStack, /*Rebuild=*/true);
+    if (HasPrivateStack && WorkingDirectory)
+    {
+      setCurrentWorkingDirectory(*WorkingDirectory);
+    }
+  }
+  else if (Changed.empty())
+  {
+    invalidateStatCache();
+  }
+  else
+  {
+    // only the index of the layer holding the file reads it again.
+    ForgetLookups(Changed, /*OutdateIndices=*/false);
+  }
+
+  // a listener may unsubscribe itself, or another.
+  auto Listeners = ChangeListeners;
+  for (auto& Listener : Listeners)
+  {
+    Listener.second(Changed);
+  }
+}
@@ -0,0 +1,261 @@
+/**
+ * The U Programming Language
+ *
+ * Copyright 2018 Joseph Benden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * \author Joseph W. Benden
+ * \copyright (C) 2018 Joseph Benden
+ * \license apache2
+ */
+
+#ifdef __clang__
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunused-parameter"
+#pragma clang diagnostic ignored "-Wmacro-redefined"
+#pragma clang diagnostic ignored "-Wshorten-64-to-32"
+#endif
+#undef HAVE_INTTYPES_H
+#undef HAVE_STDINT_H
+#undef HAVE_UINT64_T
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringSet.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Path.h>
+#ifdef __clang__
+#pragma clang diagnostic pop
+#endif
+
+#include <glog/logging.h>
+
+#include <u-lang/Basic/FileWatcher.hpp>
+#include <u-lang/u.hpp>
+
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+using namespace u;
+
+#ifdef __linux__
+namespace
+{
+
+// Everything which may change what a lookup, or a read, returns.
+constexpr uint32_t WatchMask = IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_CREATE | IN_DELETE | IN_MOVED_FROM |
+                               IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF;
+
+} // namespace
+#endif
+
+FileWatcher::FileWatcher()
+  : FD{-1}
+  , NextHandle{1}
+{
+#ifdef __linux__
+  FD = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (FD < 0)
+  {
+    LOG(WARNING) << "Unable to watch for file changes: " << std::strerror(errno); // LCOV_EXCL_LINE
+  }
+#endif
+}
+
+FileWatcher::~FileWatcher()
+{
+#ifdef __linux__
+  if (FD >= 0)
+  {
+    ::close(FD);
+  }
+#endif
+}
+
+std::error_code
+FileWatcher::addWatch(std::string const& Path, bool Tree)
+{
+#ifdef __linux__
+  if (FD < 0)
+  {
+    return std::make_error_code(std::errc::not_supported); // LCOV_EXCL_LINE
+  }
+
+  auto WD = inotify_add_watch(FD, Path.c_str(), WatchMask);
+  if (WD < 0)
+  {
+    return std::error_code(errno, std::generic_category());
+  }
+
+  // watching a path twice yields the same descriptor; a tree subsumes a file.
+  auto& Watch = Watches[WD];
+  Watch.first = Path;
+  Watch.second = Watch.second || Tree;
+
+  return std::error_code();
+#else
+  return std::make_error_code(std::errc::not_supported);
+#endif
+}
+
+std::error_code
+FileWatcher::watchTree(const llvm::Twine& Root)
+{
+  std::string RootPath = Root.str();
+  if (auto EC = addWatch(RootPath, true))
+  {
+    return EC;
+  }
+
+  std::error_code EC;
+  for (llvm::sys::fs::recursive_directory_iterator I(RootPath, EC), E; I != E && !EC; I.increment(EC))
+  {
+    llvm::sys::fs::file_status Status;
+    if (!I->status(Status) && llvm::sys::fs::is_directory(Status))
+    {
+      addWatch(I->path(), true);
+    }
+  }
+
+  return std::error_code();
+}
+
+std::error_code
+FileWatcher::watchFile(const llvm::Twine& Path)
+{
+  return addWatch(Path.str(), false);
+}
+
+unsigned
+FileWatcher::subscribe(Listener L)
+{
+  Listeners.emplace_back(NextHandle, std::move(L));
+  return NextHandle++;
+}
+
+void
+FileWatcher::unsubscribe(unsigned Handle)
+{
+  for (auto I = Listeners.begin(), E = Listeners.end(); I != E; ++I)
+  {
+    if (I->first == Handle)
+    {
+      Listeners.erase(I);
+      return;
+    }
+  }
+}
+
+unsigned
+FileWatcher::poll()
+{
+  std::vector<std::string> Changed;
+
+#ifdef __linux__
+  if (FD < 0)
+  {
+    return 0; // LCOV_EXCL_LINE
+  }
+
+  llvm::StringSet<> Seen;
+  auto Publish = [&](std::string Path) {
+    if (Seen.insert(Path).second)
+    {
+      Changed.push_back(std::move(Path));
+    }
+  };
+
+  alignas(struct inotify_event) char Buffer[16384];
+  for (;;)
+  {
+    auto Length = ::read(FD, Buffer, sizeof(Buffer));
+    if (Length < 0 && errno == EINTR)
+    {
+      continue; // LCOV_EXCL_LINE
+    }
+
+    if (Length <= 0)
+    {
+      break;
+    }
+
+    for (char* P = Buffer; P < Buffer + Length;)
+    {
+      auto* Event = reinterpret_cast<struct inotify_event*>(P);
+      P += sizeof(struct inotify_event) + Event->len;
+
+      if (Event->mask & IN_Q_OVERFLOW)
+      {
+        LOG(WARNING) << "File change events were dropped; assuming everything changed"; // LCOV_EXCL_LINE
+        Publish(std::string());                                                         // LCOV_EXCL_LINE
+        continue;                                                                       // LCOV_EXCL_LINE
+      }
+
+      auto Watch = Watches.find(Event->wd);
+      if (Watch == Watches.end())
+      {
+        continue; // LCOV_EXCL_LINE
+      }
+
+      if (Event->mask & IN_IGNORED)
+      {
+        Watches.erase(Watch);
+        continue;
+      }
+
+      // copied, as watching a new directory may grow the table.
+      std::string Path = Watch->second.first;
+      bool Tree = Watch->second.second;
+      if (Event->len != 0 && Event->name[0] != '\0')
+      {
+        Path += '/';
+        Path += Event->name;
+      }
+
+      if (Tree && (Event->mask & IN_ISDIR) && (Event->mask & (IN_CREATE | IN_MOVED_TO)))
+      {
+        // anything created before the new directory was watched went unseen.
+        watchTree(Path);
+
+        std::error_code EC;
+        for (llvm::sys::fs::recursive_directory_iterator I(Path, EC), E; I != E && !EC; I.increment(EC))
+        {
+          Publish(I->path());
+        }
+      }
+
+      Publish(std::move(Path));
+    }
+  }
+#endif
+
+  for (auto& Path : Changed)
+  {
+    VLOG(1) << "Changed: " << Path;
+
+    // a listener may unsubscribe itself, or another.
+    auto Current = Listeners;
+    for (auto& Listener : Current)
+    {
+      Listener.second(Path);
+    }
+  }
+
+  return static_cast<unsigned>(Changed.size());
+}
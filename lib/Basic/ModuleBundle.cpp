@@ -0,0 +1,619 @@
+/**
+ * The U Programming Language
+ *
+ * Copyright 2018 Joseph Benden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * \author Joseph W. Benden
+ * \copyright (C) 2018 Joseph Benden
+ * \license apache2
+ */
+
+#ifdef __clang__
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunused-parameter"
+#pragma clang diagnostic ignored "-Wmacro-redefined"
+#pragma clang diagnostic ignored "-Wshorten-64-to-32"
+#endif
+#undef HAVE_INTTYPES_H
+#undef HAVE_STDINT_H
+#undef HAVE_UINT64_T
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/Errc.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/raw_ostream.h>
+#ifdef __clang__
+#pragma clang diagnostic pop
+#endif
+
+#include <glog/logging.h>
+
+#include <u-lang/Basic/ModuleBundle.hpp>
+#include <u-lang/u.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace u;
+using namespace u::vfs;
+
+namespace
+{
+
+// The serialized form; every integer is in host byte order, which the magic
+// number doubles as a check for.
+//
+//   Header
+//   Record[NumEntries]             - the root, then every other entry
+//   char Strings[StringsSize]      - every path, unterminated
+//   padding to DataOffset
+//   the contents of each file, NUL terminated and padded to Alignment
+
+const uint32_t Magic = 0x444d4255; // "UBMD"
+const uint32_t Version = 1;
+const uint32_t Alignment = 4096;
+
+enum RecordKind : uint32_t
+{
+  RK_File = 0,
+  RK_Directory = 1,
+};
+
+struct Header
+{
+  uint32_t Magic;
+  uint32_t Version;
+  uint32_t NumEntries;
+  uint32_t Alignment;
+  uint64_t StringsOffset;
+  uint64_t StringsSize;
+  uint64_t DataOffset;
+  uint64_t Reserved;
+};
+
+struct Record
+{
+  /// \brief The offset of the contents of a file; or the index of the
+  /// first child of a directory.
+  uint64_t Offset;
+
+  /// \brief The size of a file; or the number of children of a directory.
+  uint64_t Size;
+
+  int64_t MTime;
+  uint32_t PathOffset;
+  uint32_t PathLength;
+  uint32_t Kind;
+  uint32_t Reserved;
+};
+
+/// \brief Read a T at \p Offset; the mapping need not be aligned for T.
+template<typename T>
+T
+ReadAt(llvm::StringRef Data, size_t Offset)
+{
+  T Value;
+  std::memcpy(&Value, Data.data() + Offset, sizeof(T));
+  return Value;
+}
+
+Record
+RecordAt(llvm::StringRef Data, unsigned Index)
+{
+  return ReadAt<Record>(Data, sizeof(Header) + Index * sizeof(Record));
+}
+
+llvm::StringRef
+PathOf(llvm::StringRef Data, Record const& R)
+{
+  auto H = ReadAt<Header>(Data, 0);
+  return Data.substr(H.StringsOffset + R.PathOffset, R.PathLength);
+}
+
+/// \brief Split \p Path into the path of its parent and its name.
+std::pair<llvm::StringRef, llvm::StringRef>
+SplitParent(llvm::StringRef Path)
+{
+  auto Slash = Path.rfind('/');
+  if (Slash == llvm::StringRef::npos)
+  {
+    return std::make_pair(llvm::StringRef(), Path); // LCOV_EXCL_LINE
+  }
+
+  return std::make_pair(Path.substr(0, Slash), Path.substr(Slash + 1));
+}
+
+/// \brief The order of the records: by parent, then by name.
+bool
+ComesBefore(llvm::StringRef LHS, llvm::StringRef RHS)
+{
+  auto L = SplitParent(LHS);
+  auto R = SplitParent(RHS);
+  int Compared = L.first.compare(R.first);
+  return Compared != 0 ? Compared < 0 : L.second < R.second;
+}
+
+uint64_t
+AlignTo(uint64_t Value)
+{
+  return (Value + Alignment - 1) / Alignment * Alignment;
+}
+
+int64_t
+ModificationTime(llvm::sys::fs::file_status const& Status, llvm::StringRef Path)
+{
+  auto S = Status::copyWithNewName(Status, Path);
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(S.getLastModificationTime().time_since_epoch()).count();
+}
+
+/// A file opened from a bundle; the contents are those within the mapping.
+class BundleFile : public File
+{
+  std::shared_ptr<llvm::MemoryBuffer> Bundle;
+  Status Stat;
+  llvm::StringRef Contents;
+
+public:
+  BundleFile(std::shared_ptr<llvm::MemoryBuffer> B, Status S, llvm::StringRef C)
+    : Bundle{std::move(B)}
+    , Stat{std::move(S)}
+    , Contents{C}
+  {
+  }
+
+  llvm::ErrorOr<Status> status() override { return Stat; }
+
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> getBuffer(const Twine& Name,
+                                                               uint64_t FileSize,
+                                                               bool RequiresNullTerminator,
+                                                               bool IsVolatile) override
+  {
+    // every file is followed by a NUL within the bundle.
+    return getSharedMemBuffer(Bundle, Contents, RequiresNullTerminator);
+  }
+
+  std::error_code close() override { return std::error_code{}; } // LCOV_EXCL_LINE
+};
+
+/// Iterates the consecutive records of the children of a directory.
+class BundleDirIterator : public u::vfs::detail::DirIterImpl
+{
+  IntrusiveRefCntPtr<BundleFileSystem> FS;
+  unsigned I;
+  unsigned E;
+
+public:
+  BundleDirIterator()
+    : I{0}
+    , E{0}
+  {
+  }
+
+  BundleDirIterator(IntrusiveRefCntPtr<BundleFileSystem> F, unsigned First, unsigned Count)
+    : FS{std::move(F)}
+    , I{First}
+    , E{First + Count}
+  {
+    if (I != E)
+      CurrentEntry = FS->getStatus(I);
+  }
+
+  std::error_code increment() override
+  {
+    ++I;
+    CurrentEntry = I != E ? FS->getStatus(I) : Status();
+    return std::error_code{};
+  }
+};
+
+} // end anonymous namespace
+
+//===-----------------------------------------------------------------------===/
+// ModuleBundleWriter implementation
+//===-----------------------------------------------------------------------===/
+
+void
+ModuleBundleWriter::addFile(llvm::StringRef Path, std::unique_ptr<llvm::MemoryBuffer> Contents, int64_t MTime)
+{
+  std::string Normalized = Path.str();
+  std::replace(Normalized.begin(), Normalized.end(), '\\', '/');
+  if (Normalized.empty() || Normalized.front() != '/')
+  {
+    Normalized.insert(Normalized.begin(), '/');
+  }
+
+  Files.push_back(PendingFile{std::move(Normalized), std::move(Contents), MTime});
+}
+
+std::error_code
+ModuleBundleWriter::addDirectory(llvm::StringRef Root)
+{
+  Root = Root.rtrim("/\\");
+
+  std::error_code EC;
+  for (llvm::sys::fs::recursive_directory_iterator I(Root, EC), E; I != E && !EC; I.increment(EC))
+  {
+    llvm::StringRef Path = I->path();
+
+    llvm::sys::fs::file_status FileStatus;
+    if (llvm::sys::fs::status(Path, FileStatus) || !llvm::sys::fs::is_regular_file(FileStatus))
+    {
+      continue;
+    }
+
+    auto Contents = llvm::MemoryBuffer::getFile(Path);
+    if (!Contents)
+    {
+      return Contents.getError(); // LCOV_EXCL_LINE
+    }
+
+    addFile(Path.substr(Root.size()), std::move(*Contents), ModificationTime(FileStatus, Path));
+  }
+
+  return EC;
+}
+
+std::error_code
+ModuleBundleWriter::writeToFile(llvm::StringRef BundlePath) const
+{
+  // the last file added at a path wins.
+  std::map<std::string, PendingFile const*> ByPath;
+  for (auto& F : Files)
+  {
+    ByPath[F.Path] = &F;
+  }
+
+  // every directory holding a file is implied; it is as new as its newest.
+  std::map<std::string, int64_t> Dirs;
+  for (auto& F : ByPath)
+  {
+    llvm::StringRef Parent = SplitParent(F.first).first;
+    for (; !Parent.empty(); Parent = SplitParent(Parent).first)
+    {
+      auto& MTime = Dirs[Parent.str()];
+      MTime = std::max(MTime, F.second->MTime);
+    }
+  }
+
+  std::vector<std::string> Paths;
+  for (auto& F : ByPath)
+  {
+    if (Dirs.count(F.first))
+    {
+      return std::make_error_code(std::errc::file_exists);
+    }
+
+    Paths.push_back(F.first);
+  }
+
+  for (auto& D : Dirs)
+  {
+    Paths.push_back(D.first);
+  }
+
+  std::sort(Paths.begin(), Paths.end(), ComesBefore);
+
+  // the root comes first; then everything else in order.
+  std::vector<Record> Records(Paths.size() + 1);
+  std::map<llvm::StringRef, unsigned> DirIndex;
+  DirIndex[""] = 0;
+
+  std::string Strings;
+  for (size_t i = 0; i < Paths.size(); ++i)
+  {
+    auto& R = Records[i + 1];
+    std::memset(&R, 0, sizeof(R));
+    R.PathOffset = static_cast<uint32_t>(Strings.size());
+    R.PathLength = static_cast<uint32_t>(Paths[i].size());
+    Strings += Paths[i];
+
+    auto Dir = Dirs.find(Paths[i]);
+    if (Dir != Dirs.end())
+    {
+      R.Kind = RK_Directory;
+      R.MTime = Dir->second;
+      DirIndex[Paths[i]] = static_cast<unsigned>(i + 1);
+    }
+    else
+    {
+      R.Kind = RK_File;
+      R.MTime = ByPath[Paths[i]]->MTime;
+      R.Size = ByPath[Paths[i]]->Contents->getBufferSize();
+    }
+  }
+
+  std::memset(&Records[0], 0, sizeof(Record));
+  Records[0].Kind = RK_Directory;
+
+  // the children of each directory are consecutive.
+  for (size_t i = 0; i < Paths.size(); ++i)
+  {
+    auto& Parent = Records[DirIndex[SplitParent(Paths[i]).first]];
+    if (Parent.Size++ == 0)
+    {
+      Parent.Offset = i + 1;
+    }
+  }
+
+  Header H;
+  std::memset(&H, 0, sizeof(H));
+  H.Magic = Magic;
+  H.Version = Version;
+  H.NumEntries = static_cast<uint32_t>(Records.size());
+  H.Alignment = Alignment;
+  H.StringsOffset = sizeof(Header) + Records.size() * sizeof(Record);
+  H.StringsSize = Strings.size();
+  H.DataOffset = AlignTo(H.StringsOffset + H.StringsSize);
+
+  uint64_t Cursor = H.DataOffset;
+  for (auto& R : Records)
+  {
+    if (R.Kind == RK_File)
+    {
+      R.Offset = Cursor;
+      Cursor = AlignTo(Cursor + R.Size + 1);
+    }
+  }
+
+  // write beside the bundle, then move it into place; readers never see a
+  // partially written bundle.
+  llvm::SmallString<256> TempPath{BundlePath};
+  TempPath += ".tmp";
+
+  {
+    std::error_code EC;
+    llvm::raw_fd_ostream OS(TempPath, EC, llvm::sys::fs::F_None);
+    if (EC)
+    {
+      return EC;
+    }
+
+    static const char Zeros[Alignment] = {};
+
+    OS.write(reinterpret_cast<const char*>(&H), sizeof(H));
+    OS.write(reinterpret_cast<const char*>(Records.data()), Records.size() * sizeof(Record));
+    OS << Strings;
+    OS.write(Zeros, H.DataOffset - H.StringsOffset - H.StringsSize);
+
+    for (size_t i = 0; i < Paths.size(); ++i)
+    {
+      auto& R = Records[i + 1];
+      if (R.Kind == RK_File)
+      {
+        OS << ByPath[Paths[i]]->Contents->getBuffer();
+        OS.write(Zeros, AlignTo(R.Offset + R.Size + 1) - R.Offset - R.Size);
+      }
+    }
+
+    OS.close();
+    if (OS.has_error())
+    {
+      OS.clear_error();                                 // LCOV_EXCL_LINE
+      return std::make_error_code(std::errc::io_error); // LCOV_EXCL_LINE
+    }
+  }
+
+  return llvm::sys::fs::rename(TempPath, BundlePath);
+}
+
+//===-----------------------------------------------------------------------===/
+// BundleFileSystem implementation
+//===-----------------------------------------------------------------------===/
+
+BundleFileSystem::BundleFileSystem(std::shared_ptr<llvm::MemoryBuffer> B)
+  : Bundle{std::move(B)}
+  , WorkingDirectory{"/"}
+  , Serial{getNextVirtualUniqueID().getFile()}
+{
+}
+
+llvm::ErrorOr<IntrusiveRefCntPtr<BundleFileSystem>>
+BundleFileSystem::open(const Twine& BundlePath)
+{
+  auto Buffer = llvm::MemoryBuffer::getFile(BundlePath, -1, /*RequiresNullTerminator=*/false);
+  if (!Buffer)
+  {
+    return Buffer.getError();
+  }
+
+  IntrusiveRefCntPtr<BundleFileSystem> FS{new BundleFileSystem(std::move(*Buffer))};
+  if (!FS->isValid())
+  {
+    LOG(WARNING) << "Ignoring the malformed module bundle " << BundlePath.str();
+    return make_error_code(llvm::errc::invalid_argument);
+  }
+
+  return FS;
+}
+
+bool
+BundleFileSystem::isValid() const
+{
+  auto Bytes = Bundle->getBuffer();
+  if (Bytes.size() < sizeof(Header))
+  {
+    return false;
+  }
+
+  auto H = ReadAt<Header>(Bytes, 0);
+  if (H.Magic != Magic || H.Version != Version || H.NumEntries == 0)
+  {
+    return false;
+  }
+
+  // the sections must follow one another, within the mapping.
+  if (H.StringsOffset != sizeof(Header) + uint64_t(H.NumEntries) * sizeof(Record) ||
+      H.StringsOffset + H.StringsSize > H.DataOffset || H.DataOffset > Bytes.size())
+  {
+    return false;
+  }
+
+  for (unsigned i = 0; i < H.NumEntries; ++i)
+  {
+    auto R = RecordAt(Bytes, i);
+    if (uint64_t(R.PathOffset) + R.PathLength > H.StringsSize)
+    {
+      return false; // LCOV_EXCL_LINE
+    }
+
+    if (R.Kind == RK_Directory)
+    {
+      if (R.Size != 0 && (R.Offset == 0 || R.Offset + R.Size > H.NumEntries))
+      {
+        return false; // LCOV_EXCL_LINE
+      }
+    }
+    else if (R.Kind != RK_File || i == 0 || R.Offset < H.DataOffset || R.Offset + R.Size >= Bytes.size() ||
+             Bytes[R.Offset + R.Size] != '\0')
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+unsigned
+BundleFileSystem::getNumEntries() const
+{
+  return ReadAt<Header>(Bundle->getBuffer(), 0).NumEntries;
+}
+
+llvm::Optional<unsigned>
+BundleFileSystem::lookup(const Twine& Path) const
+{
+  auto Normalized = getNormalizedPath(*this, Path);
+
+  llvm::StringRef Key = llvm::StringRef(Normalized).rtrim('/');
+  if (Key.empty())
+  {
+    return 0u;
+  }
+
+  auto Bytes = Bundle->getBuffer();
+  unsigned Low = 1, High = getNumEntries();
+  while (Low < High)
+  {
+    unsigned Middle = Low + (High - Low) / 2;
+    if (ComesBefore(PathOf(Bytes, RecordAt(Bytes, Middle)), Key))
+    {
+      Low = Middle + 1;
+    }
+    else
+    {
+      High = Middle;
+    }
+  }
+
+  if (Low < getNumEntries() && PathOf(Bytes, RecordAt(Bytes, Low)) == Key)
+  {
+    return Low;
+  }
+
+  return llvm::None;
+}
+
+Status
+BundleFileSystem::getStatus(unsigned Index) const
+{
+  auto Bytes = Bundle->getBuffer();
+  auto R = RecordAt(Bytes, Index);
+  auto IsDirectory = R.Kind == RK_Directory;
+
+  return Status(Index == 0 ? llvm::StringRef("/") : PathOf(Bytes, R),
+                llvm::sys::fs::UniqueID{std::numeric_limits<uint64_t>::max() - 1, (Serial << 32u) | Index},
+                llvm::sys::TimePoint<>(std::chrono::duration_cast<llvm::sys::TimePoint<>::duration>(
+                  std::chrono::nanoseconds(R.MTime))),
+                0,
+                0,
+                IsDirectory ? 0 : R.Size,
+                IsDirectory ? llvm::sys::fs::file_type::directory_file : llvm::sys::fs::file_type::regular_file,
+                IsDirectory ? llvm::sys::fs::perms(llvm::sys::fs::all_read | llvm::sys::fs::all_exe)
+                            : llvm::sys::fs::all_read,
+                "");
+}
+
+llvm::ErrorOr<Status>
+BundleFileSystem::status(const Twine& Path)
+{
+  auto Index = lookup(Path);
+  if (!Index)
+  {
+    return make_error_code(llvm::errc::no_such_file_or_directory);
+  }
+
+  return getStatus(*Index);
+}
+
+llvm::ErrorOr<std::unique_ptr<File>>
+BundleFileSystem::openFileForRead(const Twine& Path)
+{
+  auto Index = lookup(Path);
+  if (!Index)
+  {
+    return make_error_code(llvm::errc::no_such_file_or_directory);
+  }
+
+  auto Bytes = Bundle->getBuffer();
+  auto R = RecordAt(Bytes, *Index);
+  if (R.Kind == RK_Directory)
+  {
+    return make_error_code(llvm::errc::is_a_directory);
+  }
+
+  return std::unique_ptr<File>(new BundleFile(Bundle, getStatus(*Index), Bytes.substr(R.Offset, R.Size)));
+}
+
+directory_iterator
+BundleFileSystem::dir_begin(const Twine& Dir, std::error_code& EC)
+{
+  auto Index = lookup(Dir);
+  if (!Index)
+  {
+    EC = make_error_code(llvm::errc::no_such_file_or_directory);
+    return directory_iterator(std::make_shared<BundleDirIterator>());
+  }
+
+  auto R = RecordAt(Bundle->getBuffer(), *Index);
+  if (R.Kind != RK_Directory)
+  {
+    EC = make_error_code(llvm::errc::not_a_directory);
+    return directory_iterator(std::make_shared<BundleDirIterator>());
+  }
+
+  return directory_iterator(std::make_shared<BundleDirIterator>(
+    this, static_cast<unsigned>(R.Offset), static_cast<unsigned>(R.Size)));
+}
+
+std::error_code
+BundleFileSystem::setCurrentWorkingDirectory(const Twine& Path)
+{
+  llvm::SmallString<128> Normalized;
+  Path.toVector(Normalized);
+
+  if (auto EC = makeAbsolute(Normalized))
+  {
+    return EC; // LCOV_EXCL_LINE
+  }
+
+  llvm::sys::path::remove_dots(Normalized, /*remove_dot_dot=*/true);
+  WorkingDirectory = Normalized.str();
+  return std::error_code{};
+}
@@ -0,0 +1,679 @@
+/**
+ * The U Programming Language
+ *
+ * Copyright 2018 Joseph Benden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * \author Joseph W. Benden
+ * \copyright (C) 2018 Joseph Benden
+ * \license apache2
+ */
+
+#ifdef __clang__
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunused-parameter"
+#pragma clang diagnostic ignored "-Wmacro-redefined"
+#pragma clang diagnostic ignored "-Wshorten-64-to-32"
+#endif
+#undef HAVE_INTTYPES_H
+#undef HAVE_STDINT_H
+#undef HAVE_UINT64_T
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringSet.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/raw_ostream.h>
+#ifdef __clang__
+#pragma clang diagnostic pop
+#endif
+
+#include <glog/logging.h>
+
+#include <u-lang/Basic/ModuleIndex.hpp>
+#include <u-lang/Basic/VirtualFileSystem.hpp>
+#include <u-lang/u.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace u;
+
+namespace
+{
+
+// The serialized form; every integer is in host byte order, which the magic
+// number doubles as a check for.
+//
+//   Header
+//   Entry[NumEntries]
+//   Directory[NumDirs]
+//   uint32_t Buckets[NumBuckets]   - entry index + 1, NumEntries + directory
+//                                    index + 1, or zero if empty
+//   char Strings[StringsSize]      - the root, and every path, unterminated
+
+const uint32_t Magic = 0x58494d55; // "UMIX"
+const uint32_t Version = 2;
+
+struct Header
+{
+  uint32_t Magic;
+  uint32_t Version;
+  uint32_t Layer;
+  uint32_t NumEntries;
+  uint32_t NumDirs;
+  uint32_t NumBuckets;
+  uint32_t RootOffset;
+  uint32_t RootLength;
+  uint32_t EntriesOffset;
+  uint32_t DirsOffset;
+  uint32_t BucketsOffset;
+  uint32_t StringsOffset;
+  uint32_t StringsSize;
+  uint32_t Reserved;
+};
+
+struct EntryRecord
+{
+  uint32_t PathOffset;
+  uint32_t PathLength;
+  uint64_t Size;
+  int64_t MTime;
+  uint8_t Hash[16];
+};
+
+struct DirRecord
+{
+  uint32_t PathOffset;
+  uint32_t PathLength;
+  int64_t MTime;
+};
+
+/// \brief Read a T at \p Offset; the mapping need not be aligned for T.
+template<typename T>
+T
+ReadAt(llvm::StringRef Data, size_t Offset)
+{
+  T Value;
+  std::memcpy(&Value, Data.data() + Offset, sizeof(T));
+  return Value;
+}
+
+/// \brief The FNV-1a hash of \p Key; it is stored on disk, so must not vary
+/// between runs.
+uint32_t
+HashPath(llvm::StringRef Key)
+{
+  uint32_t Hash = 2166136261u;
+  for (auto C : Key)
+  {
+    Hash = (Hash ^ static_cast<uint8_t>(C)) * 16777619u;
+  }
+
+  return Hash;
+}
+
+int64_t
+ModificationTime(llvm::StringRef Path, bool& IsDirectory, uint64_t& Size, std::error_code& EC)
+{
+  llvm::sys::fs::file_status Status;
+  EC = llvm::sys::fs::status(Path, Status);
+  if (EC)
+  {
+    return 0;
+  }
+
+  auto S = vfs::Status::copyWithNewName(Status, Path);
+  IsDirectory = S.isDirectory();
+  Size = S.getSize();
+
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(S.getLastModificationTime().time_since_epoch()).count();
+}
+
+/// \brief A file to be indexed.
+struct PendingEntry
+{
+  std::string Path;
+  uint64_t Size;
+  int64_t MTime;
+  ContentHash Hash;
+};
+
+/// \brief A directory to be indexed, with its modification time.
+typedef std::pair<std::string, int64_t> PendingDir;
+
+/// \brief Index the file at \p Path, known to the index as \p Relative;
+/// its digest is taken from \p Previous should the file be unchanged since.
+llvm::Optional<PendingEntry>
+IndexFile(llvm::StringRef Path, std::string Relative, uint64_t Size, int64_t MTime, ModuleIndex const* Previous)
+{
+  // a file unchanged since it was last indexed need not be read again.
+  auto Known = Previous ? Previous->lookup(Relative) : llvm::None;
+  if (Known && Known->Size == Size && Known->MTime == MTime)
+  {
+    return PendingEntry{std::move(Relative), Size, MTime, Known->Hash};
+  }
+
+  auto Contents = llvm::MemoryBuffer::getFile(Path);
+  if (!Contents)
+  {
+    return llvm::None; // LCOV_EXCL_LINE
+  }
+
+  return PendingEntry{std::move(Relative), Size, MTime, getContentHash((*Contents)->getBuffer())};
+}
+
+/// \brief Lay out the serialized index of \p Root, as held by \p Layer.
+std::string
+Serialize(llvm::StringRef Root,
+          unsigned Layer,
+          std::vector<PendingEntry> const& Entries,
+          std::vector<PendingDir> const& Dirs)
+{
+  uint32_t NumBuckets = 8;
+  while (NumBuckets < (Entries.size() + Dirs.size()) * 2)
+  {
+    NumBuckets <<= 1;
+  }
+
+  Header H;
+  std::memset(&H, 0, sizeof(H));
+  H.Magic = Magic;
+  H.Version = Version;
+  H.Layer = Layer;
+  H.NumEntries = static_cast<uint32_t>(Entries.size());
+  H.NumDirs = static_cast<uint32_t>(Dirs.size());
+  H.NumBuckets = NumBuckets;
+  H.EntriesOffset = sizeof(Header);
+  H.DirsOffset = H.EntriesOffset + H.NumEntries * sizeof(EntryRecord);
+  H.BucketsOffset = H.DirsOffset + H.NumDirs * sizeof(DirRecord);
+  H.StringsOffset = H.BucketsOffset + NumBuckets * sizeof(uint32_t);
+
+  std::string Strings = Root.str();
+  H.RootOffset = 0;
+  H.RootLength = static_cast<uint32_t>(Root.size());
+
+  std::vector<uint32_t> Buckets(NumBuckets, 0);
+  auto Insert = [&](llvm::StringRef Path, uint32_t Slot) {
+    auto Bucket = HashPath(Path) & (NumBuckets - 1);
+    while (Buckets[Bucket] != 0)
+    {
+      Bucket = (Bucket + 1) & (NumBuckets - 1);
+    }
+    Buckets[Bucket] = Slot;
+  };
+
+  std::vector<EntryRecord> EntryRecords;
+  for (auto& P : Entries)
+  {
+    EntryRecord R;
+    R.PathOffset = static_cast<uint32_t>(Strings.size());
+    R.PathLength = static_cast<uint32_t>(P.Path.size());
+    R.Size = P.Size;
+    R.MTime = P.MTime;
+    std::memcpy(R.Hash, P.Hash.data(), sizeof(R.Hash));
+    Strings += P.Path;
+
+    Insert(P.Path, static_cast<uint32_t>(EntryRecords.size()) + 1);
+    EntryRecords.push_back(R);
+  }
+
+  // directories follow the files in the table.
+  std::vector<DirRecord> DirRecords;
+  for (auto& D : Dirs)
+  {
+    DirRecords.push_back(DirRecord{static_cast<uint32_t>(Strings.size()), static_cast<uint32_t>(D.first.size()), D.second});
+    Strings += D.first;
+
+    Insert(D.first, H.NumEntries + static_cast<uint32_t>(DirRecords.size()));
+  }
+
+  H.StringsSize = static_cast<uint32_t>(Strings.size());
+
+  std::string Out;
+  Out.append(reinterpret_cast<const char*>(&H), sizeof(H));
+  Out.append(reinterpret_cast<const char*>(EntryRecords.data()), EntryRecords.size() * sizeof(EntryRecord));
+  Out.append(reinterpret_cast<const char*>(DirRecords.data()), DirRecords.size() * sizeof(DirRecord));
+  Out.append(reinterpret_cast<const char*>(Buckets.data()), Buckets.size() * sizeof(uint32_t));
+  Out.append(Strings);
+
+  return Out;
+}
+
+/// \brief Store \p Index at \p IndexPath, warning should it not be.
+void
+StoreIndex(ModuleIndex const& Index, llvm::StringRef IndexPath)
+{
+  if (auto EC = Index.writeToFile(IndexPath))
+  {
+    LOG(WARNING) << "Unable to store the module index " << IndexPath.str() << ": " << EC.message();
+  }
+}
+
+} // end anonymous namespace
+
+ModuleIndex::ModuleIndex(std::unique_ptr<llvm::MemoryBuffer> D)
+  : Data{std::move(D)}
+{
+}
+
+std::unique_ptr<ModuleIndex>
+ModuleIndex::build(llvm::StringRef Root, unsigned Layer, ModuleIndex const* Previous)
+{
+  Root = Root.rtrim("/\\");
+
+  std::vector<PendingEntry> Entries;
+  std::vector<PendingDir> Dirs;
+
+  bool IsDirectory = false;
+  uint64_t Size = 0;
+  std::error_code EC;
+
+  auto RootTime = ModificationTime(Root, IsDirectory, Size, EC);
+  if (EC || !IsDirectory)
+  {
+    return nullptr;
+  }
+
+  Dirs.emplace_back("", RootTime);
+
+  for (llvm::sys::fs::recursive_directory_iterator I(Root, EC), E; I != E && !EC; I.increment(EC))
+  {
+    llvm::StringRef Path = I->path();
+    auto MTime = ModificationTime(Path, IsDirectory, Size, EC);
+    if (EC)
+    {
+      // the entry vanished while walking; the directory time will tell.
+      EC = std::error_code{}; // LCOV_EXCL_LINE
+      continue;               // LCOV_EXCL_LINE
+    }
+
+    // paths are kept as the virtual file system presents them.
+    std::string Relative = Path.substr(Root.size()).str();
+    std::replace(Relative.begin(), Relative.end(), '\\', '/');
+
+    if (IsDirectory)
+    {
+      Dirs.emplace_back(Relative, MTime);
+      continue;
+    }
+
+    if (auto Entry = IndexFile(Path, std::move(Relative), Size, MTime, Previous))
+    {
+      Entries.push_back(std::move(*Entry));
+    }
+  }
+
+  if (EC)
+  {
+    LOG(WARNING) << "Unable to index " << Root.str() << ": " << EC.message(); // LCOV_EXCL_LINE
+    return nullptr;                                                          // LCOV_EXCL_LINE
+  }
+
+  auto Out = Serialize(Root, Layer, Entries, Dirs);
+  std::unique_ptr<ModuleIndex> Index{new ModuleIndex(llvm::MemoryBuffer::getMemBufferCopy(Out, Root))};
+  return Index;
+}
+
+std::unique_ptr<ModuleIndex>
+ModuleIndex::load(llvm::StringRef IndexPath)
+{
+  auto Buffer = llvm::MemoryBuffer::getFile(IndexPath, -1, /*RequiresNullTerminator=*/false);
+  if (!Buffer)
+  {
+    return nullptr;
+  }
+
+  std::unique_ptr<ModuleIndex> Index{new ModuleIndex(std::move(*Buffer))};
+  if (!Index->isValid())
+  {
+    LOG(WARNING) << "Ignoring the malformed module index " << IndexPath.str();
+    return nullptr;
+  }
+
+  return Index;
+}
+
+std::unique_ptr<ModuleIndex>
+ModuleIndex::loadOrBuild(llvm::StringRef Root, unsigned Layer, llvm::StringRef IndexPath)
+{
+  auto Index = load(IndexPath);
+  if (Index && (Index->getRoot() != Root.rtrim("/\\") || Index->getLayer() != Layer))
+  {
+    Index.reset();
+  }
+  else if (Index && Index->isUpToDate())
+  {
+    return Index;
+  }
+
+  // only files changed since the stored index are read again.
+  return buildAndStore(Root, Layer, IndexPath, Index.get());
+}
+
+std::unique_ptr<ModuleIndex>
+ModuleIndex::rebuild(llvm::StringRef IndexPath) const
+{
+  return buildAndStore(getRoot(), getLayer(), IndexPath, this);
+}
+
+std::unique_ptr<ModuleIndex>
+ModuleIndex::buildAndStore(llvm::StringRef Root, unsigned Layer, llvm::StringRef IndexPath, ModuleIndex const* Previous)
+{
+  VLOG(1) << "Indexing the modules beneath " << Root.str();
+
+  auto Index = build(Root, Layer, Previous);
+  if (Index)
+  {
+    StoreIndex(*Index, IndexPath);
+  }
+
+  return Index;
+}
+
+std::unique_ptr<ModuleIndex>
+ModuleIndex::update(llvm::ArrayRef<std::string> Paths, llvm::StringRef IndexPath) const
+{
+  auto Bytes = Data->getBuffer();
+  auto H = ReadAt<Header>(Bytes, 0);
+  auto Strings = Bytes.substr(H.StringsOffset, H.StringsSize);
+  auto Root = getRoot();
+
+  // the entries to read again, and the directories whose time they changed.
+  llvm::StringSet<> Changed;
+  llvm::StringSet<> Parents;
+  for (auto& Path : Paths)
+  {
+    // what lies beneath a directory, old or new, only a walk can tell.
+    auto Parent = llvm::StringRef(Path).rsplit('/').first;
+    if (find(Path) > H.NumEntries || find(Parent) <= H.NumEntries)
+    {
+      return nullptr;
+    }
+
+    Changed.insert(Path);
+    Parents.insert(Parent);
+  }
+
+  bool IsDirectory = false;
+  uint64_t Size = 0;
+  std::error_code EC;
+
+  std::vector<PendingEntry> Entries;
+  Entries.reserve(H.NumEntries + Changed.size());
+  for (uint32_t i = 0; i < H.NumEntries; ++i)
+  {
+    auto R = ReadAt<EntryRecord>(Bytes, H.EntriesOffset + i * sizeof(EntryRecord));
+    auto Path = Strings.substr(R.PathOffset, R.PathLength);
+    if (Changed.count(Path))
+    {
+      continue;
+    }
+
+    ContentHash Hash;
+    std::memcpy(Hash.data(), R.Hash, sizeof(R.Hash));
+    Entries.push_back(PendingEntry{Path.str(), R.Size, R.MTime, Hash});
+  }
+
+  std::vector<PendingDir> Dirs;
+  Dirs.reserve(H.NumDirs);
+  for (uint32_t i = 0; i < H.NumDirs; ++i)
+  {
+    auto D = ReadAt<DirRecord>(Bytes, H.DirsOffset + i * sizeof(DirRecord));
+    auto Path = Strings.substr(D.PathOffset, D.PathLength);
+    auto MTime = D.MTime;
+    if (Parents.count(Path))
+    {
+      MTime = ModificationTime(Root.str() + Path.str(), IsDirectory, Size, EC);
+      if (EC || !IsDirectory)
+      {
+        return nullptr;
+      }
+    }
+
+    Dirs.emplace_back(Path.str(), MTime);
+  }
+
+  for (auto& Entry : Changed)
+  {
+    auto Path = Root.str() + Entry.getKey().str();
+    auto MTime = ModificationTime(Path, IsDirectory, Size, EC);
+    if (EC)
+    {
+      // a file removed is simply no longer indexed.
+      EC = std::error_code{};
+      continue;
+    }
+
+    if (IsDirectory)
+    {
+      return nullptr;
+    }
+
+    if (auto Pending = IndexFile(Path, Entry.getKey().str(), Size, MTime, this))
+    {
+      Entries.push_back(std::move(*Pending));
+    }
+  }
+
+  auto Out = Serialize(Root, getLayer(), Entries, Dirs);
+  std::unique_ptr<ModuleIndex> Index{new ModuleIndex(llvm::MemoryBuffer::getMemBufferCopy(Out, Root))};
+  StoreIndex(*Index, IndexPath);
+
+  return Index;
+}
+
+std::error_code
+ModuleIndex::writeToFile(llvm::StringRef IndexPath) const
+{
+  // write beside the index, then move it into place; readers never see a
+  // partially written index.
+  llvm::SmallString<256> TempPath{IndexPath};
+  TempPath += ".tmp";
+
+  {
+    std::error_code EC;
+    llvm::raw_fd_ostream OS(TempPath, EC, llvm::sys::fs::F_None);
+    if (EC)
+    {
+      return EC;
+    }
+
+    OS << Data->getBuffer();
+    OS.close();
+    if (OS.has_error())
+    {
+      OS.clear_error();                                       // LCOV_EXCL_LINE
+      return std::make_error_code(std::errc::io_error);       // LCOV_EXCL_LINE
+    }
+  }
+
+  return llvm::sys::fs::rename(TempPath, IndexPath);
+}
+
+bool
+ModuleIndex::isValid() const
+{
+  auto Bytes = Data->getBuffer();
+  if (Bytes.size() < sizeof(Header))
+  {
+    return false;
+  }
+
+  auto H = ReadAt<Header>(Bytes, 0);
+  if (H.Magic != Magic || H.Version != Version)
+  {
+    return false;
+  }
+
+  // the sections must follow one another, within the mapping.
+  uint64_t Expected = sizeof(Header);
+  if (H.EntriesOffset != Expected)
+  {
+    return false;
+  }
+
+  Expected += uint64_t(H.NumEntries) * sizeof(EntryRecord);
+  if (H.DirsOffset != Expected)
+  {
+    return false;
+  }
+
+  Expected += uint64_t(H.NumDirs) * sizeof(DirRecord);
+  if (H.BucketsOffset != Expected)
+  {
+    return false;
+  }
+
+  Expected += uint64_t(H.NumBuckets) * sizeof(uint32_t);
+  if (H.StringsOffset != Expected || Expected + H.StringsSize != Bytes.size())
+  {
+    return false;
+  }
+
+  // the table must have room to spare, and be a power of two in size.
+  return H.NumBuckets > uint64_t(H.NumEntries) + H.NumDirs && (H.NumBuckets & (H.NumBuckets - 1)) == 0 &&
+    uint64_t(H.RootOffset) + H.RootLength <= H.StringsSize;
+}
+
+bool
+ModuleIndex::isUpToDate() const
+{
+  auto Bytes = Data->getBuffer();
+  auto H = ReadAt<Header>(Bytes, 0);
+  auto Strings = Bytes.substr(H.StringsOffset, H.StringsSize);
+  auto Root = getRoot();
+
+  for (uint32_t i = 0; i < H.NumDirs; ++i)
+  {
+    auto D = ReadAt<DirRecord>(Bytes, H.DirsOffset + i * sizeof(DirRecord));
+
+    bool IsDirectory = false;
+    uint64_t Size = 0;
+    std::error_code EC;
+    auto MTime = ModificationTime(Root.str() + Strings.substr(D.PathOffset, D.PathLength).str(), IsDirectory, Size, EC);
+    if (EC || !IsDirectory || MTime != D.MTime)
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool
+ModuleIndex::isCurrent(llvm::StringRef Path, Entry const& Known) const
+{
+  bool IsDirectory = false;
+  uint64_t Size = 0;
+  std::error_code EC;
+  auto MTime = ModificationTime(getRoot().str() + Path.str(), IsDirectory, Size, EC);
+
+  return !EC && !IsDirectory && MTime == Known.MTime && Size == Known.Size;
+}
+
+uint32_t
+ModuleIndex::find(llvm::StringRef Path) const
+{
+  auto Bytes = Data->getBuffer();
+  auto H = ReadAt<Header>(Bytes, 0);
+  auto Strings = Bytes.substr(H.StringsOffset, H.StringsSize);
+
+  auto Bucket = HashPath(Path) & (H.NumBuckets - 1);
+  for (uint32_t Probes = 0; Probes < H.NumBuckets; ++Probes)
+  {
+    auto Slot = ReadAt<uint32_t>(Bytes, H.BucketsOffset + Bucket * sizeof(uint32_t));
+    if (Slot == 0 || Slot > uint64_t(H.NumEntries) + H.NumDirs)
+    {
+      break;
+    }
+
+    uint32_t PathOffset;
+    uint32_t PathLength;
+    if (Slot <= H.NumEntries)
+    {
+      auto R = ReadAt<EntryRecord>(Bytes, H.EntriesOffset + (Slot - 1) * sizeof(EntryRecord));
+      PathOffset = R.PathOffset;
+      PathLength = R.PathLength;
+    }
+    else
+    {
+      auto D = ReadAt<DirRecord>(Bytes, H.DirsOffset + (Slot - H.NumEntries - 1) * sizeof(DirRecord));
+      PathOffset = D.PathOffset;
+      PathLength = D.PathLength;
+    }
+
+    if (uint64_t(PathOffset) + PathLength <= Strings.size() && Strings.substr(PathOffset, PathLength) == Path)
+    {
+      return Slot;
+    }
+
+    Bucket = (Bucket + 1) & (H.NumBuckets - 1);
+  }
+
+  return 0;
+}
+
+llvm::Optional<ModuleIndex::Entry>
+ModuleIndex::lookup(llvm::StringRef Path) const
+{
+  auto Bytes = Data->getBuffer();
+  auto H = ReadAt<Header>(Bytes, 0);
+
+  auto Slot = find(Path);
+  if (Slot == 0 || Slot > H.NumEntries)
+  {
+    return llvm::None;
+  }
+
+  auto R = ReadAt<EntryRecord>(Bytes, H.EntriesOffset + (Slot - 1) * sizeof(EntryRecord));
+
+  Entry Result;
+  Result.Layer = H.Layer;
+  Result.Size = R.Size;
+  Result.MTime = R.MTime;
+  std::memcpy(Result.Hash.data(), R.Hash, sizeof(R.Hash));
+
+  return Result;
+}
+
+bool
+ModuleIndex::contains(llvm::StringRef Path) const
+{
+  return find(Path) != 0;
+}
+
+llvm::StringRef
+ModuleIndex::getRoot() const
+{
+  auto Bytes = Data->getBuffer();
+  auto H = ReadAt<Header>(Bytes, 0);
+
+  return Bytes.substr(H.StringsOffset, H.StringsSize).substr(H.RootOffset, H.RootLength);
+}
+
+unsigned
+ModuleIndex::getLayer() const
+{
+  return ReadAt<Header>(Data->getBuffer(), 0).Layer;
+}
+
+unsigned
+ModuleIndex::getNumEntries() const
+{
+  return ReadAt<Header>(Data->getBuffer(), 0).NumEntries;
+}
@@ -29,6 +29,7 @@
 #include <llvm/ADT/SmallVector.h>
 #include <llvm/ADT/Twine.h>
 #include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
 #include <llvm/Support/Path.h>
 
 #ifdef __clang__
@@ -43,156 +44,115 @@
 
 using namespace u;
 
-FileSource::FileSource(std::string const& fileName)
-  : Source()
-  , fileName_{fileName}
-  , first_{true}
+Source::Source()
+  : start_{nullptr}
+  , cur_{nullptr}
+  , end_{nullptr}
+  , offset_{0}
   , hasBOM_{false}
-  , stream_{fileName, std::ios::in}
-  , it_{stream_.rdbuf()}
-  , position_{1, 0}
-  , gotNewLine_{false}
   , foundFF_{false}
   , foundNL_{false}
+  , invalid_{false}
 {
-  VLOG(1) << "Reading from " << fileName_;
+}
 
-  llvm::SmallVector<char, 0> theFileName;
-  llvm::Twine f{fileName};
+void
+Source::setBuffer(std::shared_ptr<const llvm::MemoryBuffer> Buffer)
+{
+  buffer_ = std::move(Buffer);
+  if (!buffer_)
+  {
+    return;
+  }
 
-  f.toVector(theFileName);
+  start_ = cur_ = buffer_->getBufferStart();
+  end_ = buffer_->getBufferEnd();
 
-  // Is the fileName path absolute?
-  if (!llvm::sys::path::is_absolute(theFileName))
+  if (utf8::starts_with_bom(cur_, end_))
   {
-    llvm::sys::fs::make_absolute(theFileName);
+    cur_ += sizeof(utf8::bom);
+    hasBOM_ = true;
   }
+}
 
-  std::string fn;
-  std::copy(theFileName.begin(), theFileName.end(), std::back_inserter(fn));
-  fileName_ = llvm::sys::path::filename(fn).str();
+std::string const&
+Source::getVirtualPath() const
+{
+  static const std::string None;
 
-  llvm::sys::path::remove_filename(theFileName);
-  std::copy(theFileName.begin(), theFileName.end(), std::back_inserter(filePath_));
+  return None;
 }
 
 uint32_t
-FileSource::Get()
+Source::Get()
 {
-  if (first_)
-  {
-    if (utf8::starts_with_bom(it_, end_))
-    {
-      ++it_;
-      hasBOM_ = true;
-    }
-    else
-    {
-      stream_.unget();
-    }
-
-    first_ = false;
-  }
-
-  // process previous new-line
-  if (gotNewLine_)
+  if (cur_ == end_)
   {
-    position_.setColumn(0);
-    position_.incrementLineNumber();
-
-    gotNewLine_ = false;
+    return 0; // LCOV_EXCL_LINE
   }
 
-  uint32_t ch = utf8::next(it_, end_);
-
-  // increment column
-  position_.incrementColumn();
+  offset_ = getReadOffset();
+  uint32_t ch = DecodeUTF8(cur_, end_, invalid_);
 
-  while (ch == '\r') // LCOV_EXCL_BR_LINE
+  while (ch == '\r' && cur_ != end_)
   {
-    foundFF_ = true; // LCOV_EXCL_LINE
+    foundFF_ = true;
 
-    ch = utf8::next(it_, end_); // LCOV_EXCL_LINE
+    offset_ = getReadOffset();
+    ch = DecodeUTF8(cur_, end_, invalid_);
   }
 
-  // if NL, then reset column and increment line number.
   if (ch == '\n')
   {
     foundNL_ = true;
-
-    gotNewLine_ = true;
   }
 
   return ch;
 }
 
-uint32_t
-StringSource::Get()
+FileSource::FileSource(std::string const& fileName)
+  : Source()
+  , fileName_{fileName}
 {
-  if (first_)
-  {
-    if (utf8::starts_with_bom(it_, end_))
-    {
-      ++it_;
-      hasBOM_ = true;
-    }
-    else
-    {
-      stream_.unget();
-    }
-
-    first_ = false;
-  }
-
-  // process previous new-line
-  if (gotNewLine_)
-  {
-    position_.setColumn(0);
-    position_.incrementLineNumber();
-
-    gotNewLine_ = false;
-  }
+  VLOG(1) << "Reading from " << fileName_;
 
-  uint32_t ch = utf8::next(it_, end_);
+  llvm::SmallVector<char, 0> theFileName;
+  llvm::Twine f{fileName};
 
-  // increment column
-  position_.incrementColumn();
+  f.toVector(theFileName);
 
-  while (ch == '\r')
+  // Is the fileName path absolute?
+  if (!llvm::sys::path::is_absolute(theFileName))
   {
-    foundFF_ = true;
-
-    ch = utf8::next(it_, end_);
+    llvm::sys::fs::make_absolute(theFileName);
   }
 
-  // if NL, then reset column and increment line number.
-  if (ch == '\n')
+  auto Buffer = llvm::MemoryBuffer::getFile(theFileName);
+  if (Buffer)
   {
-    foundNL_ = true;
-
-    gotNewLine_ = true;
+    setBuffer(std::move(*Buffer));
   }
 
-  return ch;
+  std::string fn;
+  std::copy(theFileName.begin(), theFileName.end(), std::back_inserter(fn));
+  fileName_ = llvm::sys::path::filename(fn).str();
+
+  llvm::sys::path::remove_filename(theFileName);
+  std::copy(theFileName.begin(), theFileName.end(), std::back_inserter(filePath_));
 }
 
 MemoryBufferSource::MemoryBufferSource(llvm::sys::fs::UniqueID ID,
                                        llvm::StringRef Path,
-                                       std::unique_ptr<llvm::MemoryBuffer> Buf)
+                                       std::shared_ptr<const llvm::MemoryBuffer> Buf,
+                                       llvm::StringRef VirtualPath)
   : Source()
   , id_{ID}
-  , source_{std::move(Buf)}
-  , hasBOM_{false}
-  , stream_{reinterpret_cast<const uint8_t*>(source_->getBufferStart()), source_->getBufferSize()}
-  , it_{stream_.rdbuf()}
-  , first_{true}
-  , position_{1, 0}
-  , gotNewLine_{false}
-  , foundFF_{false}
-  , foundNL_{false}
+  , virtualPath_{VirtualPath.str()}
 {
   VLOG(1) << "Reading from " << Path.str();
 
+  setBuffer(std::move(Buf));
+
   llvm::SmallVector<char, 0> theFileName;
   llvm::Twine f{Path};
 
@@ -205,53 +165,3 @@ MemoryBufferSource::MemoryBufferSource(llvm::sys::fs::UniqueID ID,
   llvm::sys::path::remove_filename(theFileName);
   std::copy(theFileName.begin(), theFileName.end(), std::back_inserter(filePath_));
 }
-
-uint32_t
-MemoryBufferSource::Get()
-{
-  if (first_)
-  {
-    if (utf8::starts_with_bom(it_, end_))
-    {
-      ++it_;
-      hasBOM_ = true;
-    }
-    else
-    {
-      stream_.unget();
-    }
-
-    first_ = false;
-  }
-
-  // process previous new-line
-  if (gotNewLine_)
-  {
-    position_.setColumn(0);
-    position_.incrementLineNumber();
-
-    gotNewLine_ = false;
-  }
-
-  uint32_t ch = utf8::next(it_, end_);
-
-  // increment column
-  position_.incrementColumn();
-
-  while (ch == '\r') // LCOV_EXCL_BR_LINE
-  {
-    foundFF_ = true; // LCOV_EXCL_LINE
-
-    ch = utf8::next(it_, end_); // LCOV_EXCL_LINE
-  }
-
-  // if NL, then reset column and increment line number.
-  if (ch == '\n')
-  {
-    foundNL_ = true;
-
-    gotNewLine_ = true;
-  }
-
-  return ch;
-}
\ No newline at end of file
@@ -20,72 +20,755 @@
  * \license apache2
  */
 
+#ifdef __clang__
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunused-parameter"
+#pragma clang diagnostic ignored "-Wmacro-redefined"
+#pragma clang diagnostic ignored "-Wshorten-64-to-32"
+#endif
+#undef HAVE_INTTYPES_H
+#undef HAVE_STDINT_H
+#undef HAVE_UINT64_T
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/Locale.h>
+#include <llvm/Support/Path.h>
+#ifdef __clang__
+#pragma clang diagnostic pop
+#endif
+
+#include <glog/logging.h>
+
 #include <u-lang/Basic/SourceManager.hpp>
 #include <u-lang/u.hpp>
 
+#include <algorithm>
+#include <limits>
 #include <string>
-
-#include <utf8.h>
+#include <utility>
 
 using namespace u;
 
-std::string
-FileInfo::getLine(unsigned Num)
+FileInfo::FileInfo(llvm::sys::fs::UniqueID ID, // NOLINT
+                   std::string const& FN,
+                   std::string const& FP,
+                   std::shared_ptr<const llvm::MemoryBuffer> Buf,
+                   uint32_t Start,
+                   std::string const& VP,
+                   SourceManager* Owner)
+  : ID{ID}
+  , FileName{FN}
+  , FilePath{FP}
+  , VirtualPath{VP}
+  , StartOffset{Start}
+  , Size{Buf ? static_cast<uint32_t>(Buf->getBufferSize()) : 0u}
+  , Hash{}
+  , Owner{Owner}
+  , PinCount{0}
+  , Stale{false}
+  , LastUse{0}
+{
+  if (!Buf)
+  {
+    return;
+  }
+
+  // only contents which may be read again need verifying once they are.
+  if (!VirtualPath.empty())
+  {
+    Hash = getContentHash(Buf->getBuffer());
+  }
+
+  auto C = std::make_shared<Contents>();
+  C->Buffer = std::move(Buf);
+  Data = std::move(C);
+}
+
+FileInfo::ContentsRef
+FileInfo::getContents() const
 {
-  assert(Num - 1 < Lines.size() && "Requested index is out of bounds!");
+  auto C = std::atomic_load(&Data);
+  if (!C && Owner && !VirtualPath.empty() && !Stale.load())
+  {
+    C = Owner->materialize(*this);
+  }
+
+  if (!C)
+  {
+    // unreadable contents present as a single, empty line.
+    static const ContentsRef Empty = std::make_shared<Contents>(Contents{nullptr, {0u}});
+    return Empty;
+  }
 
-  auto Line = Lines[Num - 1];
+  if (Owner)
+  {
+    Owner->touch(*this);
+  }
+
+  if (!C->LineOffsets.empty())
+  {
+    return C;
+  }
+
+  // a file of identical contents may have built the table already.
+  if (Owner)
+  {
+    auto Shared = Owner->shareContents(C);
+    if (Shared != C && !Shared->LineOffsets.empty())
+    {
+      auto Bytes = Shared->LineOffsets.capacity() * sizeof(uint32_t);
+      Owner->ResidentBytes += Bytes;
+      if (!std::atomic_compare_exchange_strong(&Data, &C, Shared))
+      {
+        Owner->ResidentBytes -= Bytes; // LCOV_EXCL_LINE
+      }
+
+      return Shared;
+    }
+  }
 
-  std::string Result{};
-  utf8::utf32to8(Line.begin(), Line.end(), std::back_inserter(Result));
+  auto Text = C->getText();
+  auto Lines = std::make_shared<Contents>();
+  Lines->Buffer = C->Buffer;
+
+  // the first line begins after any byte order mark.
+  Lines->LineOffsets.push_back(Text.startswith("\xef\xbb\xbf") ? 3u : 0u);
+
+  for (auto Pos = Text.find('\n'); Pos != llvm::StringRef::npos; Pos = Text.find('\n', Pos + 1))
+  {
+    Lines->LineOffsets.push_back(static_cast<uint32_t>(Pos + 1));
+  }
+
+  // publish the table, unless another thread or an eviction came first; the
+  // table is then merely used this once. It is accounted for beforehand, so
+  // that a racing eviction never subtracts more than was added.
+  auto Bytes = Lines->LineOffsets.capacity() * sizeof(uint32_t);
+  if (Owner)
+  {
+    Owner->ResidentBytes += Bytes;
+  }
+
+  ContentsRef Result = Lines;
+  if (!std::atomic_compare_exchange_strong(&Data, &C, Result) && Owner)
+  {
+    Owner->ResidentBytes -= Bytes;
+  }
+  else if (Owner)
+  {
+    Owner->shareContents(Result);
+  }
 
   return Result;
 }
 
-void
-FileInfo::AddCharacter(uint64_t LineNum, uint32_t Char)
+llvm::StringRef
+FileInfo::getLine(unsigned Num) const
+{
+  auto C = getContents();
+  auto& Offsets = C->LineOffsets;
+  assert(Num - 1 < Offsets.size() && "Requested index is out of bounds!");
+
+  auto Text = C->getText();
+  auto End = Num < Offsets.size() ? Offsets[Num] : static_cast<uint32_t>(Text.size());
+
+  return Text.slice(Offsets[Num - 1], End).rtrim("\r\n");
+}
+
+/// \brief Return the one-based line number containing \p Offset.
+static unsigned
+LineNumberIn(std::vector<uint32_t> const& Offsets, uint32_t Offset)
 {
-  while (Lines.size() < LineNum)
+  // find the first line beginning after Offset; the line before holds it.
+  auto It = std::upper_bound(Offsets.begin(), Offsets.end(), Offset);
+
+  return It == Offsets.begin() ? 1u : static_cast<unsigned>(It - Offsets.begin());
+}
+
+unsigned
+FileInfo::getLineNumber(uint32_t Offset) const
+{
+  return LineNumberIn(getContents()->LineOffsets, Offset);
+}
+
+unsigned
+FileInfo::getColumnNumber(uint32_t Offset) const
+{
+  auto C = getContents();
+  auto LineStart = C->LineOffsets[LineNumberIn(C->LineOffsets, Offset) - 1];
+
+  return Offset < LineStart ? 1u : Offset - LineStart + 1;
+}
+
+llvm::StringRef
+FileInfo::getLinePrefix(Contents const& C, uint32_t Offset)
+{
+  auto LineStart = C.LineOffsets[LineNumberIn(C.LineOffsets, Offset) - 1];
+
+  return C.getText().slice(LineStart, std::max(LineStart, Offset));
+}
+
+unsigned
+FileInfo::getCharacterColumn(uint32_t Offset) const
+{
+  auto C = getContents();
+  auto Prefix = getLinePrefix(*C, Offset);
+
+  unsigned Column = 1;
+  bool Invalid;
+  for (auto It = Prefix.begin(); It != Prefix.end(); ++Column)
   {
-    // The line number does not exist, so we need to create it first.
-    Lines.emplace_back(std::vector<uint32_t>());
+    (void) DecodeUTF8(It, Prefix.end(), Invalid);
   }
 
-  Lines[LineNum - 1].push_back(Char);
+  return Column;
+}
+
+unsigned
+FileInfo::getDisplayColumn(uint32_t Offset) const
+{
+  auto C = getContents();
+  auto Prefix = getLinePrefix(*C, Offset);
+
+  unsigned Column = 1;
+  bool Invalid;
+  for (auto It = Prefix.begin(); It != Prefix.end();)
+  {
+    auto Start = It;
+    (void) DecodeUTF8(It, Prefix.end(), Invalid);
+
+    // control characters and malformed input occupy a single column.
+    int Width = Invalid ? 1 : llvm::sys::locale::columnWidth(llvm::StringRef(Start, It - Start));
+    Column += Width < 0 ? 1u : static_cast<unsigned>(Width);
+  }
+
+  return Column;
+}
+
+namespace
+{
+
+/// Return \p Path made absolute against \p WorkingDirectory, with any "."
+/// and ".." components removed.
+std::string
+NormalizePath(llvm::StringRef Path, llvm::StringRef WorkingDirectory)
+{
+  llvm::SmallString<256> Normalized;
+  if (!llvm::sys::path::is_absolute(Path))
+  {
+    Normalized = WorkingDirectory;
+  }
+
+  llvm::sys::path::append(Normalized, Path);
+  llvm::sys::path::remove_dots(Normalized, /*remove_dot_dot=*/true);
+
+  return Normalized.str().str();
+}
+
+} // namespace
+
+FileID
+SourceManager::createFileID(Source const& S)
+{
+  return createFileID(S.getUniqueID(), S.getFileName(), S.getFilePath(), S.getBuffer(), S.getVirtualPath());
+}
+
+FileID
+SourceManager::createFileID(llvm::sys::fs::UniqueID id,
+                            std::string const& file,
+                            std::string const& path,
+                            std::shared_ptr<const llvm::MemoryBuffer> Buffer,
+                            std::string const& VirtualPath)
+{
+  // build and hash the entry before taking the lock; its slab comes after.
+  std::unique_ptr<FileInfo> Entry{new FileInfo(id, file, path, std::move(Buffer), 0, VirtualPath, this)};
+  auto Size = Entry->getSize();
+  auto& FI = *Entry;
+
+  // files read with identical contents share them, and their line table.
+  if (FI.Data)
+  {
+    FI.Data = shareContents(FI.Data);
+  }
+
+  unsigned Index;
+  {
+    std::lock_guard<std::mutex> Lock(RegistrationMutex);
+
+    Index = NumFiles.load(std::memory_order_relaxed);
+
+    // one extra location is reserved for the end-of-file position.
+    if (Size >= std::numeric_limits<uint32_t>::max() - NextLocalOffset || Index >= MaxChunks * ChunkSize)
+    {
+      LOG(ERROR) << "Ran out of source locations while registering " << file; // LCOV_EXCL_LINE
+      return FileID();                                                            // LCOV_EXCL_LINE
+    }
+
+    auto& Chunk = FileTable[Index >> ChunkBits];
+    if (!Chunk)
+    {
+      Chunk.reset(new FileChunk);
+    }
+
+    FI.StartOffset = NextLocalOffset;
+    NextLocalOffset += Size + 1;
+
+    Chunk->Entries[Index & (ChunkSize - 1)] = std::move(Entry);
+    NumFiles.store(Index + 1, std::memory_order_release);
+  }
+
+  if (!VirtualPath.empty())
+  {
+    auto Key = normalizeVirtualPath(VirtualPath);
+
+    std::lock_guard<std::mutex> Lock(ChangedFilesMutex);
+    FilesByPath[Key].push_back(FileID::get(Index + 1));
+  }
+
+  if (FI.isResident())
+  {
+    ResidentBytes += Size;
+    touch(FI);
+
+    enforceMemoryBudget(&FI);
+  }
+
+  return FileID::get(Index + 1);
+}
+
+SourceLocation
+SourceManager::getLocForStartOfFile(FileID FID) const
+{
+  if (FID.isInvalid() || FID.ID > NumFiles.load(std::memory_order_acquire))
+  {
+    return SourceLocation();
+  }
+
+  return SourceLocation::getFileLoc(getEntry(FID.ID - 1).StartOffset);
+}
+
+FileID
+SourceManager::getFileID(SourceLocation Loc) const
+{
+  if (Loc.isInvalid())
+  {
+    return FileID();
+  }
+
+  auto Offset = Loc.getOffset();
+  auto Count = NumFiles.load(std::memory_order_acquire);
+
+  // most lookups hit the same file as the one before.
+  auto Hint = LastFileIDLookup.load(std::memory_order_relaxed);
+  if (Hint != 0 && Hint <= Count)
+  {
+    auto& Entry = getEntry(Hint - 1);
+    if (Offset >= Entry.StartOffset && Offset - Entry.StartOffset <= Entry.getSize())
+    {
+      return FileID::get(Hint);
+    }
+  }
+
+  // find the first file starting after Offset; the file before holds it.
+  unsigned Low = 0;
+  unsigned High = Count;
+  while (Low < High)
+  {
+    auto Mid = Low + (High - Low) / 2;
+    if (Offset < getEntry(Mid).StartOffset)
+    {
+      High = Mid;
+    }
+    else
+    {
+      Low = Mid + 1;
+    }
+  }
+
+  if (Low == 0)
+  {
+    return FileID(); // LCOV_EXCL_LINE
+  }
+
+  auto& Entry = getEntry(Low - 1);
+  if (Offset - Entry.StartOffset > Entry.getSize())
+  {
+    return FileID(); // LCOV_EXCL_LINE
+  }
+
+  LastFileIDLookup.store(Low, std::memory_order_relaxed);
+  return FileID::get(Low);
 }
 
 FileInfo&
-SourceManager::getOrInsertFileInfo(llvm::sys::fs::UniqueID id, std::string file, std::string path)
+SourceManager::getFileInfo(FileID FID)
+{
+  assert(FID.isValid() && FID.ID <= NumFiles.load() && "Invalid FileID!");
+
+  return getEntry(FID.ID - 1);
+}
+
+FileInfo const&
+SourceManager::getFileInfo(FileID FID) const
+{
+  assert(FID.isValid() && FID.ID <= NumFiles.load() && "Invalid FileID!");
+
+  return getEntry(FID.ID - 1);
+}
+
+uint32_t
+SourceManager::getFileOffset(SourceLocation Loc) const
+{
+  auto FID = getFileID(Loc);
+  if (FID.isInvalid())
+  {
+    return 0;
+  }
+
+  return Loc.getOffset() - getEntry(FID.ID - 1).StartOffset;
+}
+
+unsigned
+SourceManager::getLineNumber(SourceLocation Loc) const
+{
+  auto FID = getFileID(Loc);
+  if (FID.isInvalid())
+  {
+    return 0;
+  }
+
+  auto& FI = getEntry(FID.ID - 1);
+  return FI.getLineNumber(Loc.getOffset() - FI.StartOffset);
+}
+
+unsigned
+SourceManager::getColumnNumber(SourceLocation Loc) const
 {
-  auto Entry = FileTable.find(std::make_tuple(id, file, path));
+  auto FID = getFileID(Loc);
+  if (FID.isInvalid())
+  {
+    return 0;
+  }
+
+  auto& FI = getEntry(FID.ID - 1);
+  return FI.getColumnNumber(Loc.getOffset() - FI.StartOffset);
+}
 
-  if (Entry != FileTable.end())
+unsigned
+SourceManager::getCharacterColumn(SourceLocation Loc) const
+{
+  auto FID = getFileID(Loc);
+  if (FID.isInvalid())
   {
-    return Entry->second;
+    return 0;
   }
-  else
+
+  auto& FI = getEntry(FID.ID - 1);
+  return FI.getCharacterColumn(Loc.getOffset() - FI.StartOffset);
+}
+
+unsigned
+SourceManager::getDisplayColumn(SourceLocation Loc) const
+{
+  auto FID = getFileID(Loc);
+  if (FID.isInvalid())
   {
-    auto Result = FileTable.insert(std::make_pair(std::make_tuple(id, file, path), FileInfo{id, file, path}));
+    return 0;
+  }
 
-    return Result.first->second;
+  auto& FI = getEntry(FID.ID - 1);
+  return FI.getDisplayColumn(Loc.getOffset() - FI.StartOffset);
+}
+
+PresumedLoc
+SourceManager::getPresumedLoc(SourceLocation Loc) const
+{
+  auto FID = getFileID(Loc);
+  if (FID.isInvalid())
+  {
+    return PresumedLoc();
   }
+
+  auto& FI = getEntry(FID.ID - 1);
+  auto Offset = Loc.getOffset() - FI.StartOffset;
+
+  // decode against a single snapshot of the line table.
+  auto C = FI.getContents();
+  auto Line = LineNumberIn(C->LineOffsets, Offset);
+  auto LineStart = C->LineOffsets[Line - 1];
+
+  return PresumedLoc(FI.getUniqueID(),
+                     FI.getFileName(),
+                     FI.getFilePath(),
+                     Line,
+                     Offset < LineStart ? 1u : Offset - LineStart + 1);
+}
+
+void
+SourceManager::setMemoryBudget(size_t Bytes)
+{
+  MemoryBudget = Bytes;
+
+  enforceMemoryBudget();
+}
+
+void
+SourceManager::pinFile(FileID FID)
+{
+  ++getFileInfo(FID).PinCount;
 }
 
+void
+SourceManager::unpinFile(FileID FID)
+{
+  auto& FI = getFileInfo(FID);
+  assert(FI.PinCount.load() > 0 && "Unbalanced unpinFile!");
+
+  if (--FI.PinCount == 0)
+  {
+    enforceMemoryBudget();
+  }
+}
+
+void
+SourceManager::touch(FileInfo const& FI)
+{
+  FI.LastUse.store(UseClock.fetch_add(1, std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+FileInfo::ContentsRef
+SourceManager::materialize(FileInfo const& FI)
+{
+  FileInfo::ContentsRef Result;
+  {
+    std::lock_guard<std::mutex> Lock(FileManagerMutex);
+
+    // another thread may have read the contents while we waited.
+    Result = std::atomic_load(&FI.Data);
+    if (Result || FI.Stale.load())
+    {
+      return Result;
+    }
+
+    VLOG(1) << "Reading " << FI.VirtualPath << " again after eviction";
+
+    auto File = FM->openFileForRead(FI.VirtualPath);
+    if (File)
+    {
+      auto Content = (*File)->getBuffer(FI.VirtualPath, FI.Size);
+      if (Content && (*Content)->getBufferSize() == FI.Size && getContentHash((*Content)->getBuffer()) == FI.Hash)
+      {
+        auto C = std::make_shared<FileInfo::Contents>();
+        C->Buffer = FM->internBuffer(std::move(*Content));
+        Result = shareContents(std::move(C));
+      }
+    }
+
+    if (!Result)
+    {
+      // locations into the file can no longer be trusted against other contents.
+      LOG(ERROR) << "The contents of " << FI.VirtualPath << " changed, or became unreadable, since it was first read";
+      FI.Stale = true;
+      return Result;
+    }
+
+    std::atomic_store(&FI.Data, Result);
+    ResidentBytes += FI.Size;
+  }
+
+  touch(FI);
+  enforceMemoryBudget(&FI);
+
+  return Result;
+}
+
+FileInfo::ContentsRef
+SourceManager::shareContents(FileInfo::ContentsRef C)
+{
+  std::lock_guard<std::mutex> Lock(SharedContentsMutex);
+
+  // each file uses a single buffer; forget the released ones once they could
+  // outnumber those in use.
+  if (SharedContents.size() >= 2 * NumFiles.load(std::memory_order_relaxed) + 64)
+  {
+    for (auto I = SharedContents.begin(), E = SharedContents.end(); I != E; ++I)
+    {
+      if (I->second.expired())
+      {
+        SharedContents.erase(I);
+      }
+    }
+  }
+
+  auto& Slot = SharedContents[C->Buffer.get()];
+  auto Existing = Slot.lock();
+  if (Existing && (!Existing->LineOffsets.empty() || C->LineOffsets.empty()))
+  {
+    return Existing;
+  }
+
+  Slot = C;
+  return C;
+}
+
+void
+SourceManager::enforceMemoryBudget(FileInfo const* Keep)
+{
+  auto Budget = MemoryBudget.load();
+  if (Budget == 0 || ResidentBytes.load() <= Budget)
+  {
+    return;
+  }
+
+  std::lock_guard<std::mutex> Lock(EvictionMutex);
+
+  // order the evictable files by when they were last used, oldest first.
+  std::vector<std::pair<uint64_t, FileInfo const*>> Candidates;
+  for (auto& FI : *this)
+  {
+    if (&FI != Keep && FI.isEvictable() && FI.isResident())
+    {
+      Candidates.emplace_back(FI.LastUse.load(std::memory_order_relaxed), &FI);
+    }
+  }
+
+  std::sort(Candidates.begin(), Candidates.end());
+
+  for (auto& Candidate : Candidates)
+  {
+    if (ResidentBytes.load() <= Budget)
+    {
+      break;
+    }
+
+    auto& FI = *Candidate.second;
+    auto C = std::atomic_load(&FI.Data);
+
+    // should the contents have changed hands since, leave them be.
+    if (C && FI.isEvictable() && std::atomic_compare_exchange_strong(&FI.Data, &C, FileInfo::ContentsRef()))
+    {
+      VLOG(1) << "Evicting the contents of " << FI.VirtualPath;
+      ResidentBytes -= C->getResidentBytes();
+    }
+  }
+}
+
+namespace
+{
+
+/// Read the contents of \p File, opened from \p Path, into a Source; its
+/// buffer is shared with any file of identical contents \p FM read before.
 std::shared_ptr<Source>
-SourceManager::getFile(std::string Path)
+ReadSource(FileManager& FM, std::string const& Path, vfs::File& File)
 {
-  auto File = FM->openFileForRead(Path);
-  if (!File)
+  auto FileStatus = File.status();
+  if (!FileStatus)
   {
     return nullptr; // LCOV_EXCL_LINE
   }
 
-  auto FileStatus = (*File)->status();
   auto fileSize = (*FileStatus).getSize();
-  auto FileContent = (*File)->getBuffer(Path, fileSize);
+  auto FileContent = File.getBuffer(Path, fileSize);
+  if (!FileContent)
+  {
+    return nullptr; // LCOV_EXCL_LINE
+  }
 
   return std::make_shared<MemoryBufferSource>(FileStatus->getUniqueID(),
                                               FileStatus->getActualName().empty() ? FileStatus->getName()
                                                                                   : FileStatus->getActualName(),
-                                              std::move(*FileContent));
-}
\ No newline at end of file
+                                              FM.internBuffer(std::move(*FileContent)),
+                                              Path);
+}
+
+} // namespace
+
+std::shared_ptr<Source>
+SourceManager::getFile(std::string Path)
+{
+  std::lock_guard<std::mutex> Lock(FileManagerMutex);
+
+  auto File = FM->openFileForRead(Path);
+  if (!File)
+  {
+    return nullptr; // LCOV_EXCL_LINE
+  }
+
+  return ReadSource(*FM, Path, **File);
+}
+
+std::vector<std::shared_ptr<Source>>
+SourceManager::getFiles(std::vector<std::string> const& Paths)
+{
+  std::vector<std::shared_ptr<Source>> Result;
+  Result.reserve(Paths.size());
+
+  std::lock_guard<std::mutex> Lock(FileManagerMutex);
+  auto Files = FM->openFilesForRead(Paths);
+  for (size_t i = 0; i < Files.size(); ++i)
+  {
+    Result.push_back(Files[i] ? ReadSource(*FM, Paths[i], **Files[i]) : nullptr);
+  }
+
+  return Result;
+}
+
+std::vector<FileID>
+SourceManager::takeChangedFiles()
+{
+  std::lock_guard<std::mutex> Lock(ChangedFilesMutex);
+
+  std::vector<FileID> Result;
+  Result.swap(ChangedFiles);
+  return Result;
+}
+
+std::string
+SourceManager::normalizeVirtualPath(llvm::StringRef VirtualPath)
+{
+  if (llvm::sys::path::is_absolute(VirtualPath))
+  {
+    return NormalizePath(VirtualPath, "/");
+  }
+
+  // relative to the root, lacking a working directory.
+  std::lock_guard<std::mutex> Lock(FileManagerMutex);
+  auto WorkingDirectory = FM->getCurrentWorkingDirectory();
+  return NormalizePath(VirtualPath,
+                       WorkingDirectory && !WorkingDirectory->empty() ? llvm::StringRef(*WorkingDirectory) : "/");
+}
+
+void
+SourceManager::noteFileChanged(llvm::StringRef VirtualPath)
+{
+  auto MarkChanged = [this](FileID FID) {
+    if (std::find(ChangedFiles.begin(), ChangedFiles.end(), FID) == ChangedFiles.end())
+    {
+      ChangedFiles.push_back(FID);
+    }
+  };
+
+  if (VirtualPath.empty())
+  {
+    auto Count = NumFiles.load(std::memory_order_acquire);
+
+    std::lock_guard<std::mutex> Lock(ChangedFilesMutex);
+    for (unsigned i = 0; i < Count; ++i)
+    {
+      if (!getEntry(i).VirtualPath.empty())
+      {
+        MarkChanged(FileID::get(i + 1));
+      }
+    }
+
+    return;
+  }
+
+  // files may have been read by any spelling of their path.
+  auto Changed = normalizeVirtualPath(VirtualPath);
+
+  std::lock_guard<std::mutex> Lock(ChangedFilesMutex);
+  auto Files = FilesByPath.find(Changed);
+  if (Files != FilesByPath.end())
+  {
+    std::for_each(Files->getValue().begin(), Files->getValue().end(), MarkChanged);
+  }
+}
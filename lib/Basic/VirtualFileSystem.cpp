@@ -41,6 +41,7 @@
 #include <llvm/Support/MemoryBuffer.h>
 #include <llvm/Support/Path.h>
 #include <llvm/Support/Process.h>
+#include <llvm/Support/ThreadPool.h>
 
 #ifdef __clang__
 #pragma clang diagnostic pop
@@ -48,9 +49,40 @@
 
 #include <glog/logging.h>
 
+#ifdef LLVM_ON_UNIX
+#include <cerrno>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/sysmacros.h>
+#endif
+#endif
+#endif
+
+// opening files through a ring needs the operations of Linux 5.7 and later.
+#if defined(IORING_FEAT_FAST_POLL) && defined(__NR_io_uring_setup)
+#define U_HAVE_IO_URING 1
+#endif
+
 #include <u-lang/Basic/VirtualFileSystem.hpp>
 #include <u-lang/u.hpp>
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
 using namespace u;
 using namespace u::vfs;
 using namespace llvm;
@@ -167,6 +199,59 @@ Status::copyWithNewName(const file_status& In, StringRef NewName, StringRef NewM
                 NewMountPoint);
 }
 
+/// \brief The fields of a status read from a directory, looked up once for
+/// the status and all its copies.
+struct u::vfs::detail::PendingStatus
+{
+  std::once_flag Once;
+  std::atomic<bool> Done{false};
+  std::shared_ptr<const StatusResolver> Resolver;
+  Status Resolved;
+};
+
+Status
+Status::fromDirectoryEntry(StringRef Name,
+                           file_type Type,
+                           std::shared_ptr<const detail::StatusResolver> Resolver,
+                           StringRef MountPoint)
+{
+  Status Result(Name, UniqueID(), sys::TimePoint<>(), 0, 0, 0, Type, sys::fs::perms::no_perms, MountPoint);
+  Result.Pending = std::make_shared<detail::PendingStatus>();
+  Result.Pending->Resolver = std::move(Resolver);
+  return Result;
+}
+
+Status const&
+Status::resolveFields() const
+{
+  auto& P = *Pending;
+  std::call_once(P.Once, [&] {
+    auto S = P.Resolver->resolve(Name);
+    P.Resolver.reset();
+
+    if (S)
+    {
+      P.Resolved = std::move(*S);
+    }
+    else
+    {
+      // an entry removed since it was read keeps what is known of it.
+      P.Resolved = *this;            // LCOV_EXCL_LINE
+      P.Resolved.Pending.reset();    // LCOV_EXCL_LINE
+    }
+
+    P.Done.store(true, std::memory_order_release);
+  });
+
+  return P.Resolved;
+}
+
+bool
+Status::isResolved() const
+{
+  return !Pending || Pending->Done.load(std::memory_order_acquire);
+}
+
 bool
 Status::equivalent(const Status& Other) const
 {
@@ -236,6 +321,20 @@ FileSystem::makeAbsolute(SmallVectorImpl<char>& Path) const
   return llvm::sys::fs::make_absolute(WorkingDir.get(), Path); // LCOV_EXCL_LINE
 }
 
+FileBatch
+FileSystem::openFilesForRead(llvm::ArrayRef<std::string> Paths)
+{
+  FileBatch Result;
+  Result.reserve(Paths.size());
+
+  for (auto& Path : Paths)
+  {
+    Result.push_back(openFileForRead(Path));
+  }
+
+  return Result;
+}
+
 bool
 FileSystem::exists(const Twine& Path)
 {
@@ -274,16 +373,14 @@ class RealFile : public File
 {
   int FD;
   Status S;
-  std::string RealName;
   std::string MountPoint;
 
   friend class RealFileSystem;
 
 public:
-  RealFile(int FD, StringRef NewName, StringRef NewRealPathName, StringRef NewMountPoint)
+  RealFile(int FD, StringRef NewName, StringRef NewMountPoint)
     : FD(FD)
     , S(NewName, {}, {}, {}, {}, {}, llvm::sys::fs::file_type::status_error, {}, "")
-    , RealName(NewRealPathName.str())
     , MountPoint(NewMountPoint.str())
   {
     assert(FD >= 0 && "Invalid or inactive file descriptor");
@@ -346,13 +443,158 @@ RealFile::close()
   return EC;
 }
 
+#ifdef LLVM_ON_UNIX
+namespace
+{
+/// Translate the result of stat(2) into a Status named \p Name.
+Status
+StatusFromStat(struct stat const& Buf, StringRef Name, StringRef MountPoint)
+{
+  file_type Type = file_type::type_unknown;
+  if (S_ISDIR(Buf.st_mode))
+    Type = file_type::directory_file;
+  else if (S_ISREG(Buf.st_mode))
+    Type = file_type::regular_file;
+  else if (S_ISBLK(Buf.st_mode))
+    Type = file_type::block_file; // LCOV_EXCL_LINE
+  else if (S_ISCHR(Buf.st_mode))
+    Type = file_type::character_file; // LCOV_EXCL_LINE
+  else if (S_ISFIFO(Buf.st_mode))
+    Type = file_type::fifo_file; // LCOV_EXCL_LINE
+  else if (S_ISSOCK(Buf.st_mode))
+    Type = file_type::socket_file; // LCOV_EXCL_LINE
+  else if (S_ISLNK(Buf.st_mode))
+    Type = file_type::symlink_file; // LCOV_EXCL_LINE
+
+#if defined(__APPLE__)
+  auto const& MTime = Buf.st_mtimespec;
+#else
+  auto const& MTime = Buf.st_mtim;
+#endif
+
+  return Status(Name,
+                UniqueID(Buf.st_dev, Buf.st_ino),
+                sys::TimePoint<>(std::chrono::seconds(MTime.tv_sec) + std::chrono::nanoseconds(MTime.tv_nsec)),
+                Buf.st_uid,
+                Buf.st_gid,
+                Buf.st_size,
+                Type,
+                static_cast<perms>(Buf.st_mode & 07777),
+                MountPoint);
+}
+
+std::error_code
+LastError()
+{
+  return std::error_code(errno, std::generic_category());
+}
+
+/// Looks up entries by their path beneath a mount point, which it keeps open.
+class MountResolver : public u::vfs::detail::StatusResolver
+{
+  int FD;
+
+public:
+  explicit MountResolver(int MountFD)
+    : FD(MountFD)
+  {
+  }
+
+  ~MountResolver() override { ::close(FD); }
+
+  llvm::ErrorOr<Status> resolve(StringRef Name) const override
+  {
+    std::string Relative = Name.ltrim('/').str();
+    if (Relative.empty())
+      Relative = "."; // LCOV_EXCL_LINE
+
+    // report a dangling symlink as such, rather than failing.
+    struct stat Buf;
+    if (::fstatat(FD, Relative.c_str(), &Buf, 0) != 0 &&
+        ::fstatat(FD, Relative.c_str(), &Buf, AT_SYMLINK_NOFOLLOW) != 0)
+      return LastError(); // LCOV_EXCL_LINE
+
+    return StatusFromStat(Buf, Name, "");
+  }
+};
+} // end anonymous namespace
+#endif
+
+u::vfs::detail::StatusResolver::~StatusResolver() {}
+
+RealFileSystem::RealFileSystem(Twine const& RootedAt)
+  : MountPoint{RootedAt.str()}
+  , MountFD{-1}
+  , UseMembershipFilter{false}
+{
+#ifdef LLVM_ON_UNIX
+  MountFD = ::open(MountPoint.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+  // entries may outlive us, so their resolver holds its own descriptor.
+  int ResolverFD = MountFD >= 0 ? ::fcntl(MountFD, F_DUPFD_CLOEXEC, 0) : -1;
+  if (ResolverFD >= 0)
+    EntryResolver = std::make_shared<MountResolver>(ResolverFD);
+#endif
+}
+
+RealFileSystem::~RealFileSystem()
+{
+  if (MountFD >= 0)
+  {
+    sys::Process::SafelyCloseFileDescriptor(MountFD);
+  }
+}
+
+StringRef
+RealFileSystem::getRelativePath(const Twine& Path, SmallVectorImpl<char>& Storage) const
+{
+  StringRef P = Path.toNullTerminatedStringRef(Storage);
+
+  // a path spelled through the mount point names an entry beneath it.
+  StringRef Mount = StringRef(MountPoint).rtrim('/');
+  if (!Mount.empty() && P.startswith(Mount) && (P.size() == Mount.size() || P[Mount.size()] == '/'))
+  {
+    P = P.substr(Mount.size());
+  }
+
+  if (P.startswith("/"))
+  {
+    P = P.ltrim('/');
+  }
+  else if (!WorkingDirectory.empty())
+  {
+    SmallString<256> Joined{WorkingDirectory};
+    llvm::sys::path::append(Joined, P);
+
+    Storage.assign(Joined.begin(), Joined.end());
+    Storage.push_back('\0');
+    return StringRef(Storage.data(), Storage.size() - 1);
+  }
+
+  return P.empty() ? StringRef(".") : P;
+}
+
 ErrorOr<Status>
 RealFileSystem::status(const Twine& Path)
 {
-  auto final = PhysicalToVirtualPath(MountPoint, Path.str());
+  SmallString<256> Storage;
+  StringRef Relative = getRelativePath(Path, Storage);
+
+#ifdef LLVM_ON_UNIX
+  if (MountFD >= 0)
+  {
+    struct stat Buf;
+    if (::fstatat(MountFD, Relative.data(), &Buf, 0) != 0)
+      return LastError();
+    return StatusFromStat(Buf, Path.str(), MountPoint);
+  }
+#endif
+
+  SmallString<256> Physical{MountPoint};
+  llvm::sys::path::append(Physical, Relative);
 
   sys::fs::file_status RealStatus;
-  if (std::error_code EC = sys::fs::status(final, RealStatus))
+  if (std::error_code EC = sys::fs::status(Physical, RealStatus))
     return EC;
   return Status::copyWithNewName(RealStatus, Path.str(), MountPoint);
 }
@@ -361,57 +603,941 @@ ErrorOr<std::unique_ptr<File>>
 RealFileSystem::openFileForRead(const Twine& Name)
 {
   int FD;
-  SmallString<256> RealName;
+  SmallString<256> Storage;
+  StringRef Relative = getRelativePath(Name, Storage);
 
-  auto final = PhysicalToVirtualPath(MountPoint, Name.str());
+#ifdef LLVM_ON_UNIX
+  if (MountFD >= 0)
+  {
+    do
+    {
+      FD = ::openat(MountFD, Relative.data(), O_RDONLY | O_CLOEXEC);
+    } while (FD < 0 && errno == EINTR);
+
+    if (FD < 0)
+      return LastError();
 
-  if (std::error_code EC = sys::fs::openFileForRead(final, FD, &RealName))
+    return std::unique_ptr<File>(new RealFile(FD, Name.str(), MountPoint));
+  }
+#endif
+
+  SmallString<256> Physical{MountPoint};
+  llvm::sys::path::append(Physical, Relative);
+
+  if (std::error_code EC = sys::fs::openFileForRead(Physical, FD))
     return EC; // LCOV_EXCL_LINE
 
-  return std::unique_ptr<File>(new RealFile(FD, Name.str(), RealName.str(), MountPoint));
+  return std::unique_ptr<File>(new RealFile(FD, Name.str(), MountPoint));
+}
+
+namespace
+{
+/// The threads helping to open batches of files and to walk directory
+/// trees; started once, when first needed, and shared by every caller.
+llvm::ThreadPool&
+getWorkerPool()
+{
+  static llvm::ThreadPool Pool;
+  return Pool;
+}
+} // end anonymous namespace
+
+#ifdef LLVM_ON_UNIX
+namespace
+{
+/// A file read in full when opened, as part of a batch.
+class PreloadedFile : public File
+{
+  Status S;
+  std::shared_ptr<MemoryBuffer> Buffer;
+
+public:
+  PreloadedFile(Status NewS, std::unique_ptr<MemoryBuffer> NewBuffer)
+    : S(std::move(NewS))
+    , Buffer(std::move(NewBuffer))
+  {
+  }
+
+  ErrorOr<Status> status() override { return S; }
+
+  ErrorOr<std::unique_ptr<MemoryBuffer>> getBuffer(const Twine& Name,
+                                                   uint64_t FileSize,
+                                                   bool RequiresNullTerminator,
+                                                   bool IsVolatile) override
+  {
+    return getSharedMemBuffer(Buffer, Buffer->getBuffer(), RequiresNullTerminator);
+  }
+
+  std::error_code close() override { return std::error_code{}; }
+};
+
+/// The number of files a single thread of a batch is given, at the least.
+constexpr size_t FilesPerThread = 8;
+
+#ifdef U_HAVE_IO_URING
+/// A submission and a completion queue shared with the kernel, through which
+/// a batch of files is opened, examined and read with a few system calls in
+/// all, rather than several per file.
+class IoRing
+{
+  int FD;
+
+  void* SQRing;
+  size_t SQRingSize;
+  void* CQRing;
+  size_t CQRingSize;
+  io_uring_sqe* SQEs;
+  size_t SQEsSize;
+
+  unsigned* SQTail;
+  unsigned SQMask;
+  unsigned* SQArray;
+  unsigned* CQHead;
+  unsigned* CQTail;
+  unsigned CQMask;
+  io_uring_cqe* CQEs;
+
+  /// The entries queued since the last run.
+  unsigned Queued;
+
+  template<typename T>
+  static T* At(void* Base, unsigned Offset)
+  {
+    return reinterpret_cast<T*>(static_cast<char*>(Base) + Offset);
+  }
+
+  /// Whether the kernel performs each operation a batch is made of.
+  bool supportsBatches()
+  {
+    std::vector<char> Storage(sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op), 0);
+    auto* Probe = reinterpret_cast<io_uring_probe*>(Storage.data());
+    if (::syscall(__NR_io_uring_register, FD, IORING_REGISTER_PROBE, Probe, 256) < 0)
+      return false; // LCOV_EXCL_LINE
+
+    for (unsigned Op : {IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ, IORING_OP_CLOSE})
+    {
+      if (Op > Probe->last_op || !(Probe->ops[Op].flags & IO_URING_OP_SUPPORTED))
+        return false; // LCOV_EXCL_LINE
+    }
+
+    return true;
+  }
+
+public:
+  /// The number of entries the ring holds.
+  static constexpr unsigned Depth = 256;
+
+  IoRing()
+    : FD(-1)
+    , SQRing(MAP_FAILED)
+    , SQRingSize(0)
+    , CQRing(MAP_FAILED)
+    , CQRingSize(0)
+    , SQEs(static_cast<io_uring_sqe*>(MAP_FAILED))
+    , SQEsSize(0)
+    , Queued(0)
+  {
+    io_uring_params Params;
+    std::memset(&Params, 0, sizeof(Params));
+
+    int Ring = static_cast<int>(::syscall(__NR_io_uring_setup, Depth, &Params));
+    if (Ring < 0)
+      return; // LCOV_EXCL_LINE
+
+    FD = Ring;
+    SQRingSize = Params.sq_off.array + Params.sq_entries * sizeof(unsigned);
+    CQRingSize = Params.cq_off.cqes + Params.cq_entries * sizeof(io_uring_cqe);
+    if (Params.features & IORING_FEAT_SINGLE_MMAP)
+      SQRingSize = CQRingSize = std::max(SQRingSize, CQRingSize);
+
+    SQRing = ::mmap(nullptr, SQRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, FD, IORING_OFF_SQ_RING);
+    CQRing = (Params.features & IORING_FEAT_SINGLE_MMAP)
+      ? SQRing
+      : ::mmap(nullptr, CQRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, FD, IORING_OFF_CQ_RING);
+    SQEsSize = Params.sq_entries * sizeof(io_uring_sqe);
+    SQEs = static_cast<io_uring_sqe*>(
+      ::mmap(nullptr, SQEsSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, FD, IORING_OFF_SQES));
+
+    if (SQRing == MAP_FAILED || CQRing == MAP_FAILED || SQEs == MAP_FAILED || !supportsBatches())
+    {
+      // LCOV_EXCL_START
+      release();
+      return;
+      // LCOV_EXCL_STOP
+    }
+
+    SQTail = At<unsigned>(SQRing, Params.sq_off.tail);
+    SQMask = *At<unsigned>(SQRing, Params.sq_off.ring_mask);
+    SQArray = At<unsigned>(SQRing, Params.sq_off.array);
+    CQHead = At<unsigned>(CQRing, Params.cq_off.head);
+    CQTail = At<unsigned>(CQRing, Params.cq_off.tail);
+    CQMask = *At<unsigned>(CQRing, Params.cq_off.ring_mask);
+    CQEs = At<io_uring_cqe>(CQRing, Params.cq_off.cqes);
+  }
+
+  IoRing(IoRing const&) = delete;
+
+  IoRing& operator=(IoRing const&) = delete;
+
+  ~IoRing() { release(); }
+
+  bool isReady() const { return FD >= 0; }
+
+  /// Queue one more entry, to be filled in; at most Depth may be queued.
+  io_uring_sqe& queue(uint8_t Opcode, int Descriptor, uint64_t UserData)
+  {
+    unsigned Tail = *SQTail + Queued++;
+    unsigned Index = Tail & SQMask;
+
+    io_uring_sqe& SQE = SQEs[Index];
+    std::memset(&SQE, 0, sizeof(SQE));
+    SQE.opcode = Opcode;
+    SQE.fd = Descriptor;
+    SQE.user_data = UserData;
+    SQArray[Index] = Index;
+
+    return SQE;
+  }
+
+  /// Submit every entry queued, and wait for all of them to complete,
+  /// telling \p Complete the user data and result of each. False should the
+  /// ring fail, after which it is not to be used again.
+  bool run(llvm::function_ref<void(uint64_t, int)> Complete)
+  {
+    unsigned ToSubmit = Queued;
+    unsigned Outstanding = Queued;
+    Queued = 0;
+    __atomic_store_n(SQTail, *SQTail + ToSubmit, __ATOMIC_RELEASE);
+
+    while (Outstanding > 0)
+    {
+      long Submitted = ::syscall(__NR_io_uring_enter, FD, ToSubmit, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+      if (Submitted < 0 && errno == EINTR)
+        continue; // LCOV_EXCL_LINE
+      if (Submitted < 0)
+      {
+        // LCOV_EXCL_START
+        release();
+        return false;
+        // LCOV_EXCL_STOP
+      }
+
+      ToSubmit -= std::min<unsigned>(ToSubmit, static_cast<unsigned>(Submitted));
+
+      unsigned Head = *CQHead;
+      unsigned Tail = __atomic_load_n(CQTail, __ATOMIC_ACQUIRE);
+      for (; Head != Tail; ++Head, --Outstanding)
+      {
+        io_uring_cqe const& CQE = CQEs[Head & CQMask];
+        Complete(CQE.user_data, CQE.res);
+      }
+      __atomic_store_n(CQHead, Head, __ATOMIC_RELEASE);
+    }
+
+    return true;
+  }
+
+private:
+  void release()
+  {
+    if (SQEs != MAP_FAILED)
+      ::munmap(SQEs, SQEsSize);
+    if (CQRing != MAP_FAILED && CQRing != SQRing)
+      ::munmap(CQRing, CQRingSize); // LCOV_EXCL_LINE
+    if (SQRing != MAP_FAILED)
+      ::munmap(SQRing, SQRingSize);
+    if (FD >= 0)
+      ::close(FD);
+
+    SQEs = static_cast<io_uring_sqe*>(MAP_FAILED);
+    SQRing = CQRing = MAP_FAILED;
+    FD = -1;
+  }
+};
+
+/// The ring of the calling thread, set up when first needed; null should
+/// the kernel offer none able to open files, when batches are opened on the
+/// pool instead.
+IoRing*
+getThreadRing()
+{
+  static std::atomic<bool> Unavailable{false};
+  thread_local std::unique_ptr<IoRing> Ring;
+
+  // a ring which failed is set up anew.
+  if (Ring && !Ring->isReady())
+    Ring.reset(); // LCOV_EXCL_LINE
+
+  if (!Ring && !Unavailable.load(std::memory_order_relaxed))
+  {
+    Ring.reset(new IoRing());
+    if (!Ring->isReady())
+    {
+      Unavailable = true; // LCOV_EXCL_LINE
+      Ring.reset();       // LCOV_EXCL_LINE
+    }
+  }
+
+  return Ring.get();
+}
+
+/// Translate the result of statx(2) into that of stat(2).
+struct stat
+StatFromStatx(struct statx const& X)
+{
+  struct stat Buf;
+  std::memset(&Buf, 0, sizeof(Buf));
+  Buf.st_dev = makedev(X.stx_dev_major, X.stx_dev_minor);
+  Buf.st_ino = X.stx_ino;
+  Buf.st_mode = X.stx_mode;
+  Buf.st_uid = X.stx_uid;
+  Buf.st_gid = X.stx_gid;
+  Buf.st_size = static_cast<off_t>(X.stx_size);
+  Buf.st_mtim.tv_sec = X.stx_mtime.tv_sec;
+  Buf.st_mtim.tv_nsec = X.stx_mtime.tv_nsec;
+
+  return Buf;
+}
+
+/// Open, examine and read each of \p Paths, found at \p Relatives beneath
+/// \p MountFD, through \p Ring into its slot of \p Result; a chunk of files
+/// at a time, each taking three submissions however many files it holds.
+/// Returns the files left for the caller to open, such as those changing
+/// while read.
+std::vector<size_t>
+OpenThroughRing(IoRing& Ring,
+                int MountFD,
+                StringRef MountPoint,
+                llvm::ArrayRef<std::string> Paths,
+                std::vector<std::string> const& Relatives,
+                FileBatch& Result)
+{
+  struct Slot
+  {
+    int FD;
+    int Error;
+    int64_t Read;
+    struct statx Stat;
+    std::unique_ptr<MemoryBuffer> Contents;
+  };
+
+  // a read, and the close linked to it, take two entries.
+  constexpr size_t Chunk = IoRing::Depth / 2;
+  constexpr uint64_t ClosedBit = uint64_t(1) << 63;
+  static const char EmptyPath[] = "";
+
+  std::vector<size_t> Remaining;
+  std::vector<Slot> Slots(std::min(Chunk, Paths.size()));
+
+  for (size_t First = 0; First < Paths.size(); First += Chunk)
+  {
+    size_t Count = std::min(Chunk, Paths.size() - First);
+
+    for (size_t i = 0; i < Count; ++i)
+    {
+      Slots[i].FD = -1;
+      Slots[i].Error = 0;
+      Slots[i].Read = -1;
+      Slots[i].Contents.reset();
+
+      auto& SQE = Ring.queue(IORING_OP_OPENAT, MountFD, i);
+      SQE.addr = reinterpret_cast<uint64_t>(Relatives[First + i].c_str());
+      SQE.open_flags = O_RDONLY | O_CLOEXEC;
+    }
+
+    bool Ran = Ring.run([&](uint64_t i, int Res) {
+      if (Res >= 0)
+        Slots[i].FD = Res;
+      else
+        Slots[i].Error = -Res;
+    });
+
+    // then examine what was opened, through the descriptor.
+    for (size_t i = 0; Ran && i < Count; ++i)
+    {
+      if (Slots[i].FD < 0)
+        continue;
+
+      auto& SQE = Ring.queue(IORING_OP_STATX, Slots[i].FD, i);
+      SQE.addr = reinterpret_cast<uint64_t>(EmptyPath);
+      SQE.statx_flags = AT_EMPTY_PATH;
+      SQE.len = STATX_BASIC_STATS;
+      SQE.off = reinterpret_cast<uint64_t>(&Slots[i].Stat);
+    }
+
+    Ran = Ran && Ring.run([&](uint64_t i, int Res) {
+      if (Res < 0)
+        Slots[i].Error = -Res; // LCOV_EXCL_LINE
+    });
+
+    // and read each regular file whole, closing it once read.
+    for (size_t i = 0; Ran && i < Count; ++i)
+    {
+      auto& S = Slots[i];
+      if (S.FD < 0 || (!S.Error && !S_ISREG(S.Stat.stx_mode)))
+        continue;
+
+      if (!S.Error && S.Stat.stx_size <= std::numeric_limits<uint32_t>::max())
+      {
+#if LLVM_VERSION_MAJOR < 6
+        S.Contents = MemoryBuffer::getNewUninitMemBuffer(S.Stat.stx_size, Paths[First + i]);
+#else
+        S.Contents = WritableMemoryBuffer::getNewUninitMemBuffer(S.Stat.stx_size, Paths[First + i]);
+#endif
+        if (S.Stat.stx_size > 0)
+        {
+          auto& Read = Ring.queue(IORING_OP_READ, S.FD, i);
+          Read.addr = reinterpret_cast<uint64_t>(S.Contents->getBufferStart());
+          Read.len = static_cast<uint32_t>(S.Stat.stx_size);
+          Read.flags = IOSQE_IO_HARDLINK;
+        }
+        else
+        {
+          S.Read = 0;
+        }
+      }
+
+      Ring.queue(IORING_OP_CLOSE, S.FD, ClosedBit | i);
+    }
+
+    Ran = Ran && Ring.run([&](uint64_t i, int Res) {
+      if (i & ClosedBit)
+        return;
+
+      if (Res < 0)
+        Slots[i].Error = -Res; // LCOV_EXCL_LINE
+      else
+        Slots[i].Read = Res;
+    });
+
+    if (!Ran)
+    {
+      // LCOV_EXCL_START
+      for (size_t i = First; i < Paths.size(); ++i)
+      {
+        if (i < First + Count && Slots[i - First].FD >= 0)
+          ::close(Slots[i - First].FD);
+        Remaining.push_back(i);
+      }
+      return Remaining;
+      // LCOV_EXCL_STOP
+    }
+
+    for (size_t i = 0; i < Count; ++i)
+    {
+      auto& S = Slots[i];
+      auto& Slot = Result[First + i];
+      if (S.Error)
+      {
+        Slot = std::error_code(S.Error, std::generic_category());
+      }
+      else if (!S_ISREG(S.Stat.stx_mode))
+      {
+        Slot = std::unique_ptr<File>(new RealFile(S.FD, Paths[First + i], MountPoint));
+      }
+      else if (S.Contents && S.Read == static_cast<int64_t>(S.Stat.stx_size))
+      {
+        auto Stat = StatusFromStat(StatFromStatx(S.Stat), Paths[First + i], MountPoint);
+        Slot = std::unique_ptr<File>(new PreloadedFile(std::move(Stat), std::move(S.Contents)));
+      }
+      else
+      {
+        // too large to read at once, or changing while read.
+        Remaining.push_back(First + i); // LCOV_EXCL_LINE
+      }
+    }
+  }
+
+  return Remaining;
+}
+#endif
+} // end anonymous namespace
+#endif
+
+FileBatch
+RealFileSystem::openFilesForRead(llvm::ArrayRef<std::string> Paths)
+{
+#ifdef LLVM_ON_UNIX
+  if (MountFD < 0)
+    return FileSystem::openFilesForRead(Paths); // LCOV_EXCL_LINE
+
+  FileBatch Result;
+  std::vector<std::string> Relatives;
+  Result.reserve(Paths.size());
+  Relatives.reserve(Paths.size());
+  for (auto& Path : Paths)
+  {
+    SmallString<256> Storage;
+    Relatives.push_back(getRelativePath(Path, Storage).str());
+    Result.push_back(make_error_code(llvm::errc::no_such_file_or_directory));
+  }
+
+  // each file is opened, examined and read by one thread, into its own slot.
+  auto Open = [&](size_t i) -> ErrorOr<std::unique_ptr<File>> {
+    int FD;
+    do
+    {
+      FD = ::openat(MountFD, Relatives[i].c_str(), O_RDONLY | O_CLOEXEC);
+    } while (FD < 0 && errno == EINTR);
+
+    if (FD < 0)
+      return LastError();
+
+    struct stat Buf;
+    if (::fstat(FD, &Buf) != 0 || !S_ISREG(Buf.st_mode))
+      return std::unique_ptr<File>(new RealFile(FD, Paths[i], MountPoint));
+
+    auto Contents = MemoryBuffer::getOpenFile(FD, Paths[i], static_cast<uint64_t>(Buf.st_size));
+    sys::Process::SafelyCloseFileDescriptor(FD);
+    if (!Contents)
+      return Contents.getError(); // LCOV_EXCL_LINE
+
+    return std::unique_ptr<File>(new PreloadedFile(StatusFromStat(Buf, Paths[i], MountPoint), std::move(*Contents)));
+  };
+
+  // the files left to the pool; all of them, unless the ring took them.
+  std::vector<size_t> Remaining;
+#ifdef U_HAVE_IO_URING
+  if (IoRing* Ring = getThreadRing())
+  {
+    Remaining = OpenThroughRing(*Ring, MountFD, MountPoint, Paths, Relatives, Result);
+    if (Remaining.empty())
+      return Result;
+  }
+  else
+#endif
+  {
+    Remaining.resize(Paths.size());
+    for (size_t i = 0; i < Paths.size(); ++i)
+      Remaining[i] = i;
+  }
+
+  std::atomic<size_t> Next{0};
+  auto Work = [&]() {
+    for (size_t i = Next++; i < Remaining.size(); i = Next++)
+      Result[Remaining[i]] = Open(Remaining[i]);
+  };
+
+  // the pool is shared, so only the helpers of this batch are waited for.
+  size_t NumThreads = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()),
+                                       (Remaining.size() + FilesPerThread - 1) / FilesPerThread);
+  std::vector<decltype(getWorkerPool().async(Work))> Helpers;
+  for (size_t i = 1; i < NumThreads; ++i)
+    Helpers.push_back(getWorkerPool().async(Work));
+
+  Work();
+  for (auto& Helper : Helpers)
+    Helper.wait();
+
+  return Result;
+#else
+  return FileSystem::openFilesForRead(Paths);
+#endif
 }
 
 llvm::ErrorOr<std::string>
 RealFileSystem::getCurrentWorkingDirectory() const
 {
-  SmallString<256> Dir;
-  if (std::error_code EC = llvm::sys::fs::current_path(Dir))
-    return EC; // LCOV_EXCL_LINE
-  return Dir.str().str();
+  return "/" + WorkingDirectory;
 }
 
 std::error_code
 RealFileSystem::setCurrentWorkingDirectory(const Twine& Path)
 {
-  // FIXME: chdir is thread hostile; on the other hand, creating the same
-  // behavior as chdir is complex: chdir resolves the path once, thus
-  // guaranteeing that all subsequent relative path operations work
-  // on the same path the original chdir resulted in. This makes a
-  // difference for example on network filesystems, where symlinks might be
-  // switched during runtime of the tool. Fixing this depends on having a
-  // file system abstraction that allows openat() style interactions.
+  SmallString<256> Storage;
+  SmallString<256> Relative{getRelativePath(Path, Storage)};
+  llvm::sys::path::remove_dots(Relative, /*remove_dot_dot=*/true);
+
+  // the working directory never leaves the mount point.
+  if (Relative == ".." || Relative.startswith("../"))
+    return make_error_code(llvm::errc::invalid_argument);
+
+  auto S = status(Path);
+  if (!S)
+    return S.getError();
+  if (!S->isDirectory())
+    return make_error_code(llvm::errc::not_a_directory);
+
+  WorkingDirectory = Relative == "." ? std::string() : Relative.str().str();
+  return std::error_code{};
+}
+
+bool
+RealFileSystem::mayContain(const Twine& Path)
+{
+  if (!UseMembershipFilter)
+  {
+    return true;
+  }
+
+  StringRef Root = StringRef(MountPoint).rtrim("/\\");
+
+  if (!Members && !Oracle)
+  {
+    // only names are wanted, so no entry need be looked up.
+    std::vector<std::string> Entries;
+    std::mutex EntriesMutex;
+    std::error_code EC = walkInParallel(*this, Root, [&](Status const& Entry) {
+      std::lock_guard<std::mutex> Lock(EntriesMutex);
+      Entries.push_back(Entry.getName().str());
+    });
+
+    if (EC)
+    {
+      // LCOV_EXCL_START
+      LOG(WARNING) << "Unable to walk " << MountPoint << ": " << EC.message();
+      UseMembershipFilter = false;
+      return true;
+      // LCOV_EXCL_STOP
+    }
+
+    Members.reset(new BloomFilter(Entries.size()));
+    for (auto& Entry : Entries)
+    {
+      Members->insert(Entry);
+    }
+  }
+
+  // only entries strictly beneath the mount point were walked.
+  std::string Key;
+  if (!getMemberKey(Path, Key))
+  {
+    return true;
+  }
+
+  return Oracle ? Oracle(Key) : Members->mayContain(Key);
+}
+
+void
+RealFileSystem::noteEntryChanged(const Twine& Path)
+{
+  std::string Key;
+  if (!Members || !getMemberKey(Path, Key))
+  {
+    return;
+  }
+
+  auto S = status(Path);
+  if (S && S->isDirectory())
+  {
+    Members.reset();
+  }
+  else if (S)
+  {
+    Members->insert(Key);
+  }
+}
+
+bool
+RealFileSystem::getMemberKey(const Twine& Path, std::string& Key) const
+{
+  // resolve the path as a lookup would, against the working directory.
+  SmallString<256> Storage;
+  SmallString<256> Relative{getRelativePath(Path, Storage)};
+  llvm::sys::path::remove_dots(Relative, /*remove_dot_dot=*/true);
+
+  StringRef Trimmed = Relative.str().rtrim("/\\");
+  if (Trimmed.empty() || Trimmed == "." || Trimmed == ".." || Trimmed.startswith("../"))
+  {
+    return false;
+  }
+
+  Key = "/" + Trimmed.str();
+  return true;
+}
+
+std::string
+u::vfs::getNormalizedPath(FileSystem const& FS, const Twine& Path)
+{
+  SmallString<256> Normalized;
+  Path.toVector(Normalized);
+
+  if (FS.makeAbsolute(Normalized))
+  {
+    return Path.str(); // LCOV_EXCL_LINE
+  }
+
+  llvm::sys::path::remove_dots(Normalized, /*remove_dot_dot=*/true);
+  return Normalized.str().str();
+}
+
+//===-----------------------------------------------------------------------===/
+// StatCachingFileSystem implementation
+//===-----------------------------------------------------------------------===/
+ErrorOr<Status>
+StatCachingFileSystem::status(const Twine& Path)
+{
+  auto Key = getNormalizedPath(*this, Path);
+
+  auto I = Cache.find(Key);
+  if (I != Cache.end())
+  {
+    ++NumHits;
+    return I->second;
+  }
+
+  ++NumMisses;
+  auto Result = Underlying->status(Path);
+
+  // only remember answers which will not change on their own accord.
+  if (Result || isLastingError(Result.getError()))
+  {
+    Cache.insert(std::make_pair(Key, Result));
+  }
+
+  return Result;
+}
+
+bool
+StatCachingFileSystem::isLastingError(std::error_code EC)
+{
+  return EC == llvm::errc::no_such_file_or_directory || EC == llvm::errc::not_a_directory;
+}
+
+void
+StatCachingFileSystem::rememberFailedOpen(std::string const& Key, std::error_code EC)
+{
+  if (isLastingError(EC))
+  {
+    Cache.insert(std::make_pair(Key, ErrorOr<Status>(EC)));
+  }
+}
+
+ErrorOr<std::unique_ptr<File>>
+StatCachingFileSystem::openFileForRead(const Twine& Path)
+{
+  auto Key = getNormalizedPath(*this, Path);
+
+  auto I = Cache.find(Key);
+  if (I != Cache.end() && !I->second)
+  {
+    ++NumHits;
+    return I->second.getError();
+  }
+
+  auto Result = Underlying->openFileForRead(Path);
+  if (!Result)
+  {
+    rememberFailedOpen(Key, Result.getError());
+  }
+
+  return Result;
+}
+
+FileBatch
+StatCachingFileSystem::openFilesForRead(llvm::ArrayRef<std::string> Paths)
+{
+  FileBatch Result;
+  Result.reserve(Paths.size());
+
+  std::vector<std::string> Batch;
+  std::vector<std::string> Keys;
+  std::vector<size_t> Owners;
+  for (size_t i = 0; i < Paths.size(); ++i)
+  {
+    auto Key = getNormalizedPath(*this, Paths[i]);
+    auto I = Cache.find(Key);
+    if (I != Cache.end() && !I->second)
+    {
+      ++NumHits;
+      Result.push_back(I->second.getError());
+      continue;
+    }
+
+    Result.push_back(make_error_code(llvm::errc::no_such_file_or_directory));
+    Batch.push_back(Paths[i]);
+    Keys.push_back(std::move(Key));
+    Owners.push_back(i);
+  }
+
+  if (!Batch.empty())
+  {
+    auto Files = Underlying->openFilesForRead(Batch);
+    for (size_t j = 0; j < Files.size(); ++j)
+    {
+      if (!Files[j])
+      {
+        rememberFailedOpen(Keys[j], Files[j].getError());
+      }
+
+      Result[Owners[j]] = std::move(Files[j]);
+    }
+  }
+
+  return Result;
+}
+
+namespace
+{
+#ifdef LLVM_ON_UNIX
+/// The number of bytes of directory entries read at once.
+constexpr size_t DirentBufferSize = 64 * 1024;
+
+/// Translate the \c d_type of a directory entry; unknown should it not
+/// tell what a symlink names, or not be filled in at all.
+file_type
+TypeFromDirent(unsigned char Type)
+{
+  switch (Type)
+  {
+  case DT_DIR:
+    return file_type::directory_file;
+  case DT_REG:
+    return file_type::regular_file;
+  case DT_BLK:
+    return file_type::block_file; // LCOV_EXCL_LINE
+  case DT_CHR:
+    return file_type::character_file; // LCOV_EXCL_LINE
+  case DT_FIFO:
+    return file_type::fifo_file; // LCOV_EXCL_LINE
+  case DT_SOCK:
+    return file_type::socket_file; // LCOV_EXCL_LINE
+  default:
+    return file_type::type_unknown;
+  }
+}
+
+/// Iterates a directory opened beneath the mount point, naming each entry
+/// by its path beneath the mount point.
+///
+/// Entries are typed from the directory itself; the rest of their status is
+/// looked up through \p Resolver only when asked for. Symlinks, and entries
+/// of a file system not reporting types, are looked up as they are read.
+class RealFSDirFDIter : public u::vfs::detail::DirIterImpl
+{
+  int FD;
+  std::string Prefix;
+  std::shared_ptr<const u::vfs::detail::StatusResolver> Resolver;
+#ifdef __linux__
+  std::unique_ptr<char[]> Buffer;
+  size_t Offset;
+  size_t Length;
+#else
+  DIR* Dir;
+#endif
+
+  /// Read the name and type of the next entry; null at the end, or should
+  /// reading fail.
+  const char* next(unsigned char& Type, std::error_code& EC)
+  {
+#ifdef __linux__
+    // read as many entries as fit at once, as readdir(3) would read few.
+    while (Offset == Length)
+    {
+      long Read = ::syscall(SYS_getdents64, FD, Buffer.get(), DirentBufferSize);
+      if (Read <= 0)
+      {
+        if (Read < 0)
+          EC = LastError(); // LCOV_EXCL_LINE
+        return nullptr;
+      }
+
+      Offset = 0;
+      Length = static_cast<size_t>(Read);
+    }
+
+    auto Entry = reinterpret_cast<struct dirent64 const*>(Buffer.get() + Offset);
+    Offset += Entry->d_reclen;
+#else
+    errno = 0;
+    struct dirent* Entry = ::readdir(Dir);
+    if (!Entry)
+    {
+      if (errno)
+        EC = LastError(); // LCOV_EXCL_LINE
+      return nullptr;
+    }
+#endif
+
+    Type = Entry->d_type;
+    return Entry->d_name;
+  }
+
+public:
+  RealFSDirFDIter(int DirFD,
+                  std::string DirPrefix,
+                  std::shared_ptr<const u::vfs::detail::StatusResolver> EntryResolver,
+                  std::error_code& EC)
+    : FD(DirFD)
+    , Prefix(std::move(DirPrefix))
+    , Resolver(std::move(EntryResolver))
+#ifdef __linux__
+    , Buffer(new char[DirentBufferSize])
+    , Offset(0)
+    , Length(0)
+#else
+    , Dir(::fdopendir(DirFD))
+#endif
+  {
+#ifndef __linux__
+    if (!Dir)
+    {
+      EC = LastError();            // LCOV_EXCL_LINE
+      ::close(FD);                 // LCOV_EXCL_LINE
+      return;                      // LCOV_EXCL_LINE
+    }
+#endif
+
+    EC = increment();
+  }
+
+  ~RealFSDirFDIter() override
+  {
+#ifdef __linux__
+    ::close(FD);
+#else
+    if (Dir)
+      ::closedir(Dir);
+#endif
+  }
+
+  std::error_code increment() override
+  {
+    std::error_code EC;
+    unsigned char DType;
+    while (const char* Name = next(DType, EC))
+    {
+      if (!std::strcmp(Name, ".") || !std::strcmp(Name, ".."))
+        continue;
+
+      std::string Path = Prefix + "/" + Name;
+      file_type Type = TypeFromDirent(DType);
+      if (Type != file_type::type_unknown && Resolver)
+      {
+        CurrentEntry = Status::fromDirectoryEntry(Path, Type, Resolver);
+        return EC;
+      }
+
+      // report a dangling symlink as such, rather than failing.
+      struct stat Buf;
+      if (::fstatat(FD, Name, &Buf, 0) != 0 && ::fstatat(FD, Name, &Buf, AT_SYMLINK_NOFOLLOW) != 0)
+        return LastError(); // LCOV_EXCL_LINE
+
+      CurrentEntry = StatusFromStat(Buf, Path, "");
+      return EC;
+    }
 
-  // FIXME(jbenden): Handle the fact that we are rooted at MountPoint.
-  return llvm::sys::fs::set_current_path(Path);
-}
+    CurrentEntry = Status();
+    return EC;
+  }
+};
+#endif
 
-namespace
-{
 class RealFSDirIter : public u::vfs::detail::DirIterImpl
 {
-  Twine MountPoint;
+  std::string MountPoint;
   llvm::sys::fs::directory_iterator Iter;
 
 public:
-  RealFSDirIter(const Twine& MP, const Twine& Path, std::error_code& EC)
-    : MountPoint{MP}
+  RealFSDirIter(StringRef MP, const Twine& Path, std::error_code& EC)
+    : MountPoint{MP.str()}
     , Iter(Path, EC)
   {
     if (!EC && Iter != llvm::sys::fs::directory_iterator())
     {
       llvm::sys::fs::file_status S;
       EC = Iter->status(S);
-      CurrentEntry = Status::copyWithNewName(S, Iter->path(), MountPoint.str());
+      CurrentEntry = Status::copyWithNewName(S, Iter->path(), MountPoint);
     }
   }
 
@@ -431,7 +1557,7 @@ public:
     {
       llvm::sys::fs::file_status S;
       EC = Iter->status(S);
-      CurrentEntry = Status::copyWithNewName(S, Iter->path(), MountPoint.str());
+      CurrentEntry = Status::copyWithNewName(S, Iter->path(), MountPoint);
     }
     return EC;
   }
@@ -441,9 +1567,29 @@ public:
 directory_iterator
 RealFileSystem::dir_begin(const Twine& Dir, std::error_code& EC)
 {
-  auto final = PhysicalToVirtualPath(MountPoint, Dir.str());
+  SmallString<256> Storage;
+  StringRef Relative = getRelativePath(Dir, Storage);
+
+#ifdef LLVM_ON_UNIX
+  if (MountFD >= 0)
+  {
+    int FD = ::openat(MountFD, Relative.data(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (FD < 0)
+    {
+      EC = LastError();
+      return directory_iterator();
+    }
+
+    StringRef Trimmed = Relative.rtrim('/');
+    std::string Prefix = Trimmed == "." ? std::string() : "/" + Trimmed.str();
+    return directory_iterator(std::make_shared<RealFSDirFDIter>(FD, std::move(Prefix), EntryResolver, EC));
+  }
+#endif
+
+  SmallString<256> Physical{MountPoint};
+  llvm::sys::path::append(Physical, Relative);
 
-  return directory_iterator(std::make_shared<RealFSDirIter>(MountPoint, final, EC));
+  return directory_iterator(std::make_shared<RealFSDirIter>(MountPoint, Physical, EC));
 }
 
 //===-----------------------------------------------------------------------===/
@@ -469,6 +1615,11 @@ OverlayFileSystem::status(const Twine& Path)
   // FIXME: handle symlinks that cross file systems
   for (iterator I = overlays_begin(), E = overlays_end(); I != E; ++I)
   {
+    if (!(*I)->mayContain(Path))
+    {
+      continue;
+    }
+
     ErrorOr<Status> Status = (*I)->status(Path);
     if (Status || Status.getError() != llvm::errc::no_such_file_or_directory)
       return Status;
@@ -482,6 +1633,11 @@ OverlayFileSystem::openFileForRead(const llvm::Twine& Path)
   // FIXME: handle symlinks that cross file systems
   for (iterator I = overlays_begin(), E = overlays_end(); I != E; ++I)
   {
+    if (!(*I)->mayContain(Path))
+    {
+      continue;
+    }
+
     auto Result = (*I)->openFileForRead(Path);
     if (Result || Result.getError() != llvm::errc::no_such_file_or_directory)
       return Result;
@@ -489,6 +1645,14 @@ OverlayFileSystem::openFileForRead(const llvm::Twine& Path)
   return make_error_code(llvm::errc::no_such_file_or_directory);
 }
 
+bool
+OverlayFileSystem::mayContain(const Twine& Path)
+{
+  return std::any_of(FSList.begin(), FSList.end(), [&Path](IntrusiveRefCntPtr<FileSystem> const& FS) {
+    return FS->mayContain(Path);
+  });
+}
+
 llvm::ErrorOr<std::string>
 OverlayFileSystem::getCurrentWorkingDirectory() const
 {
@@ -662,7 +1826,11 @@ public:
 
 class InMemoryDirectory : public InMemoryNode
 {
-  std::map<std::string, std::unique_ptr<InMemoryNode>> Entries;
+  /// \brief The children, in the order they were added.
+  std::vector<std::unique_ptr<InMemoryNode>> Entries;
+
+  /// \brief The position of each child in Entries, by its interned name.
+  llvm::DenseMap<const char*, unsigned> Index;
 
 public:
   explicit InMemoryDirectory(Status Stat)
@@ -670,17 +1838,21 @@ public:
   {
   }
 
+  /// \pre \p Name was interned by the file system holding this directory.
   InMemoryNode* getChild(StringRef Name)
   {
-    auto I = Entries.find(Name);
-    if (I != Entries.end())
-      return I->second.get();
+    auto I = Index.find(Name.data());
+    if (I != Index.end())
+      return Entries[I->second].get();
     return nullptr;
   }
 
+  /// \pre \p Name was interned by the file system holding this directory.
   InMemoryNode* addChild(StringRef Name, std::unique_ptr<InMemoryNode> Child)
   {
-    return Entries.insert(make_pair(Name, std::move(Child))).first->second.get();
+    Index.insert(std::make_pair(Name.data(), static_cast<unsigned>(Entries.size())));
+    Entries.push_back(std::move(Child));
+    return Entries.back().get();
   }
 
   typedef decltype(Entries)::const_iterator const_iterator;
@@ -709,33 +1881,86 @@ InMemoryFileSystem::InMemoryFileSystem(bool UseNormalizedPaths)
 
 InMemoryFileSystem::~InMemoryFileSystem() {}
 
+namespace
+{
+/// Split \p Path into the components llvm::sys::path::begin would yield,
+/// should it be absolute and without any empty, "." or ".." components.
 bool
-InMemoryFileSystem::addFile(const Twine& P, time_t ModificationTime, std::unique_ptr<llvm::MemoryBuffer> Buffer)
+splitNormalizedPath(StringRef Path, SmallVectorImpl<StringRef>& Components)
 {
-  SmallString<128> Path;
-  P.toVector(Path);
+  if (Path.empty() || Path.front() != '/' || (Path.size() > 1 && Path.back() == '/') ||
+      Path.find('\\') != StringRef::npos)
+  {
+    return false;
+  }
+
+  // the root is a component of its own.
+  Components.push_back(Path.substr(0, 1));
+  for (StringRef Rest = Path.substr(1); !Rest.empty();)
+  {
+    auto Split = Rest.split('/');
+    if (Split.first.empty() || Split.first == "." || Split.first == "..")
+    {
+      Components.clear();
+      return false;
+    }
+
+    Components.push_back(Split.first);
+    Rest = Split.second;
+  }
+
+  return true;
+}
+} // end anonymous namespace
+
+StringRef
+InMemoryFileSystem::splitPath(const Twine& P,
+                              SmallVectorImpl<char>& Storage,
+                              SmallVectorImpl<StringRef>& Components) const
+{
+  StringRef Path = P.toStringRef(Storage);
+  if (splitNormalizedPath(Path, Components))
+    return Path;
+
+  SmallString<128> Full{Path};
 
   // Fix up relative paths. This just prepends the current working directory.
-  std::error_code EC = makeAbsolute(Path);
+  std::error_code EC = makeAbsolute(Full);
   assert(!EC);
   (void) EC;
 
   if (useNormalizedPaths())
-    llvm::sys::path::remove_dots(Path, /*remove_dot_dot=*/true);
+    llvm::sys::path::remove_dots(Full, /*remove_dot_dot=*/true);
+
+  Storage.assign(Full.begin(), Full.end());
+  Path = StringRef(Storage.data(), Storage.size());
+
+  for (auto I = llvm::sys::path::begin(Path), E = llvm::sys::path::end(Path); I != E; ++I)
+    Components.push_back(*I);
 
-  if (Path.empty())
+  return Path;
+}
+
+bool
+InMemoryFileSystem::addFileAt(SmallVectorImpl<detail::InMemoryDirectory*>& Chain,
+                              llvm::ArrayRef<StringRef> Components,
+                              const Twine& P,
+                              time_t ModificationTime,
+                              std::unique_ptr<llvm::MemoryBuffer> Buffer)
+{
+  if (Components.empty())
     return false; // LCOV_EXCL_LINE
 
-  detail::InMemoryDirectory* Dir = Root.get();
-  auto I = llvm::sys::path::begin(Path), E = llvm::sys::path::end(Path);
-  while (true)
+  const char* PathStart = Components.front().data();
+  for (size_t i = Chain.size() - 1; i < Components.size(); ++i)
   {
-    StringRef Name = *I;
+    detail::InMemoryDirectory* Dir = Chain.back();
+    StringRef Name = Names.insert(Components[i]).first->getKey();
     detail::InMemoryNode* Node = Dir->getChild(Name);
-    ++I;
+    bool Last = i + 1 == Components.size();
     if (!Node)
     {
-      if (I == E)
+      if (Last)
       {
         // End of the path, create a new file.
         // FIXME: expose the status details in the interface.
@@ -754,7 +1979,7 @@ InMemoryFileSystem::addFile(const Twine& P, time_t ModificationTime, std::unique
 
       // Create a new directory. Use the path up to here.
       // FIXME: expose the status details in the interface.
-      Status Stat(StringRef(Path.str().begin(), Name.end() - Path.str().begin()),
+      Status Stat(StringRef(PathStart, Components[i].end() - PathStart),
                   getNextVirtualUniqueID(),
                   llvm::sys::toTimePoint(ModificationTime), // LCOV_EXCL_LINE
                   0,
@@ -763,27 +1988,44 @@ InMemoryFileSystem::addFile(const Twine& P, time_t ModificationTime, std::unique
                   llvm::sys::fs::file_type::directory_file,
                   llvm::sys::fs::all_all,
                   "");
-      Dir = cast<detail::InMemoryDirectory>(
-        Dir->addChild(Name, llvm::make_unique<detail::InMemoryDirectory>(std::move(Stat))));
+      Chain.push_back(cast<detail::InMemoryDirectory>(
+        Dir->addChild(Name, llvm::make_unique<detail::InMemoryDirectory>(std::move(Stat)))));
       continue;
     }
 
     if (auto* NewDir = dyn_cast<detail::InMemoryDirectory>(Node)) // LCOV_EXCL_LINE
     {
-      Dir = NewDir; // LCOV_EXCL_LINE
+      // Trying to insert a file in place of a directory.
+      if (Last)
+        return false;
+
+      Chain.push_back(NewDir);
     }
     else
     {
       assert(isa<detail::InMemoryFile>(Node) && "Must be either file or directory!"); // LCOV_EXCL_LINE
 
       // Trying to insert a directory in place of a file.
-      if (I != E) // LCOV_EXCL_LINE
-        return false; // LCOV_EXCL_LINE
+      if (!Last)
+        return false;
 
       // Return false only if the new file is different from the existing one.
       return cast<detail::InMemoryFile>(Node)->getBuffer()->getBuffer() == Buffer->getBuffer();
     }
   }
+
+  return false; // LCOV_EXCL_LINE
+}
+
+bool
+InMemoryFileSystem::addFile(const Twine& P, time_t ModificationTime, std::unique_ptr<llvm::MemoryBuffer> Buffer)
+{
+  SmallString<128> Storage;
+  SmallVector<StringRef, 8> Components;
+  splitPath(P, Storage, Components);
+
+  SmallVector<detail::InMemoryDirectory*, 8> Chain{Root.get()};
+  return addFileAt(Chain, Components, P, ModificationTime, std::move(Buffer));
 }
 
 bool
@@ -793,27 +2035,65 @@ InMemoryFileSystem::addFileNoOwn(const Twine& P, time_t ModificationTime, llvm::
     P, ModificationTime, llvm::MemoryBuffer::getMemBuffer(Buffer->getBuffer(), Buffer->getBufferIdentifier()));
 }
 
-static ErrorOr<detail::InMemoryNode*>
-lookupInMemoryNode(const InMemoryFileSystem& FS, detail::InMemoryDirectory* Dir, const Twine& P)
-{
-  SmallString<128> Path;
-  P.toVector(Path);
+bool
+InMemoryFileSystem::addFiles(time_t ModificationTime,
+                             std::vector<std::pair<std::string, std::unique_ptr<llvm::MemoryBuffer>>> Files)
+{
+  // order the files by their normalized path, so that those sharing a
+  // directory are added one after another.
+  std::vector<std::pair<std::string, size_t>> Order;
+  Order.reserve(Files.size());
+  for (size_t i = 0; i < Files.size(); ++i)
+  {
+    SmallString<128> Storage;
+    SmallVector<StringRef, 8> Components;
+    Order.emplace_back(splitPath(Files[i].first, Storage, Components).str(), i);
+  }
 
-  // Fix up relative paths. This just prepends the current working directory.
-  std::error_code EC = FS.makeAbsolute(Path);
-  assert(!EC);
-  (void) EC;
+  std::sort(Order.begin(), Order.end());
 
-  if (FS.useNormalizedPaths())
-    llvm::sys::path::remove_dots(Path, /*remove_dot_dot=*/true);
+  bool Added = true;
+  SmallVector<detail::InMemoryDirectory*, 8> Chain{Root.get()};
+  SmallVector<StringRef, 8> Previous;
+  for (auto& Entry : Order)
+  {
+    SmallString<128> Storage;
+    SmallVector<StringRef, 8> Components;
+    splitPath(Entry.first, Storage, Components);
+
+    // resume from the deepest directory shared with the previous file.
+    size_t Shared = 0;
+    while (Shared + 1 < Components.size() && Shared + 1 < Previous.size() && Shared + 1 < Chain.size() &&
+           Components[Shared] == Previous[Shared])
+    {
+      ++Shared;
+    }
+
+    Chain.resize(Shared + 1);
+    Added &= addFileAt(Chain, Components, Files[Entry.second].first, ModificationTime, std::move(Files[Entry.second].second));
+    Previous = std::move(Components);
+  }
 
-  if (Path.empty())
+  return Added;
+}
+
+static ErrorOr<detail::InMemoryNode*>
+lookupInMemoryNode(const llvm::StringSet<>& Names,
+                   detail::InMemoryDirectory* Dir,
+                   ArrayRef<StringRef> Components)
+{
+  if (Components.empty())
     return Dir; // LCOV_EXCL_LINE
 
-  auto I = llvm::sys::path::begin(Path), E = llvm::sys::path::end(Path);
+  auto I = Components.begin(), E = Components.end();
   while (true)
   {
-    detail::InMemoryNode* Node = Dir->getChild(*I);
+    // a name never added cannot be the child of any directory.
+    auto Name = Names.find(*I);
+    if (Name == Names.end())
+      return errc::no_such_file_or_directory;
+
+    detail::InMemoryNode* Node = Dir->getChild(Name->getKey());
     ++I;
     if (!Node)
       return errc::no_such_file_or_directory; // LCOV_EXCL_LINE
@@ -836,7 +2116,11 @@ lookupInMemoryNode(const InMemoryFileSystem& FS, detail::InMemoryDirectory* Dir,
 llvm::ErrorOr<Status>
 InMemoryFileSystem::status(const Twine& Path)
 {
-  auto Node = lookupInMemoryNode(*this, Root.get(), Path);
+  SmallString<128> Storage;
+  SmallVector<StringRef, 8> Components;
+  splitPath(Path, Storage, Components);
+
+  auto Node = lookupInMemoryNode(Names, Root.get(), Components);
   if (Node)
     return (*Node)->getStatus();
   return Node.getError();
@@ -845,7 +2129,11 @@ InMemoryFileSystem::status(const Twine& Path)
 llvm::ErrorOr<std::unique_ptr<File>>
 InMemoryFileSystem::openFileForRead(const Twine& Path)
 {
-  auto Node = lookupInMemoryNode(*this, Root.get(), Path);
+  SmallString<128> Storage;
+  SmallVector<StringRef, 8> Components;
+  splitPath(Path, Storage, Components);
+
+  auto Node = lookupInMemoryNode(Names, Root.get(), Components);
   if (!Node)
     return Node.getError(); // LCOV_EXCL_LINE
 
@@ -874,7 +2162,7 @@ public:
     , E(Dir.end())
   {
     if (I != E)
-      CurrentEntry = I->second->getStatus();
+      CurrentEntry = (*I)->getStatus();
   }
 
   std::error_code increment() override
@@ -882,7 +2170,7 @@ public:
     ++I;
     // When we're at the end, make CurrentEntry invalid and DirIterImpl will do
     // the rest.
-    CurrentEntry = I != E ? I->second->getStatus() : Status();
+    CurrentEntry = I != E ? (*I)->getStatus() : Status();
     return std::error_code{};
   }
 };
@@ -891,7 +2179,11 @@ public:
 directory_iterator
 InMemoryFileSystem::dir_begin(const Twine& Dir, std::error_code& EC)
 {
-  auto Node = lookupInMemoryNode(*this, Root.get(), Dir);
+  SmallString<128> Storage;
+  SmallVector<StringRef, 8> Components;
+  splitPath(Dir, Storage, Components);
+
+  auto Node = lookupInMemoryNode(Names, Root.get(), Components);
   if (!Node)
   {
     EC = Node.getError();
@@ -927,17 +2219,119 @@ InMemoryFileSystem::setCurrentWorkingDirectory(const Twine& P)
 //===-----------------------------------------------------------------------===/
 // ConcatenatedOverlayFileSystem implementation
 //===-----------------------------------------------------------------------===/
-ConcatenatedOverlayFileSystem::ConcatenatedOverlayFileSystem(IntrusiveRefCntPtr<FileSystem> BaseFS)
+namespace
 {
-  FSList.push_back(std::move(BaseFS));
+
+/// A MemoryBuffer over storage kept alive by \p Owner, for as long as any
+/// buffer handed out over it.
+class SharedMemoryBuffer : public MemoryBuffer
+{
+  std::shared_ptr<const void> Owner;
+
+public:
+  SharedMemoryBuffer(std::shared_ptr<const void> O, StringRef Data, bool RequiresNullTerminator)
+    : Owner(std::move(O))
+  {
+    init(Data.begin(), Data.end(), RequiresNullTerminator);
+  }
+
+  BufferKind getBufferKind() const override { return MemoryBuffer_Malloc; } // LCOV_EXCL_LINE
+};
+
+} // end anonymous namespace
+
+std::unique_ptr<MemoryBuffer>
+getSharedMemBuffer(std::shared_ptr<const void> Owner, StringRef Data, bool RequiresNullTerminator)
+{
+  return std::unique_ptr<MemoryBuffer>(new SharedMemoryBuffer(std::move(Owner), Data, RequiresNullTerminator));
 }
 
-ConcatenatedOverlayFileSystem::~ConcatenatedOverlayFileSystem()
+namespace detail
+{
+
+/// The contents of a file across the layers of a concatenated overlay.
+struct ConcatenatedContents
 {
-  for (auto item : Cleanup)
+  Status Stat;
+
+  /// The buffer read from each layer, in the order of the segments.
+  std::vector<std::unique_ptr<MemoryBuffer>> Buffers;
+
+  std::vector<ConcatenatedFile::Segment> Segments;
+
+  /// The joined contents; built on first use, unless a single buffer
+  /// already holds the contents in full. The contents are shared by every
+  /// manager of the same stack, so any number of threads may race to join.
+  std::unique_ptr<MemoryBuffer> Joined;
+  std::once_flag JoinOnce;
+
+  StringRef getData()
   {
-    delete reinterpret_cast<detail::InMemoryFile*>(item);
+    if (Buffers.size() == 1 && Segments.front().Size == Stat.getSize())
+    {
+      return Buffers.front()->getBuffer();
+    }
+
+    std::call_once(JoinOnce, [this] {
+      Joined = MemoryBuffer::getNewMemBuffer(Stat.getSize(), Stat.getName());
+
+      auto* Out = const_cast<char*>(Joined->getBufferStart());
+      for (size_t i = 0; i < Segments.size(); ++i)
+      {
+        memcpy(Out + Segments[i].Offset, Buffers[i]->getBufferStart(), Segments[i].Size);
+
+        auto End = i + 1 < Segments.size() ? Segments[i + 1].Offset : Stat.getSize();
+        if (End != Segments[i].Offset + Segments[i].Size)
+        {
+          Out[End - 1] = '\n';
+        }
+      }
+    });
+
+    return Joined->getBuffer();
   }
+};
+
+} // end namespace detail
+
+ConcatenatedFile::ConcatenatedFile(std::shared_ptr<detail::ConcatenatedContents> C)
+  : Contents(std::move(C))
+{
+}
+
+ErrorOr<Status>
+ConcatenatedFile::status()
+{
+  return Contents->Stat;
+}
+
+ErrorOr<std::unique_ptr<MemoryBuffer>>
+ConcatenatedFile::getBuffer(const Twine& Name, uint64_t FileSize, bool RequiresNullTerminator, bool IsVolatile)
+{
+  return getSharedMemBuffer(Contents, Contents->getData(), RequiresNullTerminator);
+}
+
+llvm::ArrayRef<ConcatenatedFile::Segment>
+ConcatenatedFile::getSegments() const
+{
+  return Contents->Segments;
+}
+
+unsigned
+ConcatenatedFile::getLayerForOffset(uint64_t Offset) const
+{
+  auto& Segments = Contents->Segments;
+  auto It = std::upper_bound(Segments.begin(), Segments.end(), Offset, [](uint64_t O, Segment const& S) {
+    return O < S.Offset;
+  });
+
+  return It == Segments.begin() ? 0u : std::prev(It)->Layer;
+}
+
+ConcatenatedOverlayFileSystem::ConcatenatedOverlayFileSystem(IntrusiveRefCntPtr<FileSystem> BaseFS)
+  : NextSweep{64}
+{
+  FSList.push_back(std::move(BaseFS));
 }
 
 void
@@ -954,6 +2348,11 @@ ConcatenatedOverlayFileSystem::status(const Twine& Path)
 {
   for (iterator I = overlays_begin(), E = overlays_end(); I != E; ++I)
   {
+    if (!(*I)->mayContain(Path))
+    {
+      continue;
+    }
+
     ErrorOr<Status> Status = (*I)->status(Path);
     if (Status || Status.getError() != llvm::errc::no_such_file_or_directory)
       return Status;
@@ -961,74 +2360,214 @@ ConcatenatedOverlayFileSystem::status(const Twine& Path)
   return make_error_code(llvm::errc::no_such_file_or_directory);
 }
 
+std::shared_ptr<detail::ConcatenatedContents>
+ConcatenatedOverlayFileSystem::findOpenFile(llvm::StringRef Key)
+{
+  auto Cached = OpenFiles.find(Key);
+  if (Cached == OpenFiles.end())
+  {
+    return nullptr;
+  }
+
+  auto Contents = Cached->second.lock();
+  if (!Contents)
+  {
+    OpenFiles.erase(Cached);
+  }
+
+  return Contents;
+}
+
+void
+ConcatenatedOverlayFileSystem::rememberOpenFile(llvm::StringRef Key, File& F)
+{
+  // forget the contents released since, once they could outnumber those in use.
+  if (OpenFiles.size() >= NextSweep)
+  {
+    for (auto I = OpenFiles.begin(), E = OpenFiles.end(); I != E;)
+    {
+      auto Current = I++;
+      if (Current->second.expired())
+      {
+        OpenFiles.erase(Current);
+      }
+    }
+
+    NextSweep = 2 * OpenFiles.size() + 64;
+  }
+
+  OpenFiles[Key] = static_cast<ConcatenatedFile&>(F).Contents;
+}
+
 ErrorOr<std::unique_ptr<File>>
 ConcatenatedOverlayFileSystem::openFileForRead(const llvm::Twine& Path)
 {
-  // Get file stat for creation of faked Status object
-  auto S = status(Path);
-  if (!S)
-    return make_error_code((errc) S.getError().value()); // LCOV_EXCL_LINE
+  auto Key = getNormalizedPath(*this, Path);
 
-  // Figure out the total buffer size needed for the file concatenation.
-  uint64_t bufferSize{0};
-  for (iterator I = overlays_begin(), E = overlays_end(); I != E; ++I)
+  // repeated opens share the contents read by the first.
+  if (auto Contents = findOpenFile(Key))
   {
-    auto Result = (*I)->openFileForRead(Path);
-    if (!Result && Result.getError() != llvm::errc::no_such_file_or_directory)
+    return std::unique_ptr<File>(new ConcatenatedFile(std::move(Contents)));
+  }
+
+  auto Result = concatenate(Path, [&](size_t Layer) { return FSList[Layer]->openFileForRead(Path); });
+  if (Result)
+  {
+    rememberOpenFile(Key, **Result);
+  }
+
+  return Result;
+}
+
+FileBatch
+ConcatenatedOverlayFileSystem::openFilesForRead(llvm::ArrayRef<std::string> Paths)
+{
+  FileBatch Result;
+  Result.reserve(Paths.size());
+
+  // what each layer holds of each path, opened a layer at a time.
+  std::vector<FileBatch> Opened(Paths.size());
+  std::vector<std::string> Keys;
+  std::vector<std::shared_ptr<detail::ConcatenatedContents>> Shared;
+  Keys.reserve(Paths.size());
+  Shared.reserve(Paths.size());
+  for (auto& Path : Paths)
+  {
+    Keys.push_back(getNormalizedPath(*this, Path));
+    Shared.push_back(findOpenFile(Keys.back()));
+  }
+
+  for (size_t Layer = 0; Layer < FSList.size(); ++Layer)
+  {
+    std::vector<std::string> Batch;
+    std::vector<size_t> Owners;
+    for (size_t i = 0; i < Paths.size(); ++i)
     {
-      // got big error!
-      return Result; // LCOV_EXCL_LINE
+      if (!Shared[i] && FSList[Layer]->mayContain(Paths[i]))
+      {
+        Batch.push_back(Paths[i]);
+        Owners.push_back(i);
+      }
+    }
+
+    auto Files = Batch.empty() ? FileBatch() : FSList[Layer]->openFilesForRead(Batch);
+    for (size_t i = 0; i < Paths.size(); ++i)
+    {
+      Opened[i].push_back(make_error_code(llvm::errc::no_such_file_or_directory));
+    }
+    for (size_t j = 0; j < Files.size(); ++j)
+    {
+      Opened[Owners[j]][Layer] = std::move(Files[j]);
+    }
+  }
+
+  for (size_t i = 0; i < Paths.size(); ++i)
+  {
+    // the same path may occur earlier in the batch.
+    if (!Shared[i])
+    {
+      Shared[i] = findOpenFile(Keys[i]);
+    }
+
+    if (Shared[i])
+    {
+      Result.push_back(std::unique_ptr<File>(new ConcatenatedFile(std::move(Shared[i]))));
+      continue;
     }
-    else if (Result)
+
+    auto File = concatenate(Paths[i], [&](size_t Layer) { return std::move(Opened[i][Layer]); });
+    if (File)
     {
-      // got an entry!
-      bufferSize += (*Result)->status()->getSize() + 1;
+      rememberOpenFile(Keys[i], **File);
     }
+    Result.push_back(std::move(File));
   }
 
-  // Create a buffer to fill with the concatenation.
-  std::unique_ptr<MemoryBuffer> memoryBuffer = MemoryBuffer::getNewMemBuffer(bufferSize, Path.str());
+  return Result;
+}
+
+ErrorOr<std::unique_ptr<File>>
+ConcatenatedOverlayFileSystem::concatenate(const Twine& Path,
+                                           llvm::function_ref<ErrorOr<std::unique_ptr<File>>(size_t)> OpenLayer)
+{
+  auto Contents = std::make_shared<detail::ConcatenatedContents>();
+  ErrorOr<Status> TopMost = make_error_code(llvm::errc::no_such_file_or_directory);
 
-  // Perform concatenation, into our new buffer.
+  // Open, stat and read each layer once, from the bottom-most up.
   uint64_t offset{0};
   for (reverse_iterator I = overlays_rbegin(), E = overlays_rend(); I != E; ++I)
   {
-    auto Result = (*I)->openFileForRead(Path);
-    if (!Result && Result.getError() != llvm::errc::no_such_file_or_directory)
+    if (!(*I)->mayContain(Path))
+    {
+      continue;
+    }
+
+    auto Result = OpenLayer(static_cast<size_t>(I - overlays_rbegin()));
+    if (!Result && Result.getError() == llvm::errc::no_such_file_or_directory)
+    {
+      continue;
+    }
+    else if (!Result)
     {
       // got big error!
       return Result; // LCOV_EXCL_LINE
     }
-    else if (Result)
+
+    auto S = (*Result)->status();
+    if (!S)
+    {
+      return S.getError(); // LCOV_EXCL_LINE
+    }
+
+    if (S->isDirectory())
     {
-      // got an entry!
-      uint64_t fileSize = (*Result)->status()->getSize();
+      return make_error_code(llvm::errc::is_a_directory); // LCOV_EXCL_LINE
+    }
 
-      auto FileContent = (*Result)->getBuffer(Path.str(), fileSize);
-      memcpy(const_cast<char*>(memoryBuffer->getBufferStart()) + offset, (*FileContent)->getBufferStart(), fileSize);
+    auto FileContent = (*Result)->getBuffer(Path, S->getSize());
+    if (!FileContent)
+    {
+      return FileContent.getError(); // LCOV_EXCL_LINE
+    }
 
-      memset(const_cast<char*>(memoryBuffer->getBufferStart()) + offset + fileSize, '\n', 1);
+    uint64_t fileSize = (*FileContent)->getBufferSize();
+    Contents->Segments.push_back(ConcatenatedFile::Segment{offset, fileSize, static_cast<unsigned>(I - overlays_rbegin())});
 
-      offset += fileSize + 1;
+    // separate this layer from the next, unless it already ends a line.
+    offset += fileSize;
+    if (!(*FileContent)->getBuffer().endswith("\n"))
+    {
+      ++offset;
     }
-  }
 
-  // Create dummy InMemory wrappers for our new content.
-  Status Stat(Path.str(),
-              getNextVirtualUniqueID(),
-              S->getLastModificationTime(), // LCOV_EXCL_LINE
-              0,
-              0,
-              memoryBuffer->getBufferSize(),
-              S->getType(),
-              S->getPermissions(),
-              "");
+    Contents->Buffers.push_back(std::move(*FileContent));
+    TopMost = std::move(S);
+  }
 
-  auto* F = new detail::InMemoryFile(std::move(Stat), std::move(memoryBuffer));
+  if (!TopMost)
+  {
+    return TopMost.getError();
+  }
 
-  Cleanup.push_back(F);
+  Contents->Stat = Status(Path.str(),
+                          getNextVirtualUniqueID(),
+                          TopMost->getLastModificationTime(), // LCOV_EXCL_LINE
+                          0,
+                          0,
+                          offset,
+                          TopMost->getType(),
+                          TopMost->getPermissions(),
+                          "");
+
+  return std::unique_ptr<File>(new ConcatenatedFile(std::move(Contents)));
+}
 
-  return std::unique_ptr<File>(new detail::InMemoryFileAdaptor(*F));
+bool
+ConcatenatedOverlayFileSystem::mayContain(const Twine& Path)
+{
+  return std::any_of(FSList.begin(), FSList.end(), [&Path](IntrusiveRefCntPtr<FileSystem> const& FS) {
+    return FS->mayContain(Path);
+  });
 }
 
 llvm::ErrorOr<std::string>
@@ -1161,6 +2700,88 @@ recursive_directory_iterator::increment(std::error_code& EC)
   return *this;
 }
 
+std::error_code
+vfs::walkInParallel(FileSystem& FS, const Twine& Dir, llvm::function_ref<void(const Status&)> Visit, unsigned NumThreads)
+{
+  if (NumThreads == 0)
+    NumThreads = std::max(1u, std::thread::hardware_concurrency());
+
+  /// \brief A directory yet to be read, with those it was reached through;
+  /// a link back to any of them would have the walk go round forever.
+  struct PendingDir
+  {
+    std::string Path;
+    std::vector<UniqueID> Ancestors;
+  };
+
+  std::vector<UniqueID> Root;
+  if (auto S = FS.status(Dir))
+    Root.push_back(S->getUniqueID());
+
+  std::mutex Mutex;
+  std::condition_variable Ready;
+  std::vector<PendingDir> Pending{PendingDir{Dir.str(), std::move(Root)}};
+  unsigned Busy = 0;
+  std::error_code Result;
+
+  auto Work = [&]() {
+    std::unique_lock<std::mutex> Lock(Mutex);
+    while (true)
+    {
+      // the walk is over once nothing is pending, nor may be found.
+      Ready.wait(Lock, [&] { return !Pending.empty() || Busy == 0; });
+      if (Pending.empty())
+        break;
+
+      PendingDir Next = std::move(Pending.back());
+      Pending.pop_back();
+      ++Busy;
+      Lock.unlock();
+
+      std::vector<PendingDir> Found;
+      std::error_code EC;
+      for (directory_iterator I = FS.dir_begin(Next.Path, EC), E; I != E && !EC; I.increment(EC))
+      {
+        Visit(*I);
+        if (!I->isDirectory())
+          continue;
+
+        // an entry reached through a symlink may be a directory already
+        // being read; those without an identity are taken as they come.
+        UniqueID ID = I->getUniqueID();
+        if (ID != UniqueID() && std::find(Next.Ancestors.begin(), Next.Ancestors.end(), ID) != Next.Ancestors.end())
+          continue;
+
+        Found.push_back(PendingDir{I->getName().str(), Next.Ancestors});
+        Found.back().Ancestors.push_back(ID);
+      }
+
+      Lock.lock();
+      --Busy;
+      if (EC && !Result)
+        Result = EC;
+
+      if (Result)
+        Pending.clear();
+      else
+        Pending.insert(Pending.end(), std::make_move_iterator(Found.begin()), std::make_move_iterator(Found.end()));
+
+      Ready.notify_all();
+    }
+  };
+
+  // the pool is shared, so only the helpers of this walk are waited for.
+  std::vector<decltype(getWorkerPool().async(Work))> Helpers;
+  for (unsigned i = 1; i < NumThreads; ++i)
+    Helpers.push_back(getWorkerPool().async(Work));
+
+  Work();
+  for (auto& Helper : Helpers)
+    Helper.wait();
+
+  return Result;
+}
+
 UniqueID vfs::getNextVirtualUniqueID()
 {
   static std::atomic<unsigned> UID;
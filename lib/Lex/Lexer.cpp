@@ -33,6 +33,7 @@
 #include <llvm/ADT/DenseSet.h>
 #include <llvm/ADT/APFloat.h>
 #include <llvm/ADT/APInt.h>
+#include <llvm/ADT/StringExtras.h>
 #include <llvm/Support/ErrorHandling.h>
 #ifdef __clang__
 #pragma clang diagnostic pop
@@ -63,53 +64,75 @@ Lexer::Lexer(u::Source& source)
   : SM{std::make_shared<SourceManager>()}
   , Diags{std::make_shared<DiagnosticEngine>(SM)}
   , source_{source}
-  , id_{source_.getLocation().getFileID()}
-  , fileName_{source_.getLocation().getFileName()}
-  , filePath_{source_.getLocation().getFilePath()}
-  , sourceRange_{source_.getLocation().getRange()}
+  , FID_{SM->createFileID(source_)}
+  , fileStart_{SM->getLocForStartOfFile(FID_)}
+  , prevOffset_{0}
+  , curOffset_{0}
+  , nextOffset_{0}
   , curValid_{0}
 {
+  if (FID_.isValid())
+  {
+    SM->pinFile(FID_);
+  }
 }
 
 Lexer::Lexer(std::shared_ptr<DiagnosticEngine> D, u::Source& source) // NOLINT
   : SM{D->getSourceManager()}
   , Diags{D} // NOLINT
   , source_{source}
-  , id_{source_.getLocation().getFileID()}
-  , fileName_{source_.getLocation().getFileName()}
-  , filePath_{source_.getLocation().getFilePath()}
-  , sourceRange_{source_.getLocation().getRange()}
+  , FID_{SM->createFileID(source_)}
+  , fileStart_{SM->getLocForStartOfFile(FID_)}
+  , prevOffset_{0}
+  , curOffset_{0}
+  , nextOffset_{0}
   , curValid_{0}
 {
+  if (FID_.isValid())
+  {
+    SM->pinFile(FID_);
+  }
 }
 
 Lexer::Lexer(std::shared_ptr<SourceManager> M, std::shared_ptr<DiagnosticEngine> D, u::Source& source) // NOLINT
   : SM{M} // NOLINT
   , Diags{D} // NOLINT
   , source_{source}
-  , id_{source_.getLocation().getFileID()}
-  , fileName_{source_.getLocation().getFileName()}
-  , filePath_{source_.getLocation().getFilePath()}
-  , sourceRange_{source_.getLocation().getRange()}
+  , FID_{SM->createFileID(source_)}
+  , fileStart_{SM->getLocForStartOfFile(FID_)}
+  , prevOffset_{0}
+  , curOffset_{0}
+  , nextOffset_{0}
   , curValid_{0}
 {
+  if (FID_.isValid())
+  {
+    SM->pinFile(FID_);
+  }
+}
+
+Lexer::~Lexer()
+{
+  if (FID_.isValid())
+  {
+    SM->unpinFile(FID_);
+  }
 }
 
 uint32_t
 Lexer::NextChar()
 {
-  // increment column
-  sourceRange_.getBegin().incrementColumn();
-  sourceRange_.getEnd().incrementColumn();
+  prevOffset_ = curOffset_;
 
   if (curValid_ > 1)
   {
     --curValid_;
 
+    curOffset_ = nextOffset_;
     return curChar_ = nextChar_;
   }
 
-  return curChar_ = GetChar();
+  return curChar_ = GetChar(curOffset_);
 }
 
 uint32_t
@@ -121,7 +144,7 @@ Lexer::PeekChar()
   }
 
   ++curValid_;
-  return nextChar_ = GetChar();
+  return nextChar_ = GetChar(nextOffset_);
 }
 
 uint32_t
@@ -137,24 +160,28 @@ Lexer::CurChar()
 }
 
 uint32_t
-Lexer::GetChar()
+Lexer::GetChar(uint32_t& Offset)
 {
   if (source_)
   {
     uint32_t ch = source_.Get();
+    Offset = source_.getOffset();
 
-    // insert character into the SourceManager for this file.
-    auto& FI = SM->getOrInsertFileInfo(id_, fileName_, filePath_);
-    FI.AddCharacter(source_.getLocation().getRange().getBegin().getLineNumber(), ch);
+    // malformed input was replaced with U+FFFD; report it and carry on.
+    if (U_UNLIKELY(source_.lastCharWasInvalid()))
+    {
+      Diag(fileStart_.getLocWithOffset(Offset), diag::invalid_utf8);
+    }
 
     return ch;
   }
 
+  Offset = source_.getReadOffset();
   return 0;
 }
 
 Token
-Lexer::ConvertFloat(std::string& num, const SourceLocation& w)
+Lexer::ConvertFloat(std::string& num, const SourceRange& w)
 {
   llvm::APFloat v{-1.0};
 
@@ -163,15 +190,15 @@ Lexer::ConvertFloat(std::string& num, const SourceLocation& w)
   // LCOV_EXCL_START
   if (Result == llvm::APFloat::opOverflow)
   {
-    Diag(w, diag::apreal_overflow) << num;
+    Diag(w.getBegin(), diag::apreal_overflow) << num;
   }
   else if (Result == llvm::APFloat::opUnderflow)
   {
-    Diag(w, diag::apreal_underflow) << num;
+    Diag(w.getBegin(), diag::apreal_underflow) << num;
   }
   else if (Result != llvm::APFloat::opOK)
   {
-    Diag(w, diag::apreal_unknown);
+    Diag(w.getBegin(), diag::apreal_unknown);
   }
   // LCOV_EXCL_STOP
 
@@ -179,7 +206,7 @@ Lexer::ConvertFloat(std::string& num, const SourceLocation& w)
 }
 
 static Token
-ConvertInt(std::string& num, const SourceLocation& w, int base)
+ConvertInt(std::string& num, const SourceRange& w, int base)
 {
   // (Over-)estimate the required number of bits.
   unsigned NumBits = (((unsigned) num.size() * 64) / 19) + 2u;
@@ -277,8 +304,7 @@ Lexer::NumberToken()
       }
       break;
 
-    default:throw std::runtime_error("should not have gotten to this point!"); // LCOV_EXCL_LINE
-      break;
+    default:llvm_unreachable("should not have gotten to this point!"); // LCOV_EXCL_LINE
     }
 
     if (ch == '.' && state != Fraction && base != 16)
@@ -295,16 +321,13 @@ Lexer::NumberToken()
     }
   }
 
-  // adjust the range of this entire Token.
-  w.getRange().getEnd().setColumn(w.getRange().getEnd().getColumn() + num.size() - 1);
-
   // dispatch to float or integer conversion.
   if (isFloat)
   {
-    return ConvertFloat(num, w);
+    return ConvertFloat(num, getTokenRange(w));
   }
 
-  return ConvertInt(num, w, base);
+  return ConvertInt(num, getTokenRange(w), base);
 }
 
 struct HexCodes
@@ -353,14 +376,11 @@ Lexer::StringToken(uint32_t quote, bool longString)
   std::vector<uint32_t> str;
   SourceLocation w = getLocation();
   uint32_t ch = NextChar();
-  bool addTrailing{true};
 
-  // adjust the starting position, based upon if we have a long string.
+  // a long string begins at the first of its three quotes.
   if (longString)
   {
-    auto Pos = w.getRange().getBegin().getColumn();
-    w.getRange().getBegin().setColumn(Pos - 2);
-    w.getRange().getEnd().setColumn(Pos - 2);
+    w = w.getLocWithOffset(-2);
   }
 
   bool bDone = false;
@@ -389,16 +409,8 @@ Lexer::StringToken(uint32_t quote, bool longString)
             {
               str.push_back(quote);
               ch = NextChar();
-
-              // adjust the end column position.
-              auto EndLoc = w.getRange().getEnd().getColumn();
-              w.getRange().getEnd().setColumn(EndLoc + 1);
             }
 
-            // adjust the end column position.
-            auto EndLoc = w.getRange().getEnd().getColumn();
-            w.getRange().getEnd().setColumn(EndLoc + 2);
-
             bDone = true;
             break;
           }
@@ -503,6 +515,13 @@ Lexer::StringToken(uint32_t quote, bool longString)
           Diag(w, diag::bad_hex_digit); // LCOV_EXCL_LINE
         }
 
+        // surrogate halves are not encodable; substitute them.
+        if (value >= 0xD800 && value <= 0xDFFF)
+        {
+          Diag(w, diag::invalid_code_point) << llvm::utohexstr(value);
+          value = ReplacementCharacter;
+        }
+
         ch = value;
       }
         break;
@@ -527,21 +546,6 @@ Lexer::StringToken(uint32_t quote, bool longString)
       continue;
     }
 
-    if (ch == '\n')
-    {
-      // adjust for new-line character.
-      w.getRange().getEnd().incrementLineNumber();
-      w.getRange().getEnd().setColumn(1);
-
-      addTrailing = false;
-    }
-    else
-    {
-      // adjust the end column position.
-      auto EndLoc = w.getRange().getEnd().getColumn();
-      w.getRange().getEnd().setColumn(EndLoc + 1);
-    }
-
     str.push_back(ch);
     ch = NextChar();
 
@@ -554,22 +558,7 @@ Lexer::StringToken(uint32_t quote, bool longString)
       std::string utf8Str;
       utf8::utf32to8(str.begin(), str.end(), std::back_inserter(utf8Str));
 
-      return Token(tok::identifier, w, utf8Str);
-    }
-  }
-
-  if (addTrailing || w.getRange().getEnd().getColumn() == 0)
-  {
-    // adjust ending position, based on the length of the original long string value.
-    if (longString)
-    {
-      auto EndLoc = w.getRange().getEnd().getColumn();
-      w.getRange().getEnd().setColumn(EndLoc + 3);
-    }
-    else
-    {
-      auto EndLoc = w.getRange().getEnd().getColumn();
-      w.getRange().getEnd().setColumn(EndLoc + 1);
+      return Token(tok::identifier, getTokenRange(w), utf8Str);
     }
   }
 
@@ -578,13 +567,13 @@ Lexer::StringToken(uint32_t quote, bool longString)
   if (str.size() == 1)
   {
     // Handle a single character; ie: a Rune
-    return Token(tok::rune_constant, w, llvm::APInt{32, (uint64_t) str[0], false});
+    return Token(tok::rune_constant, getTokenRange(w), llvm::APInt{32, (uint64_t) str[0], false});
   }
 
   std::string utf8Str;
   utf8::utf32to8(str.begin(), str.end(), std::back_inserter(utf8Str));
 
-  return Token(tok::string_constant, w, utf8Str);
+  return Token(tok::string_constant, getTokenRange(w), utf8Str);
 }
 
 Token
@@ -614,15 +603,14 @@ Lexer::Lex()
         comment.push_back(ch);
       }
 
+      auto Range = getTokenRange(w);
+
       NextChar(); // eat the newline
 
       std::string commentStr;
       utf8::utf32to8(comment.begin(), comment.end(), std::back_inserter(commentStr));
 
-      auto EndPos = w.getRange().getEnd().getColumn();
-      w.getRange().getEnd().setColumn(EndPos + commentStr.size() + 1);
-
-      return Token(tok::line_comment, w, commentStr);
+      return Token(tok::line_comment, Range, commentStr);
     }
     else
     {
@@ -643,11 +631,7 @@ Lexer::Lex()
 
   if (tt != tok::unknown)
   {
-    auto EndCol = w.getRange().getEnd().getColumn();
-
-    w.getRange().getEnd().setColumn(EndCol + punctuators.size() - 2);
-
-    return Token(tt, w);
+    return Token(tt, getTokenRange(w));
   }
 
   // Handle multi-character tokens; the difficult ones.
@@ -710,18 +694,14 @@ Lexer::Lex()
     std::string str;
     utf8::utf32to8(vStr.begin(), vStr.end(), std::back_inserter(str));
 
-    // adjust the end column position.
-    auto EndCol = w.getRange().getEnd().getColumn();
-    w.getRange().getEnd().setColumn(EndCol + str.size() - 1);
-
     // does a specialized token kind exist?
     if (auto Ident = Identifiers_.get(str))
     {
-      return Token(Ident->getKind(), w);
+      return Token(Ident->getKind(), getTokenRange(w));
     }
 
     // return a non-specialized identifier token kind.
-    return Token(tok::identifier, w, str);
+    return Token(tok::identifier, getTokenRange(w), str);
   }
 
   // Handle integer and real values.
@@ -733,12 +713,6 @@ Lexer::Lex()
   // Handle newlines.
   if (ch == '\n')
   {
-    sourceRange_.getBegin().incrementLineNumber();
-    sourceRange_.getBegin().setColumn(0);
-
-    sourceRange_.getEnd().incrementLineNumber();
-    sourceRange_.getEnd().setColumn(0);
-
     NextChar();
 
     return Token(tok::eol, w);
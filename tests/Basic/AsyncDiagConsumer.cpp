@@ -0,0 +1,143 @@
+/**
+ * The U Programming Language
+ *
+ * Copyright 2018 Joseph Benden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * \author Joseph W. Benden
+ * \copyright (C) 2018 Joseph Benden
+ * \license apache2
+ */
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <u-lang/Basic/AsyncDiagConsumer.hpp>
+#include <u-lang/Basic/SourceManager.hpp>
+#include <u-lang/u.hpp>
+
+#include <algorithm>
+#include <future>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace u;
+
+class RecordingConsumer : public DiagnosticConsumer
+{
+public:
+  std::mutex Mutex;
+  std::vector<std::pair<std::thread::id, unsigned>> Values;
+  std::vector<std::string> Messages;
+  std::shared_future<void> Gate;
+
+  void HandleDiagnostic(diag::Severity DiagLevel, const Diagnostic& Info) override
+  {
+    if (Gate.valid())
+    {
+      Gate.wait();
+    }
+
+    llvm::SmallVector<char, 64> msg;
+    Info.FormatDiagnostic(msg);
+
+    std::lock_guard<std::mutex> Lock(Mutex);
+    Messages.emplace_back(msg.begin(), msg.end());
+    if (Info.getNumArgs() && Info.getArgKind(0) == DiagnosticEngine::ak_uint)
+    {
+      Values.emplace_back(std::this_thread::get_id(), Info.getArgUInt(0));
+    }
+  }
+};
+
+TEST(AsyncDiagConsumer, DeliversInOrderOnAThreadOfItsOwn) // NOLINT
+{
+  auto Recorder = std::make_shared<RecordingConsumer>();
+  auto Async = std::make_shared<AsyncDiagConsumer>(Recorder);
+
+  const unsigned NumThreads = 4;
+  const unsigned NumReports = 200;
+
+  std::vector<std::thread::id> Reporters;
+  std::mutex ReportersMutex;
+  std::vector<std::thread> Threads;
+  for (unsigned t = 0; t < NumThreads; ++t)
+  {
+    Threads.emplace_back([&, t]() {
+      {
+        std::lock_guard<std::mutex> Lock(ReportersMutex);
+        Reporters.push_back(std::this_thread::get_id());
+      }
+
+      DiagnosticEngine Diags(std::make_shared<SourceManager>(), Async);
+      Diags.setSeverity(diag::unit_test_0001, diag::Severity::Warning);
+      for (unsigned i = 0; i < NumReports; ++i)
+      {
+        Diags.Report(diag::unit_test_0001) << t * 1000 + i;
+      }
+    });
+  }
+
+  for (auto& Thread : Threads)
+  {
+    Thread.join();
+  }
+
+  Async->flush();
+  EXPECT_EQ(NumThreads * NumReports, Async->getNumWarnings());
+  ASSERT_EQ(NumThreads * NumReports, Recorder->Values.size());
+  EXPECT_NE(Recorder->Messages.end(),
+            std::find(Recorder->Messages.begin(), Recorder->Messages.end(), "I have 1199 sense."));
+
+  // each reporter's diagnostics arrive in the order they were reported.
+  std::map<unsigned, unsigned> Next;
+  for (auto& Value : Recorder->Values)
+  {
+    EXPECT_EQ(Value.first, Recorder->Values.front().first);
+    EXPECT_EQ(Reporters.end(), std::find(Reporters.begin(), Reporters.end(), Value.first));
+    EXPECT_EQ(Next[Value.second / 1000]++, Value.second % 1000);
+  }
+}
+
+TEST(AsyncDiagConsumer, KeepsTheFileOfQueuedDiagnosticsResident) // NOLINT
+{
+  auto sourceManager = std::make_shared<SourceManager>();
+  std::vector<std::string> FixturePaths{ULANG_TEST_FIXTURE_PATH "/VFS", ULANG_TEST_FIXTURE_PATH "/VFS-overlay"};
+  sourceManager->getFileManager().SetSystemModulePaths(FixturePaths);
+
+  std::promise<void> Release;
+  auto Recorder = std::make_shared<RecordingConsumer>();
+  Recorder->Gate = Release.get_future().share();
+  auto Async = std::make_shared<AsyncDiagConsumer>(Recorder);
+  DiagnosticEngine Diags(sourceManager, Async);
+
+  auto First = sourceManager->createFileID(*sourceManager->getFile("/b/1/test.txt"));
+  auto& FI = sourceManager->getFileInfo(First);
+  Diags.Report(sourceManager->getLocForStartOfFile(First), diag::bad_hex_digit) << "g";
+
+  // while queued, the diagnostic holds its file resident.
+  sourceManager->createFileID(*sourceManager->getFile("/b/3/bom.u"));
+  sourceManager->setMemoryBudget(1);
+  EXPECT_TRUE(FI.isResident());
+
+  Release.set_value();
+  Async->flush();
+  ASSERT_EQ(1u, Recorder->Messages.size());
+  EXPECT_EQ(1u, Async->getNumWarnings());
+
+  sourceManager->createFileID(*sourceManager->getFile("/b/3/bom.u"));
+  EXPECT_FALSE(FI.isResident());
+}
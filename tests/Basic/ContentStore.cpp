@@ -0,0 +1,113 @@
+/**
+ * The U Programming Language
+ *
+ * Copyright 2018 Joseph Benden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * \author Joseph W. Benden
+ * \copyright (C) 2018 Joseph Benden
+ * \license apache2
+ */
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <u-lang/Basic/ContentStore.hpp>
+#include <u-lang/Basic/SourceManager.hpp>
+#include <u-lang/u.hpp>
+
+using namespace u;
+
+TEST(ContentStore, IdenticalContentsShareABuffer) // NOLINT
+{
+  ContentStore Store;
+
+  auto First = Store.intern(llvm::MemoryBuffer::getMemBufferCopy("fn main\n", "/a/main.u"));
+  auto Second = Store.intern(llvm::MemoryBuffer::getMemBufferCopy("fn main\n", "/b/main.u"));
+  auto Other = Store.intern(llvm::MemoryBuffer::getMemBufferCopy("fn other\n", "/a/other.u"));
+
+  EXPECT_EQ(First, Second);
+  EXPECT_NE(First, Other);
+  EXPECT_EQ(First->getBufferIdentifier(), "/a/main.u");
+  EXPECT_EQ(Store.getNumBuffers(), 2u);
+  EXPECT_EQ(Store.lookup(getContentHash("fn other\n")), Other);
+
+  // the store keeps nothing alive by itself.
+  Other.reset();
+  EXPECT_EQ(Store.getNumBuffers(), 1u);
+  EXPECT_FALSE(!!Store.lookup(getContentHash("fn other\n")));
+}
+
+class ContentStoreTest : public ::testing::Test
+{
+protected:
+  void SetUp() override
+  {
+    llvm::sys::fs::createUniqueDirectory("u-lang-content-store", Root);
+
+    Write("/tenant-a/std/io.u", "fn print\nfn println\n");
+    Write("/tenant-b/std/io.u", "fn print\nfn println\n");
+    Write("/tenant-b/std/fmt.u", "fn format\n");
+
+    sourceManager.getFileManager().SetSystemModulePaths({Root.str().str()});
+  }
+
+  void TearDown() override { llvm::sys::fs::remove_directories(Root); }
+
+  void Write(llvm::StringRef Path, llvm::StringRef Contents)
+  {
+    llvm::SmallString<256> Full{Root};
+    Full += Path;
+
+    llvm::sys::fs::create_directories(llvm::sys::path::parent_path(Full));
+
+    std::error_code EC;
+    llvm::raw_fd_ostream OS(Full, EC, llvm::sys::fs::F_None);
+    OS << Contents;
+  }
+
+  llvm::SmallString<256> Root;
+  SourceManager sourceManager;
+};
+
+TEST_F(ContentStoreTest, SourceManagerSharesIdenticalFiles) // NOLINT
+{
+  auto Sources = sourceManager.getFiles({"/tenant-a/std/io.u", "/tenant-b/std/io.u", "/tenant-b/std/fmt.u"});
+  ASSERT_TRUE(Sources[0] && Sources[1] && Sources[2]);
+  EXPECT_EQ(Sources[0]->getBuffer(), Sources[1]->getBuffer());
+  EXPECT_NE(Sources[0]->getBuffer(), Sources[2]->getBuffer());
+  EXPECT_EQ(sourceManager.getFileManager().getContentStore().getNumBuffers(), 2u);
+
+  // each keeps its own name and FileID, but not its own contents.
+  auto A = sourceManager.createFileID(*Sources[0]);
+  auto B = sourceManager.createFileID(*Sources[1]);
+  EXPECT_NE(A, B);
+  EXPECT_NE(sourceManager.getFileInfo(A).getFilePath(), sourceManager.getFileInfo(B).getFilePath());
+
+  EXPECT_EQ(sourceManager.getFileInfo(A).getNumLines(), 3u);
+  EXPECT_EQ(sourceManager.getFileInfo(B).getNumLines(), 3u);
+  EXPECT_EQ(sourceManager.getFileInfo(A).getLine(2).data(), sourceManager.getFileInfo(B).getLine(2).data());
+
+  // contents read again after eviction are shared too.
+  sourceManager.setMemoryBudget(1);
+  EXPECT_FALSE(sourceManager.getFileInfo(A).isResident());
+  EXPECT_EQ(sourceManager.getFileInfo(A).getLine(2), "fn println");
+  Sources.clear();
+  EXPECT_EQ(sourceManager.getFileInfo(A).getLine(1).data(), sourceManager.getFileInfo(B).getLine(1).data());
+}
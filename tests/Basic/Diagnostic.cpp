@@ -27,6 +27,9 @@
 #include <u-lang/Lex/Lexer.hpp>
 #include <u-lang/u.hpp>
 
+#include <thread>
+#include <vector>
+
 using namespace u;
 
 TEST(DiagnosticEngine, ExpectUnterminatedString) // NOLINT
@@ -42,6 +45,20 @@ TEST(DiagnosticEngine, ExpectUnterminatedString) // NOLINT
   EXPECT_EQ(1, diagClient->getNumErrors());
 }
 
+TEST(DiagnosticTable, IsIndexedByID) // NOLINT
+{
+  static_assert(sizeof(diag::DiagnosticTable) / sizeof(diag::DiagnosticTable[0]) == diag::NUM_DIAGNOSTICS,
+                "one entry per diagnostic");
+
+  auto const& Info = diag::getDiagnosticInfo(diag::bad_hex_digit);
+  EXPECT_EQ(diag::Severity::Warning, Info.Level);
+  EXPECT_STREQ("Lexer", Info.Component);
+  EXPECT_STREQ("Invalid Hexadecimal Digit", Info.Title);
+
+  EXPECT_EQ(diag::Severity::Ignore, diag::getDiagnosticInfo(diag::unit_test_0011).Level);
+  EXPECT_STREQ("%select{a|%%|c}0", diag::getDiagnosticInfo(diag::unit_test_0011).Message);
+}
+
 class RecordingDiagConsumer : public DiagnosticConsumer
 {
 public:
@@ -76,6 +93,9 @@ protected:
     diagClient = std::make_shared<RecordingDiagConsumer>();
     diagEngine = std::make_shared<DiagnosticEngine>(sourceManager, diagClient);
 
+    // the unit-test diagnostics are ignored, yet formatted.
+    diagEngine->setReportIgnored(true);
+
     return *this;
   }
 
@@ -328,3 +348,94 @@ TEST_F(DiagnosticEngineTest, HandlesFormattingSelectWithEscape) // NOLINT
   EXPECT_EQ(diag::Severity::Ignore, diagClient->D[0].first);
   EXPECT_STREQ("%", diagClient->D[0].second.c_str());
 }
+
+class MessageFormattingConsumer : public DiagnosticConsumer
+{
+public:
+  const char* Message = "";
+
+  std::string Formatted;
+
+private:
+  void HandleDiagnostic(diag::Severity DiagLevel, const Diagnostic& Info) override
+  {
+    llvm::SmallVector<char, 32> msg;
+    Info.FormatDiagnostic(Message, Message + strlen(Message), msg);
+    Formatted.assign(msg.begin(), msg.end());
+
+    DiagnosticConsumer::HandleDiagnostic(DiagLevel, Info);
+  }
+};
+
+TEST(DiagnosticEngine, FormatsNestedSelects) // NOLINT
+{
+  auto Consumer = std::make_shared<MessageFormattingConsumer>();
+  auto Diags = std::make_shared<DiagnosticEngine>(std::make_shared<SourceManager>(), Consumer);
+  Diags->setSeverity(diag::unit_test_0001, diag::Severity::Note);
+
+  Consumer->Message = "%select{no|one|%0 item%s0 in %select{x|y|z}1}1, %ordinal0 %%";
+  Diags->Report(diag::unit_test_0001) << (unsigned) 3 << (unsigned) 2;
+  EXPECT_STREQ("3 items in z, 3rd %", Consumer->Formatted.c_str());
+
+  Diags->Report(diag::unit_test_0001) << (unsigned) 1 << (unsigned) 1;
+  EXPECT_STREQ("one, 1st %", Consumer->Formatted.c_str());
+}
+
+TEST(DiagnosticEngine, DropsIgnoredDiagnostics) // NOLINT
+{
+  auto Consumer = std::make_shared<MessageFormattingConsumer>();
+  auto Diags = std::make_shared<DiagnosticEngine>(std::make_shared<SourceManager>(), Consumer);
+
+  // an ignored diagnostic never reaches the consumer, nor captures arguments.
+  EXPECT_TRUE(Diags->isIgnored(diag::unit_test_0001));
+  Diags->Report(diag::unit_test_0001) << "never" << (unsigned) 1;
+  EXPECT_STREQ("", Consumer->Formatted.c_str());
+
+  // a diagnostic may be promoted ...
+  Diags->setSeverity(diag::bad_hex_digit, diag::Severity::Error);
+  EXPECT_EQ(diag::Severity::Error, Diags->getSeverity(diag::bad_hex_digit));
+  Diags->Report(diag::bad_hex_digit) << "g";
+  EXPECT_EQ(1, Consumer->getNumErrors());
+  EXPECT_EQ(0, Consumer->getNumWarnings());
+
+  // ... or ignored.
+  Diags->setSeverity(diag::unterminated_string, diag::Severity::Ignore);
+  EXPECT_TRUE(Diags->isIgnored(diag::unterminated_string));
+  Diags->Report(diag::unterminated_string);
+  EXPECT_EQ(1, Consumer->getNumErrors());
+}
+
+TEST(DiagnosticEngine, ReportsFromManyThreadsAtOnce) // NOLINT
+{
+  auto Consumer = std::make_shared<DiagnosticConsumer>();
+  auto Diags = std::make_shared<DiagnosticEngine>(std::make_shared<SourceManager>(), Consumer);
+
+  // each builder holds its own diagnostic, so several may be in flight.
+  {
+    auto Outer = Diags->Report(diag::bad_hex_digit);
+    Outer << "g";
+    Diags->Report(diag::unterminated_string);
+    EXPECT_EQ(1, Consumer->getNumErrors());
+    EXPECT_EQ(0, Consumer->getNumWarnings());
+  }
+  EXPECT_EQ(1, Consumer->getNumWarnings());
+
+  std::vector<std::thread> Threads;
+  for (unsigned t = 0; t < 8; ++t)
+  {
+    Threads.emplace_back([&Diags, t]() {
+      for (unsigned i = 0; i < 500; ++i)
+      {
+        Diags->Report(diag::bad_hex_digit) << std::to_string(t * 1000 + i);
+      }
+    });
+  }
+
+  for (auto& Thread : Threads)
+  {
+    Thread.join();
+  }
+
+  EXPECT_EQ(4001, Consumer->getNumWarnings());
+  EXPECT_EQ(1, Consumer->getNumErrors());
+}
@@ -0,0 +1,131 @@
+/**
+ * The U Programming Language
+ *
+ * Copyright 2018 Joseph Benden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * \author Joseph W. Benden
+ * \copyright (C) 2018 Joseph Benden
+ * \license apache2
+ */
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <u-lang/Basic/DiagnosticMerger.hpp>
+#include <u-lang/Basic/SourceManager.hpp>
+#include <u-lang/u.hpp>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace u;
+
+class OrderRecordingConsumer : public DiagnosticConsumer
+{
+public:
+  std::string Output;
+
+  void HandleDiagnostic(diag::Severity DiagLevel, const Diagnostic& Info) override
+  {
+    DiagnosticConsumer::HandleDiagnostic(DiagLevel, Info);
+
+    // the engines reporting are gone; the records alone decode locations.
+    EXPECT_EQ(nullptr, Info.getDiags());
+    if (Info.getLocation().isValid())
+    {
+      auto SM = Info.getSourceManager();
+      EXPECT_TRUE(SM && SM->getFileID(Info.getLocation()).isValid());
+    }
+
+    llvm::SmallVector<char, 64> msg;
+    Info.FormatDiagnostic(msg);
+    Output.append(msg.begin(), msg.end());
+    Output += "\n";
+  }
+};
+
+/// Report from four workers at once, each visiting its locations in an
+/// order of its own; returning what reached the consumer.
+static std::string
+MergeFromWorkers(std::shared_ptr<SourceManager> const& SM, std::vector<SourceLocation> const& Files)
+{
+  auto Recorder = std::make_shared<OrderRecordingConsumer>();
+  DiagnosticMerger Merger(Recorder);
+
+  std::vector<std::shared_ptr<BufferedDiagConsumer>> Buffers;
+  for (unsigned w = 0; w < 4; ++w)
+  {
+    Buffers.push_back(Merger.createWorkerConsumer());
+  }
+
+  std::vector<std::thread> Threads;
+  for (unsigned w = 0; w < 4; ++w)
+  {
+    Threads.emplace_back([&, w]() {
+      DiagnosticEngine Diags(SM, Buffers[w]);
+      for (unsigned i = 0; i < 8; ++i)
+      {
+        unsigned Offset = (i * (w + 3)) % 8;
+        Diags.Report(Files[(i + w) % Files.size()].getLocWithOffset(Offset), diag::bad_hex_digit)
+          << std::to_string(w) + "@" + std::to_string(Offset);
+      }
+      Diags.Report(diag::bad_hex_digit) << "no location " + std::to_string(w);
+    });
+  }
+
+  for (auto& Thread : Threads)
+  {
+    Thread.join();
+  }
+
+  EXPECT_EQ(9u, Buffers[0]->size());
+  EXPECT_EQ(0u, Recorder->getNumWarnings());
+
+  Merger.merge();
+  EXPECT_EQ(0u, Buffers[0]->size());
+  EXPECT_EQ(36u, Recorder->getNumWarnings());
+  return Recorder->Output;
+}
+
+TEST(DiagnosticMerger, OrdersByLocationThenWorker) // NOLINT
+{
+  auto SM = std::make_shared<SourceManager>();
+  std::vector<SourceLocation> Files;
+  Files.push_back(SM->getLocForStartOfFile(SM->createFileID(StringSource("first file"))));
+  Files.push_back(SM->getLocForStartOfFile(SM->createFileID(StringSource("second file"))));
+
+  std::string Output = MergeFromWorkers(SM, Files);
+  for (unsigned Run = 0; Run < 4; ++Run)
+  {
+    EXPECT_EQ(Output, MergeFromWorkers(SM, Files));
+  }
+
+  // diagnostics without a location come first, by worker.
+  EXPECT_EQ(0u, Output.find("An invalid hexadecimal digit 'no location 0'"));
+
+  // then by file and offset, ties broken by worker.
+  auto First = Output.find("'0@0'");
+  auto Second = Output.find("'2@0'");
+  ASSERT_NE(std::string::npos, First);
+  ASSERT_NE(std::string::npos, Second);
+  EXPECT_LT(First, Second);
+  ASSERT_NE(std::string::npos, Output.find("'3@6'"));
+  EXPECT_LT(Output.find("'0@6'"), Output.find("'3@6'"));
+
+  // a later file sorts after, though reported first.
+  ASSERT_NE(std::string::npos, Output.find("'0@3'"));
+  EXPECT_LT(Output.find("'0@6'"), Output.find("'0@3'"));
+}
@@ -28,6 +28,8 @@
 #include <u-lang/Basic/FileManager.hpp>
 #include <u-lang/u.hpp>
 
+#include <thread>
+
 using namespace u;
 using namespace u::vfs;
 
@@ -90,3 +92,94 @@ TEST_F(FileManagerTest, RootOfFSIsIterable) // NOLINT
 
   EXPECT_EQ(count, 3);
 }
+
+TEST_F(FileManagerTest, StatsAreCached) // NOLINT
+{
+  EXPECT_TRUE(fileManager->exists("/b/1/test.txt"));
+  auto Misses = fileManager->getNumStatCacheMisses();
+  EXPECT_GT(Misses, 0u);
+
+  // every spelling of the same path is answered from the cache.
+  EXPECT_TRUE(fileManager->exists("/b/1/test.txt"));
+  EXPECT_TRUE(fileManager->exists("/b/2/../1/./test.txt"));
+  EXPECT_TRUE(!!fileManager->openFileForRead("/b/1/test.txt"));
+  EXPECT_EQ(Misses, fileManager->getNumStatCacheMisses());
+
+  fileManager->invalidateStatCache("/b/1/test.txt");
+  EXPECT_TRUE(fileManager->exists("/b/1/test.txt"));
+  EXPECT_GT(fileManager->getNumStatCacheMisses(), Misses);
+}
+
+TEST_F(FileManagerTest, MissingFilesAreCached) // NOLINT
+{
+  EXPECT_FALSE(fileManager->exists("/missing.u"));
+  auto Misses = fileManager->getNumStatCacheMisses();
+
+  EXPECT_FALSE(fileManager->exists("/missing.u"));
+  auto File = fileManager->openFileForRead("/missing.u");
+  EXPECT_FALSE(!!File);
+  EXPECT_EQ(llvm::errc::no_such_file_or_directory, File.getError());
+  EXPECT_EQ(Misses, fileManager->getNumStatCacheMisses());
+
+  fileManager->invalidateStatCache();
+  EXPECT_FALSE(fileManager->exists("/missing.u"));
+  EXPECT_EQ(Misses, fileManager->getNumStatCacheMisses());
+}
+
+TEST_F(FileManagerTest, LayersLackingAFileAreSkipped) // NOLINT
+{
+  // only the bottom-most module root holds the file.
+  EXPECT_TRUE(fileManager->exists("/c/.gitkeep"));
+  EXPECT_EQ(1u, fileManager->getNumStatCacheMisses());
+
+  // and no module root holds this one.
+  EXPECT_FALSE(fileManager->exists("/c/missing.u"));
+  EXPECT_EQ(1u, fileManager->getNumStatCacheMisses());
+}
+
+TEST_F(FileManagerTest, IdenticallyConfiguredManagersShareTheirStack) // NOLINT
+{
+  FileManager Other;
+  Other.SetSystemModulePaths({ULANG_TEST_FIXTURE_PATH "/VFS", ULANG_TEST_FIXTURE_PATH "/VFS-overlay"});
+
+  // what one looked up, the other need not.
+  EXPECT_TRUE(fileManager->exists("/b/1/test.txt"));
+  auto Misses = fileManager->getNumStatCacheMisses();
+  EXPECT_TRUE(Other.exists("/b/1/test.txt"));
+  EXPECT_EQ(Misses, Other.getNumStatCacheMisses());
+  EXPECT_EQ(&fileManager->getContentStore(), &Other.getContentStore());
+
+  // a working directory is not shared, nor is the stack once one is set.
+  auto Original = *fileManager->getCurrentWorkingDirectory();
+  EXPECT_FALSE(Other.setCurrentWorkingDirectory("/b"));
+  EXPECT_EQ(*Other.getCurrentWorkingDirectory(), "/b");
+  EXPECT_EQ(*fileManager->getCurrentWorkingDirectory(), Original);
+  EXPECT_NE(&fileManager->getContentStore(), &Other.getContentStore());
+
+  // nor is it between managers of differing module paths.
+  FileManager Third;
+  Third.SetSystemModulePaths({ULANG_TEST_FIXTURE_PATH "/VFS"});
+  EXPECT_NE(&fileManager->getContentStore(), &Third.getContentStore());
+}
+
+TEST_F(FileManagerTest, SharedStacksJoinContentsOnce) // NOLINT
+{
+  FileManager Other;
+  Other.SetSystemModulePaths({ULANG_TEST_FIXTURE_PATH "/VFS", ULANG_TEST_FIXTURE_PATH "/VFS-overlay"});
+
+  // both managers open the same contents; each joins them on its own thread.
+  auto First = fileManager->openFileForRead("/b/1/test.txt");
+  auto Second = Other.openFileForRead("/b/1/test.txt");
+  ASSERT_TRUE(!!First);
+  ASSERT_TRUE(!!Second);
+
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> FirstContent = std::error_code();
+  std::thread Joiner([&] { FirstContent = (*First)->getBuffer("/b/1/test.txt"); });
+  auto SecondContent = (*Second)->getBuffer("/b/1/test.txt");
+  Joiner.join();
+
+  ASSERT_TRUE(!!FirstContent);
+  ASSERT_TRUE(!!SecondContent);
+  EXPECT_EQ("hello world!\nfrom earth!\n", (*FirstContent)->getBuffer());
+  EXPECT_EQ((*FirstContent)->getBufferStart(), (*SecondContent)->getBufferStart());
+}
@@ -0,0 +1,207 @@
+/**
+ * The U Programming Language
+ *
+ * Copyright 2018 Joseph Benden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * \author Joseph W. Benden
+ * \copyright (C) 2018 Joseph Benden
+ * \license apache2
+ */
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <u-lang/Basic/FileWatcher.hpp>
+#include <u-lang/Basic/ModuleBundle.hpp>
+#include <u-lang/Basic/SourceManager.hpp>
+#include <u-lang/u.hpp>
+
+#include <string>
+#include <vector>
+
+using namespace u;
+
+class FileWatcherTest : public ::testing::Test
+{
+protected:
+  void SetUp() override
+  {
+    llvm::sys::fs::createUniqueDirectory("u-lang-file-watcher", Root);
+
+    Write("/std/io.u", "fn print\n");
+  }
+
+  void TearDown() override { llvm::sys::fs::remove_directories(Root); }
+
+  void Write(llvm::StringRef Path, llvm::StringRef Contents)
+  {
+    llvm::SmallString<256> Full{Root};
+    Full += Path;
+
+    llvm::sys::fs::create_directories(llvm::sys::path::parent_path(Full));
+
+    std::error_code EC;
+    llvm::raw_fd_ostream OS(Full, EC, llvm::sys::fs::F_None);
+    OS << Contents;
+  }
+
+  llvm::SmallString<256> Root;
+};
+
+#ifdef __linux__
+TEST_F(FileWatcherTest, PublishesEachChangeOnce) // NOLINT
+{
+  FileWatcher Watcher;
+  ASSERT_TRUE(Watcher.isWatching());
+  EXPECT_FALSE(Watcher.watchTree(Root));
+  EXPECT_EQ(Watcher.getNumWatches(), 2u);
+
+  std::vector<std::string> Changed;
+  auto Handle = Watcher.subscribe([&](llvm::StringRef Path) { Changed.push_back(Path.str()); });
+
+  // nothing is published until polled.
+  Write("/std/io.u", "fn println\n");
+  EXPECT_TRUE(Changed.empty());
+
+  EXPECT_EQ(Watcher.poll(), 1u);
+  ASSERT_EQ(Changed.size(), 1u);
+  EXPECT_EQ(Changed[0], (Root + "/std/io.u").str());
+
+  // a new directory is watched, and what was created within it published.
+  Write("/std/text/utf8.u", "fn decode\n");
+  Changed.clear();
+  Watcher.poll();
+  EXPECT_THAT(Changed, ::testing::Contains((Root + "/std/text/utf8.u").str()));
+  EXPECT_EQ(Watcher.getNumWatches(), 3u);
+
+  Write("/std/text/utf8.u", "fn encode\n");
+  Changed.clear();
+  Watcher.poll();
+  EXPECT_THAT(Changed, ::testing::ElementsAre((Root + "/std/text/utf8.u").str()));
+
+  Watcher.unsubscribe(Handle);
+  Write("/std/io.u", "fn print\n");
+  Changed.clear();
+  EXPECT_EQ(Watcher.poll(), 1u);
+  EXPECT_TRUE(Changed.empty());
+}
+
+TEST_F(FileWatcherTest, ListenersMayUnsubscribeThemselves) // NOLINT
+{
+  FileWatcher Watcher;
+  ASSERT_TRUE(Watcher.isWatching());
+  EXPECT_FALSE(Watcher.watchTree(Root));
+
+  unsigned Handle{0};
+  unsigned Calls{0};
+  Handle = Watcher.subscribe([&](llvm::StringRef) { Watcher.unsubscribe(Handle); });
+  Watcher.subscribe([&](llvm::StringRef) { ++Calls; });
+
+  // the listener following one gone is still told.
+  Write("/std/io.u", "fn println\n");
+  EXPECT_EQ(Watcher.poll(), 1u);
+  EXPECT_EQ(Calls, 1u);
+}
+
+TEST_F(FileWatcherTest, FileManagerForgetsOnlyWhatChanged) // NOLINT
+{
+  SourceManager SM;
+  auto& FM = SM.getFileManager();
+  FM.SetSystemModulePaths({Root.str().str()});
+  ASSERT_TRUE(FM.EnableFileWatching());
+
+  std::vector<std::string> Changed;
+  FM.subscribeToChanges([&](llvm::StringRef Path) { Changed.push_back(Path.str()); });
+
+  auto Source = SM.getFile("/std/io.u");
+  ASSERT_TRUE(!!Source);
+  auto FID = SM.createFileID(*Source);
+
+  auto Respelled = SM.getFile("std/../std/./io.u");
+  ASSERT_TRUE(!!Respelled);
+  auto RespelledFID = SM.createFileID(*Respelled);
+
+  // a miss is cached, until the file appears.
+  EXPECT_FALSE(FM.exists("/std/fmt.u"));
+  EXPECT_TRUE(FM.exists("/std/io.u"));
+  auto Misses = FM.getNumStatCacheMisses();
+
+  Write("/std/fmt.u", "fn format\n");
+  EXPECT_FALSE(FM.exists("/std/fmt.u"));
+  EXPECT_EQ(FM.pollFileChanges(), 1u);
+  EXPECT_THAT(Changed, ::testing::ElementsAre("/std/fmt.u"));
+  EXPECT_TRUE(SM.takeChangedFiles().empty());
+
+  // only the changed file is looked up again.
+  EXPECT_TRUE(FM.exists("/std/fmt.u"));
+  EXPECT_TRUE(FM.exists("/std/io.u"));
+  EXPECT_EQ(FM.getNumStatCacheMisses(), Misses + 1);
+
+  // however the file was spelled when read.
+  Write("/std/io.u", "fn println\n");
+  FM.pollFileChanges();
+  EXPECT_THAT(SM.takeChangedFiles(), ::testing::ElementsAre(FID, RespelledFID));
+  EXPECT_TRUE(SM.takeChangedFiles().empty());
+}
+
+TEST_F(FileWatcherTest, FileManagerReindexesFilesRewrittenInPlace) // NOLINT
+{
+  llvm::SmallString<256> IndexDirectory{Root};
+  IndexDirectory += "/.indices";
+
+  llvm::SmallString<256> ModuleRoot{Root};
+  ModuleRoot += "/std";
+
+  FileManager FM;
+  FM.SetSystemModulePaths({ModuleRoot.str().str()});
+  FM.SetModuleIndexDirectory(IndexDirectory.str());
+  ASSERT_TRUE(FM.EnableFileWatching());
+  EXPECT_EQ(getContentHash("fn print\n"), FM.lookupModule("/io.u")->Hash);
+
+  // the rewrite changes the time of no directory.
+  Write("/std/io.u", "fn println\n");
+  EXPECT_EQ(FM.pollFileChanges(), 1u);
+  EXPECT_EQ(getContentHash("fn println\n"), FM.lookupModule("/io.u")->Hash);
+}
+
+TEST_F(FileWatcherTest, FileManagerRemapsRewrittenBundles) // NOLINT
+{
+  llvm::SmallString<256> BundlePath{Root};
+  BundlePath += "/modules.ubundle";
+
+  ModuleBundleWriter Writer;
+  Writer.addFile("/std/io.u", llvm::MemoryBuffer::getMemBufferCopy("fn print\n"), 0);
+  ASSERT_FALSE(!!Writer.writeToFile(BundlePath));
+
+  FileManager FM;
+  FM.SetSystemModulePaths({BundlePath.str().str()});
+  ASSERT_TRUE(FM.EnableFileWatching());
+  EXPECT_FALSE(FM.setCurrentWorkingDirectory("/std"));
+  EXPECT_FALSE(FM.exists("fmt.u"));
+
+  Writer.addFile("/std/fmt.u", llvm::MemoryBuffer::getMemBufferCopy("fn format\n"), 0);
+  ASSERT_FALSE(!!Writer.writeToFile(BundlePath));
+  EXPECT_GT(FM.pollFileChanges(), 0u);
+
+  // the bundle is mapped anew, in the working directory set before.
+  EXPECT_EQ(*FM.getCurrentWorkingDirectory(), "/std");
+  EXPECT_TRUE(FM.exists("fmt.u"));
+}
+#endif
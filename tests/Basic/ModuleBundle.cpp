@@ -0,0 +1,149 @@
+/**
+ * The U Programming Language
+ *
+ * Copyright 2018 Joseph Benden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * \author Joseph W. Benden
+ * \copyright (C) 2018 Joseph Benden
+ * \license apache2
+ */
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/Errc.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <u-lang/Basic/FileManager.hpp>
+#include <u-lang/Basic/ModuleBundle.hpp>
+#include <u-lang/u.hpp>
+
+using namespace u;
+using namespace u::vfs;
+
+class ModuleBundleTest : public ::testing::Test
+{
+protected:
+  void SetUp() override
+  {
+    llvm::sys::fs::createTemporaryFile("u-lang-module-bundle", "ubundle", BundlePath);
+
+    ModuleBundleWriter Writer;
+    ASSERT_FALSE(!!Writer.addDirectory(ULANG_TEST_FIXTURE_PATH "/VFS"));
+    Writer.addFile("/std/io.u", llvm::MemoryBuffer::getMemBufferCopy("fn print\n"), 1000000000);
+    Writer.addFile("std/text/utf8.u", llvm::MemoryBuffer::getMemBufferCopy("fn decode\n"), 2000000000);
+    ASSERT_FALSE(!!Writer.writeToFile(BundlePath));
+  }
+
+  void TearDown() override { llvm::sys::fs::remove(BundlePath); }
+
+  llvm::SmallString<256> BundlePath;
+};
+
+TEST_F(ModuleBundleTest, ServesFilesAndDirectories) // NOLINT
+{
+  auto FS = BundleFileSystem::open(BundlePath);
+  ASSERT_TRUE(!!FS);
+
+  // the root, eight directories and seven files.
+  EXPECT_EQ(16u, (*FS)->getNumEntries());
+
+  auto S = (*FS)->status("/std/text/utf8.u");
+  ASSERT_TRUE(!!S);
+  EXPECT_TRUE(S->isRegularFile());
+  EXPECT_EQ("/std/text/utf8.u", S->getName());
+  EXPECT_EQ(10u, S->getSize());
+  EXPECT_EQ(2000000000, S->getLastModificationTime().time_since_epoch().count());
+
+  S = (*FS)->status("/std/text/../text/");
+  ASSERT_TRUE(!!S);
+  EXPECT_TRUE(S->isDirectory());
+  EXPECT_EQ(2000000000, S->getLastModificationTime().time_since_epoch().count());
+
+  EXPECT_TRUE((*FS)->exists("/"));
+  EXPECT_TRUE((*FS)->exists("/b/1/test.txt"));
+  EXPECT_FALSE((*FS)->exists("/std/missing.u"));
+  EXPECT_FALSE((*FS)->exists("/std/io.u/missing.u"));
+  EXPECT_FALSE((*FS)->mayContain("/b/9"));
+  EXPECT_NE((*FS)->status("/b")->getUniqueID(), (*FS)->status("/b/1")->getUniqueID());
+
+  EXPECT_EQ(llvm::errc::is_a_directory, (*FS)->openFileForRead("/std").getError());
+}
+
+TEST_F(ModuleBundleTest, HandsOutContentsInPlace) // NOLINT
+{
+  auto FS = BundleFileSystem::open(BundlePath);
+  ASSERT_TRUE(!!FS);
+
+  auto First = (*FS)->getBufferForFile("/b/1/test.txt", 12u);
+  auto Second = (*FS)->getBufferForFile("/b/1/test.txt", 12u);
+  ASSERT_TRUE(!!First);
+  ASSERT_TRUE(!!Second);
+
+  EXPECT_EQ("hello world!", (*First)->getBuffer());
+  EXPECT_EQ((*First)->getBufferStart(), (*Second)->getBufferStart());
+  EXPECT_EQ('\0', *(*First)->getBufferEnd());
+
+  // the contents outlive the file system.
+  FS->reset();
+  EXPECT_EQ("hello world!", (*First)->getBuffer());
+}
+
+TEST_F(ModuleBundleTest, ListsDirectories) // NOLINT
+{
+  auto FS = BundleFileSystem::open(BundlePath);
+  ASSERT_TRUE(!!FS);
+
+  std::vector<std::string> Names;
+  std::error_code EC;
+  for (auto it = (*FS)->dir_begin("/std", EC); it != directory_iterator(); it.increment(EC))
+  {
+    Names.push_back(it->getName().str());
+  }
+
+  EXPECT_THAT(Names, ::testing::ElementsAre("/std/io.u", "/std/text"));
+
+  (*FS)->dir_begin("/std/io.u", EC);
+  EXPECT_EQ(llvm::errc::not_a_directory, EC);
+
+  (*FS)->dir_begin("/does/not/exist", EC);
+  EXPECT_EQ(llvm::errc::no_such_file_or_directory, EC);
+}
+
+TEST_F(ModuleBundleTest, RejectsMalformedBundles) // NOLINT
+{
+  {
+    std::error_code EC;
+    llvm::raw_fd_ostream OS(BundlePath, EC, llvm::sys::fs::F_None);
+    OS << "UBMD, but not really a bundle";
+  }
+
+  EXPECT_EQ(llvm::errc::invalid_argument, BundleFileSystem::open(BundlePath).getError());
+}
+
+TEST_F(ModuleBundleTest, FileManagerStacksBundles) // NOLINT
+{
+  FileManager FM;
+  FM.SetSystemModulePaths({BundlePath.str().str(), ULANG_TEST_FIXTURE_PATH "/VFS-overlay"});
+
+  auto Content = FM.getBufferForFile("/b/1/test.txt", 32u);
+  ASSERT_TRUE(!!Content);
+  EXPECT_EQ("hello world!\nfrom earth!\n", (*Content)->getBuffer());
+
+  EXPECT_TRUE(FM.exists("/std/io.u"));
+  EXPECT_TRUE(FM.exists("/b/3/bom.u"));
+}
@@ -0,0 +1,224 @@
+/**
+ * The U Programming Language
+ *
+ * Copyright 2018 Joseph Benden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * \author Joseph W. Benden
+ * \copyright (C) 2018 Joseph Benden
+ * \license apache2
+ */
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <u-lang/Basic/FileManager.hpp>
+#include <u-lang/Basic/ModuleIndex.hpp>
+#include <u-lang/u.hpp>
+
+using namespace u;
+
+class ModuleIndexTest : public ::testing::Test
+{
+protected:
+  void SetUp() override
+  {
+    llvm::sys::fs::createUniqueDirectory("u-lang-module-index", Root);
+
+    Write("/std/io.u", "fn print\n");
+    Write("/std/text/utf8.u", "fn decode\n");
+    Write("/main.u", "fn main\n");
+
+    IndexPath = Root;
+    IndexPath += ".uidx";
+  }
+
+  void TearDown() override
+  {
+    llvm::sys::fs::remove_directories(Root);
+    llvm::sys::fs::remove(IndexPath);
+  }
+
+  void Write(llvm::StringRef Path, llvm::StringRef Contents)
+  {
+    llvm::SmallString<256> Full{Root};
+    Full += Path;
+
+    llvm::sys::fs::create_directories(llvm::sys::path::parent_path(Full));
+
+    std::error_code EC;
+    llvm::raw_fd_ostream OS(Full, EC, llvm::sys::fs::F_None);
+    OS << Contents;
+  }
+
+  llvm::SmallString<256> Root;
+  llvm::SmallString<256> IndexPath;
+};
+
+TEST_F(ModuleIndexTest, IndexesEveryFile) // NOLINT
+{
+  auto Index = ModuleIndex::build(Root, 2);
+  ASSERT_TRUE(!!Index);
+
+  EXPECT_EQ(3u, Index->getNumEntries());
+  EXPECT_EQ(Root.str(), Index->getRoot());
+
+  auto Entry = Index->lookup("/std/text/utf8.u");
+  ASSERT_TRUE(Entry.hasValue());
+  EXPECT_EQ(2u, Entry->Layer);
+  EXPECT_EQ(10u, Entry->Size);
+  EXPECT_NE(0, Entry->MTime);
+  EXPECT_EQ(getContentHash("fn decode\n"), Entry->Hash);
+
+  EXPECT_FALSE(Index->lookup("/std/missing.u").hasValue());
+  EXPECT_FALSE(Index->lookup("/std").hasValue());
+  EXPECT_TRUE(Index->isUpToDate());
+
+  // directories are known to exist, but hold no entry of their own.
+  EXPECT_TRUE(Index->contains("/std"));
+  EXPECT_TRUE(Index->contains("/std/text/utf8.u"));
+  EXPECT_FALSE(Index->contains("/std/missing.u"));
+  EXPECT_FALSE(Index->contains("/lib"));
+}
+
+TEST_F(ModuleIndexTest, RoundTripsThroughDisk) // NOLINT
+{
+  EXPECT_FALSE(!!ModuleIndex::load(IndexPath));
+
+  auto Built = ModuleIndex::loadOrBuild(Root, 1, IndexPath);
+  ASSERT_TRUE(!!Built);
+
+  auto Loaded = ModuleIndex::load(IndexPath);
+  ASSERT_TRUE(!!Loaded);
+  EXPECT_EQ(3u, Loaded->getNumEntries());
+  EXPECT_EQ(1u, Loaded->getLayer());
+  EXPECT_EQ(getContentHash("fn main\n"), Loaded->lookup("/main.u")->Hash);
+  EXPECT_TRUE(Loaded->isUpToDate());
+}
+
+TEST_F(ModuleIndexTest, NoticesRemovedDirectories) // NOLINT
+{
+  ASSERT_TRUE(!!ModuleIndex::loadOrBuild(Root, 1, IndexPath));
+
+  llvm::SmallString<256> Text{Root};
+  Text += "/std/text";
+  llvm::sys::fs::remove_directories(Text);
+
+  EXPECT_FALSE(ModuleIndex::load(IndexPath)->isUpToDate());
+
+  // the index is rebuilt, and stored again.
+  auto Rebuilt = ModuleIndex::loadOrBuild(Root, 1, IndexPath);
+  EXPECT_EQ(2u, Rebuilt->getNumEntries());
+  EXPECT_FALSE(Rebuilt->lookup("/std/text/utf8.u").hasValue());
+  EXPECT_EQ(2u, ModuleIndex::load(IndexPath)->getNumEntries());
+}
+
+TEST_F(ModuleIndexTest, NoticesFilesRewrittenInPlace) // NOLINT
+{
+  ASSERT_TRUE(!!ModuleIndex::loadOrBuild(Root, 1, IndexPath));
+
+  llvm::SmallString<256> IndexDirectory{Root};
+  IndexDirectory += ".indices";
+
+  FileManager FM;
+  FM.SetSystemModulePaths({Root.str()});
+  FM.SetModuleIndexDirectory(IndexDirectory.str());
+  EXPECT_EQ(getContentHash("fn print\n"), FM.lookupModule("/std/io.u")->Hash);
+
+  // a rewrite changes the time of no directory; the file alone tells.
+  Write("/std/io.u", "fn print(s: str)\n");
+  auto Loaded = ModuleIndex::load(IndexPath);
+  EXPECT_TRUE(Loaded->isUpToDate());
+  EXPECT_FALSE(Loaded->isCurrent("/std/io.u", *Loaded->lookup("/std/io.u")));
+  EXPECT_TRUE(Loaded->isCurrent("/main.u", *Loaded->lookup("/main.u")));
+
+  // so a manager reads the file again once it is looked up.
+  EXPECT_EQ(getContentHash("fn print(s: str)\n"), FM.lookupModule("/std/io.u")->Hash);
+  EXPECT_EQ(getContentHash("fn main\n"), FM.lookupModule("/main.u")->Hash);
+
+  llvm::sys::fs::remove_directories(IndexDirectory);
+}
+
+TEST_F(ModuleIndexTest, UpdatesOnlyTheFilesChanged) // NOLINT
+{
+  auto Index = ModuleIndex::loadOrBuild(Root, 1, IndexPath);
+  ASSERT_TRUE(!!Index);
+
+  llvm::SmallString<256> Main{Root};
+  Main += "/main.u";
+  llvm::sys::fs::remove(Main);
+  Write("/std/io.u", "fn print(s: str)\n");
+  Write("/std/fmt.u", "fn format\n");
+
+  auto Updated = Index->update({"/std/io.u", "/std/fmt.u", "/main.u"}, IndexPath);
+  ASSERT_TRUE(!!Updated);
+  EXPECT_EQ(3u, Updated->getNumEntries());
+  EXPECT_EQ(getContentHash("fn print(s: str)\n"), Updated->lookup("/std/io.u")->Hash);
+  EXPECT_EQ(getContentHash("fn format\n"), Updated->lookup("/std/fmt.u")->Hash);
+  EXPECT_EQ(getContentHash("fn decode\n"), Updated->lookup("/std/text/utf8.u")->Hash);
+  EXPECT_FALSE(Updated->contains("/main.u"));
+
+  // the directories holding the files are brought up to date with them.
+  EXPECT_TRUE(Updated->isUpToDate());
+  EXPECT_EQ(3u, ModuleIndex::load(IndexPath)->getNumEntries());
+
+  // what lies beneath a directory, old or new, takes indexing the root anew.
+  EXPECT_FALSE(!!Updated->update({"/std/text"}, IndexPath));
+  Write("/lib/list.u", "fn push\n");
+  EXPECT_FALSE(!!Updated->update({"/lib/list.u"}, IndexPath));
+}
+
+TEST_F(ModuleIndexTest, RejectsMalformedIndices) // NOLINT
+{
+  {
+    std::error_code EC;
+    llvm::raw_fd_ostream OS(IndexPath, EC, llvm::sys::fs::F_None);
+    OS << "UMIX, but not really an index";
+  }
+
+  EXPECT_FALSE(!!ModuleIndex::load(IndexPath));
+}
+
+TEST(ModuleIndex, FileManagerIndexesModuleRoots) // NOLINT
+{
+  llvm::SmallString<256> IndexDirectory;
+  llvm::sys::fs::createUniqueDirectory("u-lang-module-indices", IndexDirectory);
+
+  FileManager FM;
+  FM.SetSystemModulePaths({ULANG_TEST_FIXTURE_PATH "/VFS", ULANG_TEST_FIXTURE_PATH "/VFS-overlay"});
+  FM.SetModuleIndexDirectory(IndexDirectory.str());
+
+  // the top-most layer holding a file answers for it.
+  auto Entry = FM.lookupModule("/b/1/test.txt");
+  ASSERT_TRUE(Entry.hasValue());
+  EXPECT_EQ(2u, Entry->Layer);
+  EXPECT_EQ(getContentHash("from earth!"), Entry->Hash);
+
+  EXPECT_EQ(1u, FM.lookupModule("/c/.gitkeep")->Layer);
+  EXPECT_FALSE(FM.lookupModule("/b/1/missing.u").hasValue());
+
+  // resolving a file consults only the layers whose index holds it.
+  EXPECT_TRUE(FM.exists("/c/.gitkeep"));
+  EXPECT_EQ(1u, FM.getNumStatCacheMisses());
+  EXPECT_TRUE(FM.exists("/b/3"));
+  EXPECT_FALSE(FM.exists("/b/1/missing.u"));
+  EXPECT_EQ(2u, FM.getNumStatCacheMisses());
+
+  llvm::sys::fs::remove_directories(IndexDirectory);
+}
@@ -35,13 +35,11 @@ TEST(FileSource, CanPassAbsolutePathSanityCheck) // NOLINT
   EXPECT_TRUE(!!source);
   EXPECT_EQ(102, source.Get());
   EXPECT_FALSE(source.hasBOM());
-  EXPECT_STREQ("FileSource-CanPassSanityCheck.u", source.getLocation().getFileName().c_str());
+  EXPECT_STREQ("FileSource-CanPassSanityCheck.u", source.getFileName().c_str());
   EXPECT_STREQ(ULANG_TEST_FIXTURE_PATH
-                 "/Basic", source.getLocation().getFilePath().c_str());
-  EXPECT_EQ(1, source.getLocation().getRange().getBegin().getLineNumber());
-  EXPECT_EQ(1, source.getLocation().getRange().getBegin().getColumn());
-  EXPECT_EQ(1, source.getLocation().getRange().getEnd().getLineNumber());
-  EXPECT_EQ(1, source.getLocation().getRange().getEnd().getColumn());
+                 "/Basic", source.getFilePath().c_str());
+  EXPECT_EQ(0u, source.getOffset());
+  EXPECT_EQ(1u, source.getReadOffset());
 }
 
 TEST(FileSource, CanPassRelativePathSanityCheck) // NOLINT
@@ -66,8 +64,7 @@ TEST(FileSource, WillSkipFormFeed) // NOLINT
 
   EXPECT_TRUE(!!source);
   EXPECT_EQ(104, source.Get());
-  EXPECT_EQ(1, source.getLocation().getRange().getBegin().getLineNumber());
-  EXPECT_EQ(1, source.getLocation().getRange().getBegin().getColumn());
+  EXPECT_EQ(0u, source.getOffset());
 
   // skip ahead
   source.Get();
@@ -77,13 +74,11 @@ TEST(FileSource, WillSkipFormFeed) // NOLINT
 
   // must now be at the newline
   EXPECT_EQ(10, source.Get());
-  EXPECT_EQ(1, source.getLocation().getRange().getBegin().getLineNumber());
-  EXPECT_EQ(6, source.getLocation().getRange().getBegin().getColumn());
+  EXPECT_EQ(5u, source.getOffset());
 
   // test the next line, first column
   EXPECT_EQ(119, source.Get());
-  EXPECT_EQ(2, source.getLocation().getRange().getBegin().getLineNumber());
-  EXPECT_EQ(1, source.getLocation().getRange().getBegin().getColumn());
+  EXPECT_EQ(6u, source.getOffset());
 }
 
 TEST(StringSource, CanPassSanityCheck) // NOLINT
@@ -93,12 +88,10 @@ TEST(StringSource, CanPassSanityCheck) // NOLINT
   EXPECT_TRUE(!!source);
   EXPECT_EQ(104, source.Get());
   EXPECT_FALSE(source.hasBOM());
-  EXPECT_STREQ("top-level.u", source.getLocation().getFileName().c_str());
-  EXPECT_STREQ(".", source.getLocation().getFilePath().c_str());
-  EXPECT_EQ(1, source.getLocation().getRange().getBegin().getLineNumber());
-  EXPECT_EQ(1, source.getLocation().getRange().getBegin().getColumn());
-  EXPECT_EQ(1, source.getLocation().getRange().getEnd().getLineNumber());
-  EXPECT_EQ(1, source.getLocation().getRange().getEnd().getColumn());
+  EXPECT_STREQ("top-level.u", source.getFileName().c_str());
+  EXPECT_STREQ(".", source.getFilePath().c_str());
+  EXPECT_EQ(0u, source.getOffset());
+  EXPECT_EQ(1u, source.getReadOffset());
 }
 
 TEST(StringSource, WillSkipBOM) // NOLINT
@@ -116,8 +109,7 @@ TEST(StringSource, WillSkipFormFeed) // NOLINT
 
   EXPECT_TRUE(!!source);
   EXPECT_EQ(104, source.Get());
-  EXPECT_EQ(1, source.getLocation().getRange().getBegin().getLineNumber());
-  EXPECT_EQ(1, source.getLocation().getRange().getBegin().getColumn());
+  EXPECT_EQ(3u, source.getOffset());
 
   // skip ahead
   source.Get();
@@ -127,11 +119,44 @@ TEST(StringSource, WillSkipFormFeed) // NOLINT
 
   // must now be at the newline
   EXPECT_EQ(10, source.Get());
-  EXPECT_EQ(1, source.getLocation().getRange().getBegin().getLineNumber());
-  EXPECT_EQ(6, source.getLocation().getRange().getBegin().getColumn());
+  EXPECT_EQ(9u, source.getOffset());
+  EXPECT_EQ(eol::WindowsLineEndings, source.detectedLineEndings());
 
   // test the next line, first column
   EXPECT_EQ(119, source.Get());
-  EXPECT_EQ(2, source.getLocation().getRange().getBegin().getLineNumber());
-  EXPECT_EQ(1, source.getLocation().getRange().getBegin().getColumn());
-}
\ No newline at end of file
+  EXPECT_EQ(10u, source.getOffset());
+}
+
+TEST(StringSource, ReplacesMalformedSequences) // NOLINT
+{
+  StringSource source{"a\xff" "b\xe2\x82" "c\xed\xa0\x80"};
+
+  EXPECT_EQ(97, source.Get());
+  EXPECT_FALSE(source.lastCharWasInvalid());
+
+  EXPECT_EQ(ReplacementCharacter, source.Get());
+  EXPECT_TRUE(source.lastCharWasInvalid());
+  EXPECT_EQ(98, source.Get());
+  EXPECT_FALSE(source.lastCharWasInvalid());
+
+  // a truncated sequence leaves the following character intact.
+  EXPECT_EQ(ReplacementCharacter, source.Get());
+  EXPECT_TRUE(source.lastCharWasInvalid());
+  EXPECT_EQ(99, source.Get());
+
+  // an encoded surrogate half is rejected.
+  EXPECT_EQ(ReplacementCharacter, source.Get());
+  EXPECT_TRUE(source.lastCharWasInvalid());
+  EXPECT_FALSE(!!source);
+}
+
+TEST(StringSource, DecodesMultiByteSequences) // NOLINT
+{
+  StringSource source{"\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80"};
+
+  EXPECT_EQ(0xE9u, source.Get());
+  EXPECT_EQ(0x20ACu, source.Get());
+  EXPECT_EQ(0x1F600u, source.Get());
+  EXPECT_FALSE(source.lastCharWasInvalid());
+  EXPECT_FALSE(!!source);
+}
@@ -29,6 +29,9 @@
 #include <u-lang/Basic/SourceManager.hpp>
 #include <u-lang/u.hpp>
 
+#include <thread>
+#include <vector>
+
 using namespace u;
 using namespace u::vfs;
 
@@ -55,7 +58,7 @@ TEST_F(SourceManagerTest, FileStatusBitsAreCorrect) // NOLINT
   auto Source = sourceManager->getFile("/b/1/test.txt");
   EXPECT_TRUE(!!Source);
   EXPECT_TRUE(!!Source.operator*());
-  EXPECT_NE(Source->getLocation().getFileID(), llvm::sys::fs::UniqueID{});
+  EXPECT_NE(Source->getUniqueID(), llvm::sys::fs::UniqueID{});
   EXPECT_EQ(Source->Get(), 104);
   EXPECT_FALSE(Source->hasBOM());
 }
@@ -65,11 +68,30 @@ TEST_F(SourceManagerTest, BOMIsSkipped) // NOLINT
   auto Source = sourceManager->getFile("/b/3/bom.u");
   EXPECT_TRUE(!!Source);
   EXPECT_TRUE(!!Source.operator*());
-  EXPECT_NE(Source->getLocation().getFileID(), llvm::sys::fs::UniqueID{});
+  EXPECT_NE(Source->getUniqueID(), llvm::sys::fs::UniqueID{});
   EXPECT_EQ(Source->Get(), 102);
   EXPECT_TRUE(Source->hasBOM());
 }
 
+TEST_F(SourceManagerTest, FilesAreReadAsABatch) // NOLINT
+{
+  auto Sources = sourceManager->getFiles({"/b/1/test.txt", "/missing.u", "/b/3/bom.u", "/b/1/test.txt"});
+  ASSERT_EQ(Sources.size(), 4u);
+  EXPECT_FALSE(!!Sources[1]);
+
+  // each is read as getFile reads it, across the layers.
+  for (size_t i : {0u, 2u, 3u})
+  {
+    ASSERT_TRUE(!!Sources[i]);
+    auto Single = sourceManager->getFile(Sources[i]->getVirtualPath());
+    EXPECT_EQ(Sources[i]->getBuffer()->getBuffer(), Single->getBuffer()->getBuffer());
+    EXPECT_EQ(Sources[i]->getUniqueID(), Single->getUniqueID());
+  }
+
+  EXPECT_EQ(Sources[0]->getBuffer()->getBuffer(), "hello world!\nfrom earth!\n");
+  EXPECT_TRUE(Sources[2]->hasBOM());
+}
+
 TEST_F(SourceManagerTest, ReadsUntilEOF) // NOLINT
 {
   auto Source = sourceManager->getFile("/b/1/test.txt");
@@ -93,3 +115,189 @@ TEST_F(SourceManagerTest, ReadsUntilEOF) // NOLINT
   EXPECT_EQ(Source->detectedLineEndings(), eol::WindowsLineEndings);
 #endif
 }
+
+TEST(SourceManager, DecodesLocationsAcrossFiles) // NOLINT
+{
+  SourceManager SM;
+
+  auto First = SM.createFileID(llvm::sys::fs::UniqueID{}, "first.u", ".", llvm::MemoryBuffer::getMemBuffer("let a = 1\n"));
+  auto Second = SM.createFileID(llvm::sys::fs::UniqueID{}, "second.u", ".", llvm::MemoryBuffer::getMemBuffer("fn\n let b = 2\n"));
+  EXPECT_TRUE(First.isValid());
+  EXPECT_TRUE(Second.isValid());
+  EXPECT_NE(First, Second);
+
+  auto Loc = SM.getLocForStartOfFile(Second).getLocWithOffset(8);
+  EXPECT_EQ(4u, sizeof(Loc));
+  EXPECT_EQ(Second, SM.getFileID(Loc));
+  EXPECT_EQ(8u, SM.getFileOffset(Loc));
+  EXPECT_EQ(First, SM.getFileID(SM.getLocForStartOfFile(First).getLocWithOffset(10)));
+
+  auto PLoc = SM.getPresumedLoc(Loc);
+  EXPECT_TRUE(PLoc.isValid());
+  EXPECT_STREQ("second.u", PLoc.getFileName().c_str());
+  EXPECT_EQ(2u, PLoc.getLine());
+  EXPECT_EQ(6u, PLoc.getColumn());
+
+  EXPECT_TRUE(SM.getFileID(SourceLocation()).isInvalid());
+  EXPECT_FALSE(SM.getPresumedLoc(SourceLocation()).isValid());
+}
+
+TEST(SourceManager, RendersCharacterAndDisplayColumns) // NOLINT
+{
+  SourceManager SM;
+
+  // "é" is two bytes wide and one column; "世" is three bytes and two columns.
+  auto FID = SM.createFileID(llvm::sys::fs::UniqueID{}, "wide.u", ".", llvm::MemoryBuffer::getMemBuffer("a\n\xc3\xa9\xe4\xb8\x96x"));
+  auto Loc = SM.getLocForStartOfFile(FID).getLocWithOffset(7);
+
+  EXPECT_EQ(2u, SM.getLineNumber(Loc));
+  EXPECT_EQ(6u, SM.getColumnNumber(Loc));
+  EXPECT_EQ(3u, SM.getCharacterColumn(Loc));
+  EXPECT_EQ(4u, SM.getDisplayColumn(Loc));
+}
+
+TEST(SourceManager, FileInfoReferencesAreStable) // NOLINT
+{
+  SourceManager SM;
+
+  auto First = SM.createFileID(llvm::sys::fs::UniqueID{}, "first.u", ".", llvm::MemoryBuffer::getMemBuffer("a"));
+  auto* FI = &SM.getFileInfo(First);
+
+  for (unsigned i = 0; i < 1000; ++i)
+  {
+    SM.createFileID(llvm::sys::fs::UniqueID{}, "more.u", ".", llvm::MemoryBuffer::getMemBuffer("b"));
+  }
+
+  EXPECT_EQ(FI, &SM.getFileInfo(First));
+  EXPECT_STREQ("first.u", FI->getFileName().c_str());
+  EXPECT_EQ(1001, std::distance(SM.begin(), SM.end()));
+}
+
+TEST(SourceManager, LinesReferToTheOriginalBuffer) // NOLINT
+{
+  SourceManager SM;
+
+  auto FID = SM.createFileID(llvm::sys::fs::UniqueID{},
+                             "lines.u",
+                             ".",
+                             llvm::MemoryBuffer::getMemBuffer("\xef\xbb\xbf" "fn main\r\n\nlet a = 1"));
+  auto& FI = SM.getFileInfo(FID);
+
+  EXPECT_EQ(3u, FI.getNumLines());
+  EXPECT_EQ("fn main", FI.getLine(1));
+  EXPECT_EQ("", FI.getLine(2));
+  EXPECT_EQ("let a = 1", FI.getLine(3));
+
+  // the text is not copied out of the buffer.
+  EXPECT_EQ(FI.getLine(1).data(), FI.getLine(3).data() - 10);
+}
+
+TEST_F(SourceManagerTest, EvictsAndReadsContentsAgain) // NOLINT
+{
+  auto First = sourceManager->createFileID(*sourceManager->getFile("/b/1/test.txt"));
+  auto Second = sourceManager->createFileID(*sourceManager->getFile("/b/3/bom.u"));
+  auto& FI = sourceManager->getFileInfo(First);
+
+  EXPECT_EQ("hello world!", FI.getLine(1));
+  EXPECT_GT(sourceManager->getResidentBytes(), 64u);
+
+  // only the most recently used file fits.
+  EXPECT_EQ(1u, sourceManager->getLineNumber(sourceManager->getLocForStartOfFile(Second)));
+  sourceManager->setMemoryBudget(48);
+  EXPECT_FALSE(FI.isResident());
+  EXPECT_TRUE(sourceManager->getFileInfo(Second).isResident());
+  EXPECT_LE(sourceManager->getResidentBytes(), 48u);
+
+  // the contents are transparently read back, displacing the other file.
+  auto Loc = sourceManager->getLocForStartOfFile(First).getLocWithOffset(18);
+  EXPECT_EQ(2u, sourceManager->getLineNumber(Loc));
+  EXPECT_EQ(6u, sourceManager->getColumnNumber(Loc));
+  EXPECT_TRUE(FI.isResident());
+  EXPECT_FALSE(sourceManager->getFileInfo(Second).isResident());
+  EXPECT_EQ("from earth!", FI.getLine(2));
+}
+
+TEST_F(SourceManagerTest, PinnedFilesStayResident) // NOLINT
+{
+  auto First = sourceManager->createFileID(*sourceManager->getFile("/b/1/test.txt"));
+  sourceManager->pinFile(First);
+
+  sourceManager->createFileID(*sourceManager->getFile("/b/3/bom.u"));
+  sourceManager->setMemoryBudget(1);
+  EXPECT_TRUE(sourceManager->getFileInfo(First).isResident());
+
+  sourceManager->createFileID(*sourceManager->getFile("/b/3/bom.u"));
+  sourceManager->unpinFile(First);
+  EXPECT_FALSE(sourceManager->getFileInfo(First).isResident());
+}
+
+TEST(SourceManager, ContentsWithoutAPathAreNeverEvicted) // NOLINT
+{
+  SourceManager SM;
+  SM.setMemoryBudget(1);
+
+  auto First = SM.createFileID(llvm::sys::fs::UniqueID{}, "first.u", ".", llvm::MemoryBuffer::getMemBuffer("let a = 1\n"));
+  SM.createFileID(llvm::sys::fs::UniqueID{}, "second.u", ".", llvm::MemoryBuffer::getMemBuffer("let b = 2\n"));
+
+  EXPECT_TRUE(SM.getFileInfo(First).isResident());
+  EXPECT_EQ("let a = 1", SM.getFileInfo(First).getLine(1));
+}
+
+TEST(SourceManager, StaleContentsAreNotServed) // NOLINT
+{
+  SourceManager SM;
+
+  // the path does not exist within the virtual file system.
+  auto FID = SM.createFileID(llvm::sys::fs::UniqueID{},
+                             "gone.u",
+                             ".",
+                             llvm::MemoryBuffer::getMemBuffer("let a = 1\nlet b = 2\n"),
+                             "/gone.u");
+  SM.createFileID(llvm::sys::fs::UniqueID{}, "second.u", ".", llvm::MemoryBuffer::getMemBuffer("x"));
+  SM.setMemoryBudget(1);
+
+  auto& FI = SM.getFileInfo(FID);
+  EXPECT_FALSE(FI.isResident());
+  EXPECT_EQ(1u, SM.getLineNumber(SM.getLocForStartOfFile(FID).getLocWithOffset(12)));
+  EXPECT_EQ(20u, FI.getSize());
+  EXPECT_EQ(SM.getFileID(SM.getLocForStartOfFile(FID).getLocWithOffset(20)), FID);
+}
+
+TEST(SourceManager, RegistersAndDecodesConcurrently) // NOLINT
+{
+  SourceManager SM;
+
+  std::vector<std::thread> Threads;
+  std::vector<std::vector<FileID>> Registered(4);
+
+  for (unsigned t = 0; t < Registered.size(); ++t)
+  {
+    Threads.emplace_back([&SM, &Registered, t]() {
+      for (unsigned i = 0; i < 500; ++i)
+      {
+        auto FID = SM.createFileID(llvm::sys::fs::UniqueID{}, "file.u", ".", llvm::MemoryBuffer::getMemBuffer("fn\nlet a\n"));
+        Registered[t].push_back(FID);
+
+        // decode our own files while the others keep registering theirs.
+        auto Loc = SM.getLocForStartOfFile(FID).getLocWithOffset(7);
+        EXPECT_EQ(FID, SM.getFileID(Loc));
+        EXPECT_EQ(2u, SM.getLineNumber(Loc));
+        EXPECT_EQ(5u, SM.getColumnNumber(Loc));
+      }
+    });
+  }
+
+  for (auto& Thread : Threads)
+  {
+    Thread.join();
+  }
+
+  EXPECT_EQ(2000, std::distance(SM.begin(), SM.end()));
+  for (auto& FIDs : Registered)
+  {
+    for (auto FID : FIDs)
+    {
+      EXPECT_EQ(FID, SM.getFileID(SM.getLocForStartOfFile(FID).getLocWithOffset(9)));
+    }
+  }
+}
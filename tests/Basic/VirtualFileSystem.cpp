@@ -21,6 +21,9 @@
  */
 
 #include <llvm/Support/Errc.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/raw_ostream.h>
 
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
@@ -28,6 +31,10 @@
 #include <u-lang/Basic/VirtualFileSystem.hpp>
 #include <u-lang/u.hpp>
 
+#include <mutex>
+#include <set>
+#include <thread>
+
 using namespace u;
 using namespace u::vfs;
 
@@ -154,6 +161,198 @@ TEST(VirtualFileSystem, RealFileSystemSanityTest) // NOLINT
   EXPECT_EQ(count, 6);
 }
 
+TEST(VirtualFileSystem, RealFileSystemResolvesRelativeToItsMount) // NOLINT
+{
+  RealFileSystem realFileSystem(ULANG_TEST_FIXTURE_PATH "/VFS");
+
+  // the physical spelling of a path names the same entry.
+  auto S = realFileSystem.status(ULANG_TEST_FIXTURE_PATH "/VFS/b/1/test.txt");
+  EXPECT_TRUE(!!S);
+  EXPECT_TRUE(S->isRegularFile());
+  EXPECT_STREQ(S->getName().str().c_str(), "/b/1/test.txt");
+
+  // the working directory is private to the file system.
+  EXPECT_FALSE(realFileSystem.setCurrentWorkingDirectory("/b"));
+  EXPECT_STREQ(realFileSystem.getCurrentWorkingDirectory()->c_str(), "/b");
+  EXPECT_TRUE(realFileSystem.exists("1/test.txt"));
+  EXPECT_TRUE(!!realFileSystem.openFileForRead("1/test.txt"));
+
+  unsigned count{0};
+  std::error_code EC;
+  for (auto it = realFileSystem.dir_begin("1", EC); it != directory_iterator(); it.increment(EC))
+  {
+    EXPECT_STREQ(it->getName().str().c_str(), "/b/1/test.txt");
+    ++count;
+  }
+  EXPECT_EQ(count, 1u);
+
+  // neither files nor escapes from the mount may become the working directory.
+  EXPECT_TRUE(!!realFileSystem.setCurrentWorkingDirectory("1/test.txt"));
+  EXPECT_TRUE(!!realFileSystem.setCurrentWorkingDirectory("../.."));
+  EXPECT_STREQ(realFileSystem.getCurrentWorkingDirectory()->c_str(), "/b");
+}
+
+TEST(VirtualFileSystem, RealFileSystemResolvesEntriesLazily) // NOLINT
+{
+  RealFileSystem realFileSystem(ULANG_TEST_FIXTURE_PATH "/VFS");
+
+  std::error_code EC;
+  auto it = realFileSystem.dir_begin("/b/1", EC);
+  ASSERT_FALSE(EC);
+  ASSERT_NE(it, directory_iterator());
+
+  // the type is read with the name; the rest only once asked for.
+  Status Entry = *it;
+  EXPECT_TRUE(Entry.isRegularFile());
+  EXPECT_FALSE(Entry.isResolved());
+
+  // copies share the lookup, from whichever thread it is made.
+  Status Copy = Entry;
+  std::thread Reader([&] { EXPECT_EQ(Copy.getSize(), 12u); });
+  EXPECT_EQ(Entry.getSize(), 12u);
+  Reader.join();
+  EXPECT_TRUE(Entry.isResolved());
+  EXPECT_TRUE(Copy.isResolved());
+
+  auto S = realFileSystem.status("/b/1/test.txt");
+  ASSERT_TRUE(!!S);
+  EXPECT_TRUE(Entry.equivalent(*S));
+  EXPECT_EQ(Entry.getLastModificationTime(), S->getLastModificationTime());
+}
+
+TEST(VirtualFileSystem, WalksSubtreesInParallel) // NOLINT
+{
+  IntrusiveRefCntPtr<FileSystem> realFileSystem = new RealFileSystem(ULANG_TEST_FIXTURE_PATH "/VFS");
+
+  std::set<std::string> Expected;
+  std::error_code EC;
+  for (auto ri = recursive_directory_iterator(*realFileSystem, "/", EC); ri != recursive_directory_iterator();
+       ri.increment(EC))
+  {
+    Expected.insert(ri->getName().str());
+  }
+
+  std::mutex Mutex;
+  std::set<std::string> Visited;
+  EC = walkInParallel(*realFileSystem, "/", [&](Status const& Entry) {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    EXPECT_TRUE(Visited.insert(Entry.getName().str()).second);
+  }, 4);
+
+  EXPECT_FALSE(EC);
+  EXPECT_EQ(Visited.size(), 11u);
+  EXPECT_EQ(Visited, Expected);
+
+  // a missing directory is reported, and nothing visited.
+  unsigned count{0};
+  EC = walkInParallel(*realFileSystem, "/missing", [&](Status const&) { ++count; }, 4);
+  EXPECT_EQ(EC, llvm::errc::no_such_file_or_directory);
+  EXPECT_EQ(count, 0u);
+}
+
+TEST(VirtualFileSystem, WalksSymlinkLoopsOnce) // NOLINT
+{
+  llvm::SmallString<128> Root;
+  llvm::sys::fs::createUniqueDirectory("u-lang-walk", Root);
+
+  llvm::SmallString<128> Sub(Root);
+  llvm::sys::path::append(Sub, "sub");
+  llvm::sys::fs::create_directory(Sub);
+
+  // sub/loop leads back to the root of the walk.
+  llvm::SmallString<128> Loop(Sub);
+  llvm::sys::path::append(Loop, "loop");
+  ASSERT_FALSE(llvm::sys::fs::create_link(Root, Loop));
+
+  IntrusiveRefCntPtr<FileSystem> realFileSystem = new RealFileSystem(Root);
+
+  std::mutex Mutex;
+  std::set<std::string> Visited;
+  std::error_code EC = walkInParallel(*realFileSystem, "/", [&](Status const& Entry) {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    Visited.insert(Entry.getName().str());
+  }, 4);
+
+  EXPECT_FALSE(EC);
+  EXPECT_EQ(Visited, (std::set<std::string>{"/sub", "/sub/loop"}));
+
+  llvm::sys::fs::remove(Loop);
+  llvm::sys::fs::remove_directories(Root);
+}
+
+TEST(VirtualFileSystem, MembershipFilterAdmitsAddedEntries) // NOLINT
+{
+  llvm::SmallString<128> Root;
+  llvm::sys::fs::createUniqueDirectory("u-lang-members", Root);
+
+  auto Write = [&](llvm::StringRef Path) {
+    llvm::SmallString<128> Full(Root);
+    Full += Path;
+    llvm::sys::fs::create_directories(llvm::sys::path::parent_path(Full));
+
+    std::error_code EC;
+    llvm::raw_fd_ostream OS(Full, EC, llvm::sys::fs::F_None);
+    OS << "u\n";
+  };
+
+  Write("/a.u");
+
+  IntrusiveRefCntPtr<RealFileSystem> realFileSystem = new RealFileSystem(Root);
+  realFileSystem->enableMembershipFilter();
+  EXPECT_TRUE(realFileSystem->mayContain("/a.u"));
+  EXPECT_FALSE(realFileSystem->mayContain("/b.u"));
+
+  // a file added is admitted as is.
+  Write("/b.u");
+  realFileSystem->noteEntryChanged("/b.u");
+  EXPECT_TRUE(realFileSystem->mayContain("/b.u"));
+
+  // a directory added has what lies beneath it found by a walk.
+  Write("/d/c.u");
+  realFileSystem->noteEntryChanged("/d");
+  EXPECT_TRUE(realFileSystem->mayContain("/d/c.u"));
+  EXPECT_FALSE(realFileSystem->mayContain("/d/e.u"));
+
+  llvm::sys::fs::remove_directories(Root);
+}
+
+TEST(VirtualFileSystem, RealFileSystemOpensFilesAsABatch) // NOLINT
+{
+  IntrusiveRefCntPtr<RealFileSystem> realFileSystem = new RealFileSystem(ULANG_TEST_FIXTURE_PATH "/VFS");
+
+  // enough files to be spread across several threads, or to fill a ring
+  // several times over.
+  std::vector<std::string> Paths;
+  for (unsigned i = 0; i < 300; ++i)
+  {
+    Paths.emplace_back(i % 4 == 1 ? "/missing.u" : i % 4 == 2 ? "/b/1" : "/b/1/test.txt");
+  }
+
+  auto Files = realFileSystem->openFilesForRead(Paths);
+  ASSERT_EQ(Files.size(), Paths.size());
+  for (unsigned i = 0; i < Paths.size(); ++i)
+  {
+    auto Single = realFileSystem->openFileForRead(Paths[i]);
+    ASSERT_EQ(!!Files[i], !!Single);
+    if (!Single)
+    {
+      EXPECT_EQ(Files[i].getError(), Single.getError());
+      continue;
+    }
+
+    auto S = (*Files[i])->status();
+    ASSERT_TRUE(!!S);
+    EXPECT_EQ(S->getName(), Paths[i]);
+    EXPECT_TRUE(S->equivalent(*(*Single)->status()));
+    if (S->isRegularFile())
+    {
+      auto Buffer = (*Files[i])->getBuffer(Paths[i], S->getSize());
+      ASSERT_TRUE(!!Buffer);
+      EXPECT_EQ((*Buffer)->getBuffer(), "hello world!");
+    }
+  }
+}
+
 TEST(VirtualFileSystem, InMemoryAndSingleRealOverlaySanityTest) // NOLINT
 {
   IntrusiveRefCntPtr<InMemoryFileSystem> inMemoryFileSystem = new InMemoryFileSystem();
@@ -325,3 +524,192 @@ TEST(VirtualFileSystem, InMemoryAndTwoRealConcatOverlaySanityTest) // NOLINT
 
   EXPECT_EQ(count, 15);
 }
+
+TEST(VirtualFileSystem, ConcatenatedFilesRecordTheirLayers) // NOLINT
+{
+  IntrusiveRefCntPtr<InMemoryFileSystem> inMemoryFileSystem = new InMemoryFileSystem();
+  inMemoryFileSystem->addFile("/b/1/test.txt", 0, llvm::MemoryBuffer::getMemBuffer("in memory\n"));
+  inMemoryFileSystem->addFile("/only.u", 0, llvm::MemoryBuffer::getMemBuffer("fn main\n"));
+
+  IntrusiveRefCntPtr<FileSystem> realFileSystem = new RealFileSystem(ULANG_TEST_FIXTURE_PATH "/VFS");
+
+  ConcatenatedOverlayFileSystem overlayFileSystem{inMemoryFileSystem};
+  overlayFileSystem.pushOverlay(realFileSystem);
+
+  auto File = overlayFileSystem.openFileForRead("/b/1/test.txt");
+  EXPECT_TRUE(!!File);
+
+  auto* Concatenated = dynamic_cast<ConcatenatedFile*>(File->get());
+  EXPECT_NE(nullptr, Concatenated);
+
+  // the in-memory layer already ends its line; the real one does not.
+  auto Segments = Concatenated->getSegments();
+  EXPECT_EQ(2u, Segments.size());
+  EXPECT_EQ(0u, Segments[0].Layer);
+  EXPECT_EQ(10u, Segments[1].Offset);
+  EXPECT_EQ(12u, Segments[1].Size);
+  EXPECT_EQ(1u, Concatenated->getLayerForOffset(15));
+  EXPECT_EQ(23u, (*File)->status()->getSize());
+
+  auto Content = (*File)->getBuffer("/b/1/test.txt");
+  EXPECT_EQ("in memory\nhello world!\n", (*Content)->getBuffer());
+
+  // reopening shares the contents already read.
+  auto Again = overlayFileSystem.openFileForRead("/b/1/test.txt");
+  EXPECT_EQ((*File)->status()->getUniqueID(), (*Again)->status()->getUniqueID());
+  EXPECT_EQ((*Content)->getBufferStart(), (*(*Again)->getBuffer("/b/1/test.txt"))->getBufferStart());
+
+  // a file held by a single layer, ending its line, is not copied.
+  auto Only = overlayFileSystem.openFileForRead("/only.u");
+  auto OnlyContent = (*Only)->getBuffer("/only.u");
+  EXPECT_EQ("fn main\n", (*OnlyContent)->getBuffer());
+  EXPECT_EQ((*inMemoryFileSystem->openFileForRead("/only.u"))->getBuffer("/only.u").get()->getBufferStart(),
+            (*OnlyContent)->getBufferStart());
+
+  EXPECT_FALSE(!!overlayFileSystem.openFileForRead("/missing.u"));
+}
+
+TEST(VirtualFileSystem, ConcatenatedOverlayForgetsReleasedFiles) // NOLINT
+{
+  IntrusiveRefCntPtr<InMemoryFileSystem> inMemoryFileSystem = new InMemoryFileSystem();
+  for (unsigned i = 0; i < 500; ++i)
+  {
+    inMemoryFileSystem->addFile("/" + std::to_string(i) + ".u", 0, llvm::MemoryBuffer::getMemBufferCopy("u\n"));
+  }
+
+  ConcatenatedOverlayFileSystem overlayFileSystem{inMemoryFileSystem};
+
+  auto Kept = overlayFileSystem.openFileForRead("/0.u");
+  EXPECT_TRUE(!!Kept);
+
+  // files opened and released in turn are not remembered without bound.
+  for (unsigned i = 1; i < 500; ++i)
+  {
+    EXPECT_TRUE(!!overlayFileSystem.openFileForRead("/" + std::to_string(i) + ".u"));
+  }
+  EXPECT_LT(overlayFileSystem.getNumRememberedFiles(), 200u);
+
+  // the contents of a released file are read again, and remembered once.
+  std::vector<std::string> Paths{"/1.u", "/0.u"};
+  auto Files = overlayFileSystem.openFilesForRead(Paths);
+  EXPECT_TRUE(!!Files[0]);
+  EXPECT_EQ((*Kept)->status()->getUniqueID(), (*Files[1])->status()->getUniqueID());
+
+  auto Remembered = overlayFileSystem.getNumRememberedFiles();
+  Files.clear();
+  EXPECT_TRUE(!!overlayFileSystem.openFileForRead("/1.u"));
+  EXPECT_EQ(Remembered, overlayFileSystem.getNumRememberedFiles());
+}
+
+TEST(VirtualFileSystem, MembershipFiltersRuleOutMissingEntries) // NOLINT
+{
+  IntrusiveRefCntPtr<RealFileSystem> realFileSystem = new RealFileSystem(ULANG_TEST_FIXTURE_PATH "/VFS-overlay");
+
+  // without a filter, anything may exist.
+  EXPECT_TRUE(realFileSystem->mayContain("/missing.u"));
+
+  realFileSystem->enableMembershipFilter();
+  EXPECT_TRUE(realFileSystem->mayContain("/"));
+  EXPECT_TRUE(realFileSystem->mayContain("/b"));
+  EXPECT_TRUE(realFileSystem->mayContain("/b/3/"));
+  EXPECT_TRUE(realFileSystem->mayContain("/b/3/bom.u"));
+  EXPECT_TRUE(realFileSystem->mayContain("/b/1/../3/bom.u"));
+  EXPECT_FALSE(realFileSystem->mayContain("/missing.u"));
+  EXPECT_FALSE(realFileSystem->mayContain("/b/3/test.txt"));
+  EXPECT_TRUE(realFileSystem->mayContain(ULANG_TEST_FIXTURE_PATH "/VFS-overlay/b/3/bom.u"));
+
+  // a relative path is resolved against the working directory.
+  EXPECT_FALSE(realFileSystem->setCurrentWorkingDirectory("/b"));
+  EXPECT_TRUE(realFileSystem->mayContain("3/bom.u"));
+  EXPECT_TRUE(realFileSystem->mayContain("./3/../3"));
+  EXPECT_FALSE(realFileSystem->mayContain("bom.u"));
+  EXPECT_TRUE(realFileSystem->exists("3/bom.u"));
+  EXPECT_FALSE(realFileSystem->setCurrentWorkingDirectory("/"));
+
+  IntrusiveRefCntPtr<InMemoryFileSystem> inMemoryFileSystem = new InMemoryFileSystem();
+  IntrusiveRefCntPtr<OverlayFileSystem> overlayFileSystem = new OverlayFileSystem(inMemoryFileSystem);
+  overlayFileSystem->pushOverlay(realFileSystem);
+
+  // an overlay may contain whatever any of its layers may.
+  EXPECT_TRUE(overlayFileSystem->mayContain("/missing.u"));
+  EXPECT_TRUE(!!overlayFileSystem->status("/b/3/bom.u"));
+  EXPECT_FALSE(!!overlayFileSystem->status("/missing.u"));
+}
+
+TEST(VirtualFileSystem, StatCacheRemembersFailedOpens) // NOLINT
+{
+  IntrusiveRefCntPtr<InMemoryFileSystem> inMemoryFileSystem = new InMemoryFileSystem();
+  inMemoryFileSystem->addFile("/a.u", 0, llvm::MemoryBuffer::getMemBufferCopy("a"));
+
+  IntrusiveRefCntPtr<StatCachingFileSystem> cachingFileSystem = new StatCachingFileSystem(inMemoryFileSystem);
+
+  EXPECT_FALSE(!!cachingFileSystem->openFileForRead("/missing.u"));
+  EXPECT_EQ(0u, cachingFileSystem->getNumHits());
+
+  // neither opening nor examining the entry again consults the file system.
+  auto File = cachingFileSystem->openFileForRead("/missing.u");
+  EXPECT_EQ(llvm::errc::no_such_file_or_directory, File.getError());
+  EXPECT_FALSE(cachingFileSystem->exists("/./missing.u"));
+  EXPECT_EQ(0u, cachingFileSystem->getNumMisses());
+  EXPECT_EQ(2u, cachingFileSystem->getNumHits());
+
+  auto Files = cachingFileSystem->openFilesForRead({"/a.u", "/missing.u", "/other.u"});
+  EXPECT_TRUE(!!Files[0]);
+  EXPECT_FALSE(!!Files[1]);
+  EXPECT_FALSE(!!Files[2]);
+  EXPECT_FALSE(!!cachingFileSystem->openFileForRead("/other.u"));
+  EXPECT_EQ(4u, cachingFileSystem->getNumHits());
+}
+
+TEST(VirtualFileSystem, InMemoryFileSystemAddsFilesInBulk) // NOLINT
+{
+  InMemoryFileSystem inMemoryFileSystem;
+
+  std::vector<std::pair<std::string, std::unique_ptr<llvm::MemoryBuffer>>> Files;
+  Files.emplace_back("/gen/b/two.u", llvm::MemoryBuffer::getMemBufferCopy("two"));
+  Files.emplace_back("/gen/a/one.u", llvm::MemoryBuffer::getMemBufferCopy("one"));
+  Files.emplace_back("/gen/./b/../a/three.u", llvm::MemoryBuffer::getMemBufferCopy("three"));
+  Files.emplace_back("/gen/c.u", llvm::MemoryBuffer::getMemBufferCopy("four"));
+  EXPECT_TRUE(inMemoryFileSystem.addFiles(0, std::move(Files)));
+
+  EXPECT_TRUE(inMemoryFileSystem.exists("/gen/a/one.u"));
+  EXPECT_TRUE(inMemoryFileSystem.exists("/gen/a/three.u"));
+  EXPECT_TRUE(inMemoryFileSystem.exists("/gen/b/../a/three.u"));
+  EXPECT_TRUE(inMemoryFileSystem.exists("/gen/b/two.u"));
+  EXPECT_TRUE(inMemoryFileSystem.exists("/gen/c.u"));
+  EXPECT_FALSE(inMemoryFileSystem.exists("/gen/a/two.u"));
+  EXPECT_FALSE(inMemoryFileSystem.exists("/gen/never-added.u"));
+
+  auto S = inMemoryFileSystem.status("/gen/a");
+  EXPECT_TRUE(!!S);
+  EXPECT_TRUE(S->isDirectory());
+  EXPECT_EQ("/gen/a", S->getName());
+
+  auto Content = inMemoryFileSystem.getBufferForFile("/gen/a/three.u", 5u);
+  EXPECT_TRUE(!!Content);
+  EXPECT_EQ("three", (*Content)->getBuffer());
+
+  unsigned count{0};
+  std::error_code EC;
+  for (auto it = inMemoryFileSystem.dir_begin("/gen", EC); it != directory_iterator(); it.increment(EC))
+  {
+    ++count;
+  }
+
+  EXPECT_EQ(3u, count);
+
+  // the same contents may be added again, but not different ones.
+  Files.clear();
+  Files.emplace_back("/gen/c.u", llvm::MemoryBuffer::getMemBufferCopy("four"));
+  EXPECT_TRUE(inMemoryFileSystem.addFiles(0, std::move(Files)));
+
+  Files.clear();
+  Files.emplace_back("/gen/d.u", llvm::MemoryBuffer::getMemBufferCopy("five"));
+  Files.emplace_back("/gen/c.u", llvm::MemoryBuffer::getMemBufferCopy("six"));
+  EXPECT_FALSE(inMemoryFileSystem.addFiles(0, std::move(Files)));
+  EXPECT_TRUE(inMemoryFileSystem.exists("/gen/d.u"));
+
+  // a file cannot stand in for a directory, nor the other way around.
+  EXPECT_FALSE(inMemoryFileSystem.addFile("/gen/c.u/e.u", 0, llvm::MemoryBuffer::getMemBufferCopy("seven")));
+  EXPECT_FALSE(inMemoryFileSystem.addFile("/gen/a", 0, llvm::MemoryBuffer::getMemBufferCopy("eight")));
+}
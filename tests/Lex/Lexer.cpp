@@ -33,44 +33,46 @@ TEST(Lexer, SanityCheck) // NOLINT
 {
   StringSource source{" fn"};
   Lexer lexer(source);
+  SourceManager& SM = *lexer.getSourceManager();
 
   Token subject = lexer.Lex();
   EXPECT_EQ(tok::kw_fn, subject.getKind());
-  EXPECT_EQ(1, subject.getLocation().getRange().getBegin().getLineNumber());
-  EXPECT_EQ(2, subject.getLocation().getRange().getBegin().getColumn());
+  EXPECT_EQ(1, SM.getLineNumber(subject.getLocation()));
+  EXPECT_EQ(2, SM.getColumnNumber(subject.getLocation()));
 
   Token finalSubject = lexer.Lex();
   EXPECT_EQ(tok::eof, finalSubject.getKind());
-  EXPECT_EQ(1, finalSubject.getLocation().getRange().getBegin().getLineNumber());
-  EXPECT_EQ(4, finalSubject.getLocation().getRange().getBegin().getColumn());
+  EXPECT_EQ(1, SM.getLineNumber(finalSubject.getLocation()));
+  EXPECT_EQ(4, SM.getColumnNumber(finalSubject.getLocation()));
 }
 
 TEST(Lexer, NewLineIncrementsLineNumberAndResetsColumn) // NOLINT
 {
   StringSource source{"let a = 1.42\nlet b = 3.1415"};
   Lexer lexer(source);
+  SourceManager& SM = *lexer.getSourceManager();
 
   Token subject1 = lexer.Lex();
   EXPECT_EQ(tok::kw_let, subject1.getKind());
-  EXPECT_EQ(1, subject1.getLocation().getRange().getBegin().getLineNumber());
-  EXPECT_EQ(1, subject1.getLocation().getRange().getBegin().getColumn());
-  EXPECT_EQ(1, subject1.getLocation().getRange().getEnd().getLineNumber());
-  EXPECT_EQ(3, subject1.getLocation().getRange().getEnd().getColumn());
+  EXPECT_EQ(1, SM.getLineNumber(subject1.getLocation()));
+  EXPECT_EQ(1, SM.getColumnNumber(subject1.getLocation()));
+  EXPECT_EQ(1, SM.getLineNumber(subject1.getEndLoc()));
+  EXPECT_EQ(3, SM.getColumnNumber(subject1.getEndLoc()));
 
   for (unsigned i = 0; i < 3; ++i)
     lexer.Lex();
 
   Token subject2 = lexer.Lex();
   EXPECT_EQ(tok::eol, subject2.getKind());
-  EXPECT_EQ(1, subject2.getLocation().getRange().getBegin().getLineNumber());
-  EXPECT_EQ(13, subject2.getLocation().getRange().getBegin().getColumn());
+  EXPECT_EQ(1, SM.getLineNumber(subject2.getLocation()));
+  EXPECT_EQ(13, SM.getColumnNumber(subject2.getLocation()));
 
   Token subject3 = lexer.Lex();
   EXPECT_EQ(tok::kw_let, subject3.getKind());
-  EXPECT_EQ(2, subject3.getLocation().getRange().getBegin().getLineNumber());
-  EXPECT_EQ(1, subject3.getLocation().getRange().getBegin().getColumn());
-  EXPECT_EQ(2, subject3.getLocation().getRange().getEnd().getLineNumber());
-  EXPECT_EQ(3, subject3.getLocation().getRange().getEnd().getColumn());
+  EXPECT_EQ(2, SM.getLineNumber(subject3.getLocation()));
+  EXPECT_EQ(1, SM.getColumnNumber(subject3.getLocation()));
+  EXPECT_EQ(2, SM.getLineNumber(subject3.getEndLoc()));
+  EXPECT_EQ(3, SM.getColumnNumber(subject3.getEndLoc()));
 }
 
 TEST(Lexer, HandlesSimpleIntegerConstant) // NOLINT
@@ -161,118 +163,123 @@ TEST(Lexer, IntegerDoesNotIncludeLeadingMinus) // NOLINT
 {
   StringSource source{"-42"};
   Lexer lexer(source);
+  SourceManager& SM = *lexer.getSourceManager();
 
   Token subject1 = lexer.Lex();
 
   EXPECT_EQ(tok::minus, subject1.getKind());
-  EXPECT_EQ(1, subject1.getLocation().getRange().getBegin().getLineNumber());
-  EXPECT_EQ(1, subject1.getLocation().getRange().getBegin().getColumn());
-  EXPECT_EQ(1, subject1.getLocation().getRange().getEnd().getLineNumber());
-  EXPECT_EQ(1, subject1.getLocation().getRange().getEnd().getColumn());
+  EXPECT_EQ(1, SM.getLineNumber(subject1.getLocation()));
+  EXPECT_EQ(1, SM.getColumnNumber(subject1.getLocation()));
+  EXPECT_EQ(1, SM.getLineNumber(subject1.getEndLoc()));
+  EXPECT_EQ(1, SM.getColumnNumber(subject1.getEndLoc()));
 
   Token subject2 = lexer.Lex();
 
   EXPECT_EQ(tok::integer_constant, subject2.getKind());
-  EXPECT_EQ(1, subject2.getLocation().getRange().getBegin().getLineNumber());
-  EXPECT_EQ(2, subject2.getLocation().getRange().getBegin().getColumn());
-  EXPECT_EQ(1, subject2.getLocation().getRange().getEnd().getLineNumber());
-  EXPECT_EQ(3, subject2.getLocation().getRange().getEnd().getColumn());
+  EXPECT_EQ(1, SM.getLineNumber(subject2.getLocation()));
+  EXPECT_EQ(2, SM.getColumnNumber(subject2.getLocation()));
+  EXPECT_EQ(1, SM.getLineNumber(subject2.getEndLoc()));
+  EXPECT_EQ(3, SM.getColumnNumber(subject2.getEndLoc()));
 }
 
 TEST(Lexer, FloatingPointDoesNotIncludeLeadingMinus) // NOLINT
 {
   StringSource source{"-3.1415"};
   Lexer lexer(source);
+  SourceManager& SM = *lexer.getSourceManager();
 
   Token subject1 = lexer.Lex();
 
   EXPECT_EQ(tok::minus, subject1.getKind());
-  EXPECT_EQ(1, subject1.getLocation().getRange().getBegin().getLineNumber());
-  EXPECT_EQ(1, subject1.getLocation().getRange().getBegin().getColumn());
-  EXPECT_EQ(1, subject1.getLocation().getRange().getEnd().getLineNumber());
-  EXPECT_EQ(1, subject1.getLocation().getRange().getEnd().getColumn());
+  EXPECT_EQ(1, SM.getLineNumber(subject1.getLocation()));
+  EXPECT_EQ(1, SM.getColumnNumber(subject1.getLocation()));
+  EXPECT_EQ(1, SM.getLineNumber(subject1.getEndLoc()));
+  EXPECT_EQ(1, SM.getColumnNumber(subject1.getEndLoc()));
 
   Token subject2 = lexer.Lex();
 
   EXPECT_EQ(tok::real_constant, subject2.getKind());
-  EXPECT_EQ(1, subject2.getLocation().getRange().getBegin().getLineNumber());
-  EXPECT_EQ(2, subject2.getLocation().getRange().getBegin().getColumn());
-  EXPECT_EQ(1, subject2.getLocation().getRange().getEnd().getLineNumber());
-  EXPECT_EQ(7, subject2.getLocation().getRange().getEnd().getColumn());
+  EXPECT_EQ(1, SM.getLineNumber(subject2.getLocation()));
+  EXPECT_EQ(2, SM.getColumnNumber(subject2.getLocation()));
+  EXPECT_EQ(1, SM.getLineNumber(subject2.getEndLoc()));
+  EXPECT_EQ(7, SM.getColumnNumber(subject2.getEndLoc()));
 }
 
 TEST(Lexer, HandlesIntegerMinusInteger) // NOLINT
 {
   StringSource source{"42-144"};
   Lexer lexer(source);
+  SourceManager& SM = *lexer.getSourceManager();
 
   Token subject1 = lexer.Lex();
 
   EXPECT_EQ(tok::integer_constant, subject1.getKind());
-  EXPECT_EQ(1, subject1.getLocation().getRange().getBegin().getLineNumber());
-  EXPECT_EQ(1, subject1.getLocation().getRange().getBegin().getColumn());
-  EXPECT_EQ(1, subject1.getLocation().getRange().getEnd().getLineNumber());
-  EXPECT_EQ(2, subject1.getLocation().getRange().getEnd().getColumn());
+  EXPECT_EQ(1, SM.getLineNumber(subject1.getLocation()));
+  EXPECT_EQ(1, SM.getColumnNumber(subject1.getLocation()));
+  EXPECT_EQ(1, SM.getLineNumber(subject1.getEndLoc()));
+  EXPECT_EQ(2, SM.getColumnNumber(subject1.getEndLoc()));
 
   Token subject2 = lexer.Lex();
 
   EXPECT_EQ(tok::minus, subject2.getKind());
-  EXPECT_EQ(1, subject2.getLocation().getRange().getBegin().getLineNumber());
-  EXPECT_EQ(3, subject2.getLocation().getRange().getBegin().getColumn());
-  EXPECT_EQ(1, subject2.getLocation().getRange().getEnd().getLineNumber());
-  EXPECT_EQ(3, subject2.getLocation().getRange().getEnd().getColumn());
+  EXPECT_EQ(1, SM.getLineNumber(subject2.getLocation()));
+  EXPECT_EQ(3, SM.getColumnNumber(subject2.getLocation()));
+  EXPECT_EQ(1, SM.getLineNumber(subject2.getEndLoc()));
+  EXPECT_EQ(3, SM.getColumnNumber(subject2.getEndLoc()));
 
   Token subject3 = lexer.Lex();
 
   EXPECT_EQ(tok::integer_constant, subject3.getKind());
-  EXPECT_EQ(1, subject3.getLocation().getRange().getBegin().getLineNumber());
-  EXPECT_EQ(4, subject3.getLocation().getRange().getBegin().getColumn());
-  EXPECT_EQ(1, subject3.getLocation().getRange().getEnd().getLineNumber());
-  EXPECT_EQ(6, subject3.getLocation().getRange().getEnd().getColumn());
+  EXPECT_EQ(1, SM.getLineNumber(subject3.getLocation()));
+  EXPECT_EQ(4, SM.getColumnNumber(subject3.getLocation()));
+  EXPECT_EQ(1, SM.getLineNumber(subject3.getEndLoc()));
+  EXPECT_EQ(6, SM.getColumnNumber(subject3.getEndLoc()));
 }
 
 TEST(Lexer, HandlesFloatingPointMinusFloatingPoint) // NOLINT
 {
   StringSource source{"1.42-3.1415"};
   Lexer lexer(source);
+  SourceManager& SM = *lexer.getSourceManager();
 
   Token subject1 = lexer.Lex();
 
   EXPECT_EQ(tok::real_constant, subject1.getKind());
-  EXPECT_EQ(1, subject1.getLocation().getRange().getBegin().getLineNumber());
-  EXPECT_EQ(1, subject1.getLocation().getRange().getBegin().getColumn());
-  EXPECT_EQ(1, subject1.getLocation().getRange().getEnd().getLineNumber());
-  EXPECT_EQ(4, subject1.getLocation().getRange().getEnd().getColumn());
+  EXPECT_EQ(1, SM.getLineNumber(subject1.getLocation()));
+  EXPECT_EQ(1, SM.getColumnNumber(subject1.getLocation()));
+  EXPECT_EQ(1, SM.getLineNumber(subject1.getEndLoc()));
+  EXPECT_EQ(4, SM.getColumnNumber(subject1.getEndLoc()));
 
   Token subject2 = lexer.Lex();
 
   EXPECT_EQ(tok::minus, subject2.getKind());
-  EXPECT_EQ(1, subject2.getLocation().getRange().getBegin().getLineNumber());
-  EXPECT_EQ(5, subject2.getLocation().getRange().getBegin().getColumn());
-  EXPECT_EQ(1, subject2.getLocation().getRange().getEnd().getLineNumber());
-  EXPECT_EQ(5, subject2.getLocation().getRange().getEnd().getColumn());
+  EXPECT_EQ(1, SM.getLineNumber(subject2.getLocation()));
+  EXPECT_EQ(5, SM.getColumnNumber(subject2.getLocation()));
+  EXPECT_EQ(1, SM.getLineNumber(subject2.getEndLoc()));
+  EXPECT_EQ(5, SM.getColumnNumber(subject2.getEndLoc()));
 
   Token subject3 = lexer.Lex();
 
   EXPECT_EQ(tok::real_constant, subject3.getKind());
-  EXPECT_EQ(1, subject3.getLocation().getRange().getBegin().getLineNumber());
-  EXPECT_EQ(6, subject3.getLocation().getRange().getBegin().getColumn());
-  EXPECT_EQ(1, subject3.getLocation().getRange().getEnd().getLineNumber());
-  EXPECT_EQ(11, subject3.getLocation().getRange().getEnd().getColumn());
+  EXPECT_EQ(1, SM.getLineNumber(subject3.getLocation()));
+  EXPECT_EQ(6, SM.getColumnNumber(subject3.getLocation()));
+  EXPECT_EQ(1, SM.getLineNumber(subject3.getEndLoc()));
+  EXPECT_EQ(11, SM.getColumnNumber(subject3.getEndLoc()));
 }
 
 TEST(Lexer, HandlesTwoCharacterPunctuator) // NOLINT
 {
   StringSource source{"&&"};
   Lexer lexer(source);
+  SourceManager& SM = *lexer.getSourceManager();
 
   Token subject = lexer.Lex();
 
   EXPECT_EQ(tok::ampamp, subject.getKind());
-  EXPECT_EQ(1, subject.getLocation().getRange().getBegin().getLineNumber());
-  EXPECT_EQ(1, subject.getLocation().getRange().getBegin().getColumn());
-  EXPECT_EQ(1, subject.getLocation().getRange().getEnd().getLineNumber());
-  EXPECT_EQ(2, subject.getLocation().getRange().getEnd().getColumn());
+  EXPECT_EQ(1, SM.getLineNumber(subject.getLocation()));
+  EXPECT_EQ(1, SM.getColumnNumber(subject.getLocation()));
+  EXPECT_EQ(1, SM.getLineNumber(subject.getEndLoc()));
+  EXPECT_EQ(2, SM.getColumnNumber(subject.getEndLoc()));
 
   EXPECT_EQ(tok::eof, lexer.Lex().getKind());
 }
@@ -281,22 +288,23 @@ TEST(Lexer, HandlesSimpleFnDecl) // NOLINT
 {
   StringSource source{"fn joe"};
   Lexer lexer(source);
+  SourceManager& SM = *lexer.getSourceManager();
 
   Token subject = lexer.Lex();
 
   EXPECT_EQ(tok::kw_fn, subject.getKind());
-  EXPECT_EQ(1, subject.getLocation().getRange().getBegin().getLineNumber());
-  EXPECT_EQ(1, subject.getLocation().getRange().getBegin().getColumn());
-  EXPECT_EQ(1, subject.getLocation().getRange().getEnd().getLineNumber());
-  EXPECT_EQ(2, subject.getLocation().getRange().getEnd().getColumn());
+  EXPECT_EQ(1, SM.getLineNumber(subject.getLocation()));
+  EXPECT_EQ(1, SM.getColumnNumber(subject.getLocation()));
+  EXPECT_EQ(1, SM.getLineNumber(subject.getEndLoc()));
+  EXPECT_EQ(2, SM.getColumnNumber(subject.getEndLoc()));
 
   Token subject2 = lexer.Lex();
 
   EXPECT_EQ(tok::identifier, subject2.getKind());
-  EXPECT_EQ(1, subject2.getLocation().getRange().getBegin().getLineNumber());
-  EXPECT_EQ(4, subject2.getLocation().getRange().getBegin().getColumn());
-  EXPECT_EQ(1, subject2.getLocation().getRange().getEnd().getLineNumber());
-  EXPECT_EQ(6, subject2.getLocation().getRange().getEnd().getColumn());
+  EXPECT_EQ(1, SM.getLineNumber(subject2.getLocation()));
+  EXPECT_EQ(4, SM.getColumnNumber(subject2.getLocation()));
+  EXPECT_EQ(1, SM.getLineNumber(subject2.getEndLoc()));
+  EXPECT_EQ(6, SM.getColumnNumber(subject2.getEndLoc()));
 
   EXPECT_EQ(tok::eof, lexer.Lex().getKind());
 }
@@ -305,14 +313,15 @@ TEST(Lexer, ParsesARune) // NOLINT
 {
   StringSource source{"'a'"};
   Lexer lexer(source);
+  SourceManager& SM = *lexer.getSourceManager();
 
   Token subject = lexer.Lex();
 
   EXPECT_EQ(tok::rune_constant, subject.getKind());
-  EXPECT_EQ(1, subject.getLocation().getRange().getBegin().getLineNumber());
-  EXPECT_EQ(1, subject.getLocation().getRange().getBegin().getColumn());
-  EXPECT_EQ(1, subject.getLocation().getRange().getEnd().getLineNumber());
-  EXPECT_EQ(3, subject.getLocation().getRange().getEnd().getColumn());
+  EXPECT_EQ(1, SM.getLineNumber(subject.getLocation()));
+  EXPECT_EQ(1, SM.getColumnNumber(subject.getLocation()));
+  EXPECT_EQ(1, SM.getLineNumber(subject.getEndLoc()));
+  EXPECT_EQ(3, SM.getColumnNumber(subject.getEndLoc()));
 
   EXPECT_EQ(tok::eof, lexer.Lex().getKind());
 }
@@ -321,14 +330,15 @@ TEST(Lexer, ParsesStringLiteral) // NOLINT
 {
   StringSource source{"'fn'"};
   Lexer lexer(source);
+  SourceManager& SM = *lexer.getSourceManager();
 
   Token subject = lexer.Lex();
 
   EXPECT_EQ(tok::string_constant, subject.getKind());
-  EXPECT_EQ(1, subject.getLocation().getRange().getBegin().getLineNumber());
-  EXPECT_EQ(1, subject.getLocation().getRange().getBegin().getColumn());
-  EXPECT_EQ(1, subject.getLocation().getRange().getEnd().getLineNumber());
-  EXPECT_EQ(4, subject.getLocation().getRange().getEnd().getColumn());
+  EXPECT_EQ(1, SM.getLineNumber(subject.getLocation()));
+  EXPECT_EQ(1, SM.getColumnNumber(subject.getLocation()));
+  EXPECT_EQ(1, SM.getLineNumber(subject.getEndLoc()));
+  EXPECT_EQ(4, SM.getColumnNumber(subject.getEndLoc()));
 
   EXPECT_EQ(tok::eof, lexer.Lex().getKind());
 }
@@ -337,14 +347,15 @@ TEST(Lexer, ParsesDoubleQuoteRune) // NOLINT
 {
   StringSource source{"'\"'"}; // NOLINT
   Lexer lexer(source);
+  SourceManager& SM = *lexer.getSourceManager();
 
   Token subject = lexer.Lex();
 
   EXPECT_EQ(tok::rune_constant, subject.getKind());
-  EXPECT_EQ(1, subject.getLocation().getRange().getBegin().getLineNumber());
-  EXPECT_EQ(1, subject.getLocation().getRange().getBegin().getColumn());
-  EXPECT_EQ(1, subject.getLocation().getRange().getEnd().getLineNumber());
-  EXPECT_EQ(3, subject.getLocation().getRange().getEnd().getColumn());
+  EXPECT_EQ(1, SM.getLineNumber(subject.getLocation()));
+  EXPECT_EQ(1, SM.getColumnNumber(subject.getLocation()));
+  EXPECT_EQ(1, SM.getLineNumber(subject.getEndLoc()));
+  EXPECT_EQ(3, SM.getColumnNumber(subject.getEndLoc()));
 
   EXPECT_EQ(tok::eof, lexer.Lex().getKind());
 }
@@ -353,14 +364,15 @@ TEST(Lexer, ParsesSingleQuoteRune) // NOLINT
 {
   StringSource source{"\"'\""}; // NOLINT
   Lexer lexer(source);
+  SourceManager& SM = *lexer.getSourceManager();
 
   Token subject = lexer.Lex();
 
   EXPECT_EQ(tok::rune_constant, subject.getKind());
-  EXPECT_EQ(1, subject.getLocation().getRange().getBegin().getLineNumber());
-  EXPECT_EQ(1, subject.getLocation().getRange().getBegin().getColumn());
-  EXPECT_EQ(1, subject.getLocation().getRange().getEnd().getLineNumber());
-  EXPECT_EQ(3, subject.getLocation().getRange().getEnd().getColumn());
+  EXPECT_EQ(1, SM.getLineNumber(subject.getLocation()));
+  EXPECT_EQ(1, SM.getColumnNumber(subject.getLocation()));
+  EXPECT_EQ(1, SM.getLineNumber(subject.getEndLoc()));
+  EXPECT_EQ(3, SM.getColumnNumber(subject.getEndLoc()));
 
   EXPECT_EQ(tok::eof, lexer.Lex().getKind());
 }
@@ -369,14 +381,15 @@ TEST(Lexer, ParsesStringLiteralEndingInQuote) // NOLINT
 {
   StringSource source{"''''a''''"}; // NOLINT
   Lexer lexer(source);
+  SourceManager& SM = *lexer.getSourceManager();
 
   Token subject = lexer.Lex();
 
   EXPECT_EQ(tok::string_constant, subject.getKind());
-  EXPECT_EQ(1, subject.getLocation().getRange().getBegin().getLineNumber());
-  EXPECT_EQ(1, subject.getLocation().getRange().getBegin().getColumn());
-  EXPECT_EQ(1, subject.getLocation().getRange().getEnd().getLineNumber());
-  EXPECT_EQ(9, subject.getLocation().getRange().getEnd().getColumn());
+  EXPECT_EQ(1, SM.getLineNumber(subject.getLocation()));
+  EXPECT_EQ(1, SM.getColumnNumber(subject.getLocation()));
+  EXPECT_EQ(1, SM.getLineNumber(subject.getEndLoc()));
+  EXPECT_EQ(9, SM.getColumnNumber(subject.getEndLoc()));
 
   EXPECT_EQ(tok::eof, lexer.Lex().getKind());
 }
@@ -385,14 +398,15 @@ TEST(Lexer, ParsesEscapesInStringLiteral) // NOLINT
 {
   StringSource source{"'\\\\a\\tb\\rc\\0\\n'"}; // NOLINT
   Lexer lexer(source);
+  SourceManager& SM = *lexer.getSourceManager();
 
   Token subject = lexer.Lex();
 
   EXPECT_EQ(tok::string_constant, subject.getKind());
-  EXPECT_EQ(1, subject.getLocation().getRange().getBegin().getLineNumber());
-  EXPECT_EQ(1, subject.getLocation().getRange().getBegin().getColumn());
-  EXPECT_EQ(2, subject.getLocation().getRange().getEnd().getLineNumber());
-  EXPECT_EQ(1, subject.getLocation().getRange().getEnd().getColumn());
+  EXPECT_EQ(1, SM.getLineNumber(subject.getLocation()));
+  EXPECT_EQ(1, SM.getColumnNumber(subject.getLocation()));
+  EXPECT_EQ(1, SM.getLineNumber(subject.getEndLoc()));
+  EXPECT_EQ(15, SM.getColumnNumber(subject.getEndLoc()));
 
   EXPECT_EQ(tok::eof, lexer.Lex().getKind());
 }
@@ -401,14 +415,15 @@ TEST(Lexer, ParsesHexStringLiteral) // NOLINT
 {
   StringSource source{"'\\x20'"};
   Lexer lexer(source);
+  SourceManager& SM = *lexer.getSourceManager();
 
   Token subject = lexer.Lex();
 
   EXPECT_EQ(tok::rune_constant, subject.getKind());
-  EXPECT_EQ(1, subject.getLocation().getRange().getBegin().getLineNumber());
-  EXPECT_EQ(1, subject.getLocation().getRange().getBegin().getColumn());
-  EXPECT_EQ(1, subject.getLocation().getRange().getEnd().getLineNumber());
-  EXPECT_EQ(3, subject.getLocation().getRange().getEnd().getColumn());
+  EXPECT_EQ(1, SM.getLineNumber(subject.getLocation()));
+  EXPECT_EQ(1, SM.getColumnNumber(subject.getLocation()));
+  EXPECT_EQ(1, SM.getLineNumber(subject.getEndLoc()));
+  EXPECT_EQ(6, SM.getColumnNumber(subject.getEndLoc()));
 
   EXPECT_EQ(tok::eof, lexer.Lex().getKind());
 }
@@ -417,14 +432,15 @@ TEST(Lexer, ParsesUnicodeStringLiteral) // NOLINT
 {
   StringSource source{"'\\U0020'"};
   Lexer lexer(source);
+  SourceManager& SM = *lexer.getSourceManager();
 
   Token subject = lexer.Lex();
 
   EXPECT_EQ(tok::rune_constant, subject.getKind());
-  EXPECT_EQ(1, subject.getLocation().getRange().getBegin().getLineNumber());
-  EXPECT_EQ(1, subject.getLocation().getRange().getBegin().getColumn());
-  EXPECT_EQ(1, subject.getLocation().getRange().getEnd().getLineNumber());
-  EXPECT_EQ(3, subject.getLocation().getRange().getEnd().getColumn());
+  EXPECT_EQ(1, SM.getLineNumber(subject.getLocation()));
+  EXPECT_EQ(1, SM.getColumnNumber(subject.getLocation()));
+  EXPECT_EQ(1, SM.getLineNumber(subject.getEndLoc()));
+  EXPECT_EQ(8, SM.getColumnNumber(subject.getEndLoc()));
 
   EXPECT_EQ(tok::eof, lexer.Lex().getKind());
 }
@@ -433,14 +449,15 @@ TEST(Lexer, ParsesAnyTypeLiteral) // NOLINT
 {
   StringSource source{"'a\n"};
   Lexer lexer(source);
+  SourceManager& SM = *lexer.getSourceManager();
 
   Token subject = lexer.Lex();
 
   EXPECT_EQ(tok::identifier, subject.getKind());
-  EXPECT_EQ(1, subject.getLocation().getRange().getBegin().getLineNumber());
-  EXPECT_EQ(1, subject.getLocation().getRange().getBegin().getColumn());
-  EXPECT_EQ(1, subject.getLocation().getRange().getEnd().getLineNumber());
-  EXPECT_EQ(2, subject.getLocation().getRange().getEnd().getColumn());
+  EXPECT_EQ(1, SM.getLineNumber(subject.getLocation()));
+  EXPECT_EQ(1, SM.getColumnNumber(subject.getLocation()));
+  EXPECT_EQ(1, SM.getLineNumber(subject.getEndLoc()));
+  EXPECT_EQ(2, SM.getColumnNumber(subject.getEndLoc()));
 
   EXPECT_EQ(tok::eol, lexer.Lex().getKind());
 }
@@ -449,14 +466,15 @@ TEST(Lexer, ParsesDoubleQuoteLargeStringLiteral) // NOLINT
 {
   StringSource source{"\"\"\"abcdefghijklmnopqrstuvwxyz\"\"\""}; // NOLINT
   Lexer lexer(source);
+  SourceManager& SM = *lexer.getSourceManager();
 
   Token subject = lexer.Lex();
 
   EXPECT_EQ(tok::string_constant, subject.getKind());
-  EXPECT_EQ(1, subject.getLocation().getRange().getBegin().getLineNumber());
-  EXPECT_EQ(1, subject.getLocation().getRange().getBegin().getColumn());
-  EXPECT_EQ(1, subject.getLocation().getRange().getEnd().getLineNumber());
-  EXPECT_EQ(32, subject.getLocation().getRange().getEnd().getColumn());
+  EXPECT_EQ(1, SM.getLineNumber(subject.getLocation()));
+  EXPECT_EQ(1, SM.getColumnNumber(subject.getLocation()));
+  EXPECT_EQ(1, SM.getLineNumber(subject.getEndLoc()));
+  EXPECT_EQ(32, SM.getColumnNumber(subject.getEndLoc()));
 
   EXPECT_EQ(tok::eof, lexer.Lex().getKind());
 }
@@ -465,14 +483,15 @@ TEST(Lexer, ParsesSingleQuoteLargerStringLiteral) // NOLINT
 {
   StringSource source{"'abcdefghijklmnopqrstuvwxyz'"};
   Lexer lexer(source);
+  SourceManager& SM = *lexer.getSourceManager();
 
   Token subject = lexer.Lex();
 
   EXPECT_EQ(tok::string_constant, subject.getKind());
-  EXPECT_EQ(1, subject.getLocation().getRange().getBegin().getLineNumber());
-  EXPECT_EQ(1, subject.getLocation().getRange().getBegin().getColumn());
-  EXPECT_EQ(1, subject.getLocation().getRange().getEnd().getLineNumber());
-  EXPECT_EQ(28, subject.getLocation().getRange().getEnd().getColumn());
+  EXPECT_EQ(1, SM.getLineNumber(subject.getLocation()));
+  EXPECT_EQ(1, SM.getColumnNumber(subject.getLocation()));
+  EXPECT_EQ(1, SM.getLineNumber(subject.getEndLoc()));
+  EXPECT_EQ(28, SM.getColumnNumber(subject.getEndLoc()));
 
   EXPECT_EQ(tok::eof, lexer.Lex().getKind());
 }
@@ -482,14 +501,15 @@ TEST(Lexer, ParsesMultilineStringLiteral) // NOLINT
   StringSource source{"'''Hello\n"
                       "World'''"};
   Lexer lexer(source);
+  SourceManager& SM = *lexer.getSourceManager();
 
   Token subject = lexer.Lex();
 
   EXPECT_EQ(tok::string_constant, subject.getKind());
-  EXPECT_EQ(1, subject.getLocation().getRange().getBegin().getLineNumber());
-  EXPECT_EQ(1, subject.getLocation().getRange().getBegin().getColumn());
-  EXPECT_EQ(2, subject.getLocation().getRange().getEnd().getLineNumber());
-  EXPECT_EQ(8, subject.getLocation().getRange().getEnd().getColumn());
+  EXPECT_EQ(1, SM.getLineNumber(subject.getLocation()));
+  EXPECT_EQ(1, SM.getColumnNumber(subject.getLocation()));
+  EXPECT_EQ(2, SM.getLineNumber(subject.getEndLoc()));
+  EXPECT_EQ(8, SM.getColumnNumber(subject.getEndLoc()));
 
   EXPECT_EQ(tok::eof, lexer.Lex().getKind());
 }
@@ -498,14 +518,15 @@ TEST(Lexer, ParsesComment) // NOLINT
 {
   StringSource source{"// comment is here\n"};
   Lexer lexer(source);
+  SourceManager& SM = *lexer.getSourceManager();
 
   Token subject = lexer.Lex();
 
   EXPECT_EQ(tok::line_comment, subject.getKind());
-  EXPECT_EQ(1, subject.getLocation().getRange().getBegin().getLineNumber());
-  EXPECT_EQ(1, subject.getLocation().getRange().getBegin().getColumn());
-  EXPECT_EQ(1, subject.getLocation().getRange().getEnd().getLineNumber());
-  EXPECT_EQ(18, subject.getLocation().getRange().getEnd().getColumn());
+  EXPECT_EQ(1, SM.getLineNumber(subject.getLocation()));
+  EXPECT_EQ(1, SM.getColumnNumber(subject.getLocation()));
+  EXPECT_EQ(1, SM.getLineNumber(subject.getEndLoc()));
+  EXPECT_EQ(18, SM.getColumnNumber(subject.getEndLoc()));
 
   EXPECT_EQ(tok::eof, lexer.Lex().getKind());
 }
@@ -514,14 +535,15 @@ TEST(Lexer, ParsesCommentWithLeadingSlash) // NOLINT
 {
   StringSource source{"/// comment is here\n"};
   Lexer lexer(source);
+  SourceManager& SM = *lexer.getSourceManager();
 
   Token subject = lexer.Lex();
 
   EXPECT_EQ(tok::line_comment, subject.getKind());
-  EXPECT_EQ(1, subject.getLocation().getRange().getBegin().getLineNumber());
-  EXPECT_EQ(1, subject.getLocation().getRange().getBegin().getColumn());
-  EXPECT_EQ(1, subject.getLocation().getRange().getEnd().getLineNumber());
-  EXPECT_EQ(19, subject.getLocation().getRange().getEnd().getColumn());
+  EXPECT_EQ(1, SM.getLineNumber(subject.getLocation()));
+  EXPECT_EQ(1, SM.getColumnNumber(subject.getLocation()));
+  EXPECT_EQ(1, SM.getLineNumber(subject.getEndLoc()));
+  EXPECT_EQ(19, SM.getColumnNumber(subject.getEndLoc()));
 
   EXPECT_EQ(tok::eof, lexer.Lex().getKind());
 }
@@ -571,6 +593,32 @@ TEST_F(LexerTest, ExpectBadHexDigit) // NOLINT
   EXPECT_EQ(tok::eof, lexer->Lex().getKind());
 }
 
+TEST_F(LexerTest, RecoversFromMalformedUTF8) // NOLINT
+{
+  SetFixture("fn \xff\xfe joe");
+
+  EXPECT_EQ(tok::kw_fn, lexer->Lex().getKind());
+
+  Token subject = lexer->Lex();
+  EXPECT_EQ(tok::identifier, subject.getKind());
+  EXPECT_EQ(2, diagClient->getNumErrors());
+
+  EXPECT_EQ(tok::identifier, lexer->Lex().getKind());
+
+  EXPECT_EQ(tok::eof, lexer->Lex().getKind());
+}
+
+TEST_F(LexerTest, ReplacesEscapedSurrogate) // NOLINT
+{
+  SetFixture("'a\\ud800'");
+
+  Token subject = lexer->Lex();
+  EXPECT_EQ(tok::string_constant, subject.getKind());
+  EXPECT_EQ(1, diagClient->getNumWarnings());
+
+  EXPECT_EQ(tok::eof, lexer->Lex().getKind());
+}
+
 TEST(Lexer, WarningsAreIgnored) // NOLINT
 {
   StringSource source{"'\\xg0'"};
@@ -596,10 +644,11 @@ TEST_F(LexerTest, SourceManagerContainsOurSource) // NOLINT
 
   EXPECT_EQ(tok::eof, lexer->Lex().getKind());
 
-  auto& FI = sourceManager->getOrInsertFileInfo(llvm::sys::fs::UniqueID{}, "top-level.u", ".");
+  auto& FI = sourceManager->getFileInfo(lexer->getFileID());
   EXPECT_GE(FI.getLine(1).size(), 0u);
-  EXPECT_EQ(0, FI.getFileID().getFile());
-  EXPECT_EQ(0, FI.getFileID().getDevice());
+  EXPECT_EQ(0, FI.getUniqueID().getFile());
+  EXPECT_EQ(0, FI.getUniqueID().getDevice());
+  EXPECT_STREQ("top-level.u", FI.getFileName().c_str());
 
-  EXPECT_STREQ("'\\xg0'", FI.getLine(1).c_str());
+  EXPECT_EQ("'\\xg0'", FI.getLine(1));
 }
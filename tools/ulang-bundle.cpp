@@ -0,0 +1,83 @@
+/**
+ * The U Programming Language
+ *
+ * Copyright 2018 Joseph Benden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * \author Joseph W. Benden
+ * \copyright (C) 2018 Joseph Benden
+ * \license apache2
+ */
+
+#ifdef __clang__
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunused-parameter"
+#pragma clang diagnostic ignored "-Wmacro-redefined"
+#pragma clang diagnostic ignored "-Wshorten-64-to-32"
+#endif
+#undef HAVE_INTTYPES_H
+#undef HAVE_STDINT_H
+#undef HAVE_UINT64_T
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/raw_ostream.h>
+#ifdef __clang__
+#pragma clang diagnostic pop
+#endif
+
+#include <glog/logging.h>
+
+#include <u-lang/Basic/ModuleBundle.hpp>
+#include <u-lang/u.hpp>
+
+#include <string>
+
+using namespace u;
+
+static llvm::cl::opt<std::string> OutputFilename("o",
+                                                 llvm::cl::desc("Write the module bundle to <file>"),
+                                                 llvm::cl::value_desc("file"),
+                                                 llvm::cl::Required);
+
+static llvm::cl::list<std::string> ModuleRoots(llvm::cl::Positional,
+                                               llvm::cl::desc("<module root>..."),
+                                               llvm::cl::OneOrMore);
+
+int
+main(int argc, char** argv)
+{
+  ::google::InitGoogleLogging(argv[0]);
+
+  llvm::cl::ParseCommandLineOptions(argc, argv, "U module bundle packer\n\n"
+                                                "  Packs every file beneath each module root into a single bundle;\n"
+                                                "  where roots hold the same file, the last root given wins.\n");
+
+  ModuleBundleWriter Writer;
+  for (auto& Root : ModuleRoots)
+  {
+    if (auto EC = Writer.addDirectory(Root))
+    {
+      llvm::errs() << argv[0] << ": unable to read " << Root << ": " << EC.message() << "\n";
+      return 1;
+    }
+  }
+
+  if (auto EC = Writer.writeToFile(OutputFilename))
+  {
+    llvm::errs() << argv[0] << ": unable to write " << OutputFilename << ": " << EC.message() << "\n";
+    return 1;
+  }
+
+  llvm::outs() << "Packed " << Writer.getNumFiles() << " files into " << OutputFilename << "\n";
+  return 0;
+}